@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# EXEC
+# Fan out: run an external program n times
+
+n=$1
+# The external program, not the builtin:
+TRUE=$( type -P true )
+
+i=0
+while (( i < n ))
+do
+  $TRUE
+  (( ++i ))
+done
+echo i: $i
@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# IMPORT
+# Start up by sourcing n files import-1.sh ... import-n.sh,
+# generated next to this script by bench-all.zsh
+
+n=$1
+
+THIS=$( dirname $0 )
+i=0
+while (( i < n ))
+do
+  (( ++i ))
+  source $THIS/import-$i.sh
+done
+echo imported: $i
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+# LINES
+# Read a file line by line, counting lines and characters
+
+file=$1
+
+n=0
+c=0
+while IFS= read -r l
+do
+  (( ++n ))
+  (( c += ${#l} ))
+done < $file
+echo lines: $n chars: $c
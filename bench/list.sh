@@ -0,0 +1,20 @@
+#!/bin/bash
+
+# LIST
+# Append n items, then iterate over them
+
+n=$1
+
+L=()
+i=0
+while (( i < n ))
+do
+  L+=( $i )
+  (( ++i ))
+done
+sum=0
+for v in "${L[@]}"
+do
+  (( sum += v ))
+done
+echo sum: $sum
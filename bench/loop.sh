@@ -0,0 +1,13 @@
+#!/bin/bash
+
+# LOOP
+# A tight integer loop: count to n
+
+n=$1
+
+i=0
+while (( i < n ))
+do
+  (( ++i ))
+done
+echo i: $i
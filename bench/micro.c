@@ -0,0 +1,485 @@
+
+/**
+   MICRO C
+   Microbenchmarks for the containers and the hash function.
+   Usage: micro.x [-m MAX] [-t SECONDS] [-p] [STRUCTURE...]
+          -m: Largest size, default 10000000
+          -t: Minimum time per measurement, default 0.2
+          -p: Count cycles with perf_event_open()
+          STRUCTURE: strmap table buffer list hash, default all
+   Sizes go by powers of 10 from 10 to MAX.
+   Each measurement repeats its operation until it has run for
+   the minimum time, then prints one CSV line.
+   Latency percentiles are over batches of BATCH operations,
+   so they do not include the cost of reading the clock;
+   with no full batch they are the mean.
+   strmap is a linear scan, so it stops at STRMAP_MAX.
+   table_expand() is static: compare add_grow with add_presized.
+*/
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "buffer.h"
+#include "jenkins-hash.h"
+#include "list-array.h"
+#include "strmap.h"
+#include "table.h"
+#include "util.h"
+
+#define BATCH 256
+
+#define STRMAP_MAX 100000
+
+static size_t size_max = 10000000;
+static uint64_t time_min = 200000000;  // ns
+static int perf_fd = -1;
+
+typedef struct
+{
+  const char* structure;
+  const char* operation;
+  size_t size;
+  size_t ops;
+  /// Accumulated over runs
+  uint64_t ns;
+  uint64_t cycles;
+  /// Start of the current run and batch
+  uint64_t start;
+  uint64_t batch_start;
+  uint64_t cycles_start;
+  size_t batch_count;
+  /// ns per op for each full batch
+  double* samples;
+  size_t sample_count;
+  size_t sample_capacity;
+} bench;
+
+static inline uint64_t
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static inline uint64_t
+cycles(void)
+{
+  uint64_t count = 0;
+  if (perf_fd >= 0 &&
+      read(perf_fd, &count, sizeof(count)) != sizeof(count))
+    count = 0;
+  return count;
+}
+
+static void
+perf_open(void)
+{
+#ifdef __linux__
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = PERF_TYPE_HARDWARE;
+  attr.config         = PERF_COUNT_HW_CPU_CYCLES;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+  perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (perf_fd >= 0)
+  {
+    ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    return;
+  }
+#endif
+  fprintf(stderr, "micro: perf_event_open() failed: "
+          "no cycle counts\n");
+}
+
+static void
+bench_init(bench* B, const char* structure, const char* operation,
+           size_t size)
+{
+  B->structure = structure;
+  B->operation = operation;
+  B->size      = size;
+  B->ops       = 0;
+  B->ns        = 0;
+  B->cycles    = 0;
+  B->sample_count    = 0;
+  B->sample_capacity = 1024;
+  B->samples = malloc_checked(B->sample_capacity * sizeof(double));
+}
+
+static inline bool
+bench_more(bench* B)
+{
+  return B->ns < time_min;
+}
+
+static inline void
+bench_resume(bench* B)
+{
+  B->batch_count  = 0;
+  B->cycles_start = cycles();
+  B->start        = now();
+  B->batch_start  = B->start;
+}
+
+/** Call after each operation */
+static inline void
+bench_tick(bench* B)
+{
+  if (++B->batch_count < BATCH) return;
+  uint64_t t = now();
+  if (B->sample_count == B->sample_capacity)
+  {
+    B->sample_capacity *= 2;
+    B->samples = realloc_checked(B->samples, B->sample_capacity *
+                                             sizeof(double));
+  }
+  B->samples[B->sample_count++] =
+    (double) (t - B->batch_start) / BATCH;
+  B->batch_start = t;
+  B->batch_count = 0;
+}
+
+static inline void
+bench_pause(bench* B, size_t ops)
+{
+  uint64_t t = now();
+  B->cycles += cycles() - B->cycles_start;
+  B->ns     += t - B->start;
+  B->ops    += ops;
+}
+
+static int
+compare_doubles(const void* a, const void* b)
+{
+  double x = *(const double*) a;
+  double y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+/** Print the CSV line and free B */
+static void
+bench_report(bench* B)
+{
+  double mean = (double) B->ns / B->ops;
+  double p50 = mean, p99 = mean;
+  if (B->sample_count > 0)
+  {
+    qsort(B->samples, B->sample_count, sizeof(double),
+          compare_doubles);
+    p50 = B->samples[(B->sample_count - 1) * 50 / 100];
+    p99 = B->samples[(B->sample_count - 1) * 99 / 100];
+  }
+  printf("%s,%s,%zu,%zu,%.2f,%.3f,%.2f,%.2f,",
+         B->structure, B->operation, B->size, B->ops,
+         mean, 1000.0 / mean, p50, p99);
+  if (perf_fd >= 0)
+    printf("%.2f", (double) B->cycles / B->ops);
+  printf("\n");
+  fflush(stdout);
+  free(B->samples);
+}
+
+/** Keys "key-0" ... for the largest size, in one allocation */
+static char** keys;
+
+static void
+keys_make(size_t n)
+{
+  size_t width = 24;
+  char* text = malloc_checked(n * width);
+  keys = malloc_checked(n * sizeof(char*));
+  for (size_t i = 0; i < n; i++)
+  {
+    keys[i] = text + i * width;
+    sprintf(keys[i], "key-%zu", i);
+  }
+}
+
+static void
+keys_free(void)
+{
+  free(keys[0]);
+  free(keys);
+}
+
+/** Spread searches over the whole structure */
+static inline size_t
+probe(size_t j, size_t n)
+{
+  return (j * 7919) % n;
+}
+
+/** The data for every entry */
+static int datum = 42;
+
+static void
+bench_strmap(size_t n)
+{
+  if (n > STRMAP_MAX) return;
+  bench B;
+  strmap map;
+
+  bench_init(&B, "strmap", "add", n);
+  do
+  {
+    strmap_init(&map, 4);
+    bench_resume(&B);
+    for (size_t i = 0; i < n; i++)
+    {
+      strmap_add(&map, keys[i], &datum);
+      bench_tick(&B);
+    }
+    bench_pause(&B, n);
+    strmap_finalize(&map);
+  } while (bench_more(&B));
+  bench_report(&B);
+
+  strmap_init(&map, 4);
+  for (size_t i = 0; i < n; i++)
+    strmap_add(&map, keys[i], &datum);
+  // Each search is O(n): do not search n times
+  size_t count = n < 1000 ? n : 1000;
+  bench_init(&B, "strmap", "search", n);
+  do
+  {
+    bench_resume(&B);
+    for (size_t j = 0; j < count; j++)
+    {
+      void* data;
+      bool found = strmap_search(&map, keys[probe(j, n)], &data);
+      valgrind_assert(found);
+      bench_tick(&B);
+    }
+    bench_pause(&B, count);
+  } while (bench_more(&B));
+  bench_report(&B);
+  strmap_finalize(&map);
+}
+
+static void
+table_add_all(bench* B, size_t n, int capacity)
+{
+  do
+  {
+    struct table* T = table_create(capacity);
+    bench_resume(B);
+    for (size_t i = 0; i < n; i++)
+    {
+      table_add(T, keys[i], &datum);
+      bench_tick(B);
+    }
+    bench_pause(B, n);
+    table_free(T);
+  } while (bench_more(B));
+  bench_report(B);
+}
+
+static void
+bench_table(size_t n)
+{
+  bench B;
+  // Grow from the smallest table: this includes table_expand()
+  bench_init(&B, "table", "add_grow", n);
+  table_add_all(&B, n, 1);
+  bench_init(&B, "table", "add_presized", n);
+  table_add_all(&B, n, (int) n);
+
+  struct table* T = table_create(1);
+  for (size_t i = 0; i < n; i++)
+    table_add(T, keys[i], &datum);
+  bench_init(&B, "table", "search", n);
+  do
+  {
+    bench_resume(&B);
+    for (size_t j = 0; j < n; j++)
+    {
+      void* data;
+      bool found = table_search(T, keys[probe(j, n)], &data);
+      valgrind_assert(found);
+      bench_tick(&B);
+    }
+    bench_pause(&B, n);
+  } while (bench_more(&B));
+  bench_report(&B);
+  table_free(T);
+}
+
+static void
+bench_buffer(size_t n)
+{
+  bench B;
+  buffer b;
+
+  bench_init(&B, "buffer", "cat", n);
+  do
+  {
+    buffer_init(&b, 64);
+    bench_resume(&B);
+    for (size_t i = 0; i < n; i++)
+    {
+      buffer_cat(&b, "0123456789abcdef");
+      bench_tick(&B);
+    }
+    bench_pause(&B, n);
+    buffer_finalize(&b);
+  } while (bench_more(&B));
+  bench_report(&B);
+
+  bench_init(&B, "buffer", "catv", n);
+  do
+  {
+    buffer_init(&b, 64);
+    bench_resume(&B);
+    for (size_t i = 0; i < n; i++)
+    {
+      buffer_catv(&b, "%zu,", i);
+      bench_tick(&B);
+    }
+    bench_pause(&B, n);
+    buffer_finalize(&b);
+  } while (bench_more(&B));
+  bench_report(&B);
+}
+
+static void
+bench_list(size_t n)
+{
+  bench B;
+  bench_init(&B, "list_array", "add", n);
+  do
+  {
+    list_array L;
+    list_array_init(&L, 4);
+    bench_resume(&B);
+    for (size_t i = 0; i < n; i++)
+    {
+      list_array_add(&L, &datum);
+      bench_tick(&B);
+    }
+    bench_pause(&B, n);
+    list_array_finalize(&L);
+  } while (bench_more(&B));
+  bench_report(&B);
+}
+
+static void
+bench_hash(size_t n)
+{
+  bench B;
+  // Many short keys, as in table_add():
+  uint32_t h = 0;
+  bench_init(&B, "bj_hashlittle", "key", n);
+  do
+  {
+    bench_resume(&B);
+    for (size_t i = 0; i < n; i++)
+    {
+      h ^= bj_hashlittle(keys[i], strlen(keys[i]), 0u);
+      bench_tick(&B);
+    }
+    bench_pause(&B, n);
+  } while (bench_more(&B));
+  bench_report(&B);
+
+  // One long key of n bytes: one op is one byte
+  char* data = malloc_checked(n);
+  memset(data, 'x', n);
+  bench_init(&B, "bj_hashlittle", "bytes", n);
+  do
+  {
+    bench_resume(&B);
+    h ^= bj_hashlittle(data, n, 0u);
+    bench_pause(&B, n);
+  } while (bench_more(&B));
+  bench_report(&B);
+  free(data);
+  // Keep the hashes live:
+  if (h == 1) fprintf(stderr, "\n");
+}
+
+typedef struct
+{
+  const char* name;
+  void (*run)(size_t n);
+} structure;
+
+static const structure structures[] =
+{
+  { "strmap", bench_strmap },
+  { "table",  bench_table  },
+  { "buffer", bench_buffer },
+  { "list",   bench_list   },
+  { "hash",   bench_hash   },
+  { NULL,     NULL         }
+};
+
+static bool
+selected(const char* name, int count, char** names)
+{
+  if (count == 0) return true;
+  for (int i = 0; i < count; i++)
+    if (strcmp(name, names[i]) == 0)
+      return true;
+  return false;
+}
+
+int
+main(int argc, char* argv[])
+{
+  while (true)
+  {
+    int c = getopt(argc, argv, "m:pt:");
+    if (c == -1) break;
+    switch (c)
+    {
+      case 'm':
+        size_max = strtoull(optarg, NULL, 10);
+        break;
+      case 'p':
+        perf_open();
+        break;
+      case 't':
+        time_min = strtod(optarg, NULL) * 1e9;
+        break;
+      default:
+        fail("usage: micro.x [-m MAX] [-t SECONDS] [-p] "
+             "[STRUCTURE...]");
+    }
+  }
+  for (int i = optind; i < argc; i++)
+  {
+    const structure* s = structures;
+    while (s->name != NULL && strcmp(s->name, argv[i]) != 0) s++;
+    if (s->name == NULL)
+      fail("micro: unknown structure: %s", argv[i]);
+  }
+
+  keys_make(size_max);
+  printf("structure,operation,size,ops,ns_per_op,mops_per_s,"
+         "p50_ns,p99_ns,cycles_per_op\n");
+  for (const structure* s = structures; s->name != NULL; s++)
+  {
+    if (! selected(s->name, argc - optind, &argv[optind]))
+      continue;
+    for (size_t n = 10; n <= size_max; n *= 10)
+      s->run(n);
+  }
+  keys_free();
+  if (perf_fd >= 0) close(perf_fd);
+  return EXIT_SUCCESS;
+}
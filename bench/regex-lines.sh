@@ -0,0 +1,10 @@
+#!/bin/bash
+
+# REGEX LINES
+# Count matching lines and rewrite every line,
+# with the equivalent grep and sed processes
+
+file=$1
+
+echo matched: $( grep -c -E "^line [0-9]*7 of" $file )
+echo last: $( sed -E 's/([0-9]+)/<\1>/g' $file | tail -1 )
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+# STRINGS
+# Build a string of n pieces by appending
+
+n=$1
+
+s=""
+i=0
+while (( i < n ))
+do
+  s+="ab"
+  (( ++i ))
+done
+echo length: ${#s}
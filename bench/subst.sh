@@ -0,0 +1,14 @@
+#!/bin/bash
+
+# SUBST
+# Command substitution n times
+
+n=$1
+
+i=0
+while (( i < n ))
+do
+  x=$( sh -c "echo -n x" )
+  (( ++i ))
+done
+echo i: $i
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# TABLE
+# Insert n keys, then look each one up
+
+n=$1
+
+declare -A t
+i=0
+while (( i < n ))
+do
+  t[k$i]=$i
+  (( ++i ))
+done
+sum=0
+i=0
+while (( i < n ))
+do
+  (( sum += t[k$i] ))
+  (( ++i ))
+done
+echo sum: $sum
@@ -6,11 +6,7 @@
 #include <sys/time.h>
 
 #include "activations.h"
-
-mcsh_activation mcsh_activation_time,
-                mcsh_activation_random,
-                mcsh_activation_this,
-                mcsh_activation_last;
+#include "builtins.h"
 
 static bool
 activation_time_get(UNUSED mcsh_entry* entry,
@@ -41,9 +37,11 @@ activation_time_set(UNUSED mcsh_entry* entry,
 }
 
 static void
-activation_random_init(void)
+activation_random_init(mcsh_data* data)
 {
-  srandom(42);
+  memset(&data->random, 0, sizeof(data->random));
+  initstate_r(42, data->random_state, sizeof(data->random_state),
+              &data->random);
 }
 
 static bool
@@ -57,18 +55,19 @@ activation_random_set(mcsh_entry* entry,
   bool rc = mcsh_value_integer(input, &seed);
   valgrind_assert(rc);
   LOG(MCSH_LOG_BUILTIN, MCSH_INFO, "random set: %"PRId64, seed);
-  srandom(seed);
+  srandom_r(seed, &entry->stack->vm->data->random);
   status->code = MCSH_OK;
   return true;
 }
 
 static bool
-activation_random_get(UNUSED mcsh_entry* entry,
+activation_random_get(mcsh_entry* entry,
                       UNUSED const char* name,
                       mcsh_value** output,
                       mcsh_status* status)
 {
-  long r = random();
+  int32_t r;
+  random_r(&entry->stack->vm->data->random, &r);
   mcsh_value* value = mcsh_value_new_int(r);
   *output = value;
   status->code = MCSH_OK;
@@ -141,27 +140,52 @@ activation_last_set(UNUSED mcsh_entry* entry,
   return true;
 }
 
+static bool
+activation_stats_get(mcsh_entry* entry,
+                     UNUSED const char* name,
+                     mcsh_value** output,
+                     mcsh_status* status)
+{
+  *output = mcsh_stats_table(entry->stack->vm);
+  status->code = MCSH_OK;
+  return true;
+}
+
+static bool
+activation_stats_set(UNUSED mcsh_entry* entry,
+                     UNUSED const char* name,
+                     UNUSED mcsh_value* input,
+                     mcsh_status* status)
+{
+  mcsh_raise(status, NULL, 0,
+             "MCSH_READ_ONLY", "cannot assign to STATS");
+  return true;
+}
+
 static void init(const char* name, mcsh_activation* a,
                  struct table* T, mcsh_logger* logger);
 
+// Constant: shared by the VMs in all threads
+mcsh_activation
+  mcsh_activation_time   = { activation_time_get,   activation_time_set   },
+  mcsh_activation_random = { activation_random_get, activation_random_set },
+  mcsh_activation_this   = { activation_this_get,   activation_this_set   },
+  mcsh_activation_last   = { activation_last_get,   activation_last_set   },
+  mcsh_activation_stats  = { activation_stats_get,  activation_stats_set  };
+
 void
-mcsh_activation_init(mcsh_logger* logger, struct table* T)
+mcsh_activation_init(mcsh_vm* vm)
 {
-  mcsh_activation_time  .get = activation_time_get;
-  mcsh_activation_time  .set = activation_time_set;
-  mcsh_activation_random.get = activation_random_get;
-  mcsh_activation_random.set = activation_random_set;
-  mcsh_activation_this  .get = activation_this_get;
-  mcsh_activation_this  .set = activation_this_set;
-  mcsh_activation_last  .get = activation_last_get;
-  mcsh_activation_last  .set = activation_last_set;
+  mcsh_logger* logger = &vm->logger;
+  struct table* T = vm->data->specials;
 
   init("time",   &mcsh_activation_time,   T, logger);
   init("random", &mcsh_activation_random, T, logger);
   init("this",   &mcsh_activation_this,   T, logger);
   init("?",      &mcsh_activation_last,   T, logger);
+  init("STATS",  &mcsh_activation_stats,  T, logger);
 
-  activation_random_init();
+  activation_random_init(vm->data);
 }
 
 static void
@@ -161,6 +161,17 @@ buffer_catc(buffer* B, char c)
   B->length++;
 }
 
+/** Put count bytes of binary data at end of buffer.
+    Does not maintain a trailing NULL byte:
+    do not mix with the cat functions on the same buffer */
+static inline void
+buffer_put(buffer* B, const void* data, size_t count)
+{
+  check_size(B, count);
+  memcpy(B->data + B->length, data, count);
+  B->length += count;
+}
+
 // /** Put buffer a after B as binary data */
 // UNUSED void buffer_putb(buffer* B, buffer* a);
 // Not yet needed/implemented.
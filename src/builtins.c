@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <string.h>
 #include <libgen.h>
@@ -18,8 +19,15 @@
 #include "util-string.h"
 #include "util.h"
 
+#include "iterators.h"
 #include "mcsh-iface.h"
+#include "mcsh-mem.h"
+#include "mcsh-pack.h"
+#include "mcsh-regex.h"
+#include "mcsh-save.h"
 #include "mcsh-sys.h"
+#include "mcsh-thread.h"
+#include "strmap.h"
 
 static void builtins_add(void);
 
@@ -33,10 +41,22 @@ typedef struct
   mcsh_status* status;
 } mcsh_bb;
 
+/** A registered builtin: mcsh.builtins maps each name to one */
+typedef struct
+{
+  const char* name;
+  bool (*function)(mcsh_bb* bb);
+} builtin_entry;
+
+/** Indexed by builtin number, as in mcsh_stats.builtins */
+static builtin_entry builtin_entries[MCSH_STATS_BUILTINS];
+static int builtin_count = 0;
+
 void
 mcsh_builtins_init()
 {
   mcsh.builtins = table_create(128);
+  builtin_count = 0;
   builtins_add();
 }
 
@@ -72,11 +92,17 @@ mcsh_builtins_execute(mcsh_module* module, list_array* args,
   bool b = table_search(mcsh.builtins, command, &p);
   valgrind_assert(b);
   valgrind_assert(p);
-  bool (*builtin)(mcsh_bb*) = p;
+  builtin_entry* builtin = p;
+  module->vm->stats.builtins[builtin - builtin_entries]++;
   mcsh_bb bb;
   bb_init(&bb, module, args, output, status);
 
-  bool rc = builtin(&bb);
+  mcsh_profile* profile = module->vm->profile;
+  if (profile != NULL)
+    mcsh_profile_enter(profile, MCSH_PROFILE_BUILTIN, command);
+  bool rc = builtin->function(&bb);
+  if (profile != NULL)
+    mcsh_profile_exit(profile);
 
   LOG(MCSH_LOG_BUILTIN, MCSH_INFO,
       "builtin_execute: '%s' done.", command);
@@ -156,6 +182,10 @@ builtin_noop(mcsh_bb* bb)
   return true;
 }
 
+/**
+   open filename [mode] [buffer-size]
+   mode is as in fopen(): r w a with optional +
+*/
 static bool
 builtin_open(mcsh_bb* bb)
 {
@@ -163,54 +193,52 @@ builtin_open(mcsh_bb* bb)
   LOG(MCSH_LOG_BUILTIN, MCSH_INFO,
       "builtin_open: (%zi)", bb->args->size);
 
-  mcsh_value* value_filename = NULL;
+  EXCEPTION_ARGC_GE(1);
+  RAISE_IF(bb->args->size > 4, bb->status, NULL, 0,
+           "mcsh.invalid_arguments",
+           "open: too many arguments: %zi", bb->args->size - 1);
+  mcsh_value* value_filename = bb->args->data[1];
   mcsh_value* value_mode     = NULL;
-  char* filename;
+  mcsh_value* value_capacity = NULL;
+  if (bb->args->size > 2) value_mode     = bb->args->data[2];
+  if (bb->args->size > 3) value_capacity = bb->args->data[3];
   char* mode = "r";
-  switch (bb->args->size)
-  {
-    case 1:
-      valgrind_fail();
-      break;
-    case 2:
-      value_filename = bb->args->data[1];
-      break;
-    case 3:
-      value_filename = bb->args->data[1];
-      value_mode     = bb->args->data[2];
-      break;
-    default:
-      valgrind_fail();
-  }
+  int64_t capacity = 0;
   TYPE_CHECK(value_filename, MCSH_VALUE_STRING, bb->status,
              "open", 1, "must be filename");
-  filename = value_filename->string;
-  show("filename: '%s'", filename);
+  char* filename = value_filename->string;
   if (value_mode != NULL)
   {
-    TYPE_CHECK(value_mode,     MCSH_VALUE_STRING, bb->status,
-               "open", 2, "must be filename");
+    TYPE_CHECK(value_mode, MCSH_VALUE_STRING, bb->status,
+               "open", 2, "must be mode");
     mode = value_mode->string;
   }
-
-  FILE* fp = fopen(filename, mode);
-  if (fp == NULL)
+  if (value_capacity != NULL)
+    RAISE_IF(! mcsh_value_integer(value_capacity, &capacity) ||
+             capacity < 1,
+             bb->status, NULL, 0, "mcsh.invalid_arguments",
+             "open: buffer size must be a positive integer");
+
+  mcsh_handle* handle = mcsh_handle_open(filename, mode, capacity);
+  if (handle == NULL)
     RAISE(bb->status, NULL, 0, "mcsh.io", "could not open: '%s': %s",
           filename, strerror(errno));
-  int64_t fp_int = (int64_t) fp;
-  show("fp_int: %"PRId64, fp_int);
-  mcsh_value* result = mcsh_value_new_int(fp_int);
+  LOG(MCSH_LOG_BUILTIN, MCSH_INFO,
+      "builtin_open: '%s' fd=%i", filename, handle->fd);
+  mcsh_value* result = mcsh_value_new_handle(handle);
   maybe_assign(bb->output, result);
   return true;
 }
 
 static bool
-get_fp(mcsh_bb* bb, mcsh_value* value,
-       const char* name, int index, FILE** output)
-{
-  TYPE_CHECK(value, MCSH_VALUE_INT, bb->status, name, index,
-             "%s requires a file pointer from open", name);
-  *output = (FILE*) value->integer;
+get_handle(mcsh_bb* bb, mcsh_value* value,
+           const char* name, int index, mcsh_handle** output)
+{
+  TYPE_CHECK(value, MCSH_VALUE_HANDLE, bb->status, name, index,
+             "%s requires a handle from open", name);
+  RAISE_IF(value->handle->fd == -1, bb->status, NULL, 0, "mcsh.io",
+           "%s: handle is closed: '%s'", name, value->handle->name);
+  *output = value->handle;
   return true;
 }
 
@@ -224,12 +252,11 @@ builtin_close(mcsh_bb* bb)
 
   mcsh_value* value = bb->args->data[1];
 
-  FILE* fp = NULL;
-  get_fp(bb, value, "close", 1, &fp);
+  mcsh_handle* handle = NULL;
+  get_handle(bb, value, "close", 1, &handle);
   PROPAGATE(bb->status);
 
-  int rc = fclose(fp);
-  if (rc < 0)
+  if (! mcsh_handle_close(handle))
     RAISE(bb->status, NULL, 0, "mcsh.io", "Could not close: %s",
           strerror(errno));
 
@@ -237,32 +264,32 @@ builtin_close(mcsh_bb* bb)
   return true;
 }
 
-static bool
-do_write(mcsh_bb* bb, FILE* fp, size_t offset)
+/** Join the arguments from offset with spaces, add newline */
+static void
+write_line(mcsh_bb* bb, size_t offset, buffer* B)
 {
   mcsh_logger* logger = &bb->module->vm->logger;
-  buffer B;
-  buffer_init(&B, bb->args->size * 8);
-
-  if (bb->args->size > 1)
+  buffer_init(B, bb->args->size * 8);
+  buffer_catn(B, "", 0);
+  for (size_t i = offset; i < bb->args->size; i++)
   {
-    size_t i = offset;
-    for ( ; i < bb->args->size - 1; i++)
-    {
-      mcsh_value* value = bb->args->data[i];
-      mcsh_resolve(value);
-      // printf("type: %i\n", value->type);
-      mcsh_value_buffer(logger, value, &B);
-      buffer_catc(&B, ' ');
-    }
     mcsh_value* value = bb->args->data[i];
     mcsh_resolve(value);
-    mcsh_value_buffer(logger, value, &B);
+    // printf("type: %i\n", value->type);
+    mcsh_value_buffer(logger, value, B);
+    if (i < bb->args->size - 1)
+      buffer_catc(B, ' ');
   }
-  else
-    B.data[0] = '\0';
+  buffer_catc(B, '\n');
+}
 
-  size_t count = fprintf(fp, "%s\n", B.data);
+static bool
+do_write(mcsh_bb* bb, FILE* fp, size_t offset)
+{
+  buffer B;
+  write_line(bb, offset, &B);
+  // The length includes the NUL byte:
+  size_t count = fwrite(B.data, 1, B.length-1, fp);
   mcsh_value* result = mcsh_value_new_int(count);
   maybe_assign(bb->output, result);
   buffer_finalize(&B);
@@ -289,52 +316,81 @@ builtin_write(mcsh_bb* bb)
   EXCEPTION_ARGC_GE(1);
   mcsh_value* value = bb->args->data[1];
 
-  FILE* fp = NULL;
-  get_fp(bb, value, "write", 1, &fp);
+  mcsh_handle* handle = NULL;
+  get_handle(bb, value, ">>", 1, &handle);
   PROPAGATE(bb->status);
+  RAISE_IF(! handle->writable, bb->status, NULL, 0, "mcsh.io",
+           ">>: handle is not open for writing: '%s'", handle->name);
 
-  do_write(bb, fp, 2);
+  buffer B;
+  write_line(bb, 2, &B);
+  bool rc = mcsh_handle_write(handle, B.data, B.length-1);
+  size_t count = B.length-1;
+  buffer_finalize(&B);
+  if (! rc)
+    RAISE(bb->status, NULL, 0, "mcsh.io", "could not write: '%s': %s",
+          handle->name, strerror(errno));
 
+  mcsh_value* result = mcsh_value_new_int(count);
+  maybe_assign(bb->output, result);
   return true;
 }
 
 static mcsh_value* read_rl(mcsh_bb* bb);
-static mcsh_value* read_fgets(mcsh_bb* bb, FILE* fp);
+static mcsh_value* read_getline(mcsh_bb* bb, FILE* fp);
 
 static bool
-builtin_read(mcsh_bb* bb)
+builtin_read_line(mcsh_bb* bb)
 {
   mcsh_logger* logger = &bb->module->vm->logger;
   LOG(MCSH_LOG_BUILTIN, MCSH_INFO,
-      "builtin_read: (%zi)", bb->args->size);
+      "builtin_read_line: (%zi)", bb->args->size);
 
-  mcsh_value* value = NULL;
+  mcsh_value* result;
   switch (bb->args->size)
   {
     case 1:
+      if (isatty(fileno(stdin)) && isatty(STDOUT_FILENO))
+        result = read_rl(bb);
+      else
+        result = read_getline(bb, stdin);
       break;
     case 2:
-      value = bb->args->data[1];
+    {
+      mcsh_handle* handle = NULL;
+      get_handle(bb, bb->args->data[1], "<<", 1, &handle);
+      PROPAGATE(bb->status);
+      RAISE_IF(! handle->readable, bb->status, NULL, 0, "mcsh.io",
+               "<<: handle is not open for reading: '%s'",
+               handle->name);
+      buffer B;
+      buffer_init(&B, 128);
+      bool eof;
+      if (! mcsh_handle_read_line(handle, &B, &eof))
+      {
+        buffer_finalize(&B);
+        RAISE(bb->status, NULL, 0, "mcsh.io",
+              "could not read: '%s': %s",
+              handle->name, strerror(errno));
+      }
+      if (eof)
+      {
+        buffer_finalize(&B);
+        result = &mcsh_null;
+      }
+      else
+      {
+        // The value takes the buffer storage:
+        result = mcsh_value_new_string_take(B.data);
+      }
       break;
+    }
     default:
       RAISE(bb->status, NULL, 0,
             "mcsh.args", "too many args to read");
       break;
   }
 
-  FILE* fp = NULL;
-  if (value == NULL)
-    fp = stdin;
-  else
-    get_fp(bb, value, "read", 1, &fp);
-  PROPAGATE(bb->status);
-
-  mcsh_value* result;
-  if (isatty(fileno(fp)) && isatty(STDOUT_FILENO))
-    result = read_rl(bb);
-  else
-    result = read_fgets(bb, fp);
-
   maybe_assign(bb->output, result);
   return true;
 }
@@ -351,24 +407,160 @@ read_rl(mcsh_bb* bb)
   return result;
 }
 
+/** Lines of any length */
 static mcsh_value*
-read_fgets(mcsh_bb* bb, FILE* fp)
+read_getline(mcsh_bb* bb, FILE* fp)
 {
-  char text[4096];
-  char* s = fgets(text, 4096, fp);
+  char* text = NULL;
+  size_t size = 0;
+  ssize_t count = getline(&text, &size, fp);
   mcsh_value* result;
-  if (s == NULL)
+  if (count == -1)
+  {
+    free(text);
+    return &mcsh_null;
+  }
+  if (count > 0 && text[count-1] == '\n')
+    text[count-1] = '\0';
+  result = mcsh_value_new_string_take(text);
+  return result;
+}
+
+/**
+   read handle     : the rest of the file
+   read handle N   : up to N bytes
+   Returns NULL at end of file
+*/
+static bool
+builtin_read(mcsh_bb* bb)
+{
+  mcsh_logger* logger = &bb->module->vm->logger;
+  LOG(MCSH_LOG_BUILTIN, MCSH_INFO,
+      "builtin_read: (%zi)", bb->args->size);
+  EXCEPTION_ARGC_GE(1);
+  RAISE_IF(bb->args->size > 3, bb->status, NULL, 0,
+           "mcsh.invalid_arguments",
+           "read: too many arguments: %zi", bb->args->size - 1);
+
+  mcsh_handle* handle = NULL;
+  get_handle(bb, bb->args->data[1], "read", 1, &handle);
+  PROPAGATE(bb->status);
+  RAISE_IF(! handle->readable, bb->status, NULL, 0, "mcsh.io",
+           "read: handle is not open for reading: '%s'",
+           handle->name);
+  int64_t count = -1;
+  if (bb->args->size == 3)
+    RAISE_IF(! mcsh_value_integer(bb->args->data[2], &count) ||
+             count < 0,
+             bb->status, NULL, 0, "mcsh.invalid_arguments",
+             "read: count must be a non-negative integer");
+
+  buffer B;
+  buffer_init(&B, 1024);
+  bool rc;
+  if (count < 0)
+    rc = mcsh_handle_read_all(handle, &B);
+  else
+    rc = mcsh_handle_read(handle, count, &B);
+  if (! rc)
+  {
+    buffer_finalize(&B);
+    RAISE(bb->status, NULL, 0, "mcsh.io", "could not read: '%s': %s",
+          handle->name, strerror(errno));
+  }
+
+  mcsh_value* result;
+  if (B.length == 1 && count != 0)
+  {
+    // Nothing left: end of file
+    buffer_finalize(&B);
     result = &mcsh_null;
+  }
   else
-    result = mcsh_value_new_string(bb->module->vm,
-                                   trim_right(text));
-  return result;
+  {
+    result = mcsh_value_new_string_take(B.data);
+  }
+  maybe_assign(bb->output, result);
+  return true;
 }
 
+/**
+   seek handle offset [set|cur|end]
+   Returns the new offset
+*/
+static bool
+builtin_seek(mcsh_bb* bb)
+{
+  EXCEPTION_ARGC_GE(2);
+  RAISE_IF(bb->args->size > 4, bb->status, NULL, 0,
+           "mcsh.invalid_arguments",
+           "seek: too many arguments: %zi", bb->args->size - 1);
+  mcsh_handle* handle = NULL;
+  get_handle(bb, bb->args->data[1], "seek", 1, &handle);
+  PROPAGATE(bb->status);
+  int64_t offset;
+  RAISE_IF(! mcsh_value_integer(bb->args->data[2], &offset),
+           bb->status, NULL, 0, "mcsh.invalid_arguments",
+           "seek: offset must be an integer");
+  int whence = SEEK_SET;
+  if (bb->args->size == 4)
+  {
+    mcsh_value* value = bb->args->data[3];
+    TYPE_CHECK(value, MCSH_VALUE_STRING, bb->status, "seek", 3);
+    if      (strcmp(value->string, "set") == 0) whence = SEEK_SET;
+    else if (strcmp(value->string, "cur") == 0) whence = SEEK_CUR;
+    else if (strcmp(value->string, "end") == 0) whence = SEEK_END;
+    else
+      RAISE(bb->status, NULL, 0, "mcsh.invalid_arguments",
+            "seek: unknown whence: '%s'", value->string);
+  }
+  off_t result;
+  if (! mcsh_handle_seek(handle, offset, whence, &result))
+    RAISE(bb->status, NULL, 0, "mcsh.io", "could not seek: '%s': %s",
+          handle->name, strerror(errno));
+  maybe_assign(bb->output, mcsh_value_new_int(result));
+  return true;
+}
+
+/**
+   lines filename
+   Returns an iterator over the lines of the file for foreach
+*/
+static bool
+builtin_lines(mcsh_bb* bb)
+{
+  EXCEPTION_ARGC_EQ(1);
+  mcsh_value* value = bb->args->data[1];
+  mcsh_resolve(value);
+  TYPE_CHECK(value, MCSH_VALUE_STRING, bb->status, "lines", 1);
+  mcsh_iterator* it = mcsh_iterator_lines(value->string);
+  if (it == NULL)
+    RAISE(bb->status, NULL, 0, "mcsh.io", "could not open: '%s': %s",
+          value->string, strerror(errno));
+  maybe_assign(bb->output, mcsh_value_new_iterator(it));
+  return true;
+}
+
+/** flush [handle] : with no handle, flush everything */
 static bool
 builtin_flush(mcsh_bb* bb)
 {
-  fflush(NULL);
+  if (bb->args->size == 1)
+  {
+    fflush(NULL);
+    mcsh_handles_flush_all();
+  }
+  else
+  {
+    EXCEPTION_ARGC_EQ(1);
+    mcsh_handle* handle = NULL;
+    get_handle(bb, bb->args->data[1], "flush", 1, &handle);
+    PROPAGATE(bb->status);
+    if (! mcsh_handle_flush(handle))
+      RAISE(bb->status, NULL, 0, "mcsh.io",
+            "could not flush: '%s': %s",
+            handle->name, strerror(errno));
+  }
   maybe_assign(bb->output, &mcsh_null);
   return true;
 }
@@ -545,13 +737,12 @@ builtin_plus_string(mcsh_bb* bb)
 {
   buffer B;
   buffer_init(&B, bb->args->size * 4);
-  char t[1024];
   for (size_t i = 1; i < bb->args->size; i++)
   {
     mcsh_value* value = bb->args->data[i];
     mcsh_resolve(value);
-    mcsh_to_string(&bb->module->vm->logger, t, 1024, value);
-    buffer_cat(&B, t);
+    // No length limit, unlike mcsh_to_string():
+    mcsh_value_buffer(&bb->module->vm->logger, value, &B);
   }
   mcsh_value* result = mcsh_value_new_string_null();
   result->string = B.data;
@@ -583,6 +774,7 @@ builtin_plus_table(mcsh_bb* bb)
   mcsh_value* value  = bb->args->data[3];
   mcsh_table_add(&bb->module->vm->logger,
                  target, key, value);
+  mcsh_value_grab(&bb->module->vm->logger, value);
   maybe_assign(bb->output, target);
   // printf("new table size: %i\n", target->table->size);
   return true;
@@ -655,11 +847,15 @@ builtin_expr(mcsh_bb* bb)
 
   mcsh_value* result;
   mcsh_node* node;
+  STATS(bb->module->vm, exprs);
   mcsh_expr_scan(B.data, &node, bb->status);
   // printf("scan ok.\n");
 
+  buffer_finalize(&B);
+
   mcsh_expr* expr;
   mcsh_node_to_expr(node, &expr);
+  if (node != NULL) mcsh_node_free(node, 0);
   // printf("translate OK\n");
 
   // mcsh_expr_print(expr, 0);
@@ -667,6 +863,7 @@ builtin_expr(mcsh_bb* bb)
   bool rc = mcsh_expr_eval(bb->module->vm, expr, &result);
   // printf("execute\n");
   CHECK(rc, "mcsh: expr execution failed!\n");
+  mcsh_expr_finalize(expr);
 
   maybe_assign(bb->output, result);
   return true;
@@ -676,9 +873,6 @@ static bool
 builtin_set(mcsh_bb* bb)
 {
   mcsh_value* target = bb->args->data[1];
-  buffer b;
-  buffer_init(&b, 16);
-  // mcsh_value_buffer
   valgrind_assert_msg(target->type == MCSH_VALUE_STRING,
                       "type: %i", target->type);
   char* name = target->string;
@@ -699,9 +893,6 @@ static bool
 builtin_drop(mcsh_bb* bb)
 {
   mcsh_value* target = bb->args->data[1];
-  buffer b;
-  buffer_init(&b, 16);
-  // mcsh_value_buffer
   valgrind_assert_msg(target->type == MCSH_VALUE_STRING,
                       "type: %i", target->type);
   char* name = target->string;
@@ -715,7 +906,8 @@ static void link_to_global(mcsh_module* module,
 static bool
 builtin_global(mcsh_bb* bb)
 {
-  printf("builtin_global: (%zi)\n", bb->args->size);
+  mcsh_log(&bb->module->vm->logger, MCSH_LOG_BUILTIN, MCSH_DEBUG,
+           "builtin_global: (%zi)", bb->args->size);
   mcsh_value* target = bb->args->data[1];
   mcsh_resolve(target);
   valgrind_assert(target->type == MCSH_VALUE_STRING);
@@ -724,12 +916,12 @@ builtin_global(mcsh_bb* bb)
   mcsh_value* global;
   if (table_search(&module->vm->globals, name, (void*) &global))
   {
-    printf("link to existing global: '%s'\n", name);
+    TRACE(GLOBAL_LINK, mcsh_trace_str(name), 0);
   }
   else
   {
     global = mcsh_value_new_null();
-    printf("new global: '%s'\n", name);
+    TRACE(GLOBAL_NEW, mcsh_trace_str(name), 0);
     table_add(&module->vm->globals, name, global);
   }
   link_to_global(module, name, global);
@@ -762,7 +954,7 @@ builtin_public(mcsh_bb* bb)
   mcsh_value* public;
   if (strmap_search(&module->vars, name, (void*) &public))
   {
-    printf("link to existing public: '%s'\n", name);
+    TRACE(PUBLIC_LINK, mcsh_trace_str(name), 0);
   }
   else
   {
@@ -780,9 +972,7 @@ static void
 link_to_public(mcsh_module* module,
                const char* name, mcsh_value* public)
 {
-  mcsh_value* value = malloc(sizeof(mcsh_value));
-  value->type = MCSH_VALUE_LINK;
-  value->link = public;
+  mcsh_value* value = mcsh_value_new_link(public);
   strmap_add(&module->vm->stack.current->vars, name, value);
 }
 
@@ -887,6 +1077,7 @@ static bool builtin_os_pid(mcsh_bb* bb);
 static bool builtin_os_dirname(mcsh_bb* bb);
 static bool builtin_os_basename(mcsh_bb* bb);
 static bool builtin_os_resolve(mcsh_bb* bb);
+static bool builtin_os_mem(mcsh_bb* bb);
 
 static bool
 builtin_os(mcsh_bb* bb)
@@ -914,6 +1105,8 @@ builtin_os(mcsh_bb* bb)
     rc = builtin_os_basename(bb);
   else if (strcmp(subcommand->string, "resolve") == 0)
     rc = builtin_os_resolve(bb);
+  else if (strcmp(subcommand->string, "mem") == 0)
+    rc = builtin_os_mem(bb);
 
   else
     RAISE(bb->status, NULL, 0, "mcsh.exception.invalid_arguments",
@@ -927,7 +1120,6 @@ builtin_os(mcsh_bb* bb)
 static bool
 builtin_os_env(mcsh_bb* bb)
 {
-  printf("getcwd: %zi\n", bb->args->size);
   mcsh_value* key = bb->args->data[2];
   mcsh_resolve(key);
   valgrind_assert(key->type == MCSH_VALUE_STRING);
@@ -942,7 +1134,6 @@ static bool
 builtin_os_pwd(mcsh_bb* bb)
 {
   // valgrind_assert(args->size == 1);
-  printf("getcwd: %zi\n", bb->args->size);
   char p[PATH_MAX];
   char* t = getcwd(p, PATH_MAX);
   if (t == NULL)
@@ -951,7 +1142,7 @@ builtin_os_pwd(mcsh_bb* bb)
     perror("mcsh:");
     return false;
   }
-  printf("getcwd: %s\n", p);
+  TRACE(GETCWD, bb->args->size, mcsh_trace_str(p));
   mcsh_value* result = mcsh_value_new_string(bb->module->vm, p);
   *bb->output = result;
   return true;
@@ -1019,11 +1210,87 @@ builtin_os_resolve(mcsh_bb* bb)
   return true;
 }
 
+static mcsh_value*
+mem_count_table(mcsh_vm* vm, mcsh_mem_count* count)
+{
+  mcsh_value* result = mcsh_value_new_table(vm, 8);
+  struct { const char* key; uint64_t n; } fields[] =
+    {{"live",       count->live      },
+     {"peak",       count->peak      },
+     {"total",      count->total     },
+     {"bytes",      count->bytes     },
+     {"bytes_peak", count->bytes_peak}};
+  for (size_t i = 0; i < sizeof(fields)/sizeof(fields[0]); i++)
+  {
+    mcsh_value* v = mcsh_value_new_int(fields[i].n);
+    mcsh_value_grab(&vm->logger, v);
+    table_add(result->table, fields[i].key, v);
+  }
+  return result;
+}
+
+/**
+   os mem                 -> table of type -> table of counts
+   os mem census [FILE]   write the heap census, by default to stdout
+*/
+static bool
+builtin_os_mem(mcsh_bb* bb)
+{
+  mcsh_vm* vm = bb->module->vm;
+  if (bb->args->size > 2)
+  {
+    mcsh_value* sub = bb->args->data[2];
+    mcsh_resolve(sub);
+    RAISE_IF(sub->type != MCSH_VALUE_STRING ||
+             strcmp(sub->string, "census") != 0 ||
+             bb->args->size > 4,
+             bb->status, NULL, 0, "mcsh.invalid_arguments",
+             "usage: os mem [census [FILE]]");
+    FILE* fp = stdout;
+    if (bb->args->size == 4)
+    {
+      mcsh_value* file = bb->args->data[3];
+      mcsh_resolve(file);
+      EXCEPTION_SUBARG_TYPE("mem", file, MCSH_VALUE_STRING, 3);
+      fp = fopen(file->string, "w");
+      RAISE_IF(fp == NULL, bb->status, NULL, 0, "mcsh.io",
+               "os mem census: could not write: %s", file->string);
+    }
+    mcsh_handles_flush_all();
+    mcsh_mem_census(vm, fp);
+    if (fp != stdout) fclose(fp);
+    else fflush(stdout);
+    maybe_assign(bb->output, &mcsh_null);
+    bb->status->code = MCSH_OK;
+    return true;
+  }
+
+  // Copy the counts first: the result changes them
+  mcsh_mem_count types[MCSH_TYPE_COUNT];
+  mcsh_mem_count all = mcsh_mem_all;
+  memcpy(types, mcsh_mem_types, sizeof(types));
+  mcsh_value* result = mcsh_value_new_table(vm, 16);
+  char name[64];
+  for (int i = 0; i < MCSH_TYPE_COUNT; i++)
+  {
+    if (types[i].total == 0) continue;
+    mcsh_value_type_name(i, name);
+    mcsh_value* t = mem_count_table(vm, &types[i]);
+    mcsh_value_grab(&vm->logger, t);
+    table_add(result->table, name, t);
+  }
+  mcsh_value* t = mem_count_table(vm, &all);
+  mcsh_value_grab(&vm->logger, t);
+  table_add(result->table, "all", t);
+  maybe_assign(bb->output, result);
+  bb->status->code = MCSH_OK;
+  return true;
+}
+
 static bool
 builtin_sh(mcsh_bb* bb)
 {
   valgrind_assert(bb->args->size > 1);
-  printf("sh: %zi\n", bb->args->size);
   // Replace arg 0:
   bb->args->data[0] =
     mcsh_value_new_string(bb->module->vm, "sh -c '");
@@ -1032,7 +1299,8 @@ builtin_sh(mcsh_bb* bb)
   mcsh_value_init_string(&end_quote, "'");
   list_array_add(bb->args, &end_quote);
   char* cmd = list_array_join_values(bb->args, " ");
-  printf("sh: %s\n", cmd);
+  TRACE(SH, bb->args->size, mcsh_trace_str(cmd));
+  mcsh_handles_flush_all();
   int rc = system(cmd);
   char exitcode[8];
   sprintf(exitcode, "%i", rc);
@@ -1090,45 +1358,69 @@ builtin_get(mcsh_bb* bb)
   return true;
 }
 
+/**
+   split [-i] string delimiter [max]
+   The delimiter may be any non-empty string.
+   Stop after max splits, the rest is the last field.
+   With -i, return an iterator over the fields for foreach
+*/
 static bool
 builtin_split(mcsh_bb* bb)
 {
   mcsh_logger* logger = &bb->module->vm->logger;
   LOG(MCSH_LOG_BUILTIN, MCSH_DEBUG, "split...");
-  mcsh_value* result = mcsh_value_new_list(bb->module->vm);
-  list_array* L = result->list;
-  mcsh_value* target    = bb->args->data[1];
-  mcsh_value* delimiter = bb->args->data[2];
+  size_t i = 1;
+  bool lazy = false;
+  if (bb->args->size > 1)
+  {
+    mcsh_value* flag = bb->args->data[1];
+    if (flag->type == MCSH_VALUE_STRING &&
+        strcmp(flag->string, "-i") == 0)
+    {
+      lazy = true;
+      i++;
+    }
+  }
+  size_t given = bb->args->size - i;
+  RAISE_IF(given < 2 || given > 3, bb->status, NULL, 0,
+           "mcsh.invalid_arguments",
+           "split: requires 2 or 3 arguments, given %zi", given);
+  mcsh_value* target    = bb->args->data[i];
+  mcsh_value* delimiter = bb->args->data[i+1];
   mcsh_resolve(target);
   mcsh_resolve(delimiter);
-  valgrind_assert(target   ->type == MCSH_VALUE_STRING);
-  valgrind_assert(delimiter->type == MCSH_VALUE_STRING);
-  char* s = target->string;
-  char* d = delimiter->string;
-  char* t = alloca(strlen(s+1));  // Temporary space
-  char* p = s;  // Moving start pointer through target s
-  char* q;      // Next match
-  int count = 0;
-  mcsh_value* value;
-  while (true)
+  TYPE_CHECK(target,    MCSH_VALUE_STRING, bb->status, "split", i);
+  TYPE_CHECK(delimiter, MCSH_VALUE_STRING, bb->status, "split", i+1);
+  RAISE_IF(delimiter->string[0] == '\0', bb->status, NULL, 0,
+           "mcsh.invalid_arguments", "split: empty delimiter");
+  int64_t max = -1;
+  if (given == 3)
+    RAISE_IF(! mcsh_value_integer(bb->args->data[i+2], &max) ||
+             max < 0,
+             bb->status, NULL, 0, "mcsh.invalid_arguments",
+             "split: max must be a non-negative integer");
+
+  mcsh_iterator* it = mcsh_iterator_split(bb->module->vm, target,
+                                          delimiter->string, max);
+  if (lazy)
   {
-    q = strstr(p, d);
-    if (q == NULL) break;
-    strlcpyj(t, p, q-p+1);
-    LOG(MCSH_LOG_BUILTIN, MCSH_DEBUG, "%i: '%s'", count, t);
-    value = mcsh_value_new_string(bb->module->vm, t);
-    list_array_add(L, value);
-    mcsh_value_grab(logger, value);
-    p = q+1;
-    count++;
+    maybe_assign(bb->output, mcsh_value_new_iterator(it));
+    return true;
   }
-  if (strlen(p) > 0)
+
+  mcsh_value* result = mcsh_value_new_list(bb->module->vm);
+  list_array* L = result->list;
+  mcsh_value* value;
+  while (true)
   {
-    LOG(MCSH_LOG_BUILTIN, MCSH_DEBUG, "%i: '%s'", count, p);
-    value = mcsh_value_new_string(bb->module->vm, p);
+    it->next(it, bb->module->vm, &value);
+    if (value == NULL) break;
+    LOG(MCSH_LOG_BUILTIN, MCSH_DEBUG, "%zi: '%s'",
+        L->size, value->string);
     list_array_add(L, value);
     mcsh_value_grab(logger, value);
   }
+  mcsh_iterator_free_all(it);
 
   maybe_assign(bb->output, result);
   return true;
@@ -1183,13 +1475,135 @@ builtin_find(mcsh_bb* bb)
   return true;
 }
 
+/**
+   match [-i] string regex
+   Return a list of the whole match then each group,
+   or an empty list if regex does not match.
+   Groups that did not take part in the match are empty strings.
+   The regex is POSIX extended: see mcsh-regex.h
+*/
+static bool
+builtin_match(mcsh_bb* bb)
+{
+  mcsh_logger* logger = &bb->module->vm->logger;
+  size_t i = 1;
+  int cflags = 0;
+  if (bb->args->size > 1)
+  {
+    mcsh_value* flag = bb->args->data[1];
+    if (flag->type == MCSH_VALUE_STRING &&
+        strcmp(flag->string, "-i") == 0)
+    {
+      cflags = REG_ICASE;
+      i++;
+    }
+  }
+  size_t given = bb->args->size - i;
+  RAISE_IF(given != 2, bb->status, NULL, 0,
+           "mcsh.invalid_arguments",
+           "match: requires 2 arguments, given %zi", given);
+  mcsh_value* target  = bb->args->data[i];
+  mcsh_value* pattern = bb->args->data[i+1];
+  mcsh_resolve(target);
+  mcsh_resolve(pattern);
+  TYPE_CHECK(target,  MCSH_VALUE_STRING, bb->status, "match", i);
+  TYPE_CHECK(pattern, MCSH_VALUE_STRING, bb->status, "match", i+1);
+
+  char error[256];
+  regex_t* regex = mcsh_regex_get(bb->module->vm->data->regex,
+                                  pattern->string, cflags,
+                                  error, sizeof(error));
+  RAISE_IF(regex == NULL, bb->status, NULL, 0, "mcsh.regex",
+           "match: bad regex: '%s': %s", pattern->string, error);
+
+  size_t groups = regex->re_nsub + 1;
+  regmatch_t m[groups];
+  mcsh_value* result = mcsh_value_new_list(bb->module->vm);
+  if (regexec(regex, target->string, groups, m, 0) == 0)
+    for (size_t g = 0; g < groups; g++)
+    {
+      const char* s = target->string + m[g].rm_so;
+      size_t n = m[g].rm_eo - m[g].rm_so;
+      if (m[g].rm_so < 0) n = 0;
+      mcsh_value* value = mcsh_value_new_string_n(s, n);
+      list_array_add(result->list, value);
+      mcsh_value_grab(logger, value);
+    }
+  maybe_assign(bb->output, result);
+  return true;
+}
+
+/**
+   walk [-l] [-p prune]... [pattern]
+   Return an iterator over the paths matching pattern for foreach,
+   in no particular order.  Directories are read in parallel.
+   The pattern is a glob with ** for any depth: the default is **,
+   and a directory name means everything below it.
+   With -l, each item is a table of path, type, size, mtime, mode.
+   With -p, do not enter directories with names matching prune
+*/
+static bool
+builtin_walk(mcsh_bb* bb)
+{
+  mcsh_walk_options options = { NULL, 0, 0, false };
+  char* prune[bb->args->size];
+  options.prune = prune;
+  size_t i = 1;
+  for (; i < bb->args->size; i++)
+  {
+    mcsh_value* flag = bb->args->data[i];
+    mcsh_resolve(flag);
+    if (flag->type != MCSH_VALUE_STRING) break;
+    if (strcmp(flag->string, "-l") == 0)
+      options.stat = true;
+    else if (strcmp(flag->string, "-p") == 0)
+    {
+      RAISE_IF(i+1 == bb->args->size, bb->status, NULL, 0,
+               "mcsh.invalid_arguments", "walk: -p requires a glob");
+      mcsh_value* glob = bb->args->data[++i];
+      mcsh_resolve(glob);
+      TYPE_CHECK(glob, MCSH_VALUE_STRING, bb->status, "walk", i);
+      prune[options.prune_count++] = glob->string;
+    }
+    else break;
+  }
+  size_t given = bb->args->size - i;
+  RAISE_IF(given > 1, bb->status, NULL, 0,
+           "mcsh.invalid_arguments",
+           "walk: requires 0 or 1 patterns, given %zi", given);
+  char* text = "**";
+  char* tmp = NULL;
+  if (given == 1)
+  {
+    mcsh_value* pattern = bb->args->data[i];
+    mcsh_resolve(pattern);
+    TYPE_CHECK(pattern, MCSH_VALUE_STRING, bb->status, "walk", i);
+    text = pattern->string;
+    struct stat s;
+    if (strpbrk(text, "*?[") == NULL &&
+        stat(text, &s) == 0 && S_ISDIR(s.st_mode))
+    {
+      tmp = malloc_checked(strlen(text) + 4);
+      sprintf(tmp, "%s/**", text);
+      text = tmp;
+    }
+  }
+  mcsh_walk_pattern* compiled = mcsh_walk_pattern_compile(text);
+  free(tmp);
+  RAISE_IF(compiled == NULL, bb->status, NULL, 0, "mcsh.glob",
+           "walk: pattern is too deep");
+
+  mcsh_walk* walk = mcsh_walk_start(compiled, &options);
+  mcsh_iterator* it = mcsh_iterator_walk(walk, options.stat);
+  maybe_assign(bb->output, mcsh_value_new_iterator(it));
+  return true;
+}
+
 static bool
 builtin_substring(mcsh_bb* bb)
 {
-  printf("SUBSTRING\n");
   mcsh_value* target = bb->args->data[1];
   mcsh_resolve(target);
-  printf("arg 1 %p\n", target);
   mcsh_value* start = bb->args->data[2];
   mcsh_resolve(start);
   mcsh_value* end = bb->args->data[3];
@@ -1204,7 +1618,7 @@ builtin_substring(mcsh_bb* bb)
   int r_length = p1-p0+1;
   char r[r_length];
   strlcpyj(r, t+p0, r_length);
-  printf("result: '%s'\n", r);
+  TRACE(SUBSTRING, p0, mcsh_trace_str(r));
   result = mcsh_value_new_string(bb->module->vm, r);
 
   maybe_assign(bb->output, result);
@@ -1215,12 +1629,28 @@ builtin_substring(mcsh_bb* bb)
 static bool
 builtin_import(mcsh_bb* bb)
 {
-  EXCEPTION_ARGC_EQ(1);
-  mcsh_value* target = bb->args->data[1];
+  // import -l: do not load the module until a member is used
+  size_t i = 1;
+  bool lazy = false;
+  if (bb->args->size > 2)
+  {
+    mcsh_value* flag = bb->args->data[1];
+    if (flag->type == MCSH_VALUE_STRING &&
+        strcmp(flag->string, "-l") == 0)
+    {
+      lazy = true;
+      i++;
+    }
+  }
+  RAISE_IF(bb->args->size - i != 1, bb->status, NULL, 0,
+           "mcsh.invalid_arguments",
+           "import: requires 1 argument, given %zi",
+           bb->args->size - i);
+  mcsh_value* target = bb->args->data[i];
   mcsh_resolve(target);
   valgrind_assert(target->type == MCSH_VALUE_STRING);
   char* t = target->string;
-  mcsh_import(bb->module, t, bb->output, bb->status);
+  mcsh_import(bb->module, t, lazy, bb->output, bb->status);
   maybe_assign(bb->output, &mcsh_null);
   return true;
 }
@@ -1276,7 +1706,6 @@ builtin_continue(mcsh_bb* bb)
 static bool
 builtin_sleep(mcsh_bb* bb)
 {
-  printf("c: '%s'\n", (char*) bb->args->data[0]);
   EXCEPTION_ARGC_EQ(1);
   mcsh_value* value = bb->args->data[1];
   mcsh_resolve(value);
@@ -1296,15 +1725,31 @@ builtin_sleep(mcsh_bb* bb)
   return true;
 }
 
+/**
+   clock [ns]
+   Output: seconds since the epoch,
+           or with ns: nanoseconds from the monotonic clock
+*/
 static bool
 builtin_clock(mcsh_bb* bb)
 {
-  /* ARG_CHECK(1); */
-  /* mcsh_value* value = bb->args->data[1]; */
-  /* mcsh_resolve(value); */
-
-  time_t t = time(NULL);
-  mcsh_value* result = mcsh_value_new_int(t);
+  mcsh_value* result;
+  if (bb->args->size == 1)
+  {
+    time_t t = time(NULL);
+    result = mcsh_value_new_int(t);
+  }
+  else
+  {
+    EXCEPTION_ARGC_EQ(1);
+    mcsh_value* unit = bb->args->data[1];
+    mcsh_resolve(unit);
+    RAISE_IF(unit->type != MCSH_VALUE_STRING ||
+             strcmp(unit->string, "ns") != 0,
+             bb->status, NULL, 0, "mcsh.invalid_arguments",
+             "usage: clock [ns]");
+    result = mcsh_value_new_int(mcsh_trace_now());
+  }
 
   maybe_assign(bb->output, result);
   return true;
@@ -1322,7 +1767,7 @@ builtin_bang(mcsh_bb* bb)
   buffer_init(&B, 32);
   mcsh_value_buffer(logger, bb->args->data[1], &B);
   char* cmd = buffer_dup(&B);
-  show("cmd: %s", cmd);
+  TRACE(EXEC_ARG, 0, mcsh_trace_str(cmd));
   int i = 2;
   a[0] = cmd;
   for ( ; i < n; i++)
@@ -1330,7 +1775,7 @@ builtin_bang(mcsh_bb* bb)
     buffer_reset(&B);
     mcsh_value_buffer(logger, bb->args->data[i], &B);
     a[i-1] = buffer_dup(&B);
-    show("%i %s", i-1, a[i-1]);
+    TRACE(EXEC_ARG, i-1, mcsh_trace_str(a[i-1]));
   }
   a[i-1] = NULL;
 
@@ -1402,6 +1847,245 @@ builtin_wait(mcsh_bb* bb)
   return true;
 }
 
+static bool thread_join(mcsh_bb* bb);
+
+/**
+   thread { block } ARGS...
+   Run block in a new VM on a new thread, with ARGS as $args
+   Output: the thread ID
+   thread join ID
+   Wait for the thread ID
+   Output: the result of its block
+*/
+static bool
+builtin_thread(mcsh_bb* bb)
+{
+  EXCEPTION_ARGC_GE(1);
+  mcsh_value* body = bb->args->data[1];
+  mcsh_resolve(body);
+  if (body->type == MCSH_VALUE_STRING &&
+      strcmp(body->string, "join") == 0)
+    return thread_join(bb);
+  RAISE_IF(body->type != MCSH_VALUE_BLOCK,
+           bb->status, NULL, 0, "mcsh.invalid_arguments",
+           "builtin thread: requires a block or join");
+  return mcsh_thread_start(bb->module, body->block, bb->args, 2,
+                           bb->output, bb->status);
+}
+
+static bool
+thread_join(mcsh_bb* bb)
+{
+  RAISE_IF(bb->args->size != 3,
+           bb->status, NULL, 0, "mcsh.invalid_arguments",
+           "builtin thread join: requires a thread ID");
+  mcsh_value* value = bb->args->data[2];
+  mcsh_resolve(value);
+  int64_t id;
+  RAISE_IF(! mcsh_value_integer(value, &id),
+           bb->status, NULL, 0, "mcsh.invalid_arguments",
+           "builtin thread join: not a thread ID");
+  return mcsh_thread_join(bb->module, id, bb->output, bb->status);
+}
+
+/**
+   chan
+   Output: a new channel, shared with bg children and threads
+*/
+static bool
+builtin_chan(mcsh_bb* bb)
+{
+  EXCEPTION_ARGC_EQ(0);
+  mcsh_chan* chan = mcsh_chan_create();
+  RAISE_IF(chan == NULL, bb->status, NULL, 0, "mcsh.io",
+           "chan: %s", strerror(errno));
+  maybe_assign(bb->output, mcsh_value_new_chan(chan));
+  return true;
+}
+
+static bool
+get_chan(mcsh_bb* bb, mcsh_value* value,
+         const char* name, int index, mcsh_chan** output)
+{
+  mcsh_resolve(value);
+  TYPE_CHECK(value, MCSH_VALUE_CHAN, bb->status, name, index,
+             "%s requires a channel from chan", name);
+  *output = value->chan;
+  return true;
+}
+
+/**
+   send CHAN VALUE
+   VALUE is copied: a string, number, list, table, or channel
+*/
+static bool
+builtin_send(mcsh_bb* bb)
+{
+  EXCEPTION_ARGC_EQ(2);
+  mcsh_chan* chan = NULL;
+  get_chan(bb, bb->args->data[1], "send", 1, &chan);
+  PROPAGATE(bb->status);
+  buffer B;
+  buffer_init(&B, 256);
+  mcsh_pack(&bb->module->vm->logger, bb->args->data[2], &B, true,
+            bb->status);
+  bool rc = bb->status->code != MCSH_OK ||
+    mcsh_chan_send(chan, B.data, B.length);
+  int e = errno;
+  // No receiver will take these references:
+  if (! rc) mcsh_pack_release(B.data, B.data + B.length);
+  buffer_finalize(&B);
+  PROPAGATE(bb->status);
+  RAISE_IF(! rc, bb->status, NULL, 0, "mcsh.io",
+           "send: %s", strerror(e));
+  maybe_assign(bb->output, &mcsh_null);
+  return true;
+}
+
+/** Optional TIMEOUT in seconds at args->data[i], else forever */
+static bool
+get_timeout(mcsh_bb* bb, size_t i, double* output)
+{
+  *output = -1;
+  if (i >= bb->args->size) return true;
+  mcsh_value* value = bb->args->data[i];
+  mcsh_resolve(value);
+  mcsh_to_float(output, value, bb->status);
+  return true;
+}
+
+/** Receive one value from chans into *output,
+    or set *index to -1 after the timeout */
+static bool
+chan_receive(mcsh_bb* bb, const char* name,
+             mcsh_chan** chans, int count, double timeout,
+             int* index, mcsh_value** output)
+{
+  buffer B;
+  buffer_init(&B, 256);
+  bool rc = mcsh_chan_recv(chans, count, timeout, &B, index);
+  int e = errno;
+  if (rc && *index >= 0)
+  {
+    const char* p   = B.data;
+    const char* end = B.data + B.length;
+    rc = mcsh_unpack(bb->module->vm, &p, end, output) && p == end;
+    if (! rc) e = EBADMSG;
+  }
+  buffer_finalize(&B);
+  RAISE_IF(! rc, bb->status, NULL, 0, "mcsh.io",
+           "%s: %s", name, strerror(e));
+  return true;
+}
+
+/**
+   recv CHAN [TIMEOUT]
+   Wait up to TIMEOUT seconds, or forever
+   Output: the next value, or NULL after the timeout
+*/
+static bool
+builtin_recv(mcsh_bb* bb)
+{
+  EXCEPTION_ARGC_GE(1);
+  RAISE_IF(bb->args->size > 3, bb->status, NULL, 0,
+           "mcsh.invalid_arguments", "recv: too many arguments");
+  mcsh_chan* chan = NULL;
+  get_chan(bb, bb->args->data[1], "recv", 1, &chan);
+  PROPAGATE(bb->status);
+  double timeout;
+  get_timeout(bb, 2, &timeout);
+  PROPAGATE(bb->status);
+  int index;
+  mcsh_value* value = &mcsh_null;
+  chan_receive(bb, "recv", &chan, 1, timeout, &index, &value);
+  PROPAGATE(bb->status);
+  maybe_assign(bb->output, value);
+  return true;
+}
+
+/**
+   select CHAN... [TIMEOUT]
+   Wait up to TIMEOUT seconds, or forever, for any CHAN
+   Output: the list [index value] for the first ready CHAN,
+           or NULL after the timeout
+*/
+static bool
+builtin_select(mcsh_bb* bb)
+{
+  EXCEPTION_ARGC_GE(1);
+  size_t count = bb->args->size - 1;
+  mcsh_chan* chans[count];
+  size_t n = 0;
+  for (size_t i = 1; i < bb->args->size; i++)
+  {
+    mcsh_value* value = bb->args->data[i];
+    mcsh_resolve(value);
+    // The last argument may be the timeout:
+    if (i > 1 && i == count && value->type != MCSH_VALUE_CHAN)
+      break;
+    get_chan(bb, value, "select", i, &chans[n++]);
+    PROPAGATE(bb->status);
+  }
+  double timeout;
+  get_timeout(bb, n+1, &timeout);
+  PROPAGATE(bb->status);
+  int index;
+  mcsh_value* value = NULL;
+  chan_receive(bb, "select", chans, n, timeout, &index, &value);
+  PROPAGATE(bb->status);
+  if (index < 0)
+  {
+    maybe_assign(bb->output, &mcsh_null);
+    return true;
+  }
+  mcsh_logger* logger = &bb->module->vm->logger;
+  mcsh_value* result = mcsh_value_new_list(bb->module->vm);
+  mcsh_value* i = mcsh_value_new_int(index);
+  list_array_add(result->list, i);
+  mcsh_value_grab(logger, i);
+  list_array_add(result->list, value);
+  mcsh_value_grab(logger, value);
+  maybe_assign(bb->output, result);
+  return true;
+}
+
+/**
+   save VALUE FILE
+   Write VALUE to FILE for load: see mcsh-save.h
+*/
+static bool
+builtin_save(mcsh_bb* bb)
+{
+  EXCEPTION_ARGC_EQ(2);
+  mcsh_value* filename = bb->args->data[2];
+  mcsh_resolve(filename);
+  TYPE_CHECK(filename, MCSH_VALUE_STRING, bb->status, "save", 2,
+             "save requires a filename");
+  mcsh_save(&bb->module->vm->logger, bb->args->data[1],
+            filename->string, bb->status);
+  PROPAGATE(bb->status);
+  maybe_assign(bb->output, &mcsh_null);
+  return true;
+}
+
+/**
+   load FILE [KEY...]
+   Output: the value saved in FILE,
+           or only its member at the path of table keys
+           and list indices, without decoding the rest
+*/
+static bool
+builtin_load(mcsh_bb* bb)
+{
+  EXCEPTION_ARGC_GE(1);
+  mcsh_value* filename = bb->args->data[1];
+  mcsh_resolve(filename);
+  TYPE_CHECK(filename, MCSH_VALUE_STRING, bb->status, "load", 1,
+             "load requires a filename");
+  return mcsh_load(bb->module->vm, filename->string, bb->args, 2,
+                   bb->output, bb->status);
+}
+
 static bool
 builtin_jobs(mcsh_bb* bb)
 {
@@ -1414,51 +2098,180 @@ builtin_jobs(mcsh_bb* bb)
   return true;
 }
 
+/**
+   trace dump [FILE]
+   Write the trace ring to FILE, by default mcsh-trace.PID
+   Output: the file name
+*/
+static bool
+builtin_trace(mcsh_bb* bb)
+{
+  EXCEPTION_ARGC_GE(1);
+  mcsh_value* subcommand = bb->args->data[1];
+  mcsh_resolve(subcommand);
+  RAISE_IF(subcommand->type != MCSH_VALUE_STRING ||
+           strcmp(subcommand->string, "dump") != 0,
+           bb->status, NULL, 0, "mcsh.invalid_arguments",
+           "builtin trace: unknown subcommand");
+  RAISE_IF(bb->args->size > 3,
+           bb->status, NULL, 0, "mcsh.invalid_arguments",
+           "trace dump: requires 0 or 1 files, given %zi",
+           bb->args->size - 2);
+  mcsh_trace* trace = bb->module->vm->trace;
+  RAISE_IF(trace == NULL, bb->status, NULL, 0, "mcsh.invalid_arguments",
+           "trace dump: tracing is off: use mcsh --trace");
+
+  char filename[PATH_MAX];
+  if (bb->args->size == 3)
+  {
+    mcsh_value* file = bb->args->data[2];
+    mcsh_resolve(file);
+    EXCEPTION_SUBARG_TYPE("dump", file, MCSH_VALUE_STRING, 2);
+    strlcpyj(filename, file->string, PATH_MAX);
+  }
+  else
+    snprintf(filename, PATH_MAX, "mcsh-trace.%i", getpid());
+
+  RAISE_IF(! mcsh_trace_dump(trace, filename),
+           bb->status, NULL, 0, "mcsh.io",
+           "trace dump: could not write: %s", filename);
+  maybe_assign(bb->output,
+               mcsh_value_new_string(bb->module->vm, filename));
+  bb->status->code = MCSH_OK;
+  return true;
+}
+
+/**
+   stats
+   Output: a table of the event counters of this VM:
+           see mcsh-stats.h
+*/
+static bool
+builtin_stats(mcsh_bb* bb)
+{
+  EXCEPTION_ARGC_EQ(0);
+  maybe_assign(bb->output, mcsh_stats_table(bb->module->vm));
+  bb->status->code = MCSH_OK;
+  return true;
+}
+
+static void
+stats_add(mcsh_vm* vm, mcsh_value* t, const char* key, uint64_t n)
+{
+  mcsh_value* v = mcsh_value_new_int(n);
+  mcsh_value_grab(&vm->logger, v);
+  table_add(t->table, key, v);
+}
+
+mcsh_value*
+mcsh_stats_table(mcsh_vm* vm)
+{
+  // Copy the counters first: the result changes them
+  mcsh_stats stats = vm->stats;
+  unsigned long expands  = table_expands;
+  unsigned long reallocs = strmap_reallocs;
+
+  mcsh_value* result = mcsh_value_new_table(vm, 16);
+  struct { const char* key; uint64_t n; } fields[] =
+    {{"stmts",          stats.stmts         },
+     {"stack_searches", stats.stack_searches},
+     {"stack_depth",    stats.stack_depth   },
+     {"stack_misses",   stats.stack_misses  },
+     {"env_lookups",    stats.env_lookups   },
+     {"calls",          stats.calls         },
+     {"exprs",          stats.exprs         },
+     {"table_expands",  expands             },
+     {"strmap_reallocs", reallocs           }};
+  for (size_t i = 0; i < sizeof(fields)/sizeof(fields[0]); i++)
+    stats_add(vm, result, fields[i].key, fields[i].n);
+
+  mcsh_value* forks = mcsh_value_new_table(vm, 8);
+  stats_add(vm, forks, "subcmd",   stats.fork_subcmd);
+  stats_add(vm, forks, "bg",       stats.fork_bg);
+  stats_add(vm, forks, "exec",     stats.fork_exec);
+  stats_add(vm, forks, "pforeach", stats.fork_pforeach);
+  mcsh_value_grab(&vm->logger, forks);
+  table_add(result->table, "forks", forks);
+
+  mcsh_value* builtins = mcsh_value_new_table(vm, 64);
+  for (int i = 0; i < builtin_count; i++)
+    if (stats.builtins[i] > 0)
+      stats_add(vm, builtins, builtin_entries[i].name,
+                stats.builtins[i]);
+  mcsh_value_grab(&vm->logger, builtins);
+  table_add(result->table, "builtins", builtins);
+  return result;
+}
+
+static void
+builtin_add(const char* name, bool (*function)(mcsh_bb* bb))
+{
+  valgrind_assert(builtin_count < MCSH_STATS_BUILTINS);
+  builtin_entry* entry = &builtin_entries[builtin_count++];
+  entry->name     = name;
+  entry->function = function;
+  table_add(mcsh.builtins, name, entry);
+}
+
 static void
 builtins_add()
 {
-  table_add(mcsh.builtins, ":",         builtin_noop);
-  table_add(mcsh.builtins, "+",         builtin_plus);
-  table_add(mcsh.builtins, "++",        builtin_incr);
-  table_add(mcsh.builtins, "$",         builtin_expr);
-  table_add(mcsh.builtins, "=",         builtin_set);
-  table_add(mcsh.builtins, "drop",      builtin_drop);
-  table_add(mcsh.builtins, "global",    builtin_global);
-  table_add(mcsh.builtins, "public",    builtin_public);
-  table_add(mcsh.builtins, "signature", builtin_signature);
-  table_add(mcsh.builtins, "function",  builtin_function);
-  table_add(mcsh.builtins, "inplace",   builtin_function);
-  table_add(mcsh.builtins, "macro",     builtin_function);
-  table_add(mcsh.builtins, "open",      builtin_open);
-  table_add(mcsh.builtins, "close",     builtin_close);
-  table_add(mcsh.builtins, "print",     builtin_print);
-  table_add(mcsh.builtins, "<<",        builtin_read);
-  table_add(mcsh.builtins, ">>",        builtin_write);
-  table_add(mcsh.builtins, "flush",     builtin_flush);
-  table_add(mcsh.builtins, "type",      builtin_type);
-  table_add(mcsh.builtins, "as",        builtin_as);
-  table_add(mcsh.builtins, "string",    builtin_string);
-  table_add(mcsh.builtins, "find",      builtin_find);
-  table_add(mcsh.builtins, "substring", builtin_substring);
-  table_add(mcsh.builtins, "sh",        builtin_sh);
-  table_add(mcsh.builtins, "list",      builtin_list_create);
-  table_add(mcsh.builtins, "table",     builtin_table_create);
-  table_add(mcsh.builtins, "get",       builtin_get);
-  table_add(mcsh.builtins, "split",     builtin_split);
-  table_add(mcsh.builtins, "join",      builtin_join);
-  table_add(mcsh.builtins, "import",    builtin_import);
-  table_add(mcsh.builtins, ".",         builtin_source);
-  table_add(mcsh.builtins, "eval",      builtin_eval);
-  table_add(mcsh.builtins, "break",     builtin_break);
-  table_add(mcsh.builtins, "continue",  builtin_continue);
-  table_add(mcsh.builtins, "os",        builtin_os);
-  table_add(mcsh.builtins, "sleep",     builtin_sleep);
-  table_add(mcsh.builtins, "clock",     builtin_clock);
-  table_add(mcsh.builtins, "!",         builtin_bang);
-  table_add(mcsh.builtins, "bg",        builtin_bg);
-  table_add(mcsh.builtins, "wait",      builtin_wait);
-  table_add(mcsh.builtins, "jobs",      builtin_jobs);
-  table_add(mcsh.builtins, "exit",      builtin_exit);
+  builtin_add(":",         builtin_noop);
+  builtin_add("+",         builtin_plus);
+  builtin_add("++",        builtin_incr);
+  builtin_add("$",         builtin_expr);
+  builtin_add("=",         builtin_set);
+  builtin_add("drop",      builtin_drop);
+  builtin_add("global",    builtin_global);
+  builtin_add("public",    builtin_public);
+  builtin_add("signature", builtin_signature);
+  builtin_add("function",  builtin_function);
+  builtin_add("inplace",   builtin_function);
+  builtin_add("macro",     builtin_function);
+  builtin_add("open",      builtin_open);
+  builtin_add("close",     builtin_close);
+  builtin_add("print",     builtin_print);
+  builtin_add("<<",        builtin_read_line);
+  builtin_add("read",      builtin_read);
+  builtin_add("seek",      builtin_seek);
+  builtin_add("lines",     builtin_lines);
+  builtin_add(">>",        builtin_write);
+  builtin_add("flush",     builtin_flush);
+  builtin_add("type",      builtin_type);
+  builtin_add("as",        builtin_as);
+  builtin_add("string",    builtin_string);
+  builtin_add("find",      builtin_find);
+  builtin_add("match",     builtin_match);
+  builtin_add("walk",      builtin_walk);
+  builtin_add("substring", builtin_substring);
+  builtin_add("sh",        builtin_sh);
+  builtin_add("list",      builtin_list_create);
+  builtin_add("table",     builtin_table_create);
+  builtin_add("get",       builtin_get);
+  builtin_add("split",     builtin_split);
+  builtin_add("join",      builtin_join);
+  builtin_add("import",    builtin_import);
+  builtin_add(".",         builtin_source);
+  builtin_add("eval",      builtin_eval);
+  builtin_add("break",     builtin_break);
+  builtin_add("continue",  builtin_continue);
+  builtin_add("os",        builtin_os);
+  builtin_add("sleep",     builtin_sleep);
+  builtin_add("clock",     builtin_clock);
+  builtin_add("!",         builtin_bang);
+  builtin_add("bg",        builtin_bg);
+  builtin_add("wait",      builtin_wait);
+  builtin_add("jobs",      builtin_jobs);
+  builtin_add("thread",    builtin_thread);
+  builtin_add("chan",      builtin_chan);
+  builtin_add("send",      builtin_send);
+  builtin_add("recv",      builtin_recv);
+  builtin_add("select",    builtin_select);
+  builtin_add("save",      builtin_save);
+  builtin_add("load",      builtin_load);
+  builtin_add("trace",     builtin_trace);
+  builtin_add("stats",     builtin_stats);
+  builtin_add("exit",      builtin_exit);
 }
 
 void
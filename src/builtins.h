@@ -13,4 +13,7 @@ bool mcsh_builtins_has(const char* symbol);
 bool mcsh_builtins_execute(mcsh_module* module, list_array* args,
                            mcsh_value** value,  mcsh_status* status);
 
+/** The event counters of vm as an mcsh table: see mcsh-stats.h */
+mcsh_value* mcsh_stats_table(mcsh_vm* vm);
+
 void mcsh_builtins_finalize(void);
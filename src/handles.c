@@ -0,0 +1,301 @@
+
+/**
+   HANDLES C
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "handles.h"
+#include "util.h"
+
+/** Head of the list of open handles in this thread:
+    a handle belongs to one VM, and each VM runs in one thread */
+static _Thread_local mcsh_handle* handles = NULL;
+
+static pthread_once_t handles_atexit = PTHREAD_ONCE_INIT;
+
+static void handles_exit(void);
+
+static void
+handles_register()
+{
+  atexit(handles_exit);
+}
+
+static bool
+mode_flags(const char* mode, int* flags, bool* readable, bool* writable)
+{
+  bool plus = (strchr(mode, '+') != NULL);
+  switch (mode[0])
+  {
+    case 'r':
+      *flags = plus ? O_RDWR : O_RDONLY;
+      *readable = true;
+      *writable = plus;
+      break;
+    case 'w':
+      *flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+      *readable = plus;
+      *writable = true;
+      break;
+    case 'a':
+      *flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+      *readable = plus;
+      *writable = true;
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+mcsh_handle*
+mcsh_handle_open(const char* filename, const char* mode,
+                 size_t capacity)
+{
+  int flags;
+  bool readable, writable;
+  if (! mode_flags(mode, &flags, &readable, &writable))
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+  int fd = open(filename, flags | O_CLOEXEC, 0666);
+  if (fd == -1) return NULL;
+
+  if (capacity == 0) capacity = MCSH_HANDLE_BUFFER_DEFAULT;
+  mcsh_handle* h = malloc_checked(sizeof(*h));
+  h->fd       = fd;
+  h->name     = strdup_checked((char*) filename);
+  h->readable = readable;
+  h->writable = writable;
+  h->capacity = capacity;
+  h->rbuf     = readable ? malloc_checked(capacity) : NULL;
+  h->rstart   = 0;
+  h->rend     = 0;
+  h->wbuf     = writable ? malloc_checked(capacity) : NULL;
+  h->wlen     = 0;
+
+  h->prev = NULL;
+  h->next = handles;
+  if (handles != NULL) handles->prev = h;
+  handles = h;
+  // Forked children exit() without the normal shutdown:
+  pthread_once(&handles_atexit, handles_register);
+  return h;
+}
+
+/** Read ahead into rbuf.  *count is 0 at end of file */
+static bool
+fill(mcsh_handle* h, ssize_t* count)
+{
+  if (h->wlen > 0 && ! mcsh_handle_flush(h)) return false;
+  h->rstart = 0;
+  h->rend   = 0;
+  ssize_t n;
+  do
+    n = read(h->fd, h->rbuf, h->capacity);
+  while (n == -1 && errno == EINTR);
+  if (n == -1) return false;
+  h->rend = n;
+  *count = n;
+  return true;
+}
+
+/** Append count bytes to string buffer B and NUL-terminate.
+    Unlike buffer_catn(), data[count] is not read */
+static inline void
+cat_bytes(buffer* B, const char* data, size_t count)
+{
+  if (B->length > 0) B->length--;
+  buffer_put(B, data, count);
+  buffer_put(B, "", 1);
+}
+
+/** Make sure B is a valid (possibly empty) string */
+static inline void
+terminate(buffer* B)
+{
+  if (B->length == 0)
+    buffer_put(B, "", 1);
+}
+
+bool
+mcsh_handle_read_line(mcsh_handle* h, buffer* B, bool* eof)
+{
+  bool found = false;
+  *eof = false;
+  while (true)
+  {
+    if (h->rstart == h->rend)
+    {
+      ssize_t n;
+      if (! fill(h, &n)) return false;
+      if (n == 0)
+      {
+        // End of file: any partial last line is still a line
+        *eof = ! found;
+        break;
+      }
+    }
+    found = true;
+    char* p = h->rbuf + h->rstart;
+    size_t available = h->rend - h->rstart;
+    char* newline = memchr(p, '\n', available);
+    if (newline != NULL)
+    {
+      cat_bytes(B, p, newline - p);
+      h->rstart += newline - p + 1;
+      break;
+    }
+    cat_bytes(B, p, available);
+    h->rstart = h->rend;
+  }
+  terminate(B);
+  return true;
+}
+
+bool
+mcsh_handle_read(mcsh_handle* h, size_t count, buffer* B)
+{
+  while (count > 0)
+  {
+    if (h->rstart == h->rend)
+    {
+      ssize_t n;
+      if (! fill(h, &n)) return false;
+      if (n == 0) break;
+    }
+    size_t available = h->rend - h->rstart;
+    size_t m = available < count ? available : count;
+    cat_bytes(B, h->rbuf + h->rstart, m);
+    h->rstart += m;
+    count     -= m;
+  }
+  terminate(B);
+  return true;
+}
+
+bool
+mcsh_handle_read_all(mcsh_handle* h, buffer* B)
+{
+  return mcsh_handle_read(h, SIZE_MAX, B);
+}
+
+static bool
+write_fd(int fd, const char* data, size_t count)
+{
+  while (count > 0)
+  {
+    ssize_t n = write(fd, data, count);
+    if (n == -1)
+    {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data  += n;
+    count -= n;
+  }
+  return true;
+}
+
+/** Give back unconsumed read-ahead so the file offset is correct */
+static bool
+drop_read_ahead(mcsh_handle* h)
+{
+  if (h->rstart == h->rend) return true;
+  off_t unread = h->rend - h->rstart;
+  h->rstart = 0;
+  h->rend   = 0;
+  return lseek(h->fd, -unread, SEEK_CUR) != -1;
+}
+
+bool
+mcsh_handle_write(mcsh_handle* h, const char* data, size_t count)
+{
+  if (h->rend > 0 && ! drop_read_ahead(h)) return false;
+  if (h->wlen + count > h->capacity)
+    if (! mcsh_handle_flush(h)) return false;
+  // Large writes bypass the buffer:
+  if (count >= h->capacity)
+    return write_fd(h->fd, data, count);
+  memcpy(h->wbuf + h->wlen, data, count);
+  h->wlen += count;
+  return true;
+}
+
+bool
+mcsh_handle_flush(mcsh_handle* h)
+{
+  if (h->wlen == 0) return true;
+  bool result = write_fd(h->fd, h->wbuf, h->wlen);
+  h->wlen = 0;
+  return result;
+}
+
+bool
+mcsh_handle_seek(mcsh_handle* h, off_t offset, int whence,
+                 off_t* output)
+{
+  if (! mcsh_handle_flush(h)) return false;
+  if (whence == SEEK_CUR)
+    // The kernel offset is ahead of the user by the read-ahead:
+    offset -= (off_t) (h->rend - h->rstart);
+  h->rstart = 0;
+  h->rend   = 0;
+  off_t result = lseek(h->fd, offset, whence);
+  if (result == -1) return false;
+  *output = result;
+  return true;
+}
+
+bool
+mcsh_handle_close(mcsh_handle* h)
+{
+  if (h->fd == -1)
+  {
+    errno = EBADF;
+    return false;
+  }
+  bool result = mcsh_handle_flush(h);
+  int rc = close(h->fd);
+  if (rc == -1) result = false;
+  h->fd = -1;
+
+  if (h->prev != NULL) h->prev->next = h->next;
+  else                 handles       = h->next;
+  if (h->next != NULL) h->next->prev = h->prev;
+  h->prev = NULL;
+  h->next = NULL;
+  return result;
+}
+
+void
+mcsh_handle_free(mcsh_handle* h)
+{
+  if (h->fd != -1)
+    mcsh_handle_close(h);
+  free(h->name);
+  free(h->rbuf);
+  free(h->wbuf);
+  free(h);
+}
+
+void
+mcsh_handles_flush_all()
+{
+  for (mcsh_handle* h = handles; h != NULL; h = h->next)
+    mcsh_handle_flush(h);
+}
+
+static void
+handles_exit()
+{
+  mcsh_handles_flush_all();
+}
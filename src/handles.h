@@ -0,0 +1,77 @@
+
+/**
+   HANDLES H
+   Buffered file handles: the data behind MCSH_VALUE_HANDLE
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "buffer.h"
+
+/** Default size of each user-space buffer in a handle */
+#define MCSH_HANDLE_BUFFER_DEFAULT (64*1024)
+
+typedef struct mcsh_handle_s mcsh_handle;
+
+struct mcsh_handle_s
+{
+  /// -1 after close
+  int fd;
+  char* name;
+  bool readable;
+  bool writable;
+  /// Size of each of rbuf and wbuf
+  size_t capacity;
+  /// Read-ahead: the unconsumed bytes are rbuf[rstart,rend)
+  char* rbuf;
+  size_t rstart;
+  size_t rend;
+  /// Pending writes: wbuf[0,wlen)
+  char* wbuf;
+  size_t wlen;
+  /// All open handles, for flushing before fork() and exit()
+  mcsh_handle* prev;
+  mcsh_handle* next;
+};
+
+/** mode is as in fopen(): r w a with optional +
+    capacity 0 means MCSH_HANDLE_BUFFER_DEFAULT
+    @return NULL on error, check errno
+*/
+mcsh_handle* mcsh_handle_open(const char* filename, const char* mode,
+                              size_t capacity);
+
+/** Read up to and excluding the next newline of any length
+    into string buffer B.
+    @return False on I/O error.  Sets *eof if there was no line.
+*/
+bool mcsh_handle_read_line(mcsh_handle* h, buffer* B, bool* eof);
+
+/** Read up to count bytes into string buffer B,
+    fewer at end of file */
+bool mcsh_handle_read(mcsh_handle* h, size_t count, buffer* B);
+
+/** Read the rest of the file into string buffer B */
+bool mcsh_handle_read_all(mcsh_handle* h, buffer* B);
+
+/** Write count bytes, which may include NUL bytes */
+bool mcsh_handle_write(mcsh_handle* h, const char* data, size_t count);
+
+bool mcsh_handle_flush(mcsh_handle* h);
+
+/** whence is as in lseek(); the new offset goes in *output */
+bool mcsh_handle_seek(mcsh_handle* h, off_t offset, int whence,
+                      off_t* output);
+
+/** Flush and close the file descriptor.  May be called once */
+bool mcsh_handle_close(mcsh_handle* h);
+
+/** Close if needed and release memory */
+void mcsh_handle_free(mcsh_handle* h);
+
+/** Flush all open handles, e.g., before fork() */
+void mcsh_handles_flush_all(void);
@@ -0,0 +1,292 @@
+
+/**
+   ITERATORS C
+*/
+
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "iterators.h"
+#include "util-string.h"
+
+/** Give pages behind the cursor back to the kernel this often */
+static const size_t lines_release = 16*1024*1024;
+
+typedef struct
+{
+  int fd;
+  /// NULL for an empty file
+  char* map;
+  size_t size;
+  /// Start of the next line
+  size_t offset;
+  /// Pages before this offset have been released
+  size_t released;
+} lines_state;
+
+static bool lines_next(mcsh_iterator* it, mcsh_vm* vm,
+                       mcsh_value** output);
+static void lines_free(mcsh_iterator* it);
+
+mcsh_iterator*
+mcsh_iterator_lines(const char* filename)
+{
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return NULL;
+  struct stat s;
+  if (fstat(fd, &s) == -1)
+  {
+    close(fd);
+    return NULL;
+  }
+  char* map = NULL;
+  if (s.st_size > 0)
+  {
+    map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+      int e = errno;
+      close(fd);
+      errno = e;
+      return NULL;
+    }
+    madvise(map, s.st_size, MADV_SEQUENTIAL);
+  }
+
+  lines_state* state = malloc_checked(sizeof(*state));
+  state->fd       = fd;
+  state->map      = map;
+  state->size     = s.st_size;
+  state->offset   = 0;
+  state->released = 0;
+
+  mcsh_iterator* it = malloc_checked(sizeof(*it));
+  it->name = strdup_checked((char*) filename);
+  it->next = lines_next;
+  it->free = lines_free;
+  it->data = state;
+  return it;
+}
+
+/** Unmap as soon as the last line is out */
+static void
+lines_close(lines_state* state)
+{
+  if (state->fd == -1) return;
+  if (state->map != NULL)
+    munmap(state->map, state->size);
+  close(state->fd);
+  state->map = NULL;
+  state->fd  = -1;
+}
+
+static bool
+lines_next(mcsh_iterator* it, UNUSED mcsh_vm* vm, mcsh_value** output)
+{
+  lines_state* state = it->data;
+  if (state->fd == -1 || state->offset >= state->size)
+  {
+    lines_close(state);
+    *output = NULL;
+    return true;
+  }
+
+  char* p = state->map + state->offset;
+  size_t available = state->size - state->offset;
+  char* newline = memchr(p, '\n', available);
+  size_t length = (newline != NULL) ? (size_t) (newline - p) : available;
+  // String values must be NUL-terminated, so copy the slice:
+  mcsh_value* result = mcsh_value_new_string_n(p, length);
+  state->offset += (newline != NULL) ? length + 1 : length;
+
+  // Keep the resident size flat for large files:
+  if (state->offset - state->released >= lines_release)
+  {
+    size_t page  = sysconf(_SC_PAGESIZE);
+    size_t count = (state->offset - state->released) & ~(page - 1);
+    madvise(state->map + state->released, count, MADV_DONTNEED);
+    state->released += count;
+  }
+
+  *output = result;
+  return true;
+}
+
+static void
+lines_free(mcsh_iterator* it)
+{
+  lines_state* state = it->data;
+  lines_close(state);
+  free(state);
+}
+
+typedef struct
+{
+  mcsh_vm* vm;
+  mcsh_value* target;
+  char* d;
+  size_t n;
+  /// Start of the next field
+  const char* p;
+  const char* end;
+  /// Splits remaining, negative for unlimited
+  int64_t max;
+} split_state;
+
+static bool split_next(mcsh_iterator* it, mcsh_vm* vm,
+                       mcsh_value** output);
+static void split_free(mcsh_iterator* it);
+
+mcsh_iterator*
+mcsh_iterator_split(mcsh_vm* vm, mcsh_value* target,
+                    const char* d, int64_t max)
+{
+  valgrind_assert(target->type == MCSH_VALUE_STRING);
+  valgrind_assert(d[0] != '\0');
+  split_state* state = malloc_checked(sizeof(*state));
+  state->vm     = vm;
+  state->target = target;
+  state->d      = strdup_checked((char*) d);
+  state->n      = strlen(d);
+  state->p      = target->string;
+  state->end    = target->string + strlen(target->string);
+  state->max    = max;
+  mcsh_value_grab(&vm->logger, target);
+
+  mcsh_iterator* it = malloc_checked(sizeof(*it));
+  it->name = strdup_checked("split");
+  it->next = split_next;
+  it->free = split_free;
+  it->data = state;
+  return it;
+}
+
+static bool
+split_next(mcsh_iterator* it, UNUSED mcsh_vm* vm, mcsh_value** output)
+{
+  split_state* state = it->data;
+  const char* q = NULL;
+  if (state->max != 0)
+    q = string_find(state->p, state->end, state->d, state->n);
+  if (q == NULL)
+  {
+    // The last field, unless it is empty:
+    *output = NULL;
+    if (state->p < state->end)
+      *output = mcsh_value_new_string_n(state->p,
+                                        state->end - state->p);
+    state->p = state->end;
+    return true;
+  }
+  *output = mcsh_value_new_string_n(state->p, q - state->p);
+  state->p = q + state->n;
+  if (state->max > 0) state->max--;
+  return true;
+}
+
+static void
+split_free(mcsh_iterator* it)
+{
+  split_state* state = it->data;
+  mcsh_value_drop(&state->vm->logger, state->target);
+  free(state->d);
+  free(state);
+}
+
+typedef struct
+{
+  mcsh_walk* walk;
+  bool tables;
+} walk_state;
+
+static bool walk_next(mcsh_iterator* it, mcsh_vm* vm,
+                      mcsh_value** output);
+static void walk_free(mcsh_iterator* it);
+
+mcsh_iterator*
+mcsh_iterator_walk(mcsh_walk* walk, bool tables)
+{
+  walk_state* state = malloc_checked(sizeof(*state));
+  state->walk   = walk;
+  state->tables = tables;
+
+  mcsh_iterator* it = malloc_checked(sizeof(*it));
+  it->name = strdup_checked("walk");
+  it->next = walk_next;
+  it->free = walk_free;
+  it->data = state;
+  return it;
+}
+
+static const char*
+walk_type(unsigned char type)
+{
+  switch (type)
+  {
+    case DT_REG: return "file";
+    case DT_DIR: return "dir";
+    case DT_LNK: return "link";
+    default:     return "other";
+  }
+}
+
+static void
+walk_put(mcsh_vm* vm, mcsh_value* T, const char* key, mcsh_value* v)
+{
+  mcsh_value_grab(&vm->logger, v);
+  table_add(T->table, key, v);
+}
+
+static bool
+walk_next(mcsh_iterator* it, mcsh_vm* vm, mcsh_value** output)
+{
+  walk_state* state = it->data;
+  mcsh_walk_entry entry;
+  if (! mcsh_walk_next(state->walk, &entry))
+  {
+    *output = NULL;
+    return true;
+  }
+  // The value takes the path:
+  mcsh_value* path = mcsh_value_new_string_take(entry.path);
+  if (! state->tables)
+  {
+    *output = path;
+    return true;
+  }
+
+  struct stat* s = &entry.st;
+  mcsh_value* result = mcsh_value_new_table(vm, 8);
+  walk_put(vm, result, "path", path);
+  walk_put(vm, result, "type",
+           mcsh_value_new_string(vm, walk_type(entry.type)));
+  walk_put(vm, result, "size", mcsh_value_new_int(s->st_size));
+  walk_put(vm, result, "mtime",
+           mcsh_value_new_float(s->st_mtim.tv_sec +
+                                s->st_mtim.tv_nsec / 1e9));
+  walk_put(vm, result, "mode",
+           mcsh_value_new_int(s->st_mode & 07777));
+  *output = result;
+  return true;
+}
+
+static void
+walk_free(mcsh_iterator* it)
+{
+  walk_state* state = it->data;
+  mcsh_walk_free(state->walk);
+  free(state);
+}
+
+void
+mcsh_iterator_free_all(mcsh_iterator* it)
+{
+  it->free(it);
+  free(it->name);
+  free(it);
+}
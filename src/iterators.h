@@ -0,0 +1,49 @@
+
+/**
+   ITERATORS H
+   Lazy sequences: the data behind MCSH_VALUE_ITERATOR
+*/
+
+#pragma once
+
+#include "mcsh.h"
+#include "mcsh-walk.h"
+
+/** Produce the next value in *output, or NULL when exhausted.
+    @return False on error, check errno */
+typedef bool (*mcsh_iterator_next)(mcsh_iterator* it, mcsh_vm* vm,
+                                   mcsh_value** output);
+
+typedef void (*mcsh_iterator_free)(mcsh_iterator* it);
+
+struct mcsh_iterator_s
+{
+  /// For messages
+  char* name;
+  mcsh_iterator_next next;
+  mcsh_iterator_free free;
+  void* data;
+};
+
+/** Iterate over the lines of a file via mmap()
+    @return NULL on error, check errno
+*/
+mcsh_iterator* mcsh_iterator_lines(const char* filename);
+
+/** Iterate over the fields of string value target separated by
+    delimiter d, which may be any non-empty string.
+    Stops splitting after max splits if max >= 0.
+    As in split, a trailing empty field is dropped.
+    Holds a reference on target
+*/
+mcsh_iterator* mcsh_iterator_split(mcsh_vm* vm, mcsh_value* target,
+                                   const char* d, int64_t max);
+
+/** Iterate over the paths from walk, in no particular order.
+    If tables, each item is a table of path, type, size,
+    mtime, and mode, and walk must have been started with stat.
+    Takes walk
+*/
+mcsh_iterator* mcsh_iterator_walk(mcsh_walk* walk, bool tables);
+
+void mcsh_iterator_free_all(mcsh_iterator* it);
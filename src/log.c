@@ -1,16 +1,41 @@
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "buffer.h"
 #include "log.h"
 #include "strlcpyj.h"
 #include "util.h"
 
-static bool enabled = false;
+bool mcsh_log_enabled = false;
 static const int buffer_size = 100 * 1024;
 static bool flush = true;
 
+/**
+   The asynchronous sink: messages are appended to pending
+   and a thread writes them in chunks
+*/
+static struct
+{
+  bool running;
+  bool stopping;
+  FILE* stream;
+  buffer pending;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+} sink = { .running = false,
+           .mutex = PTHREAD_MUTEX_INITIALIZER,
+           .cond  = PTHREAD_COND_INITIALIZER };
+
+/** Wake the writer when this much is pending */
+static const size_t sink_chunk = 64 * 1024;
+
+static void sink_start(FILE* stream);
+
 static void init_entries(mcsh_logger* logger);
 
 bool
@@ -28,14 +53,21 @@ mcsh_log_init(mcsh_logger* logger, pid_t pid, mcsh_log_lvl lvl)
   bool b = false;
   bool rc = getenv_boolean("MCSH_LOG", b, &b);
   if (! rc) return false;
-  mcsh_log_enable(b);
+  // Only the first init writes this: later VMs may be in threads
+  if (b != mcsh_log_enabled) mcsh_log_enable(b);
+  if (! b) return true;
+
+  bool async = false;
+  rc = getenv_boolean("MCSH_LOG_ASYNC", async, &async);
+  if (! rc) return false;
+  if (async) sink_start(logger->stream);
   return true;
 }
 
 void
 mcsh_log_enable(bool b)
 {
-  enabled = b;
+  mcsh_log_enabled = b;
 }
 
 struct log_setting
@@ -92,35 +124,39 @@ mcsh_log_entry_set(mcsh_logger* logger, mcsh_logcat cat,
   strcpy(logger->entry[cat].label, label);
 }
 
-static bool log_check(mcsh_log_entry* entry,
-                      mcsh_log_lvl lvl_default,
-                      mcsh_log_lvl lvl_message);
-
 bool
 mcsh_log_check(mcsh_logger* logger, mcsh_logcat cat,
                mcsh_log_lvl lvl)
 {
-  // Silently allow NULL loggers:
-  if (logger == NULL) return false;
+  return mcsh_log_compiled(cat) && mcsh_log_wants(logger, cat, lvl);
+}
 
-  mcsh_log_entry* entry = &logger->entry[cat];
-  bool result = log_check(entry, logger->lvl, lvl);
-  return result;
+/** The time string changes once per second: reuse it */
+static size_t
+time_string_cached(char* s)
+{
+  static _Thread_local time_t last = 0;
+  static _Thread_local char text[64];
+  static _Thread_local size_t length = 0;
+  time_t t = time(NULL);
+  if (t != last)
+  {
+    length = time_string(text);
+    last = t;
+  }
+  memcpy(s, text, length+1);
+  return length;
 }
 
+static void sink_put(const char* text, size_t length);
+
 void
-mcsh_log(mcsh_logger* logger, mcsh_logcat cat,
-         mcsh_log_lvl lvl, char* format, ...)
+mcsh_log_write(mcsh_logger* logger, mcsh_logcat cat,
+               mcsh_log_lvl lvl, const char* format, ...)
 {
-  // Silently allow NULL loggers:
-  if (logger == NULL) return;
-
   // Look up the log category entry:
   mcsh_log_entry* entry = &logger->entry[cat];
 
-  // First, check if we are really going to write this log message:
-  if (! log_check(entry, logger->lvl, lvl)) return;
-
   // Make a label with the log label and a colon:
   const int label_size = 16;
   char label[label_size];
@@ -135,7 +171,7 @@ mcsh_log(mcsh_logger* logger, mcsh_logcat cat,
 
   if (logger->show_pid) appendf(p, "%7i ", logger->pid);
 
-  n = time_string(p);
+  n = time_string_cached(p);
   p += n;
   appendf(p, " %-8s ", label);
   // User message:
@@ -143,41 +179,121 @@ mcsh_log(mcsh_logger* logger, mcsh_logcat cat,
   va_start(ap, format);
   appendv(p, format, ap);
   va_end(ap);
+  appendf(p, "\n");
 
   // Write the buffer:
-  fprintf(logger->stream, "%s\n", buffer);
+  if (sink.running)
+  {
+    sink_put(buffer, p - buffer);
+    return;
+  }
+  fputs(buffer, logger->stream);
   if (flush) fflush(logger->stream);
 }
 
-static bool
-log_check(mcsh_log_entry* entry,
-          mcsh_log_lvl lvl_default, mcsh_log_lvl lvl_message)
+static void*
+sink_loop(UNUSED void* arg)
 {
-  if (!enabled) return false;
-
-  mcsh_log_lvl threshold = MCSH_ZERO;
-  switch (entry->state)
+  buffer out;
+  buffer_init(&out, sink_chunk);
+  pthread_mutex_lock(&sink.mutex);
+  while (true)
   {
-    case MCSH_LOG_OFF:
-      return false;
-    case MCSH_LOG_ON:
-      threshold = entry->lvl;
-      break;
-    case MCSH_LOG_DEFAULT:
-      threshold = lvl_default;
-      break;
-    default:
-      valgrind_fail_msg("Unknown log state: %i", lvl_message);
+    while (sink.pending.length == 0 && ! sink.stopping)
+    {
+      // Write at least every 100ms:
+      struct timespec t;
+      clock_gettime(CLOCK_REALTIME, &t);
+      t.tv_nsec += 100 * 1000 * 1000;
+      if (t.tv_nsec >= 1000000000)
+      {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&sink.cond, &sink.mutex, &t);
+    }
+    if (sink.pending.length == 0) break;  // stopping
+    // Swap so that writers do not wait for the write:
+    buffer tmp  = sink.pending;
+    sink.pending = out;
+    out = tmp;
+    pthread_mutex_unlock(&sink.mutex);
+    fwrite(out.data, 1, out.length, sink.stream);
+    fflush(sink.stream);
+    out.length = 0;
+    pthread_mutex_lock(&sink.mutex);
   }
-  if (lvl_message < threshold)
-    return false;
+  pthread_mutex_unlock(&sink.mutex);
+  buffer_finalize(&out);
+  return NULL;
+}
 
-  // Message lvl exceeds relevant threshold:
-  return true;
+static void
+sink_put(const char* text, size_t length)
+{
+  pthread_mutex_lock(&sink.mutex);
+  buffer_put(&sink.pending, text, length);
+  if (sink.pending.length >= sink_chunk)
+    pthread_cond_signal(&sink.cond);
+  pthread_mutex_unlock(&sink.mutex);
+}
+
+static void
+sink_stop(void)
+{
+  if (! sink.running) return;
+  pthread_mutex_lock(&sink.mutex);
+  sink.stopping = true;
+  pthread_cond_signal(&sink.cond);
+  pthread_mutex_unlock(&sink.mutex);
+  pthread_join(sink.thread, NULL);
+  sink.running = false;
+  buffer_finalize(&sink.pending);
+}
+
+static void
+sink_fork_prepare(void)
+{
+  pthread_mutex_lock(&sink.mutex);
+}
+
+static void
+sink_fork_parent(void)
+{
+  pthread_mutex_unlock(&sink.mutex);
+}
+
+/** The child has no writer thread: write directly,
+    and leave the pending messages to the parent */
+static void
+sink_fork_child(void)
+{
+  sink.running = false;
+  sink.pending.length = 0;
+  pthread_mutex_unlock(&sink.mutex);
+}
+
+static void
+sink_start(FILE* stream)
+{
+  if (sink.running) return;
+  sink.stream   = stream;
+  sink.stopping = false;
+  buffer_init(&sink.pending, sink_chunk);
+  int rc = thread_create_noprof(&sink.thread, sink_loop, NULL);
+  if (rc != 0) return;  // Write directly
+  sink.running = true;
+  static bool registered = false;
+  if (registered) return;
+  registered = true;
+  pthread_atfork(sink_fork_prepare, sink_fork_parent,
+                 sink_fork_child);
+  atexit(sink_stop);
 }
 
 void
 mcsh_log_finalize(UNUSED mcsh_logger* logger)
 {
+  sink_stop();
   fflush(stdout);
 }
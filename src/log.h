@@ -7,6 +7,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "config.h"
+
 /**
    Number of logging categories, including LOG_NULL
    Make sure this agrees with enum mcsh_logcat
@@ -83,11 +85,57 @@ typedef struct
   pid_t pid;
 } mcsh_logger;
 
+/**
+   Bit N is set if category N is compiled in:
+   set by configure --with-log-categories
+*/
+#ifndef MCSH_LOG_MASK
+#define MCSH_LOG_MASK 0x7FF
+#endif
+
+#define mcsh_log_compiled(cat) ((MCSH_LOG_MASK >> (cat)) & 1)
+
+/** Set by MCSH_LOG or mcsh_log_enable() */
+extern bool mcsh_log_enabled;
+
+/** True if this message would be written */
+static inline bool
+mcsh_log_wants(const mcsh_logger* logger, mcsh_logcat cat,
+               mcsh_log_lvl lvl)
+{
+  if (__builtin_expect(! mcsh_log_enabled, 1)) return false;
+  // Silently allow NULL loggers:
+  if (logger == NULL) return false;
+  const mcsh_log_entry* entry = &logger->entry[cat];
+  switch (entry->state)
+  {
+    case MCSH_LOG_OFF:
+      return false;
+    case MCSH_LOG_ON:
+      return lvl >= entry->lvl;
+    default:
+      return lvl >= logger->lvl;
+  }
+}
+
+/**
+   The arguments are not evaluated unless the message is written,
+   and not compiled at all if the category is compiled out
+*/
+#define mcsh_log(logger, cat, lvl, format...)                 \
+  do {                                                        \
+    if (mcsh_log_compiled(cat) &&                             \
+        mcsh_log_wants(logger, cat, lvl))                     \
+      mcsh_log_write(logger, cat, lvl, ##format);             \
+  } while (0)
+
 #define LOG(cat, lvl, format...)          \
   do {                                    \
     mcsh_log(logger, cat, lvl, ##format); \
   } while (0);
 
+/** Also reads MCSH_LOG, and MCSH_LOG_ASYNC:
+    if set, messages are buffered and written by a thread */
 bool mcsh_log_init(mcsh_logger* logger, pid_t pid, mcsh_log_lvl lvl);
 
 void mcsh_log_enable(bool b);
@@ -99,7 +147,10 @@ void mcsh_log_entry_set(mcsh_logger* logger, mcsh_logcat cat,
 bool mcsh_log_check(mcsh_logger* logger, mcsh_logcat cat,
                     mcsh_log_lvl lvl);
 
-void mcsh_log(mcsh_logger* logger, mcsh_logcat cat,
-              mcsh_log_lvl lvl, char* format, ...);
+/** Write unconditionally: normally use mcsh_log() */
+void mcsh_log_write(mcsh_logger* logger, mcsh_logcat cat,
+                    mcsh_log_lvl lvl, const char* format, ...)
+  __attribute__((format(printf, 4, 5)));
 
+/** Write any buffered messages and stop the writer thread */
 void mcsh_log_finalize(mcsh_logger* logger);
@@ -0,0 +1,405 @@
+
+/**
+   MCSH CACHE C
+   Entry file format, in host byte order:
+   HEADER: magic, uint32 version, uint32 byte order mark,
+           source path string, int64 mtime sec, int64 mtime nsec,
+           int64 size, uint64 text hash, uint8 lazy bodies
+   STMTS:  uint64 count, count STMT
+   STMT:   int64 line, uint64 count, count THING
+   THING:  uint8 type, then:
+           TOKEN:  string
+           BLOCK:  int64 line, int64 lazy offset or -1, then:
+                   lazy:   int64 length
+                   else:   STMTS
+           SUBCMD: STMTS
+           SUBFUN: STMTS
+   Strings are packed as in mcsh-pack
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mcsh-cache.h"
+#include "mcsh-pack.h"
+#include "jenkins-hash.h"
+
+static const char     cache_magic[8] = "MCSHPARS";
+static const uint32_t cache_version  = 4;
+static const uint32_t cache_order    = 0x01020304;
+
+bool
+mcsh_cache_hash_file(int fd, uint64_t* output)
+{
+  struct stat s;
+  if (fstat(fd, &s) == -1) return false;
+  const char* map = "";
+  if (s.st_size > 0)
+  {
+    map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return false;
+  }
+  uint32_t c = 0, b = 0;
+  bj_hashlittle2(map, s.st_size, &c, &b);
+  if (s.st_size > 0) munmap((void*) map, s.st_size);
+  *output = ((uint64_t) b << 32) | c;
+  return true;
+}
+
+/** Find the cache directory, creating it if needed.
+    MCSH_CACHE is the directory, or 1 for the default:
+    $XDG_CACHE_HOME/mcsh or $HOME/.cache/mcsh
+    @return False if caching is disabled or unavailable */
+static bool
+cache_dir(char* output)
+{
+  char* s = getenv("MCSH_CACHE");
+  if (s == NULL || strlen(s) == 0 || strcmp(s, "0") == 0)
+    return false;
+  if (strcmp(s, "1") != 0)
+  {
+    if (strlen(s) >= PATH_MAX) return false;
+    strcpy(output, s);
+  }
+  else
+  {
+    char* xdg  = getenv("XDG_CACHE_HOME");
+    char* home = getenv("HOME");
+    int n;
+    if (xdg != NULL && xdg[0] == '/')
+      n = snprintf(output, PATH_MAX, "%s", xdg);
+    else if (home != NULL)
+      n = snprintf(output, PATH_MAX, "%s/.cache", home);
+    else
+      return false;
+    if (n >= PATH_MAX - 6) return false;
+    // Failures show up in the mkdir() below:
+    mkdir(output, 0700);
+    strcat(output, "/mcsh");
+  }
+  // Best effort: without the directory, nothing is cached
+  if (mkdir(output, 0755) == -1 && errno != EEXIST) return false;
+  return true;
+}
+
+/** Resolve source to the entry filename and the file key.
+    @return False if source is not a regular file */
+static bool
+cache_entry(const char* source, char* realname, char* entry,
+            struct stat* s)
+{
+  if (realpath(source, realname) == NULL) return false;
+  if (stat(realname, s) == -1 || ! S_ISREG(s->st_mode)) return false;
+  char dir[PATH_MAX];
+  if (! cache_dir(dir)) return false;
+  uint32_t c = 0, b = 0;
+  bj_hashlittle2(realname, strlen(realname), &c, &b);
+  int n = snprintf(entry, PATH_MAX, "%s/%08x%08x.mcc", dir, b, c);
+  return n < PATH_MAX;
+}
+
+static void
+pack_header(buffer* B, const char* realname, struct stat* s,
+            uint64_t hash, bool lazy)
+{
+  buffer_put(B, cache_magic,    sizeof(cache_magic));
+  buffer_put(B, &cache_version, sizeof(cache_version));
+  buffer_put(B, &cache_order,   sizeof(cache_order));
+  mcsh_pack_string(B, realname);
+  mcsh_pack_int(B, s->st_mtim.tv_sec);
+  mcsh_pack_int(B, s->st_mtim.tv_nsec);
+  mcsh_pack_int(B, s->st_size);
+  buffer_put(B, &hash, sizeof(hash));
+  uint8_t l = lazy;
+  buffer_put(B, &l, 1);
+}
+
+static void pack_stmts(buffer* B, mcsh_stmts* stmts, bool load);
+
+/** If load, lazy bodies are loaded and packed */
+static void
+pack_thing(buffer* B, mcsh_thing* thing, bool load)
+{
+  uint8_t t = (uint8_t) thing->type;
+  buffer_put(B, &t, 1);
+  switch (thing->type)
+  {
+    case MCSH_THING_TOKEN:
+      mcsh_pack_string(B, thing->data.token->text);
+      break;
+    case MCSH_THING_BLOCK:
+    {
+      mcsh_block* block = thing->data.block;
+      mcsh_pack_int(B, block->line);
+      if (load) mcsh_block_load(block);
+      if (block->lazy != NULL)
+      {
+        mcsh_pack_int(B, block->lazy->offset);
+        mcsh_pack_int(B, block->lazy->length);
+      }
+      else
+      {
+        mcsh_pack_int(B, -1);
+        pack_stmts(B, &block->stmts, load);
+      }
+      break;
+    }
+    case MCSH_THING_SUBCMD:
+      pack_stmts(B, &thing->data.subcmd->stmts, load);
+      break;
+    case MCSH_THING_SUBFUN:
+      pack_stmts(B, &thing->data.subfun->stmts, load);
+      break;
+    default:
+      valgrind_fail_msg("cache: bad thing type: %i", thing->type);
+  }
+}
+
+static void
+pack_stmts(buffer* B, mcsh_stmts* stmts, bool load)
+{
+  mcsh_pack_size(B, stmts->stmts.size);
+  for (size_t i = 0; i < stmts->stmts.size; i++)
+  {
+    mcsh_stmt* stmt = stmts->stmts.data[i];
+    mcsh_pack_int(B, stmt->line);
+    mcsh_pack_size(B, stmt->things.size);
+    for (size_t j = 0; j < stmt->things.size; j++)
+      pack_thing(B, stmt->things.data[j], load);
+  }
+}
+
+void
+mcsh_cache_store(mcsh_module* module, const char* source,
+                 uint64_t hash, mcsh_stmts* stmts)
+{
+  char realname[PATH_MAX], entry[PATH_MAX], tmp[PATH_MAX+32];
+  struct stat s;
+  if (! cache_entry(source, realname, entry, &s)) return;
+
+  buffer B;
+  buffer_init(&B, 4096);
+  pack_header(&B, realname, &s, hash, module->vm->lazy_bodies);
+  pack_stmts(&B, stmts, false);
+
+  // Write then rename so concurrent readers never see a partial entry
+  snprintf(tmp, sizeof(tmp), "%s.%i.tmp", entry, getpid());
+  bool ok = false;
+  FILE* fp = fopen(tmp, "w");
+  if (fp != NULL)
+  {
+    ok = (fwrite(B.data, 1, B.length, fp) == B.length);
+    if (fclose(fp) != 0) ok = false;
+    if (ok) ok = (rename(tmp, entry) == 0);
+    if (! ok) unlink(tmp);
+  }
+  mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_INFO,
+           "cache store: %s -> %s: %s", realname, entry,
+           ok ? "ok" : strerror(errno));
+  buffer_finalize(&B);
+}
+
+static bool
+unpack_header(const char** p, const char* end, const char* realname,
+              struct stat* s, uint64_t hash, bool lazy)
+{
+  char magic[sizeof(cache_magic)];
+  uint32_t version, order;
+  char* name;
+  int64_t sec, nsec, size;
+  uint64_t h;
+  uint8_t l;
+  if (! mcsh_unpack_bytes(p, end, magic,    sizeof(magic))   ||
+      ! mcsh_unpack_bytes(p, end, &version, sizeof(version)) ||
+      ! mcsh_unpack_bytes(p, end, &order,   sizeof(order)))
+    return false;
+  if (memcmp(magic, cache_magic, sizeof(magic)) != 0 ||
+      version != cache_version || order != cache_order)
+    return false;
+  if (! mcsh_unpack_string(p, end, &name)) return false;
+  bool same = (strcmp(name, realname) == 0);
+  free(name);
+  if (! same) return false;
+  if (! mcsh_unpack_int(p, end, &sec)  ||
+      ! mcsh_unpack_int(p, end, &nsec) ||
+      ! mcsh_unpack_int(p, end, &size) ||
+      ! mcsh_unpack_bytes(p, end, &h, sizeof(h)) ||
+      ! mcsh_unpack_bytes(p, end, &l, 1))
+    return false;
+  // An eager parse must not reuse lazy bodies, or lose its checks:
+  return sec  == s->st_mtim.tv_sec  &&
+         nsec == s->st_mtim.tv_nsec &&
+         size == s->st_size         &&
+         h    == hash               &&
+         l    == lazy;
+}
+
+static bool unpack_stmts(mcsh_module* module, const char** p,
+                         const char* end, mcsh_stmts* stmts);
+
+/** Mirrors the mcsh_thing_construct_*() functions in mcsh.c */
+static bool
+unpack_thing(mcsh_module* module, const char** p, const char* end,
+             mcsh_thing** output)
+{
+  uint8_t type;
+  int64_t line, offset, length;
+  if (! mcsh_unpack_bytes(p, end, &type, 1)) return false;
+  mcsh_thing* thing = malloc_checked(sizeof(mcsh_thing));
+  thing->type   = type;
+  thing->parent = NULL;
+  thing->module = module;
+  switch (type)
+  {
+    case MCSH_THING_TOKEN:
+    {
+      char* text;
+      if (! mcsh_unpack_string(p, end, &text))
+      {
+        free(thing);
+        return false;
+      }
+      thing->data.token = malloc_checked(sizeof(mcsh_token));
+      mcsh_token_init(thing->data.token, text);
+      break;
+    }
+    case MCSH_THING_BLOCK:
+      thing->data.block = malloc_checked(sizeof(mcsh_block));
+      thing->data.block->id = mcsh_parse_id();
+      list_array_init(&thing->data.block->stmts.stmts, 2);
+      thing->data.block->lazy = NULL;
+      thing->data.block->captured = false;
+      if (! mcsh_unpack_int(p, end, &line) ||
+          ! mcsh_unpack_int(p, end, &offset))
+        goto fail;
+      thing->data.block->line = line;
+      if (offset >= 0)
+      {
+        if (! mcsh_unpack_int(p, end, &length))
+          goto fail;
+        mcsh_lazy* lazy = malloc_checked(sizeof(*lazy));
+        lazy->module = module;
+        lazy->offset = offset;
+        lazy->length = length;
+        lazy->line   = line;
+        thing->data.block->lazy = lazy;
+        module->lazy++;
+      }
+      else if (! unpack_stmts(module, p, end,
+                              &thing->data.block->stmts))
+        goto fail;
+      break;
+    case MCSH_THING_SUBCMD:
+      thing->data.subcmd = malloc_checked(sizeof(mcsh_subcmd));
+      list_array_init(&thing->data.subcmd->stmts.stmts, 2);
+      if (! unpack_stmts(module, p, end, &thing->data.subcmd->stmts))
+        goto fail;
+      break;
+    case MCSH_THING_SUBFUN:
+      thing->data.subfun = malloc_checked(sizeof(mcsh_subfun));
+      list_array_init(&thing->data.subfun->stmts.stmts, 2);
+      if (! unpack_stmts(module, p, end, &thing->data.subfun->stmts))
+        goto fail;
+      break;
+    default:
+      free(thing);
+      return false;
+  }
+  *output = thing;
+  return true;
+
+  fail:
+  // Partial contents are released by the thing owner
+  *output = thing;
+  return false;
+}
+
+static bool
+unpack_stmts(mcsh_module* module, const char** p, const char* end,
+             mcsh_stmts* stmts)
+{
+  uint64_t n, m;
+  int64_t line;
+  if (! mcsh_unpack_bytes(p, end, &n, sizeof(n))) return false;
+  for (uint64_t i = 0; i < n; i++)
+  {
+    if (! mcsh_unpack_int(p, end, &line) ||
+        ! mcsh_unpack_bytes(p, end, &m, sizeof(m)))
+      return false;
+    mcsh_stmt* stmt = malloc_checked(sizeof(mcsh_stmt));
+    list_array_init(&stmt->things, m > 0 ? m : 1);
+    stmt->module = module;
+    stmt->parent = NULL;
+    stmt->line   = line;
+    list_array_add(&stmts->stmts, stmt);
+    for (uint64_t j = 0; j < m; j++)
+    {
+      mcsh_thing* thing = NULL;
+      bool ok = unpack_thing(module, p, end, &thing);
+      if (thing != NULL) list_array_add(&stmt->things, thing);
+      if (! ok) return false;
+    }
+  }
+  return true;
+}
+
+bool
+mcsh_cache_load(mcsh_module* module, const char* source,
+                uint64_t hash, mcsh_stmts* stmts)
+{
+  valgrind_assert(stmts->stmts.size == 0);
+  char realname[PATH_MAX], entry[PATH_MAX];
+  struct stat s, e;
+  if (! cache_entry(source, realname, entry, &s)) return false;
+
+  int fd = open(entry, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return false;
+  bool result = false;
+  if (fstat(fd, &e) == -1 || e.st_size == 0) goto done;
+  char* map = mmap(NULL, e.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) goto done;
+
+  const char* p   = map;
+  const char* end = map + e.st_size;
+  if (unpack_header(&p, end, realname, &s, hash,
+                    module->vm->lazy_bodies))
+  {
+    result = unpack_stmts(module, &p, end, stmts) && p == end;
+    if (! result)
+    {
+      mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_WARN,
+               "cache: corrupt entry: %s", entry);
+      mcsh_stmts_finalize(module, stmts);
+      list_array_init(&stmts->stmts, 8);
+      module->lazy = 0;
+    }
+  }
+  munmap(map, e.st_size);
+
+  done:
+  close(fd);
+  mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_INFO,
+           "cache load: %s: %s", realname, result ? "hit" : "miss");
+  return result;
+}
+
+void
+mcsh_cache_pack(mcsh_stmts* stmts, buffer* B)
+{
+  pack_stmts(B, stmts, true);
+}
+
+bool
+mcsh_cache_unpack(mcsh_module* module, buffer* B, mcsh_stmts* stmts)
+{
+  const char* p   = B->data;
+  const char* end = B->data + B->length;
+  return unpack_stmts(module, &p, end, stmts) && p == end;
+}
@@ -0,0 +1,37 @@
+
+/**
+   MCSH CACHE H
+   On-disk cache of parsed modules, keyed by path, mtime, size,
+   and a hash of the text.
+   Off unless MCSH_CACHE is set: to the cache directory,
+   or to 1 for $XDG_CACHE_HOME/mcsh or $HOME/.cache/mcsh
+*/
+
+#pragma once
+
+#include "mcsh.h"
+
+/** Hash the text of the open regular file fd via mmap(),
+    without moving its offset.
+    @return False on error */
+bool mcsh_cache_hash_file(int fd, uint64_t* output);
+
+/** Fill empty stmts from the cache entry for file source
+    if it is fresh.
+    @return False on any miss: the caller should parse
+*/
+bool mcsh_cache_load(mcsh_module* module, const char* source,
+                     uint64_t hash, mcsh_stmts* stmts);
+
+/** Best effort: errors are logged and ignored */
+void mcsh_cache_store(mcsh_module* module, const char* source,
+                      uint64_t hash, mcsh_stmts* stmts);
+
+/** Append stmts to B in the entry format, with lazy bodies loaded,
+    to copy them to another VM with mcsh_cache_unpack() */
+void mcsh_cache_pack(mcsh_stmts* stmts, buffer* B);
+
+/** Fill empty stmts for module from mcsh_cache_pack() output.
+    @return False if B is corrupt */
+bool mcsh_cache_unpack(mcsh_module* module, buffer* B,
+                       mcsh_stmts* stmts);
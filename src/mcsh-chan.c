@@ -0,0 +1,258 @@
+
+/**
+   MCSH CHAN C
+*/
+
+#define _GNU_SOURCE  // for pipe2()
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mcsh-chan.h"
+#include "util.h"
+
+/** Channel IDs are unique in the process */
+static int64_t chan_ids = 0;
+
+static void
+locks_init(mcsh_chan_locks* locks)
+{
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  // pforeach and kill may end a process that holds a lock:
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&locks->send, &attr);
+  pthread_mutex_init(&locks->recv, &attr);
+  pthread_mutexattr_destroy(&attr);
+  locks->broken = false;
+}
+
+static inline void
+chan_break(mcsh_chan* chan)
+{
+  __atomic_store_n(&chan->locks->broken, true, __ATOMIC_RELEASE);
+}
+
+/** Handle the result rc of locking m: a lock whose holder died
+    breaks the channel.
+    @return True if m is held and the channel is usable,
+            else m is not held and errno is set */
+static bool
+chan_locked(mcsh_chan* chan, pthread_mutex_t* m, int rc)
+{
+  if (rc == EOWNERDEAD)
+  {
+    // Leave m unrecoverable: later lockers get ENOTRECOVERABLE
+    chan_break(chan);
+    pthread_mutex_unlock(m);
+  }
+  else if (rc != 0)
+    chan_break(chan);
+  else if (__atomic_load_n(&chan->locks->broken, __ATOMIC_ACQUIRE))
+    pthread_mutex_unlock(m);
+  else
+    return true;
+  errno = EOWNERDEAD;
+  return false;
+}
+
+mcsh_chan*
+mcsh_chan_create()
+{
+  int fd[2];
+  // External commands do not get the channel:
+  if (pipe2(fd, O_CLOEXEC) == -1) return NULL;
+  mcsh_chan_locks* locks = mmap(NULL, sizeof(*locks),
+                                PROT_READ|PROT_WRITE,
+                                MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (locks == MAP_FAILED)
+  {
+    int e = errno;
+    close(fd[0]);
+    close(fd[1]);
+    errno = e;
+    return NULL;
+  }
+  locks_init(locks);
+  mcsh_chan* result = malloc_checked(sizeof(*result));
+  result->id    = __atomic_add_fetch(&chan_ids, 1, __ATOMIC_RELAXED);
+  result->fd[0] = fd[0];
+  result->fd[1] = fd[1];
+  result->refs  = 1;
+  result->locks = locks;
+  return result;
+}
+
+void
+mcsh_chan_ref(mcsh_chan* chan)
+{
+  __atomic_add_fetch(&chan->refs, 1, __ATOMIC_RELAXED);
+}
+
+void
+mcsh_chan_unref(mcsh_chan* chan)
+{
+  if (__atomic_sub_fetch(&chan->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+  close(chan->fd[0]);
+  close(chan->fd[1]);
+  munmap(chan->locks, sizeof(*chan->locks));
+  free(chan);
+}
+
+static bool
+write_full(int fd, const void* data, size_t count)
+{
+  const char* p = data;
+  while (count > 0)
+  {
+    ssize_t n = write(fd, p, count);
+    if (n == -1)
+    {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p     += n;
+    count -= n;
+  }
+  return true;
+}
+
+static bool
+read_full(int fd, void* output, size_t count)
+{
+  char* p = output;
+  while (count > 0)
+  {
+    ssize_t n = read(fd, p, count);
+    if (n == -1)
+    {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (n == 0)
+    {
+      // We hold the write end, so this is not expected:
+      errno = EPIPE;
+      return false;
+    }
+    p     += n;
+    count -= n;
+  }
+  return true;
+}
+
+bool
+mcsh_chan_send(mcsh_chan* chan, const char* data, size_t count)
+{
+  if (count > MCSH_CHAN_FRAME_MAX)
+  {
+    errno = EMSGSIZE;
+    return false;
+  }
+  uint32_t length = count;
+  pthread_mutex_t* m = &chan->locks->send;
+  if (! chan_locked(chan, m, pthread_mutex_lock(m)))
+    return false;
+  bool rc = write_full(chan->fd[1], &length, sizeof(length)) &&
+            write_full(chan->fd[1], data, count);
+  pthread_mutex_unlock(&chan->locks->send);
+  return rc;
+}
+
+/** Read one frame: the caller holds the recv lock */
+static bool
+frame_read(mcsh_chan* chan, buffer* B)
+{
+  uint32_t length;
+  if (! read_full(chan->fd[0], &length, sizeof(length)))
+    return false;
+  if (length > MCSH_CHAN_FRAME_MAX)
+  {
+    // The pipe is out of step with the frames:
+    chan_break(chan);
+    errno = EBADMSG;
+    return false;
+  }
+  // The sender holds its lock until the whole frame is written:
+  size_t start = B->length;
+  check_size(B, length);
+  if (! read_full(chan->fd[0], B->data + start, length))
+    return false;
+  B->length = start + length;
+  return true;
+}
+
+static double
+now_seconds()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double) t.tv_sec + (double) t.tv_nsec / 1e9;
+}
+
+/** Milliseconds left for poll(), or -1 for no deadline */
+static int
+remaining(double deadline)
+{
+  if (deadline < 0) return -1;
+  double left = deadline - now_seconds();
+  if (left <= 0) return 0;
+  return (int) (left * 1000) + 1;
+}
+
+bool
+mcsh_chan_recv(mcsh_chan** chans, int count, double timeout,
+               buffer* B, int* index)
+{
+  double deadline = timeout < 0 ? -1 : now_seconds() + timeout;
+  struct pollfd fds[count];
+  for (int i = 0; i < count; i++)
+  {
+    fds[i].fd     = chans[i]->fd[0];
+    fds[i].events = POLLIN;
+  }
+  while (true)
+  {
+    int rc = poll(fds, count, remaining(deadline));
+    if (rc == -1)
+    {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (rc == 0)
+    {
+      *index = -1;
+      return true;
+    }
+    for (int i = 0; i < count; i++)
+    {
+      if (fds[i].revents == 0) continue;
+      mcsh_chan* chan = chans[i];
+      pthread_mutex_t* m = &chan->locks->recv;
+      int lock = pthread_mutex_trylock(m);
+      if (lock == EBUSY) continue;
+      if (! chan_locked(chan, m, lock))
+      {
+        *index = i;
+        return false;
+      }
+      // Another receiver may have taken the frame:
+      struct pollfd one = { .fd = chan->fd[0], .events = POLLIN };
+      bool ready = poll(&one, 1, 0) == 1;
+      bool ok = true;
+      if (ready) ok = frame_read(chan, B);
+      pthread_mutex_unlock(&chan->locks->recv);
+      if (! ready) continue;
+      *index = i;
+      return ok;
+    }
+    // Each ready channel is being read by another receiver:
+    sched_yield();
+  }
+}
@@ -0,0 +1,71 @@
+
+/**
+   MCSH CHAN H
+   Channels: the data behind MCSH_VALUE_CHAN
+   A channel is a pipe carrying frames: a uint32 length then that
+   many bytes, normally one value in the mcsh_pack() format.
+   bg children inherit the pipe and threads share it, so one
+   channel links processes and threads.
+   A frame is written and read whole under the send and recv locks,
+   which are process-shared mutexes in a shared mapping,
+   so any number of senders and receivers may use a channel.
+   A send blocks while the pipe is full.
+   The locks are robust: if a process dies holding one,
+   the channel is broken, since a frame may be torn,
+   and every later send or recv fails with EOWNERDEAD.
+*/
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "buffer.h"
+
+/** Largest frame: a longer length means a torn frame */
+#define MCSH_CHAN_FRAME_MAX (64 * 1024 * 1024)
+
+typedef struct
+{
+  pthread_mutex_t send;
+  pthread_mutex_t recv;
+  /// Set when a holder of a lock died, or a frame was corrupt
+  bool broken;
+} mcsh_chan_locks;
+
+typedef struct mcsh_chan_s mcsh_chan;
+
+struct mcsh_chan_s
+{
+  /// Unique in the process, for messages
+  int64_t id;
+  /// The pipe: 0=read, 1=write
+  int fd[2];
+  /// Values in all VMs of this process that refer to this channel
+  int refs;
+  /// Shared with forked children
+  mcsh_chan_locks* locks;
+};
+
+/** @return NULL on error, check errno */
+mcsh_chan* mcsh_chan_create(void);
+
+/** Add a reference from any thread */
+void mcsh_chan_ref(mcsh_chan* chan);
+
+/** Drop a reference from any thread: the last closes the pipe */
+void mcsh_chan_unref(mcsh_chan* chan);
+
+/** Send one frame of count bytes
+    @return False on I/O error, check errno */
+bool mcsh_chan_send(mcsh_chan* chan, const char* data, size_t count);
+
+/** Receive one frame from the first ready of chans[0,count)
+    into binary buffer B, waiting up to timeout seconds,
+    or forever if timeout is negative.
+    @return False on I/O error, check errno.
+    *index is the channel, or -1 after the timeout */
+bool mcsh_chan_recv(mcsh_chan** chans, int count, double timeout,
+                    buffer* B, int* index);
@@ -5,7 +5,7 @@
 
 #define _GNU_SOURCE  // for strchrnul()
 #include <assert.h>
-#include <glob.h>
+#include <dirent.h>
 #include <regex.h>
 #include <string.h>
 
@@ -13,6 +13,8 @@
 #include "exceptions.h"
 // #include "strlcpy.h"
 #include "mcsh-data.h"
+#include "mcsh-regex.h"
+#include "mcsh-walk.h"
 #include "util.h"
 
 static void data_init_activations(mcsh_vm* vm);
@@ -22,13 +24,14 @@ mcsh_data_init(mcsh_vm* vm)
 {
   vm->data = malloc_checked(sizeof(mcsh_data));
   vm->data->specials = table_create(32);
+  vm->data->regex = mcsh_regex_cache_create(MCSH_REGEX_CACHE_DEFAULT);
   data_init_activations(vm);
 }
 
 static void
 data_init_activations(mcsh_vm* vm)
 {
-  mcsh_activation_init(&vm->logger, vm->data->specials);
+  mcsh_activation_init(vm);
 }
 
 typedef struct
@@ -58,6 +61,9 @@ mcsh_set_value(mcsh_module* module,
       "set_value(): entry=%zi:%zi name='%s'",
       entry->depth, entry->id, name);
   valgrind_assert_msg(entry != NULL, "Stack entry is NULL!");
+  if (value->literal)
+    // Variables may be assigned through links: do not share
+    value = mcsh_value_new_string(module->vm, value->string);
   bool modules_only = false;
   // A prior value:
   void*  old;
@@ -162,8 +168,7 @@ mcsh_drop_variable(mcsh_module* module,
     {
       if (strmap_search_index(&entry->module->vars, name, &index))
       {
-        printf("stack_search(): %zi:%zi found:  '%s'\n",
-               entry->depth, entry->id, name);
+        TRACE(STACK_FOUND, mcsh_trace_str(name), entry->depth);
         goto found;
       }
     }
@@ -223,6 +228,7 @@ mcsh_data_finalize(mcsh_vm* vm)
   // printf("data specials: size: %i\n", table_size(vm->data->specials));
   table_free_callback(vm->data->specials, true,
                       data_value_free, &vm->logger);
+  mcsh_regex_cache_free(vm->data->regex);
   free(vm->data);
 }
 
@@ -298,6 +304,12 @@ typedef struct
   expander_type type;
   /// Text to go with the expander (regex/subst)
   char* text;
+  /// For regex: the substitution within text, or NULL for a test
+  char* subst;
+  /// For regex: replace every match
+  bool global;
+  /// For regex: extra regcomp() flags
+  int cflags;
 } expander;
 
 typedef enum
@@ -309,22 +321,33 @@ typedef enum
   VARIABLE_MODULE = 4
 } variable_type;
 
-typedef struct
+struct mcsh_variable_s
 {
   variable_type type;
   char name[128];
   /// For modules:
   char* subname;
+  /// For $1, $2, ...: the argument index
+  bool is_index;
+  size_t index;
   /// For subscript expansions: e.g., $L[2:3,4]
   bool subscripted;
+  /// The subscript text: it may contain variables,
+  /// so it is parsed into subscript on each evaluation
+  char* spec;
   subscript subscript;
   /// For expansion behavior, e.g., $#s
   expander expander;
-} variable;
+};
+
+typedef struct mcsh_variable_s variable;
 
-static inline bool variable_parse(context* ctx,
-                                  variable* v,
-                                  const char* s);
+static void variable_scan(variable* v, const char* s);
+
+static void variable_finalize(variable* v);
+
+static bool parse_subscript(context* ctx,
+                            subscript* ss, const char* spec);
 
 static bool subscript_eval(context* ctx, variable* v,
                            mcsh_value* value,
@@ -335,7 +358,8 @@ static bool variable_eval(mcsh_entry* entry,
                           mcsh_value** subvalue);
 
 static mcsh_value* expand(mcsh_vm* vm,
-                          variable* v, mcsh_value* value);
+                          variable* v, mcsh_value* value,
+                          mcsh_status* status);
 
 static mcsh_value* expand_test(bool found);
 
@@ -346,6 +370,88 @@ static mcsh_value* activate(context* ctx,
 static bool to_value(context* ctx, const char* token,
                      mcsh_value** output);
 
+static inline bool is_glob(const char* token);
+
+void
+mcsh_token_init(mcsh_token* token, char* text)
+{
+  token->text = text;
+  if (text[0] == '$' && text[1] != '\0')
+  {
+    token->kind     = MCSH_TOKEN_VARIABLE;
+    token->variable = malloc_checked(sizeof(variable));
+    variable_scan(token->variable, &text[1]);
+  }
+  else if (is_glob(text))
+  {
+    token->kind = MCSH_TOKEN_GLOB;
+  }
+  else
+  {
+    token->kind  = MCSH_TOKEN_LITERAL;
+    token->value = mcsh_value_new_string_n(text, strlen(text));
+    token->value->literal = true;
+    // Held by the token:
+    token->value->refs = 1;
+  }
+}
+
+void
+mcsh_token_free(mcsh_logger* logger, mcsh_token* token)
+{
+  switch (token->kind)
+  {
+    case MCSH_TOKEN_LITERAL:
+      // Variables and lists may still hold the value:
+      token->value->literal = false;
+      if (token->value->refs == 0)
+        // Dropped elsewhere while interned
+        mcsh_value_free(logger, token->value);
+      else
+        mcsh_value_drop(logger, token->value);
+      break;
+    case MCSH_TOKEN_VARIABLE:
+      variable_finalize(token->variable);
+      free(token->variable);
+      break;
+    case MCSH_TOKEN_GLOB:
+      break;
+  }
+  free(token->text);
+  free(token);
+}
+
+static bool variable_value(context* ctx, variable* v,
+                           const char* token, mcsh_value** output);
+static bool do_glob(context* ctx, const char* token,
+                    mcsh_value** output);
+
+bool
+mcsh_token_eval(mcsh_logger* logger,
+                mcsh_entry* entry, mcsh_token* token,
+                mcsh_value** output, mcsh_status* status)
+{
+  context ctx;
+  ctx.logger = logger;
+  ctx.entry = entry;
+  ctx.status = status;
+  LOG(MCSH_LOG_DATA, MCSH_INFO, "token_eval: '%s'", token->text);
+  bool rc = true;
+  switch (token->kind)
+  {
+    case MCSH_TOKEN_LITERAL:
+      *output = token->value;
+      break;
+    case MCSH_TOKEN_VARIABLE:
+      rc = variable_value(&ctx, token->variable, token->text, output);
+      break;
+    case MCSH_TOKEN_GLOB:
+      rc = do_glob(&ctx, token->text, output);
+      break;
+  }
+  return rc;
+}
+
 /** External entry point */
 bool
 mcsh_token_to_value(mcsh_logger* logger,
@@ -365,76 +471,20 @@ static bool arg_index(size_t index, context* ctx,
 static bool arg_all(context* ctx,
                     mcsh_value** output);
 
-static inline bool is_glob(const char* token);
-static bool do_glob(context* ctx, const char* token,
-                    mcsh_value** output);
-
 static bool
 to_value(context* ctx, const char* token, mcsh_value** output)
 {
-  mcsh_logger* logger = &ctx->entry->module->vm->logger;
-  mcsh_value* value = NULL;
   bool rc;
   if (token[0] == '$' && token[1] != '\0')
   {
     variable v;
-    variable_parse(ctx, &v, &token[1]);
-    LOG(MCSH_LOG_DATA, MCSH_DEBUG, "name:  '%s' type=%i",
-        v.name, v.type);
-    size_t index;
-    if (is_integer(v.name, &index))
-    {
-      arg_index(index, ctx, &value);
-      PROPAGATE(ctx->status);
-      rc = true;
-    }
-    else if (strcmp(v.name, "*") == 0)
-    {
-      list_array* A = ctx->entry->args;
-      value = mcsh_value_new_int(A->size - 1);
-      rc = true;
-    }
-    else if (strcmp(v.name, "@") == 0)
-    {
-      arg_all(ctx, &value);
-      rc = true;
-    }
-    else
-    {
-      rc = mcsh_stack_search(ctx->entry, v.name, &value);
-    }
-    if (v.expander.type == EXPANDER_TEST &&
-        ! v.subscripted)
-    {
-      value = expand_test(rc);
-      goto end;
-    }
-
-    RAISE_IF(!rc, ctx->status, NULL, 0, "mcsh.undefined",
-             "could not find variable '%s'", v.name);
-
-    value = activate(ctx, v.name, value);
-    // printf("variable found: '%s'\n", v.name);
-    if (v.type != VARIABLE_SCALAR)
-    {
-      mcsh_value* subvalue;
-      rc = variable_eval(ctx->entry, &v, value, &subvalue);
-      CHECK(rc, "could not eval variable: '%s'", token);
-      value = subvalue;
-    }
-    if (v.subscripted)
-    {
-      mcsh_value* t = NULL;
-      rc = subscript_eval(ctx, &v, value, &t);
-      PROPAGATE(ctx->status);
-      value = t;
-    }
-    if (v.expander.type != EXPANDER_NONE)
-      value = expand(ctx->entry->stack->vm, &v, value);
+    variable_scan(&v, &token[1]);
+    rc = variable_value(ctx, &v, token, output);
+    variable_finalize(&v);
   }
   else if (is_glob(token))
   {
-    rc = do_glob(ctx, token, &value);
+    rc = do_glob(ctx, token, output);
     valgrind_assert(rc);
   }
   /*
@@ -447,7 +497,99 @@ to_value(context* ctx, const char* token, mcsh_value** output)
   */
   else
   {
-    value = mcsh_value_new_string(ctx->entry->module->vm, token);
+    *output = mcsh_value_new_string(ctx->entry->module->vm, token);
+    rc = true;
+  }
+  return rc;
+}
+
+static bool variable_lookup(context* ctx, variable* v,
+                            const char* token, mcsh_value** output);
+
+static void subscript_free(subscript* ss);
+
+/** Evaluate v for token, whose text is used in messages */
+static bool
+variable_value(context* ctx, variable* v, const char* token,
+               mcsh_value** output)
+{
+  if (! v->subscripted)
+    return variable_lookup(ctx, v, token, output);
+
+  // Subscripts may contain variables: parse them into a copy
+  variable local = *v;
+  parse_subscript(ctx, &local.subscript, local.spec);
+  bool rc = variable_lookup(ctx, &local, token, output);
+  subscript_free(&local.subscript);
+  return rc;
+}
+
+static bool
+variable_lookup(context* ctx, variable* v, const char* token,
+                mcsh_value** output)
+{
+  mcsh_logger* logger = &ctx->entry->module->vm->logger;
+  mcsh_value* value = NULL;
+  bool rc;
+  LOG(MCSH_LOG_DATA, MCSH_DEBUG, "name:  '%s' type=%i",
+      v->name, v->type);
+  if (v->is_index)
+  {
+    arg_index(v->index, ctx, &value);
+    PROPAGATE(ctx->status);
+    rc = true;
+  }
+  else if (strcmp(v->name, "*") == 0)
+  {
+    list_array* A = ctx->entry->args;
+    value = mcsh_value_new_int(A->size - 1);
+    rc = true;
+  }
+  else if (strcmp(v->name, "@") == 0)
+  {
+    arg_all(ctx, &value);
+    rc = true;
+  }
+  else
+  {
+    rc = mcsh_stack_search(ctx->entry, v->name, &value);
+  }
+  if (v->expander.type == EXPANDER_TEST &&
+      ! v->subscripted)
+  {
+    value = expand_test(rc);
+    goto end;
+  }
+
+  RAISE_IF(!rc, ctx->status, NULL, 0, "mcsh.undefined",
+           "could not find variable '%s'", v->name);
+
+  value = activate(ctx, v->name, value);
+  // printf("variable found: '%s'\n", v->name);
+  if (v->type != VARIABLE_SCALAR)
+  {
+    if (value->type == MCSH_VALUE_MODULE)
+    {
+      // Finish any import -l
+      mcsh_module_load(value->module, ctx->status);
+      PROPAGATE(ctx->status);
+    }
+    mcsh_value* subvalue;
+    rc = variable_eval(ctx->entry, v, value, &subvalue);
+    CHECK(rc, "could not eval variable: '%s'", token);
+    value = subvalue;
+  }
+  if (v->subscripted)
+  {
+    mcsh_value* t = NULL;
+    rc = subscript_eval(ctx, v, value, &t);
+    PROPAGATE(ctx->status);
+    value = t;
+  }
+  if (v->expander.type != EXPANDER_NONE)
+  {
+    value = expand(ctx->entry->stack->vm, v, value, ctx->status);
+    PROPAGATE(ctx->status);
   }
   end:
   *output = value;
@@ -459,7 +601,7 @@ arg_index(size_t index, context* ctx,
           mcsh_value** output)
 {
   int shift = ctx->entry->shift;
-  show("size: %zi", ctx->entry->args->size);
+  TRACE(ARGS, ctx->entry->args->size, shift);
   *output = ctx->entry->args->data[index+shift];
   return true;
 }
@@ -472,7 +614,7 @@ arg_all(context* ctx, mcsh_value** output)
   int shift = ctx->entry->shift;
   list_array* A = ctx->entry->args;
   size_t n = A->size - 1 - shift;
-  printf("n: %zi\n", n);
+  TRACE(ARGS, n, shift);
   mcsh_value* result =
     mcsh_value_new_list_sized(ctx->entry->stack->vm, n);
   for (size_t index = shift + 1; index < A->size; index++)
@@ -502,22 +644,45 @@ is_glob(const char* token)
 /*   glob(token,  */
 /* } */
 
+static int
+path_compare(const void* a, const void* b)
+{
+  const mcsh_value* x = *(mcsh_value* const*) a;
+  const mcsh_value* y = *(mcsh_value* const*) b;
+  return strcmp(x->string, y->string);
+}
+
 static bool
 do_glob(context* ctx, const char* token, mcsh_value** output)
 {
-  glob_t G;
   mcsh_vm* vm = ctx->entry->stack->vm;
-  // |GLOB_TILDE is not on Cygwin
-  glob(token, GLOB_ERR|GLOB_MARK, NULL, &G);
-  printf("matches: %zi\n", G.gl_pathc);
-  mcsh_value* result = mcsh_value_new_list_sized(vm,
-                                                       G.gl_pathc);
-  for (size_t i = 0; i < G.gl_pathc; i++)
+  mcsh_walk_pattern* pattern = mcsh_walk_pattern_compile(token);
+  RAISE_IF(pattern == NULL, ctx->status, NULL, 0,
+           "mcsh.glob", "glob: pattern is too deep: '%s'", token);
+  // Threads only pay off for **:
+  mcsh_walk_options options = { NULL, 0, 1, false };
+  if (mcsh_walk_pattern_recursive(pattern))
+    options.threads = 0;
+  mcsh_walk* walk = mcsh_walk_start(pattern, &options);
+  mcsh_value* result = mcsh_value_new_list(vm);
+  mcsh_walk_entry entry;
+  while (mcsh_walk_next(walk, &entry))
   {
-    mcsh_value* v = mcsh_value_new_string(vm, G.gl_pathv[i]);
+    if (entry.type == DT_DIR)
+    {
+      // Mark directories, as GLOB_MARK did:
+      size_t n = strlen(entry.path);
+      entry.path = realloc_checked(entry.path, n + 2);
+      strcpy(entry.path + n, "/");
+    }
+    mcsh_value* v = mcsh_value_new_string_take(entry.path);
     mcsh_value_grab(ctx->logger, v);
     list_array_add(result->list, v);
   }
+  mcsh_walk_free(walk);
+  // The walk order depends on the threads, so sort as glob() did:
+  qsort(result->list->data, result->list->size, sizeof(void*),
+        path_compare);
   result->word_split = true;
   *output = result;
   return true;
@@ -548,17 +713,19 @@ variable_print(variable* v)
 
 static bool parse_expander(char s, expander_type* type);
 
-static bool parse_subscript(context* ctx,
-                            subscript* ss, const char* spec);
+static void regex_split(expander* e);
 
-static inline bool
-variable_parse(context* ctx, variable* v, const char* s)
+/** Parse the variable reference s, without the $.
+    Needs no context: subscripts are parsed on evaluation */
+static void
+variable_scan(variable* v, const char* s)
 {
-  mcsh_logger* logger = &ctx->entry->module->vm->logger;
-  LOG(MCSH_LOG_DATA, MCSH_INFO, "parse: '%s'", s);
   // Defaults:
-  v->type        = VARIABLE_PROTO;
-  v->subscripted = false;
+  v->type          = VARIABLE_PROTO;
+  v->subname       = NULL;
+  v->subscripted   = false;
+  v->spec          = NULL;
+  v->expander.text = NULL;
 
   if (strcmp(s, "@") == 0 ||
       strcmp(s, "#") == 0)
@@ -566,7 +733,7 @@ variable_parse(context* ctx, variable* v, const char* s)
     v->type = VARIABLE_SCALAR;
     strcpy(v->name, s);
     v->expander.type = EXPANDER_NONE;
-    return true;
+    goto done;
   }
 
   parse_expander(s[0], &v->expander.type);
@@ -582,17 +749,18 @@ variable_parse(context* ctx, variable* v, const char* s)
       int m = n - i;
       v->subname = malloc(m);
       strcpy(v->subname, s+i+1);
-      show("parsed: '%s' -> '%s'.'%s'",
-           s, v->name, v->subname);
+      TRACE(VARIABLE_MEMBER, mcsh_trace_str(v->name),
+            mcsh_trace_str(v->subname));
       v->type = VARIABLE_MODULE;
-      return true;
+      goto done;
     }
     if (s[i] == '[')
     {
       strlcpy(v->name, s+start, i+1);
       v->name[i] = '\0';
       v->subscripted = true;
-      parse_subscript(ctx, &v->subscript, s+i);
+      free(v->spec);
+      v->spec = strdup(s+i);
       // Not always actually a scalar:
       v->type = VARIABLE_SCALAR;
     }
@@ -603,8 +771,9 @@ variable_parse(context* ctx, variable* v, const char* s)
       v->expander.type = EXPANDER_REGEX;
       // Start at character after slash:
       v->expander.text = strdup(s+i+1);
+      regex_split(&v->expander);
       v->type = VARIABLE_SCALAR;
-      return true;
+      goto done;
     }
   }
   if (v->type == VARIABLE_PROTO)
@@ -612,7 +781,58 @@ variable_parse(context* ctx, variable* v, const char* s)
     v->type = VARIABLE_SCALAR;
     strcpy(v->name, s);
   }
-  return true;
+  done:
+  v->is_index = is_integer(v->name, &v->index);
+}
+
+static void
+variable_finalize(variable* v)
+{
+  free(v->subname);
+  free(v->spec);
+  free(v->expander.text);
+}
+
+static void
+subscript_free(subscript* ss)
+{
+  for (size_t i = 0; i < ss->contigs.size; i++)
+  {
+    contig* c = ss->contigs.data[i];
+    if (c->type == CONTIG_STRINGS)
+      free(c->key);
+    free(c);
+  }
+  list_array_finalize(&ss->contigs);
+}
+
+/**
+   Split expander text regex[/subst[/flags]] in place.
+   Flags are g for global and i for case-insensitive:
+   a last segment of other characters is part of subst
+*/
+static void
+regex_split(expander* e)
+{
+  e->subst  = NULL;
+  e->global = false;
+  e->cflags = 0;
+  char* p = strchr(e->text, '/');
+  if (p == NULL)
+  {
+    // A test:
+    e->cflags = REG_NOSUB;
+    return;
+  }
+  *p = '\0';
+  e->subst = p+1;
+  char* q = strrchr(e->subst, '/');
+  if (q == NULL || q[1 + strspn(q+1, "gi")] != '\0')
+    return;
+  *q = '\0';
+  e->global = (strchr(q+1, 'g') != NULL);
+  if (strchr(q+1, 'i') != NULL)
+    e->cflags |= REG_ICASE;
 }
 
 static bool
@@ -710,8 +930,13 @@ parse_subscript1(context* ctx,
   contig* c = calloc(1, sizeof(*c));
   list_array_add(&ss->contigs, c);
   mcsh_value* value;
-  to_value(ctx, t, &value);
-  if (is_integer(value->string, NULL))
+  // t is one of a list of n-character contigs:
+  char token[n+1];
+  memcpy(token, t, n);
+  token[n] = '\0';
+  to_value(ctx, token, &value);
+  if (value->type == MCSH_VALUE_INT ||
+      (value->type == MCSH_VALUE_STRING && is_integer(value->string, NULL)))
   {
     c->type = CONTIG_INTEGERS;
     int64_t v;
@@ -722,7 +947,7 @@ parse_subscript1(context* ctx,
   else
   {
     c->type = CONTIG_STRINGS;
-    c->key  = strndup(value->string, n);
+    c->key  = strdup(value->string);
   }
   return true;
 }
@@ -1038,8 +1263,7 @@ subscript_eval_table(context* ctx,
   mcsh_value* result;
   if (v->subscript.contigs.size == 1)
   {
-    printf("eval_table_1\n");
-    variable_print(v);
+    TRACE(TABLE_EVAL, mcsh_trace_str(v->name), T);
     eval_table_1(ctx, v, T, &result);
   }
   else
@@ -1112,12 +1336,15 @@ subscript_eval_expander(variable* v, contig* c, mcsh_value* found,
 static mcsh_value* expand_size(mcsh_logger* logger,
                                mcsh_value* value);
 static mcsh_value* expand_view(mcsh_vm* vm, variable* v,
-                               mcsh_value* value);
+                               mcsh_value* value,
+                               mcsh_status* status);
 static mcsh_value* expand_regex(mcsh_vm* vm,
-                                variable* v, mcsh_value* value);
+                                variable* v, mcsh_value* value,
+                                mcsh_status* status);
 
 static mcsh_value*
-expand(mcsh_vm* vm, variable* v, mcsh_value* value)
+expand(mcsh_vm* vm, variable* v, mcsh_value* value,
+       mcsh_status* status)
 {
   mcsh_value* result;
   switch (v->expander.type)
@@ -1126,10 +1353,10 @@ expand(mcsh_vm* vm, variable* v, mcsh_value* value)
       result = expand_size(&vm->logger, value);
       break;
     case EXPANDER_VIEW:
-      result = expand_view(vm, v, value);
+      result = expand_view(vm, v, value, status);
       break;
     case EXPANDER_REGEX:
-      result = expand_regex(vm, v, value);
+      result = expand_regex(vm, v, value, status);
       break;
     default:
       valgrind_assert(false);
@@ -1145,7 +1372,7 @@ expand_size(mcsh_logger* logger, mcsh_value* value)
   switch (value->type)
   {
     case MCSH_VALUE_STRING:
-      n = mcsh_to_string(logger, t, PATH_MAX, value);
+      n = strlen(value->string);
       break;
     case MCSH_VALUE_INT:
     case MCSH_VALUE_FLOAT:
@@ -1170,23 +1397,16 @@ static mcsh_value* expand_view_table(mcsh_vm* vm,
                                      mcsh_value* value);
 
 static mcsh_value*
-expand_view(mcsh_vm* vm, UNUSED variable* v, mcsh_value* value)
+expand_view(mcsh_vm* vm, variable* v, mcsh_value* value,
+            mcsh_status* status)
 {
-  mcsh_value* result;
-  switch (value->type)
-  {
-    case MCSH_VALUE_STRING:
-      printf("HASH\n");
-      result = NULL;
-      exit(1);
-      break;
-    case MCSH_VALUE_TABLE:
-      result = expand_view_table(vm, value);
-      break;
-    default:
-      valgrind_fail_msg("NYI");
-  }
-  return result;
+  if (value->type == MCSH_VALUE_TABLE)
+    return expand_view_table(vm, value);
+  char t[64];
+  mcsh_value_type_name(value->type, t);
+  mcsh_raise(status, NULL, 0, "mcsh.invalid_type",
+             "$@%s: requires a table, given a %s", v->name, t);
+  return NULL;
 }
 
 static mcsh_value*
@@ -1205,111 +1425,48 @@ expand_view_table(mcsh_vm* vm, mcsh_value* value)
 }
 
 
-static mcsh_value* expand_regex_test(mcsh_vm* vm,
-                                        variable* v,
-                                        mcsh_value* value);
-static mcsh_value* expand_regex_replace(mcsh_vm* vm,
-                                        variable* v,
-                                        mcsh_value* value,
-                                        char* p);
-
+/**
+   $v/regex : 1 if regex matches, else 0
+   $v/regex/subst[/flags] : replace the first or every match
+   Patterns are POSIX extended, compiled once per VM:
+   see mcsh-regex.h
+*/
 static mcsh_value*
-expand_regex(mcsh_vm* vm, variable* v, mcsh_value* value)
+expand_regex(mcsh_vm* vm, variable* v, mcsh_value* value,
+             mcsh_status* status)
 {
-  printf("expand_regex: text: '%s'\n", v->expander.text);
-  char* p = strchr(v->expander.text, '/');
-  mcsh_value* result;
-  if (p == NULL)
-    result = expand_regex_test(vm, v, value);
-  else
-    result = expand_regex_replace(vm, v, value, p);
-  return result;
-}
-
-static mcsh_value* expand_regex_test(UNUSED mcsh_vm* vm,
-                                     variable* v,
-                                     mcsh_value* value)
-{
-  char* pattern = v->expander.text;
-  printf("pattern: '%s'\n", pattern);
-  printf("string: '%s'\n", value->string);
-  regmatch_t match;
-  regex_t regex;
-  int rc;
-  rc = regcomp(&regex, pattern, REG_NOSUB);
-  valgrind_assert(rc == 0);
-  rc = regexec(&regex, value->string, 1, &match, 0);
-  int found;
-  char t[1024];
-  switch (rc)
+  expander* e = &v->expander;
+  char t[64];
+  const char* string = value->string;
+  if (value->type != MCSH_VALUE_STRING)
   {
-    case 0:
-      found = 1;
-      break;
-    case REG_NOMATCH:
-      found = 0;
-      break;
-    default:
-      regerror(rc, &regex, t, 1024);
-      printf("error: %s\n", t);
-      found = 0;
-      break;
+    mcsh_to_string(&vm->logger, t, sizeof(t), value);
+    string = t;
   }
-  regfree(&regex);
-  return mcsh_value_new_int(found);
-}
-
-static mcsh_value* replace(mcsh_vm* vm, char* original,
-                           regoff_t start, regoff_t end,
-                           char* substitute);
-
-static mcsh_value*
-expand_regex_replace(mcsh_vm* vm, variable* v, mcsh_value* value,
-                     char* p)
-{
-  *p = '\0';
-  p++;
-  char* pattern = v->expander.text;
-  char* subst = p;
-  printf("pattern: '%s' subst: '%s'\n", pattern, subst);
-
-  regmatch_t match;
-  regex_t regex;
-  regcomp(&regex, pattern, 0);
-  int rc = regexec(&regex, value->string, 1, &match, 0);
-  int found = (rc == 0);
-  mcsh_value* result;
-  if (found)
+  char error[256];
+  regex_t* regex = mcsh_regex_get(vm->data->regex, e->text, e->cflags,
+                                  error, sizeof(error));
+  if (regex == NULL)
   {
-    result = replace(vm, value->string, match.rm_so, match.rm_eo,
-                     subst);
+    mcsh_raise(status, NULL, 0, "mcsh.regex",
+               "bad regex: '%s': %s", e->text, error);
+    return NULL;
   }
-  else
-    result = mcsh_value_new_string(vm, value->string);
+  if (e->subst == NULL)
+    return mcsh_value_new_int(regexec(regex, string, 0, NULL, 0) == 0);
 
-  regfree(&regex);
-  return result;
-}
-
-static mcsh_value*
-replace(mcsh_vm* vm, char* original,
-        regoff_t start, regoff_t end,
-        char* substitute)
-{
-  size_t original_length   = strlen(original);
-  size_t substitute_length = strlen(substitute);
-  char t[original_length + substitute_length];
-  char* p = &t[0];
-  copy(  p, original,     start);
-  append(p, substitute,   substitute_length+1);
-  append(p, original+end, original_length);
-  mcsh_value* result = mcsh_value_new_string(vm, t);
+  buffer B;
+  buffer_init(&B, strlen(string) + 64);
+  mcsh_regex_replace(regex, string, e->subst, e->global, &B);
+  mcsh_value* result = mcsh_value_new_string(vm, B.data);
+  buffer_finalize(&B);
   return result;
 }
 
 bool
 mcsh_data_env(mcsh_vm* vm, const char* name, mcsh_value** result)
 {
+  STATS(vm, env_lookups);
   char* v = getenv(name);
   if (v == NULL)
     return false;
@@ -1391,7 +1548,7 @@ mcsh_join_table_to_buffer(mcsh_logger* logger,
                           struct table* T, const char* delimiter,
                           buffer* result)
 {
-  LOG(MCSH_LOG_DATA, MCSH_INFO, "join_table: %zi", T->size);
+  LOG(MCSH_LOG_DATA, MCSH_INFO, "join_table: %i", T->size);
   buffer t;
   buffer_init(&t, 64);
   buffer_cat(result, "{");
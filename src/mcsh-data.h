@@ -8,6 +8,20 @@
 
 void mcsh_data_init(mcsh_vm* vm);
 
+/** Classify token text once, at parse time:
+    a literal gets its value now, a variable its parsed reference.
+    Takes ownership of text */
+void mcsh_token_init(mcsh_token* token, char* text);
+
+void mcsh_token_free(mcsh_logger* logger, mcsh_token* token);
+
+/** Evaluate a token classified by mcsh_token_init().
+    A literal produces its interned value: do not modify it */
+bool mcsh_token_eval(mcsh_logger* logger,
+                     mcsh_entry* entry, mcsh_token* token,
+                     mcsh_value** output, mcsh_status* status);
+
+/** Classify and evaluate token text on the fly */
 bool mcsh_token_to_value(mcsh_logger* logger,
                          mcsh_entry* entry, const char* token,
                          mcsh_value** output, mcsh_status* status);
@@ -3,23 +3,26 @@
   MCSH EXPR GRAMMAR Y
 */
 
+%code requires {
+  #include "mcsh-expr-parser.h"
+
+  // The reentrant Flex scanner handle
+  #ifndef YY_TYPEDEF_YY_SCANNER_T
+  #define YY_TYPEDEF_YY_SCANNER_T
+  typedef void* yyscan_t;
+  #endif
+}
+
 %{
   #include <assert.h>
   #include <stdio.h>
   #include <stdlib.h>
-
-  #include "mcsh-expr-parser.h"
-
-  // Declare stuff from Flex that Bison needs to know about:
-  extern int mcsh_expr_lex();
-
-  extern FILE* mcsh_expr_in;
-  extern int   mcsh_expr_line;
-
-  void yyerror(const char* message);
 %}
 
 %define api.prefix {mcsh_expr_}
+%define api.pure full
+%param       {yyscan_t scanner}
+%parse-param {mcsh_parse_context* ctx}
 /* %define api.value.type {double} */
 %define parse.error verbose
 
@@ -60,6 +63,14 @@
 
 %type <node> program lines line expr ;
 
+%code {
+  // Declare stuff from Flex that Bison needs to know about:
+  int mcsh_expr_lex(MCSH_EXPR_STYPE* lval, yyscan_t scanner);
+
+  void yyerror(yyscan_t scanner, mcsh_parse_context* ctx,
+               const char* message);
+}
+
 %left EQ NE LT GT LE GE
 %left PLUS MINUS
 %left MULT DIV IDIV MOD
@@ -70,7 +81,7 @@
 
 program: lines END {
   // printf("parser: program END.\n");
-  mcsh_parse_output_set($1);
+  mcsh_parse_output_set(ctx, $1);
   return 1;
  }
 
@@ -81,13 +92,13 @@ lines: %empty {
         |
                 lines line
                 {
-                  $$ = mcsh_node_expr_join($1, $2, mcsh_expr_line);
+                  $$ = mcsh_node_expr_join($1, $2, ctx->line);
                 }
                 ;
         |
                 lines line NL
                 {
-                  $$ = mcsh_node_expr_join($1, $2, mcsh_expr_line);
+                  $$ = mcsh_node_expr_join($1, $2, ctx->line);
                 }
                 ;
 
@@ -103,14 +114,15 @@ line:
                 line SEMICOLON expr
                 {
                   // printf("SEMICOLON\n");
-                  $$ = mcsh_node_expr_join($1, $3, mcsh_expr_line);
+                  $$ = mcsh_node_expr_join($1, $3, ctx->line);
                 }
                 ;
 
 expr:
                 TOKEN
                 {
-                  $$ = mcsh_node_token($1, mcsh_expr_line);
+                  $$ = mcsh_node_token($1, ctx->line);
+                  free($1);
                 }
         |
                 LPAREN expr RPAREN
@@ -122,87 +134,87 @@ expr:
                 expr QM expr COLON expr
                 {
                   // printf("found TERN\n");
-                  $$ = mcsh_node_tern($1, $3, $5, mcsh_expr_line);
+                  $$ = mcsh_node_tern($1, $3, $5, ctx->line);
                 }
         |
                 expr EQ expr
                 {
                   // printf("found: EQ: %s\n", $2);
                   $$ = mcsh_node_op(MCSH_OP_EQ, $1, $3,
-                                    mcsh_expr_line);
+                                    ctx->line);
                 }
         |
                 expr NE expr
                 {
                   // printf("found: NE: %s\n", $2);
-                  $$ = mcsh_node_op(MCSH_OP_NE, $1, $3, mcsh_expr_line);
+                  $$ = mcsh_node_op(MCSH_OP_NE, $1, $3, ctx->line);
                 }
         |
                 expr LT expr
                 {
                   // printf("found: LT: %s\n", $2);
                   $$ = mcsh_node_op(MCSH_OP_LT, $1, $3,
-                                    mcsh_expr_line);
+                                    ctx->line);
                 }
         |
                 expr GT expr
                 {
                   // printf("found: GT: %s\n", $2);
                   $$ = mcsh_node_op(MCSH_OP_GT, $1, $3,
-                                    mcsh_expr_line);
+                                    ctx->line);
                 }
         |
                 expr LE expr
                 {
-                  printf("found: LE: %s\n", $2);
+                  // printf("found: LE: %s\n", $2);
                   $$ = mcsh_node_op(MCSH_OP_LE, $1, $3,
-                                    mcsh_expr_line);
+                                    ctx->line);
                 }
         |
                 expr GE expr
                 {
-                  printf("found: GE: %s\n", $2);
+                  // printf("found: GE: %s\n", $2);
                   $$ = mcsh_node_op(MCSH_OP_GE, $1, $3,
-                                    mcsh_expr_line);
+                                    ctx->line);
                 }
         |
                 expr PLUS expr
                 {
                   // printf("found: PLUS: %s\n", $2);
                   $$ = mcsh_node_op(MCSH_OP_PLUS, $1, $3,
-                                    mcsh_expr_line);
+                                    ctx->line);
                 }
         |
                 expr MINUS expr
                 {
                   // printf("found: minus: %s\n", $2);
                   $$ = mcsh_node_op(MCSH_OP_MINUS, $1, $3,
-                                    mcsh_expr_line);
+                                    ctx->line);
                 }
         |
                 expr MULT expr
                 {
                   // printf("found: mult: %s\n", $2);
                   $$ = mcsh_node_op(MCSH_OP_MULT, $1, $3,
-                                    mcsh_expr_line);
+                                    ctx->line);
                 }
         |       expr DIV expr
                 {
                   // printf("found: div: %s\n", $2);
                   $$ = mcsh_node_op(MCSH_OP_DIV, $1, $3,
-                                    mcsh_expr_line);
+                                    ctx->line);
                 }
         |       expr IDIV expr
                 {
                   // printf("found: idiv: %s\n", $2);
                   $$ = mcsh_node_op(MCSH_OP_IDIV, $1, $3,
-                                    mcsh_expr_line);
+                                    ctx->line);
                 }
         |       expr MOD expr
                 {
                   // printf("found: mod: %s\n", $2);
                   $$ = mcsh_node_op(MCSH_OP_MOD, $1, $3,
-                                    mcsh_expr_line);
+                                    ctx->line);
                 }
         ;
 
@@ -222,15 +234,8 @@ expr:
 // extern int yylex(void);
 
 void
-yyerror(const char* message)
+yyerror(UNUSED yyscan_t scanner, mcsh_parse_context* ctx,
+        const char* message)
 {
-  mcsh_expr_grammar_status = false;
-
-  // printf("MCSH EXPR ERROR: line=%i %s \n", mcsh_expr_line, s);
-
-  valgrind_assert(mcsh_expr_grammar_message == NULL);
-
-  mcsh_expr_grammar_message = strdup(message);
-
-  // exit(EXIT_FAILURE);
+  mcsh_expr_syntax_error(ctx, message);
 }
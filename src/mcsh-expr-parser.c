@@ -6,6 +6,14 @@
 
 #include <mcsh-expr-parser.h>
 
-int   mcsh_expr_line            = 1;
-bool  mcsh_expr_grammar_status  = true;
-char* mcsh_expr_grammar_message = NULL;
+void
+mcsh_expr_syntax_error(mcsh_parse_context* ctx, const char* message)
+{
+  ctx->status = MCSH_PARSE_FAIL;
+
+  // printf("MCSH EXPR ERROR: line=%i %s \n", ctx->line, message);
+
+  valgrind_assert(ctx->message == NULL);
+
+  ctx->message = strdup(message);
+}
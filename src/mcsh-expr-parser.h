@@ -8,14 +8,16 @@
 #include <stdbool.h>
 #include "mcsh-parser.h"
 
-/** Current source code line: incremented by lexer */
-extern int mcsh_expr_line;
-
-/** This is true unless there is an error */
-extern bool  mcsh_expr_grammar_status;
+/** Parse text into ctx->output.  Reentrant: all state is in ctx
+    and a scanner local to this call.
+    In mcsh-expr-lexer.l
+    @return True on success, else the message is in ctx->message
+*/
+bool mcsh_expr_parse_string(mcsh_parse_context* ctx, char* text);
 
-/** On error, this contains the error message */
-extern char* mcsh_expr_grammar_message;
+/** Record a grammar error in ctx */
+void mcsh_expr_syntax_error(mcsh_parse_context* ctx,
+                            const char* message);
 
 void mcsh_expr_token(const char* token);
 
@@ -137,25 +137,33 @@ bool
 mcsh_start_slurp(mcsh_cmd_line* cmd, mcsh_module* module,
                  mcsh_value** value, mcsh_status* status)
 {
-  buffer code;
-  buffer_init(&code, 1024);
-  bool b = slurp_buffer(cmd->stream, &code);
-  assert(b);
-
-  if (cmd->stream != stdin) fclose(cmd->stream);
-
   mcsh_log(&module->vm->logger, MCSH_LOG_SYSTEM, MCSH_INFO,
            "parse: %s", cmd->argv[0]);
 
-  mcsh_module_parse(cmd->argv[0], "mcsh.main", code.data, module);
+  mcsh_vm_init_stream(module->vm, status);
+  if (status->code == MCSH_EXCEPTION)
+  {
+    if (cmd->stream != stdin) fclose(cmd->stream);
+    return true;
+  }
+  if (module->vm->stream)
+  {
+    bool result = mcsh_module_stream(cmd->argv[0], "mcsh.main",
+                                     cmd->stream, module,
+                                     value, status);
+    if (cmd->stream != stdin) fclose(cmd->stream);
+    return result;
+  }
+
+  mcsh_module_parse_file(cmd->argv[0], "mcsh.main", cmd->stream,
+                         module);
+  if (cmd->stream != stdin) fclose(cmd->stream);
 
   if (mcsh_log_check(&module->vm->logger, MCSH_LOG_PARSE, MCSH_FATAL))
     mcsh_module_print(module, 0);
 
   status->code = MCSH_OK;
-  bool result = mcsh_module_execute(module, value, status);
-  buffer_finalize(&code);
-  return result;
+  return mcsh_module_execute(module, value, status);
 }
 
 bool
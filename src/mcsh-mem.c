@@ -0,0 +1,341 @@
+
+/**
+   MCSH MEM C
+*/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mcsh-mem.h"
+#include "table.h"
+#include "util.h"
+
+_Thread_local mcsh_mem_count mcsh_mem_types[MCSH_TYPE_COUNT];
+_Thread_local mcsh_mem_count mcsh_mem_all;
+
+bool mcsh_mem_sites = false;
+_Thread_local mcsh_stmt* mcsh_mem_site = NULL;
+
+/** From MCSH_MEM, or NULL */
+static char* report_file = NULL;
+
+typedef struct
+{
+  uint64_t count;
+  uint64_t bytes;
+} site_count;
+
+/** Map from "source:line" to site_count*: shared by all threads */
+static struct table sites;
+static pthread_mutex_t sites_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+count_free(void* context, const char* key, void* data)
+{
+  free(data);
+}
+
+void
+mcsh_mem_init()
+{
+  char* s = getenv("MCSH_MEM");
+  if (s != NULL && s[0] != '\0')
+    report_file = strdup_checked(s);
+  getenv_boolean("MCSH_MEM_SITES", false, &mcsh_mem_sites);
+  if (mcsh_mem_sites)
+    table_init(&sites, 1024);
+}
+
+size_t
+mcsh_mem_value_bytes(const mcsh_value* value)
+{
+  size_t result = sizeof(mcsh_value);
+  switch (value->type)
+  {
+    case MCSH_VALUE_STRING:
+      if (value->string != NULL)
+        result += strlen(value->string) + 1;
+      break;
+    case MCSH_VALUE_LIST:
+      result += sizeof(list_array) +
+        value->list->capacity * sizeof(void*);
+      break;
+    case MCSH_VALUE_TABLE:
+      result += sizeof(struct table) +
+        value->table->capacity * sizeof(struct table_entry);
+      break;
+    default:
+      break;
+  }
+  return result;
+}
+
+static inline void
+count_add(mcsh_mem_count* count, uint32_t bytes)
+{
+  count->live++;
+  count->total++;
+  count->bytes += bytes;
+  if (count->live  > count->peak)       count->peak = count->live;
+  if (count->bytes > count->bytes_peak) count->bytes_peak = count->bytes;
+}
+
+static void
+site_charge(uint32_t bytes)
+{
+  char key[PATH_MAX+16];
+  if (mcsh_mem_site == NULL)
+    strcpy(key, "(none)");
+  else
+    snprintf(key, sizeof(key), "%s:%i",
+             mcsh_mem_site->module->source, mcsh_mem_site->line);
+  site_count* site;
+  pthread_mutex_lock(&sites_lock);
+  if (! table_search(&sites, key, (void*) &site))
+  {
+    site = calloc_checked(1, sizeof(*site));
+    table_add(&sites, key, site);
+  }
+  site->count++;
+  site->bytes += bytes;
+  pthread_mutex_unlock(&sites_lock);
+}
+
+void
+mcsh_mem_new(mcsh_value* value)
+{
+  size_t n = mcsh_mem_value_bytes(value);
+  uint32_t bytes = n < UINT32_MAX ? n : UINT32_MAX;
+  value->mem_type  = value->type;
+  value->mem_bytes = bytes;
+  count_add(&mcsh_mem_types[value->type], bytes);
+  count_add(&mcsh_mem_all, bytes);
+  if (mcsh_mem_sites) site_charge(bytes);
+}
+
+static void
+count_write(FILE* fp, const char* name, mcsh_mem_count* count)
+{
+  fprintf(fp, "  %-10s %10"PRIu64" %10"PRIu64" %10"PRIu64
+          " %12"PRIu64" %12"PRIu64"\n",
+          name, count->live, count->peak, count->total,
+          count->bytes, count->bytes_peak);
+}
+
+/** Most bytes first */
+static int
+site_compare(const void* a, const void* b)
+{
+  const site_count* x = (*(table_entry* const*) a)->data;
+  const site_count* y = (*(table_entry* const*) b)->data;
+  if (x->bytes != y->bytes)
+    return x->bytes < y->bytes ? 1 : -1;
+  return 0;
+}
+
+static void
+sites_write(FILE* fp)
+{
+  size_t count = table_size(&sites);
+  table_entry** sorted = malloc_checked((count+1) * sizeof(table_entry*));
+  size_t i = 0;
+  TABLE_FOREACH(&sites, item)
+    sorted[i++] = item;
+  qsort(sorted, count, sizeof(table_entry*), site_compare);
+  fprintf(fp, "# %10s %12s  %s\n", "allocs", "bytes", "site");
+  for (i = 0; i < count; i++)
+  {
+    site_count* site = sorted[i]->data;
+    fprintf(fp, "  %10"PRIu64" %12"PRIu64"  %s\n",
+            site->count, site->bytes, sorted[i]->key);
+  }
+  free(sorted);
+}
+
+void
+mcsh_mem_report(FILE* fp)
+{
+  char name[64];
+  fprintf(fp, "# mcsh memory: values by type at construction\n");
+  fprintf(fp, "# %-10s %10s %10s %10s %12s %12s\n",
+          "type", "live", "peak", "total", "bytes", "bytes-peak");
+  for (int i = 0; i < MCSH_TYPE_COUNT; i++)
+  {
+    if (mcsh_mem_types[i].total == 0) continue;
+    mcsh_value_type_name(i, name);
+    count_write(fp, name, &mcsh_mem_types[i]);
+  }
+  count_write(fp, "all", &mcsh_mem_all);
+  if (mcsh_mem_sites)
+  {
+    pthread_mutex_lock(&sites_lock);
+    sites_write(fp);
+    pthread_mutex_unlock(&sites_lock);
+  }
+}
+
+typedef struct
+{
+  /// Set of "%p" of values seen
+  struct table seen;
+  /// Map from "type refs" to site_count*
+  struct table groups;
+  uint64_t reachable[MCSH_TYPE_COUNT];
+} census;
+
+static void census_value(census* c, mcsh_value* value);
+
+static void
+census_strmap(census* c, strmap* map)
+{
+  for (size_t i = 0; i < map->size; i++)
+    if (map->keys[i] != NULL)
+      census_value(c, map->data[i]);
+}
+
+static void
+census_value(census* c, mcsh_value* value)
+{
+  if (value == NULL || value == &mcsh_null) return;
+  char key[64];
+  snprintf(key, sizeof(key), "%p", (void*) value);
+  if (table_contains(&c->seen, key)) return;
+  table_add(&c->seen, key, NULL);
+
+  char name[64];
+  mcsh_value_type_name(value->type, name);
+  char group_key[96];
+  snprintf(group_key, sizeof(group_key), "%-10s %6i", name, value->refs);
+  site_count* group;
+  if (! table_search(&c->groups, group_key, (void*) &group))
+  {
+    group = calloc_checked(1, sizeof(*group));
+    table_add(&c->groups, group_key, group);
+  }
+  group->count++;
+  group->bytes += mcsh_mem_value_bytes(value);
+  if (value->mem_bytes > 0)
+    c->reachable[value->mem_type]++;
+
+  switch (value->type)
+  {
+    case MCSH_VALUE_LIST:
+      for (size_t i = 0; i < value->list->size; i++)
+        census_value(c, value->list->data[i]);
+      break;
+    case MCSH_VALUE_TABLE:
+      TABLE_FOREACH(value->table, item)
+        census_value(c, item->data);
+      break;
+    case MCSH_VALUE_LINK:
+      census_value(c, value->link);
+      break;
+    case MCSH_VALUE_MODULE:
+      census_strmap(c, &value->module->vars);
+      break;
+    default:
+      break;
+  }
+}
+
+static int
+key_compare(const void* a, const void* b)
+{
+  return strcmp((*(table_entry* const*) a)->key,
+                (*(table_entry* const*) b)->key);
+}
+
+void
+mcsh_mem_census(mcsh_vm* vm, FILE* fp)
+{
+  // Do not count our own allocations:
+  unsigned long allocs = util_allocs;
+  census c;
+  table_init(&c.seen,   1024);
+  table_init(&c.groups, 64);
+  memset(c.reachable, 0, sizeof(c.reachable));
+
+  // The roots: globals, the main module, and each stack entry
+  TABLE_FOREACH(&vm->globals, item)
+    census_value(&c, item->data);
+  census_strmap(&c, &vm->main->vars);
+  for (mcsh_entry* entry = vm->stack.current; entry != NULL;
+       entry = entry->parent)
+  {
+    census_strmap(&c, &entry->vars);
+    if (entry->type == MCSH_ENTRY_MODULE)
+      census_strmap(&c, &entry->module->vars);
+  }
+
+  size_t count = table_size(&c.groups);
+  table_entry** sorted = malloc_checked((count+1) * sizeof(table_entry*));
+  size_t i = 0;
+  TABLE_FOREACH(&c.groups, item)
+    sorted[i++] = item;
+  qsort(sorted, count, sizeof(table_entry*), key_compare);
+
+  fprintf(fp, "# mcsh census: values reachable from the VM\n");
+  fprintf(fp, "# %-10s %6s %10s %12s\n", "type", "refs", "count", "bytes");
+  for (i = 0; i < count; i++)
+  {
+    site_count* group = sorted[i]->data;
+    fprintf(fp, "  %s %10"PRIu64" %12"PRIu64"\n",
+            sorted[i]->key, group->count, group->bytes);
+  }
+  free(sorted);
+
+  char name[64];
+  // Unreachable values are held by parsed code or temporaries,
+  // or are leaks:
+  fprintf(fp, "# %-10s %10s %10s %12s\n",
+          "type", "live", "reachable", "unreachable");
+  for (int t = 0; t < MCSH_TYPE_COUNT; t++)
+  {
+    if (mcsh_mem_types[t].live == 0) continue;
+    mcsh_value_type_name(t, name);
+    uint64_t live = mcsh_mem_types[t].live;
+    fprintf(fp, "  %-10s %10"PRIu64" %10"PRIu64" %12"PRIu64"\n",
+            name, live, c.reachable[t], live - c.reachable[t]);
+  }
+
+  table_free_callback(&c.seen,   false, NULL,       NULL);
+  table_free_callback(&c.groups, false, count_free, NULL);
+  util_allocs = allocs;
+}
+
+void
+mcsh_mem_exit(mcsh_vm* vm)
+{
+  mcsh_log(&vm->logger, MCSH_LOG_MEM, MCSH_INFO,
+           "values: live=%"PRIu64" bytes=%"PRIu64" peak=%"PRIu64,
+           mcsh_mem_all.live, mcsh_mem_all.bytes,
+           mcsh_mem_all.bytes_peak);
+  if (report_file == NULL || vm->id != 0) return;
+  FILE* fp = stdout;
+  if (strcmp(report_file, "-") != 0)
+    fp = fopen(report_file, "w");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "mcsh: could not write memory report: %s: %s\n",
+            report_file, strerror(errno));
+    mcsh_log(&vm->logger, MCSH_LOG_MEM, MCSH_WARN,
+             "could not write memory report: %s", report_file);
+    return;
+  }
+  mcsh_mem_report(fp);
+  mcsh_mem_census(vm, fp);
+  if (fp != stdout) fclose(fp);
+}
+
+void
+mcsh_mem_finalize()
+{
+  free(report_file);
+  report_file = NULL;
+  if (mcsh_mem_sites)
+    table_free_callback(&sites, false, count_free, NULL);
+}
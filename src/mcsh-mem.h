@@ -0,0 +1,82 @@
+
+/**
+   MCSH MEM H
+   Accounting of mcsh_value allocations by value type.
+   Each value constructor calls mcsh_mem_new() and value_free()
+   calls mcsh_mem_free().  The type and size are recorded in the
+   value at construction, so the counts stay balanced if the value
+   later changes type.  Sizes are those at construction:
+   the census measures current sizes.
+   MCSH_MEM=FILE writes the report and census at exit ("-" is stdout).
+   MCSH_MEM_SITES=1 also counts allocations by script line.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mcsh.h"
+
+typedef struct
+{
+  uint64_t live;
+  uint64_t peak;
+  /// Allocations ever made
+  uint64_t total;
+  uint64_t bytes;
+  uint64_t bytes_peak;
+} mcsh_mem_count;
+
+/** Indexed by the type at construction.
+    Per thread: the values of a VM stay in its thread */
+extern _Thread_local mcsh_mem_count mcsh_mem_types[MCSH_TYPE_COUNT];
+/** All types */
+extern _Thread_local mcsh_mem_count mcsh_mem_all;
+
+/** Set by MCSH_MEM_SITES */
+extern bool mcsh_mem_sites;
+/** The statement now running, if mcsh_mem_sites */
+extern _Thread_local mcsh_stmt* mcsh_mem_site;
+
+/** Reads MCSH_MEM and MCSH_MEM_SITES */
+void mcsh_mem_init(void);
+
+/** The bytes used by value and its own storage, now */
+size_t mcsh_mem_value_bytes(const mcsh_value* value);
+
+/** Count a new value: call after its type is set */
+void mcsh_mem_new(mcsh_value* value);
+
+static inline void
+mcsh_mem_count_drop(mcsh_mem_count* count, uint32_t bytes)
+{
+  count->live--;
+  count->bytes -= bytes;
+}
+
+/** Uncount a value about to be freed */
+static inline void
+mcsh_mem_free(mcsh_value* value)
+{
+  // Values on the stack or static are not counted:
+  if (value->mem_bytes == 0) return;
+  mcsh_mem_count_drop(&mcsh_mem_types[value->mem_type],
+                      value->mem_bytes);
+  mcsh_mem_count_drop(&mcsh_mem_all, value->mem_bytes);
+  value->mem_bytes = 0;
+}
+
+/** Write the counts by type and by site */
+void mcsh_mem_report(FILE* fp);
+
+/** Write the values reachable from the VM
+    grouped by type and refcount */
+void mcsh_mem_census(mcsh_vm* vm, FILE* fp);
+
+/** If MCSH_MEM is set, write the report and census
+    for the first VM */
+void mcsh_mem_exit(mcsh_vm* vm);
+
+void mcsh_mem_finalize(void);
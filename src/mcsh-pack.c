@@ -0,0 +1,268 @@
+
+/**
+   MCSH PACK C
+   Encoding: one type byte, then:
+   NULL:   nothing
+   STRING: uint64 length, bytes (no NUL)
+   INT:    int64
+   FLOAT:  double
+   LIST:   uint64 count, count values
+   TABLE:  uint64 count, count (key string, value) pairs
+   CHAN:   int64 pid, int64 address: valid only in that process,
+           and holds a reference until unpacked or released
+   All in host byte order: these are not for persistent storage
+*/
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "mcsh-pack.h"
+#include "exceptions.h"
+
+static inline void
+pack_type(buffer* B, mcsh_value_type type)
+{
+  uint8_t t = (uint8_t) type;
+  buffer_put(B, &t, 1);
+}
+
+void
+mcsh_pack_string(buffer* B, const char* s)
+{
+  uint64_t n = strlen(s);
+  mcsh_pack_size(B, n);
+  buffer_put(B, s, n);
+}
+
+void
+mcsh_pack_int(buffer* B, int64_t i)
+{
+  buffer_put(B, &i, sizeof(i));
+}
+
+static bool pack_value(mcsh_logger* logger, mcsh_value* value,
+                       buffer* B, bool chans, mcsh_status* status);
+
+bool
+mcsh_pack(mcsh_logger* logger, mcsh_value* value, buffer* B,
+          bool chans, mcsh_status* status)
+{
+  size_t start = B->length;
+  pack_value(logger, value, B, chans, status);
+  if (status->code == MCSH_EXCEPTION)
+  {
+    // Drop the references taken so far:
+    mcsh_pack_release(B->data + start, B->data + B->length);
+    B->length = start;
+  }
+  return true;
+}
+
+static bool
+pack_value(mcsh_logger* logger, mcsh_value* value, buffer* B,
+           bool chans, mcsh_status* status)
+{
+  char t[64];
+  status->code = MCSH_OK;
+  switch (value->type)
+  {
+    case MCSH_VALUE_NULL:
+      pack_type(B, MCSH_VALUE_NULL);
+      break;
+    case MCSH_VALUE_STRING:
+      pack_type(B, MCSH_VALUE_STRING);
+      mcsh_pack_string(B, value->string);
+      break;
+    case MCSH_VALUE_INT:
+      pack_type(B, MCSH_VALUE_INT);
+      mcsh_pack_int(B, value->integer);
+      break;
+    case MCSH_VALUE_FLOAT:
+      pack_type(B, MCSH_VALUE_FLOAT);
+      buffer_put(B, &value->number, sizeof(value->number));
+      break;
+    case MCSH_VALUE_LIST:
+      pack_type(B, MCSH_VALUE_LIST);
+      mcsh_pack_size(B, value->list->size);
+      for (size_t i = 0; i < value->list->size; i++)
+      {
+        pack_value(logger, value->list->data[i], B, chans, status);
+        PROPAGATE(status);
+      }
+      break;
+    case MCSH_VALUE_TABLE:
+      pack_type(B, MCSH_VALUE_TABLE);
+      mcsh_pack_size(B, table_size(value->table));
+      TABLE_FOREACH(value->table, item)
+      {
+        mcsh_pack_string(B, item->key);
+        pack_value(logger, item->data, B, chans, status);
+        PROPAGATE(status);
+      }
+      break;
+    case MCSH_VALUE_LINK:
+      return pack_value(logger, value->link, B, chans, status);
+    case MCSH_VALUE_CHAN:
+      RAISE_IF(! chans, status, NULL, 0, "mcsh.invalid_type",
+               "cannot pack a chan for another process");
+      pack_type(B, MCSH_VALUE_CHAN);
+      mcsh_pack_int(B, getpid());
+      mcsh_pack_int(B, (intptr_t) value->chan);
+      mcsh_chan_ref(value->chan);
+      break;
+    default:
+      mcsh_value_type_name(value->type, t);
+      RAISE(status, NULL, 0, "mcsh.invalid_type",
+            "cannot pack value of type: %s", t);
+  }
+  return true;
+}
+
+bool
+mcsh_unpack_int(const char** p, const char* end, int64_t* output)
+{
+  return mcsh_unpack_bytes(p, end, output, sizeof(*output));
+}
+
+bool
+mcsh_unpack_string(const char** p, const char* end, char** output)
+{
+  uint64_t n;
+  if (!mcsh_unpack_bytes(p, end, &n, sizeof(n))) return false;
+  if ((uint64_t) (end - *p) < n) return false;
+  *output = strndup(*p, n);
+  *p += n;
+  return true;
+}
+
+bool
+mcsh_unpack(mcsh_vm* vm, const char** p, const char* end,
+            mcsh_value** output)
+{
+  uint8_t type;
+  uint64_t n;
+  int64_t i;
+  double d;
+  char* s;
+  mcsh_value* result;
+  mcsh_value* item;
+  if (!mcsh_unpack_bytes(p, end, &type, 1)) return false;
+  switch (type)
+  {
+    case MCSH_VALUE_NULL:
+      result = mcsh_value_new_null();
+      break;
+    case MCSH_VALUE_STRING:
+      if (!mcsh_unpack_string(p, end, &s)) return false;
+      result = mcsh_value_new_string_take(s);
+      break;
+    case MCSH_VALUE_INT:
+      if (!mcsh_unpack_int(p, end, &i)) return false;
+      result = mcsh_value_new_int(i);
+      break;
+    case MCSH_VALUE_FLOAT:
+      if (!mcsh_unpack_bytes(p, end, &d, sizeof(d))) return false;
+      result = mcsh_value_new_float(d);
+      break;
+    case MCSH_VALUE_LIST:
+      if (!mcsh_unpack_bytes(p, end, &n, sizeof(n))) return false;
+      result = mcsh_value_new_list_sized(vm, n > 0 ? n : 1);
+      for (uint64_t j = 0; j < n; j++)
+      {
+        if (!mcsh_unpack(vm, p, end, &item))
+        {
+          mcsh_value_free(&vm->logger, result);
+          return false;
+        }
+        list_array_add(result->list, item);
+        mcsh_value_grab(&vm->logger, item);
+      }
+      break;
+    case MCSH_VALUE_TABLE:
+      if (!mcsh_unpack_bytes(p, end, &n, sizeof(n))) return false;
+      result = mcsh_value_new_table(vm, n > 0 ? n : 1);
+      for (uint64_t j = 0; j < n; j++)
+      {
+        if (!mcsh_unpack_string(p, end, &s))
+        {
+          mcsh_value_free(&vm->logger, result);
+          return false;
+        }
+        if (!mcsh_unpack(vm, p, end, &item))
+        {
+          free(s);
+          mcsh_value_free(&vm->logger, result);
+          return false;
+        }
+        table_add(result->table, s, item);
+        mcsh_value_grab(&vm->logger, item);
+        free(s);
+      }
+      break;
+    case MCSH_VALUE_CHAN:
+      if (!mcsh_unpack_int(p, end, &i)) return false;
+      // Another process cannot use this address:
+      if (i != getpid()) return false;
+      if (!mcsh_unpack_int(p, end, &i)) return false;
+      result = mcsh_value_new_chan((mcsh_chan*) (intptr_t) i);
+      break;
+    default:
+      return false;
+  }
+  *output = result;
+  return true;
+}
+
+/** Step over one value, dropping the references of its chans
+    @return False at the end of the data or on corrupt data */
+static bool
+release_value(const char** p, const char* end)
+{
+  uint8_t type;
+  uint64_t n;
+  int64_t pid, address;
+  char* s;
+  if (!mcsh_unpack_bytes(p, end, &type, 1)) return false;
+  switch (type)
+  {
+    case MCSH_VALUE_NULL:
+      return true;
+    case MCSH_VALUE_STRING:
+      if (!mcsh_unpack_string(p, end, &s)) return false;
+      free(s);
+      return true;
+    case MCSH_VALUE_INT:
+    case MCSH_VALUE_FLOAT:
+      return mcsh_unpack_bytes(p, end, &n, sizeof(n));
+    case MCSH_VALUE_LIST:
+      if (!mcsh_unpack_bytes(p, end, &n, sizeof(n))) return false;
+      for (uint64_t j = 0; j < n; j++)
+        if (!release_value(p, end)) return false;
+      return true;
+    case MCSH_VALUE_TABLE:
+      if (!mcsh_unpack_bytes(p, end, &n, sizeof(n))) return false;
+      for (uint64_t j = 0; j < n; j++)
+      {
+        if (!mcsh_unpack_string(p, end, &s)) return false;
+        free(s);
+        if (!release_value(p, end)) return false;
+      }
+      return true;
+    case MCSH_VALUE_CHAN:
+      if (!mcsh_unpack_int(p, end, &pid) ||
+          !mcsh_unpack_int(p, end, &address))
+        return false;
+      if (pid == getpid())
+        mcsh_chan_unref((mcsh_chan*) (intptr_t) address);
+      return true;
+    default:
+      return false;
+  }
+}
+
+void
+mcsh_pack_release(const char* p, const char* end)
+{
+  while (p < end)
+    if (!release_value(&p, end)) break;
+}
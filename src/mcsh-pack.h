@@ -0,0 +1,65 @@
+
+/**
+   MCSH PACK H
+   Binary encoding of data values,
+   used to move values between processes
+*/
+
+#pragma once
+
+#include <string.h>
+
+#include "mcsh.h"
+
+/** Append the encoding of value to B.
+    Raises an exception for types that cannot be packed
+    (blocks, functions, modules, ...), and leaves B as it was.
+    A channel can be unpacked only in this process:
+    if chans is false, channels raise an exception too.
+    A packed channel holds a reference until it is unpacked,
+    or released by mcsh_pack_release()
+ */
+bool mcsh_pack(mcsh_logger* logger, mcsh_value* value, buffer* B,
+               bool chans, mcsh_status* status);
+
+/** Drop the references held by the channels packed in [p,end):
+    for packed values that will never be unpacked */
+void mcsh_pack_release(const char* p, const char* end);
+
+void mcsh_pack_string(buffer* B, const char* s);
+
+void mcsh_pack_int(buffer* B, int64_t i);
+
+/** Sizes and counts are uint64 */
+static inline void
+mcsh_pack_size(buffer* B, uint64_t n)
+{
+  buffer_put(B, &n, sizeof(n));
+}
+
+/** Copy n bytes at *p to output, advancing *p past them.
+    Shared by the pack, cache, and save formats.
+    @return False if fewer than n bytes remain */
+static inline bool
+mcsh_unpack_bytes(const char** p, const char* end,
+                  void* output, size_t n)
+{
+  if ((size_t) (end - *p) < n) return false;
+  memcpy(output, *p, n);
+  *p += n;
+  return true;
+}
+
+/** Decode one value starting at *p, advancing *p past it.
+    @return False if the data is truncated or corrupt
+ */
+bool mcsh_unpack(mcsh_vm* vm, const char** p, const char* end,
+                 mcsh_value** output);
+
+/** Decode a string packed with mcsh_pack_string() into a new
+    allocation owned by the caller */
+bool mcsh_unpack_string(const char** p, const char* end,
+                        char** output);
+
+bool mcsh_unpack_int(const char** p, const char* end,
+                     int64_t* output);
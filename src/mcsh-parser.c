@@ -2,8 +2,8 @@
 #include "mcsh-parser.h"
 
 void
-mcsh_parse_output_set(mcsh_node* node)
+mcsh_parse_output_set(mcsh_parse_context* ctx, mcsh_node* node)
 {
-  mcsh.parse_state.output = node;
-  mcsh.parse_state.status = MCSH_PARSE_OK;
+  ctx->output = node;
+  ctx->status = MCSH_PARSE_OK;
 }
@@ -7,7 +7,91 @@
 
 #include "mcsh.h"
 
-void mcsh_parse_output_set(mcsh_node* node);
+typedef enum
+{
+  MCSH_SCAN_NONE,
+  /// After function, inplace, or macro at statement start
+  MCSH_SCAN_KEYWORD,
+  /// After the name
+  MCSH_SCAN_NAMED,
+  /// Inside the signature braces
+  MCSH_SCAN_SIGNATURE,
+  /// After the signature: the next brace opens the body
+  MCSH_SCAN_SIGNED
+} mcsh_scan_fn_state;
+
+/** Scanner state beyond what flex tracks */
+typedef struct
+{
+  /// Skip function bodies, leaving LAZY tokens
+  bool lazy_bodies;
+  /// If not NULL, echo the preprocessed text here
+  FILE* echo;
+  /// Bytes consumed so far, for lazy body offsets
+  size_t offset;
+  /// The next token starts a statement
+  bool stmt_start;
+  mcsh_scan_fn_state fn_state;
+  /// Brace depth in a signature or skipped body
+  int depth;
+  size_t body_offset;
+  int body_line;
+} mcsh_scan_state;
+
+typedef struct mcsh_parse_context_s mcsh_parse_context;
+
+/** Receives a chain of complete top-level statements
+    and takes ownership of it.
+    @return False to stop the parse */
+typedef bool (*mcsh_parse_batch)(mcsh_parse_context* ctx,
+                                 mcsh_node* stmts);
+
+/** Per-call state shared by a grammar and its scanner:
+    there is no process-global parse state */
+struct mcsh_parse_context_s
+{
+  /// Resulting node tree goes here:
+  mcsh_node* output;
+  mcsh_parse_status status;
+  /// Current source line: incremented by the scanner
+  int line;
+  /// Set by the scanner for each token
+  bool token_quoted;
+  /// On error, the message, else NULL
+  char* message;
+  /// Function bodies skipped by the scanner
+  mcsh_lazy* lazy;
+  size_t lazy_count;
+  mcsh_scan_state scan;
+  /// If not NULL, top-level statements are passed here
+  /// in batches as they are parsed, instead of to output
+  mcsh_parse_batch batch;
+  void* batch_data;
+  size_t batch_size;
+  /// Statements held since the last batch
+  size_t batch_count;
+};
+
+static inline void
+mcsh_parse_context_init(mcsh_parse_context* ctx)
+{
+  ctx->output       = NULL;
+  ctx->status       = MCSH_PARSE_START;
+  ctx->line         = 1;
+  ctx->token_quoted = false;
+  ctx->message      = NULL;
+  ctx->lazy         = NULL;
+  ctx->lazy_count   = 0;
+  ctx->scan.lazy_bodies = false;
+  ctx->scan.echo        = NULL;
+  ctx->scan.offset      = 0;
+  ctx->batch            = NULL;
+  ctx->batch_data       = NULL;
+  ctx->batch_size       = 0;
+  ctx->batch_count      = 0;
+}
+
+void mcsh_parse_output_set(mcsh_parse_context* ctx, mcsh_node* node);
 
 static void
 mcsh_node_to_string(char* output, mcsh_node* node)
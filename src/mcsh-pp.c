@@ -5,23 +5,14 @@
 
 #include <assert.h>
 
-#include "buffer.h"
 #include "util.h"
 #include "mcsh-preprocess.h"
 
 int
 main(int argc, char* argv[])
 {
-  buffer code;
-  buffer_init(&code, 1024);
-  bool b = slurp_buffer(stdin, &code);
+  bool b = mcsh_script_preprocess_file(stdin, stdout);
   assert(b);
 
-  // printf("[%s]\n", code.data);
-  mcsh_script_preprocess(code.data);
-  // printf("\nafter:\n");
-  // printf("[%s]\n", code.data);
-  printf("%s", code.data);
-
   return EXIT_SUCCESS;
 }
@@ -3,4 +3,13 @@
 
 #include <stdbool.h>
 
+#include "mcsh.h"
+
+/** Replace comments and line continuations in code with
+    whitespace, in place, keeping the line structure.
+    In mcsh-script-lexer.l, as the scanner does this itself
+*/
 bool mcsh_script_preprocess(char* code);
+
+/** As mcsh_script_preprocess(), streaming from in to out */
+bool mcsh_script_preprocess_file(FILE* in, FILE* out);
@@ -0,0 +1,242 @@
+
+/**
+   MCSH PROFILE C
+*/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mcsh-profile.h"
+#include "util.h"
+
+static const char* kind_names[] = { "stmt", "function", "builtin" };
+
+mcsh_profile*
+mcsh_profile_create(const char* prefix)
+{
+  mcsh_profile* profile = malloc_checked(sizeof(*profile));
+  profile->prefix = strdup_checked((char*) prefix);
+  table_init(&profile->entries, 1024);
+  table_init(&profile->stacks,  1024);
+  profile->depth    = 0;
+  profile->capacity = 64;
+  profile->frames   = malloc_checked(profile->capacity *
+                                     sizeof(mcsh_profile_frame));
+  buffer_init(&profile->stack, 1024);
+  return profile;
+}
+
+static inline uint64_t
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static mcsh_profile_entry*
+entry_get(mcsh_profile* profile, mcsh_profile_kind kind,
+          const char* name)
+{
+  char key[PATH_MAX+64];
+  snprintf(key, sizeof(key), "%i:%s", kind, name);
+  mcsh_profile_entry* entry;
+  if (table_search(&profile->entries, key, (void*) &entry))
+    return entry;
+  entry = calloc_checked(1, sizeof(*entry));
+  entry->kind = kind;
+  entry->name = strdup_checked((char*) name);
+  table_add(&profile->entries, key, entry);
+  return entry;
+}
+
+void
+mcsh_profile_enter(mcsh_profile* profile,
+                   mcsh_profile_kind kind, const char* name)
+{
+  // Do not count our own allocations:
+  unsigned long allocs = util_allocs;
+  if (profile->depth == profile->capacity)
+  {
+    profile->capacity *= 2;
+    profile->frames = realloc_checked(profile->frames,
+                                      profile->capacity *
+                                      sizeof(mcsh_profile_frame));
+  }
+  mcsh_profile_frame* frame = &profile->frames[profile->depth++];
+  frame->entry = entry_get(profile, kind, name);
+  frame->entry->count++;
+  frame->entry->active++;
+  frame->stack_length = profile->stack.length;
+  if (profile->stack.length > 0)
+    buffer_catc(&profile->stack, ';');
+  buffer_cat(&profile->stack, name);
+  frame->children        = 0;
+  frame->allocs_children = 0;
+  util_allocs = allocs;
+  frame->allocs_start = allocs;
+  frame->start = now();
+}
+
+static void
+stack_charge(mcsh_profile* profile, uint64_t ns)
+{
+  uint64_t* total;
+  if (! table_search(&profile->stacks, profile->stack.data,
+                     (void*) &total))
+  {
+    total = calloc_checked(1, sizeof(*total));
+    table_add(&profile->stacks, profile->stack.data, total);
+  }
+  *total += ns;
+}
+
+void
+mcsh_profile_exit(mcsh_profile* profile)
+{
+  uint64_t t = now();
+  unsigned long allocs = util_allocs;
+  valgrind_assert(profile->depth > 0);
+  mcsh_profile_frame* frame = &profile->frames[--profile->depth];
+  mcsh_profile_entry* entry = frame->entry;
+
+  uint64_t inclusive = t - frame->start;
+  uint64_t exclusive = inclusive - frame->children;
+  unsigned long allocs_inclusive = allocs - frame->allocs_start;
+  entry->exclusive        += exclusive;
+  entry->allocs_exclusive += allocs_inclusive - frame->allocs_children;
+  // A recursive entry is already timed by its outermost frame:
+  if (--entry->active == 0)
+  {
+    entry->inclusive += inclusive;
+    entry->allocs    += allocs_inclusive;
+  }
+
+  stack_charge(profile, exclusive);
+  if (frame->stack_length == 0)
+    buffer_reset(&profile->stack);
+  else
+  {
+    profile->stack.length = frame->stack_length;
+    profile->stack.data[frame->stack_length-1] = '\0';
+  }
+
+  if (profile->depth > 0)
+  {
+    mcsh_profile_frame* parent = &profile->frames[profile->depth-1];
+    parent->children        += inclusive;
+    parent->allocs_children += allocs_inclusive;
+  }
+  util_allocs = allocs;
+}
+
+/** Most exclusive time first */
+static int
+entry_compare(const void* a, const void* b)
+{
+  const mcsh_profile_entry* x = *(mcsh_profile_entry* const*) a;
+  const mcsh_profile_entry* y = *(mcsh_profile_entry* const*) b;
+  if (x->exclusive != y->exclusive)
+    return x->exclusive < y->exclusive ? 1 : -1;
+  return strcmp(x->name, y->name);
+}
+
+static bool
+write_report(mcsh_profile* profile)
+{
+  char filename[PATH_MAX];
+  snprintf(filename, PATH_MAX, "%s.txt", profile->prefix);
+  FILE* fp = fopen(filename, "w");
+  if (fp == NULL) return false;
+
+  size_t count = table_size(&profile->entries);
+  mcsh_profile_entry** sorted =
+    malloc_checked((count+1) * sizeof(mcsh_profile_entry*));
+  size_t i = 0;
+  TABLE_FOREACH(&profile->entries, item)
+    sorted[i++] = item->data;
+  qsort(sorted, count, sizeof(mcsh_profile_entry*), entry_compare);
+
+  fprintf(fp, "# mcsh profile: times in milliseconds\n");
+  fprintf(fp, "# %10s %10s %10s %10s %10s  %-8s  %s\n",
+          "self", "total", "calls", "self-alloc", "allocs",
+          "kind", "name");
+  for (i = 0; i < count; i++)
+  {
+    mcsh_profile_entry* e = sorted[i];
+    fprintf(fp, "  %10.3f %10.3f %10"PRIu64" %10"PRIu64" "
+            "%10"PRIu64"  %-8s  %s\n",
+            e->exclusive / 1e6, e->inclusive / 1e6, e->count,
+            e->allocs_exclusive, e->allocs,
+            kind_names[e->kind], e->name);
+  }
+  free(sorted);
+  return fclose(fp) == 0;
+}
+
+/** In the collapsed-stack format of flamegraph.pl:
+    one line per stack, with the nanoseconds spent in its top */
+static bool
+write_folded(mcsh_profile* profile)
+{
+  char filename[PATH_MAX];
+  snprintf(filename, PATH_MAX, "%s.folded", profile->prefix);
+  FILE* fp = fopen(filename, "w");
+  if (fp == NULL) return false;
+  TABLE_FOREACH(&profile->stacks, item)
+  {
+    uint64_t* total = item->data;
+    fprintf(fp, "%s %"PRIu64"\n", item->key, *total);
+  }
+  return fclose(fp) == 0;
+}
+
+bool
+mcsh_profile_write(mcsh_profile* profile, mcsh_logger* logger)
+{
+  // Frames left open by exit:
+  while (profile->depth > 0)
+    mcsh_profile_exit(profile);
+  errno = 0;
+  bool result = write_report(profile) && write_folded(profile);
+  if (! result)
+  {
+    // Keep the script's stdout clean:
+    int e = errno;
+    fprintf(stderr, "mcsh: could not write profile: %s: %s\n",
+            profile->prefix, strerror(e));
+    mcsh_log(logger, MCSH_LOG_SYSTEM, MCSH_WARN,
+             "could not write profile: %s: %s",
+             profile->prefix, strerror(e));
+  }
+  return result;
+}
+
+static void
+entry_free(void* context, const char* name, void* data)
+{
+  mcsh_profile_entry* entry = data;
+  free(entry->name);
+  free(entry);
+}
+
+static void
+total_free(void* context, const char* name, void* data)
+{
+  free(data);
+}
+
+void
+mcsh_profile_free(mcsh_profile* profile)
+{
+  table_free_callback(&profile->entries, false, entry_free,  NULL);
+  table_free_callback(&profile->stacks,  false, total_free, NULL);
+  buffer_finalize(&profile->stack);
+  free(profile->frames);
+  free(profile->prefix);
+  free(profile);
+}
@@ -0,0 +1,84 @@
+
+/**
+   MCSH PROFILE H
+   Statement, function, and builtin profiler for mcsh --profile.
+   Each enter/exit pair is a frame on a stack of frames.
+   Time in a frame not spent in its child frames is its
+   exclusive time: it is charged to the entry and
+   to the collapsed stack of frame names.
+   Allocations are counted with util_allocs.
+   When the VM has no profile, nothing here is called.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "buffer.h"
+#include "log.h"
+#include "table.h"
+
+typedef enum
+{
+  MCSH_PROFILE_STMT,
+  MCSH_PROFILE_FUNCTION,
+  MCSH_PROFILE_BUILTIN
+} mcsh_profile_kind;
+
+typedef struct
+{
+  mcsh_profile_kind kind;
+  /// source:line, or the function or builtin name
+  char* name;
+  uint64_t count;
+  /// Nanoseconds, not counting recursive frames twice
+  uint64_t inclusive;
+  uint64_t exclusive;
+  /// Allocations
+  uint64_t allocs;
+  uint64_t allocs_exclusive;
+  /// Number of frames for this entry on the stack
+  int active;
+} mcsh_profile_entry;
+
+typedef struct
+{
+  mcsh_profile_entry* entry;
+  uint64_t start;
+  uint64_t children;
+  unsigned long allocs_start;
+  unsigned long allocs_children;
+  /// Length of the collapsed stack before this frame
+  size_t stack_length;
+} mcsh_profile_frame;
+
+typedef struct
+{
+  /// Output file prefix: writes PREFIX.txt and PREFIX.folded
+  char* prefix;
+  /// Map from kind and name to mcsh_profile_entry*
+  struct table entries;
+  /// Map from collapsed stack "a;b;c" to uint64_t* nanoseconds
+  struct table stacks;
+  mcsh_profile_frame* frames;
+  size_t depth;
+  size_t capacity;
+  /// The current collapsed stack
+  buffer stack;
+} mcsh_profile;
+
+mcsh_profile* mcsh_profile_create(const char* prefix);
+
+/** name is copied if this is a new entry */
+void mcsh_profile_enter(mcsh_profile* profile,
+                        mcsh_profile_kind kind, const char* name);
+
+void mcsh_profile_exit(mcsh_profile* profile);
+
+/** Close any open frames and write the report files.
+    Errors are reported on stderr and to the logger.
+    @return False on I/O error */
+bool mcsh_profile_write(mcsh_profile* profile, mcsh_logger* logger);
+
+void mcsh_profile_free(mcsh_profile* profile);
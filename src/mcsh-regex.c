@@ -0,0 +1,160 @@
+
+/**
+   MCSH REGEX C
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mcsh-regex.h"
+#include "util.h"
+
+typedef struct
+{
+  /// NULL if this slot is empty
+  char* pattern;
+  int cflags;
+  regex_t regex;
+  /// Clock value at last use: the least is evicted first
+  uint64_t used;
+} entry;
+
+struct mcsh_regex_cache_s
+{
+  size_t size;
+  uint64_t clock;
+  entry entries[];
+};
+
+mcsh_regex_cache*
+mcsh_regex_cache_create(size_t size)
+{
+  valgrind_assert(size > 0);
+  mcsh_regex_cache* cache =
+    malloc_checked(sizeof(*cache) + size * sizeof(entry));
+  cache->size  = size;
+  cache->clock = 0;
+  for (size_t i = 0; i < size; i++)
+    cache->entries[i].pattern = NULL;
+  return cache;
+}
+
+static void
+entry_clear(entry* e)
+{
+  if (e->pattern == NULL) return;
+  regfree(&e->regex);
+  free(e->pattern);
+  e->pattern = NULL;
+}
+
+void
+mcsh_regex_cache_free(mcsh_regex_cache* cache)
+{
+  for (size_t i = 0; i < cache->size; i++)
+    entry_clear(&cache->entries[i]);
+  free(cache);
+}
+
+regex_t*
+mcsh_regex_get(mcsh_regex_cache* cache,
+               const char* pattern, int cflags,
+               char* error, size_t error_max)
+{
+  cflags |= REG_EXTENDED;
+  cache->clock++;
+  // The slot to fill on a miss: empty, else least recently used
+  entry* victim = &cache->entries[0];
+  for (size_t i = 0; i < cache->size; i++)
+  {
+    entry* e = &cache->entries[i];
+    if (e->pattern == NULL)
+    {
+      if (victim->pattern != NULL) victim = e;
+      continue;
+    }
+    if (e->cflags == cflags && strcmp(e->pattern, pattern) == 0)
+    {
+      e->used = cache->clock;
+      return &e->regex;
+    }
+    if (victim->pattern != NULL && e->used < victim->used)
+      victim = e;
+  }
+
+  entry_clear(victim);
+  int rc = regcomp(&victim->regex, pattern, cflags);
+  if (rc != 0)
+  {
+    regerror(rc, &victim->regex, error, error_max);
+    regfree(&victim->regex);
+    return NULL;
+  }
+  victim->pattern = strdup_checked((char*) pattern);
+  victim->cflags  = cflags;
+  victim->used    = cache->clock;
+  return &victim->regex;
+}
+
+/** Append n bytes of text, which is followed by more text */
+static inline void
+cat_slice(buffer* B, const char* text, size_t n)
+{
+  buffer_catn(B, text, n);
+  // buffer_catn() copied the following byte too:
+  B->data[B->length-1] = '\0';
+}
+
+static void
+substitute(buffer* B, const char* s, const regmatch_t* m,
+           size_t groups, const char* subst)
+{
+  for (const char* p = subst; *p != '\0'; p++)
+  {
+    size_t g;
+    if (*p == '&')
+      g = 0;
+    else if (*p == '\\' && p[1] >= '0' && p[1] <= '9')
+      g = *++p - '0';
+    else
+    {
+      if (*p == '\\' && p[1] != '\0') p++;
+      buffer_catc(B, *p);
+      continue;
+    }
+    // Groups that do not exist or did not match are empty:
+    if (g < groups && m[g].rm_so >= 0)
+      cat_slice(B, s + m[g].rm_so, m[g].rm_eo - m[g].rm_so);
+  }
+}
+
+size_t
+mcsh_regex_replace(const regex_t* regex, const char* string,
+                   const char* subst, bool global,
+                   buffer* output)
+{
+  regmatch_t m[10];
+  size_t groups = regex->re_nsub + 1;
+  if (groups > 10) groups = 10;
+  size_t count = 0;
+  const char* p = string;
+  int eflags = 0;
+  while (regexec(regex, p, groups, m, eflags) == 0)
+  {
+    cat_slice(output, p, m[0].rm_so);
+    substitute(output, p, m, groups, subst);
+    count++;
+    p += m[0].rm_eo;
+    if (m[0].rm_so == m[0].rm_eo)
+    {
+      // An empty match: step over one character
+      if (*p == '\0') break;
+      buffer_catc(output, *p);
+      p++;
+    }
+    if (! global) break;
+    eflags = REG_NOTBOL;
+  }
+  buffer_cat(output, p);
+  return count;
+}
@@ -0,0 +1,40 @@
+
+/**
+   MCSH REGEX H
+   POSIX extended regexes, compiled once and kept in a small
+   per-VM LRU cache keyed by pattern text and flags,
+   plus sed-style substitution
+*/
+
+#pragma once
+
+#include <regex.h>
+#include <stdbool.h>
+
+#include "buffer.h"
+
+/** Default count of compiled patterns kept by a cache */
+#define MCSH_REGEX_CACHE_DEFAULT 32
+
+typedef struct mcsh_regex_cache_s mcsh_regex_cache;
+
+mcsh_regex_cache* mcsh_regex_cache_create(size_t size);
+
+void mcsh_regex_cache_free(mcsh_regex_cache* cache);
+
+/** Find or compile pattern with REG_EXTENDED|cflags.
+    The result belongs to the cache, and is valid until the next
+    call on this cache.
+    @return NULL on a bad pattern, with a message in error */
+regex_t* mcsh_regex_get(mcsh_regex_cache* cache,
+                        const char* pattern, int cflags,
+                        char* error, size_t error_max);
+
+/** Append string to output with the first match of regex,
+    or every match if global, replaced by subst.
+    In subst, & or \0 is the whole match, \1 to \9 are groups,
+    and \& and \\ are literal.
+    @return The count of replacements */
+size_t mcsh_regex_replace(const regex_t* regex, const char* string,
+                          const char* subst, bool global,
+                          buffer* output);
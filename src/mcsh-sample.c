@@ -0,0 +1,240 @@
+
+/**
+   MCSH SAMPLE C
+*/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "mcsh-sample.h"
+#include "buffer.h"
+#include "list-array.h"
+#include "table.h"
+#include "util.h"
+
+bool mcsh_sampling = false;
+
+/** Maximal stack entries recorded per sample */
+#define SAMPLE_DEPTH 64
+
+/** Words in the sample buffer: calloc() leaves the pages
+    untouched until the handler writes them */
+static const size_t sample_words = 1 << 20;
+
+typedef struct
+{
+  mcsh_vm* vm;
+  /// The thread running vm: helper threads block SIGPROF,
+  /// see thread_create_noprof()
+  pthread_t thread;
+  /// Only this process writes the file, not forked children
+  pid_t pid;
+  char* filename;
+  /// Module source names: a frame's source ID is its index+1
+  list_array sources;
+  /// Each sample is its depth then that many frames,
+  /// each a source ID and a line
+  uintptr_t* words;
+  size_t capacity;
+  size_t used;
+  uint64_t samples;
+  /// Samples lost because the buffer was full
+  uint64_t dropped;
+} sampler;
+
+static sampler* current = NULL;
+
+static void
+sample_handler(UNUSED int signum)
+{
+  sampler* s = current;
+  if (s == NULL) return;
+  // Another thread must not walk this stack:
+  if (! pthread_equal(pthread_self(), s->thread)) return;
+  if (s->used + 1 + 2*SAMPLE_DEPTH > s->capacity)
+  {
+    s->dropped++;
+    return;
+  }
+  uintptr_t* record = &s->words[s->used];
+  size_t depth = 0;
+  // Copy the keys: the statements may be freed before exit
+  for (mcsh_entry* entry = s->vm->stack.current;
+       entry != NULL && depth < SAMPLE_DEPTH;
+       entry = entry->parent)
+    if (entry->stmt != NULL)
+    {
+      record[1 + 2*depth] = entry->stmt->module->sample_id;
+      record[2 + 2*depth] = entry->stmt->line;
+      depth++;
+    }
+  record[0] = depth;
+  s->used += 1 + 2*depth;
+  s->samples++;
+}
+
+static bool
+timer_set(long usec)
+{
+  struct itimerval t;
+  t.it_interval.tv_sec  = usec / 1000000;
+  t.it_interval.tv_usec = usec % 1000000;
+  t.it_value = t.it_interval;
+  return setitimer(ITIMER_PROF, &t, NULL) == 0;
+}
+
+void
+mcsh_sample_init(mcsh_vm* vm)
+{
+  if (current != NULL) return;
+  char* s = getenv("MCSH_PROF_HZ");
+  size_t hz;
+  if (s == NULL || s[0] == '\0') return;
+  if (! is_integer(s, &hz) || hz == 0 || hz > 1000000)
+  {
+    mcsh_log(&vm->logger, MCSH_LOG_CORE, MCSH_WARN,
+             "MCSH_PROF_HZ: not a rate: '%s'", s);
+    return;
+  }
+  char* f = getenv("MCSH_PROF_FILE");
+  if (f == NULL || f[0] == '\0') f = "mcsh-prof.folded";
+
+  sampler* result = malloc_checked(sizeof(*result));
+  result->vm       = vm;
+  result->thread   = pthread_self();
+  result->pid      = getpid();
+  result->filename = strdup_checked(f);
+  list_array_init(&result->sources, 8);
+  result->capacity = sample_words;
+  result->words    = calloc_checked(result->capacity, sizeof(uintptr_t));
+  result->used     = 0;
+  result->samples  = 0;
+  result->dropped  = 0;
+  current = result;
+  mcsh_sampling = true;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = sample_handler;
+  sa.sa_flags   = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+  if (! timer_set(1000000 / hz))
+    mcsh_log(&vm->logger, MCSH_LOG_CORE, MCSH_WARN,
+             "MCSH_PROF_HZ: setitimer failed: %s", strerror(errno));
+}
+
+void
+mcsh_sample_source(mcsh_module* module)
+{
+  sampler* s = current;
+  if (s == NULL || s->vm != module->vm) return;
+  list_array_add(&s->sources, strdup_checked(module->source));
+  module->sample_id = s->sources.size;
+}
+
+static void
+frame_name(sampler* s, uintptr_t id, uintptr_t line,
+           char* output, size_t size)
+{
+  const char* source = "(unknown)";
+  if (id > 0 && id <= s->sources.size)
+    source = s->sources.data[id-1];
+  snprintf(output, size, "%s:%i", source, (int) line);
+}
+
+/** Count the samples by stack, outermost entry first */
+static void
+samples_fold(sampler* s, struct table* stacks)
+{
+  buffer B;
+  buffer_init(&B, 1024);
+  char name[PATH_MAX+16];
+  size_t i = 0;
+  while (i < s->used)
+  {
+    size_t depth = s->words[i];
+    uintptr_t* frames = &s->words[i+1];
+    buffer_reset(&B);
+    if (depth == 0)
+      buffer_cat(&B, "(none)");
+    for (size_t j = depth; j > 0; j--)
+    {
+      frame_name(s, frames[2*j-2], frames[2*j-1], name, sizeof(name));
+      buffer_cat(&B, name);
+      if (j > 1) buffer_catc(&B, ';');
+    }
+    uint64_t* count;
+    if (! table_search(stacks, B.data, (void*) &count))
+    {
+      count = calloc_checked(1, sizeof(*count));
+      table_add(stacks, B.data, count);
+    }
+    (*count)++;
+    i += 1 + 2*depth;
+  }
+  buffer_finalize(&B);
+}
+
+static void
+count_free(void* context, const char* key, void* data)
+{
+  free(data);
+}
+
+static bool
+write_folded(sampler* s)
+{
+  struct table stacks;
+  table_init(&stacks, 1024);
+  samples_fold(s, &stacks);
+  FILE* fp = fopen(s->filename, "w");
+  if (fp != NULL)
+  {
+    TABLE_FOREACH(&stacks, item)
+    {
+      uint64_t* count = item->data;
+      fprintf(fp, "%s %"PRIu64"\n", item->key, *count);
+    }
+  }
+  table_free_callback(&stacks, false, count_free, NULL);
+  return fp != NULL && fclose(fp) == 0;
+}
+
+void
+mcsh_sample_exit(mcsh_vm* vm)
+{
+  sampler* s = current;
+  if (s == NULL || s->vm != vm) return;
+  timer_set(0);
+  signal(SIGPROF, SIG_DFL);
+  current = NULL;
+  mcsh_sampling = false;
+
+  if (s->pid == getpid())
+  {
+    mcsh_log(&vm->logger, MCSH_LOG_CORE, MCSH_INFO,
+             "sampler: samples=%"PRIu64" dropped=%"PRIu64,
+             s->samples, s->dropped);
+    errno = 0;
+    if (! write_folded(s))
+    {
+      int e = errno;
+      fprintf(stderr, "mcsh: could not write samples: %s: %s\n",
+              s->filename, strerror(e));
+      mcsh_log(&vm->logger, MCSH_LOG_CORE, MCSH_WARN,
+               "could not write samples: %s: %s",
+               s->filename, strerror(e));
+    }
+  }
+  free(s->words);
+  free(s->filename);
+  list_array_demolish(&s->sources);
+  free(s);
+}
@@ -0,0 +1,34 @@
+
+/**
+   MCSH SAMPLE H
+   Sampling profiler: MCSH_PROF_HZ=N takes N samples per second
+   of CPU time with setitimer(ITIMER_PROF).
+   Each sample is the source ID and line of the statement running
+   in each stack entry, innermost first, copied by the SIGPROF
+   handler into a buffer allocated at start.  Nothing is allocated or formatted
+   in the handler.
+   At exit the samples are counted by stack into a folded-stack
+   file for flamegraph.pl: MCSH_PROF_FILE, default mcsh-prof.folded
+   The itimer is per process, so only the first VM is sampled.
+   Other threads are started with SIGPROF blocked.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "mcsh.h"
+
+/** True while the sampler runs:
+    then each statement is recorded in its stack entry */
+extern bool mcsh_sampling;
+
+/** Reads MCSH_PROF_HZ and MCSH_PROF_FILE, and starts the timer */
+void mcsh_sample_init(mcsh_vm* vm);
+
+/** If module->vm is sampled, give the module its sample_id:
+    called before its first statement runs */
+void mcsh_sample_source(mcsh_module* module);
+
+/** If vm is sampled, stop the timer and write the folded stacks */
+void mcsh_sample_exit(mcsh_vm* vm);
@@ -0,0 +1,390 @@
+
+/**
+   MCSH SAVE C
+   File format, in host byte order as for the cache:
+   HEADER: magic, uint32 version, uint32 byte order mark
+   VALUE:  uint8 tag, then:
+           NULL:   nothing
+           STRING: string as in mcsh-pack
+           INT:    int64
+           FLOAT:  double
+           LIST:   uint64 bytes, uint64 count, count VALUE
+           TABLE:  uint64 bytes, uint64 count, count (string, VALUE)
+   bytes is the length of the rest of the list or table
+   Tags are save_tag, not mcsh_value_type, and must never change
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mcsh-save.h"
+#include "exceptions.h"
+#include "mcsh-data.h"
+#include "mcsh-pack.h"
+
+static const char     save_magic[8] = "MCSHDATA";
+static const uint32_t save_version  = 1;
+static const uint32_t save_order    = 0x01020304;
+
+/** Distinguishes temporary files from threads of this process */
+static int save_count = 0;
+
+/** Type tags in the file: frozen, so files outlive any change
+    to mcsh_value_type */
+typedef enum
+{
+  SAVE_NULL   = 0,
+  SAVE_STRING = 1,
+  SAVE_INT    = 2,
+  SAVE_FLOAT  = 3,
+  SAVE_LIST   = 4,
+  SAVE_TABLE  = 5
+} save_tag;
+
+static inline void
+put_tag(buffer* B, save_tag tag)
+{
+  uint8_t t = (uint8_t) tag;
+  buffer_put(B, &t, 1);
+}
+
+/** Fill in the bytes of the container that starts at mark */
+static inline void
+patch_size(buffer* B, size_t mark)
+{
+  uint64_t n = B->length - mark - sizeof(n);
+  memcpy(B->data + mark, &n, sizeof(n));
+}
+
+static bool
+save_value(mcsh_logger* logger, mcsh_value* value, buffer* B,
+           mcsh_status* status)
+{
+  char t[64];
+  size_t mark;
+  status->code = MCSH_OK;
+  switch (value->type)
+  {
+    case MCSH_VALUE_NULL:
+      put_tag(B, SAVE_NULL);
+      break;
+    case MCSH_VALUE_STRING:
+      put_tag(B, SAVE_STRING);
+      mcsh_pack_string(B, value->string);
+      break;
+    case MCSH_VALUE_INT:
+      put_tag(B, SAVE_INT);
+      mcsh_pack_int(B, value->integer);
+      break;
+    case MCSH_VALUE_FLOAT:
+      put_tag(B, SAVE_FLOAT);
+      buffer_put(B, &value->number, sizeof(value->number));
+      break;
+    case MCSH_VALUE_LIST:
+      put_tag(B, SAVE_LIST);
+      mark = B->length;
+      mcsh_pack_size(B, 0);
+      mcsh_pack_size(B, value->list->size);
+      for (size_t i = 0; i < value->list->size; i++)
+      {
+        save_value(logger, value->list->data[i], B, status);
+        PROPAGATE(status);
+      }
+      patch_size(B, mark);
+      break;
+    case MCSH_VALUE_TABLE:
+      put_tag(B, SAVE_TABLE);
+      mark = B->length;
+      mcsh_pack_size(B, 0);
+      mcsh_pack_size(B, table_size(value->table));
+      TABLE_FOREACH(value->table, item)
+      {
+        mcsh_pack_string(B, item->key);
+        save_value(logger, item->data, B, status);
+        PROPAGATE(status);
+      }
+      patch_size(B, mark);
+      break;
+    case MCSH_VALUE_LINK:
+      return save_value(logger, value->link, B, status);
+    default:
+      mcsh_value_type_name(value->type, t);
+      RAISE(status, NULL, 0, "mcsh.invalid_type",
+            "save: cannot save value of type: %s", t);
+  }
+  return true;
+}
+
+bool
+mcsh_save(mcsh_logger* logger, mcsh_value* value,
+          const char* filename, mcsh_status* status)
+{
+  buffer B;
+  buffer_init(&B, 4096);
+  buffer_put(&B, save_magic,    sizeof(save_magic));
+  buffer_put(&B, &save_version, sizeof(save_version));
+  buffer_put(&B, &save_order,   sizeof(save_order));
+  save_value(logger, value, &B, status);
+  if (status->code != MCSH_OK)
+  {
+    buffer_finalize(&B);
+    return true;
+  }
+
+  // Write then rename so readers never see a partial file
+  char tmp[PATH_MAX+64];
+  snprintf(tmp, sizeof(tmp), "%s.%i.%i.tmp", filename, getpid(),
+           __atomic_add_fetch(&save_count, 1, __ATOMIC_RELAXED));
+  bool ok = false;
+  FILE* fp = fopen(tmp, "w");
+  if (fp != NULL)
+  {
+    ok = (fwrite(B.data, 1, B.length, fp) == B.length);
+    if (fclose(fp) != 0) ok = false;
+    if (ok) ok = (rename(tmp, filename) == 0);
+    if (! ok) unlink(tmp);
+  }
+  int e = errno;
+  mcsh_log(logger, MCSH_LOG_BUILTIN, MCSH_INFO,
+           "save: %s: %zi bytes", filename, B.length);
+  buffer_finalize(&B);
+  RAISE_IF(! ok, status, NULL, 0, "mcsh.io",
+           "save: could not write: '%s': %s", filename, strerror(e));
+  return true;
+}
+
+/** Step over one VALUE without decoding it */
+static bool
+skip_value(const char** p, const char* end)
+{
+  uint8_t tag;
+  uint64_t n;
+  if (! mcsh_unpack_bytes(p, end, &tag, 1)) return false;
+  switch (tag)
+  {
+    case SAVE_NULL:
+      n = 0;
+      break;
+    case SAVE_INT:
+    case SAVE_FLOAT:
+      n = 8;
+      break;
+    case SAVE_STRING:
+    case SAVE_LIST:
+    case SAVE_TABLE:
+      if (! mcsh_unpack_bytes(p, end, &n, sizeof(n))) return false;
+      break;
+    default:
+      return false;
+  }
+  if ((uint64_t) (end - *p) < n) return false;
+  *p += n;
+  return true;
+}
+
+static bool
+load_value(mcsh_vm* vm, const char** p, const char* end,
+           mcsh_value** output)
+{
+  uint8_t tag;
+  uint64_t n;
+  int64_t i;
+  double d;
+  char* s;
+  mcsh_value* result;
+  mcsh_value* item;
+  if (! mcsh_unpack_bytes(p, end, &tag, 1)) return false;
+  switch (tag)
+  {
+    case SAVE_NULL:
+      result = mcsh_value_new_null();
+      break;
+    case SAVE_STRING:
+      if (! mcsh_unpack_string(p, end, &s)) return false;
+      result = mcsh_value_new_string_take(s);
+      break;
+    case SAVE_INT:
+      if (! mcsh_unpack_int(p, end, &i)) return false;
+      result = mcsh_value_new_int(i);
+      break;
+    case SAVE_FLOAT:
+      if (! mcsh_unpack_bytes(p, end, &d, sizeof(d))) return false;
+      result = mcsh_value_new_float(d);
+      break;
+    case SAVE_LIST:
+      // Each entry takes at least a byte:
+      if (! mcsh_unpack_bytes(p, end, &n, sizeof(n)) ||
+          ! mcsh_unpack_bytes(p, end, &n, sizeof(n)) ||
+          n > (uint64_t) (end - *p))
+        return false;
+      result = mcsh_value_new_list_sized(vm, n > 0 ? n : 1);
+      for (uint64_t j = 0; j < n; j++)
+      {
+        if (! load_value(vm, p, end, &item))
+        {
+          mcsh_value_free(&vm->logger, result);
+          return false;
+        }
+        list_array_add(result->list, item);
+        mcsh_value_grab(&vm->logger, item);
+      }
+      break;
+    case SAVE_TABLE:
+      // Each entry takes at least a byte:
+      if (! mcsh_unpack_bytes(p, end, &n, sizeof(n)) ||
+          ! mcsh_unpack_bytes(p, end, &n, sizeof(n)) ||
+          n > (uint64_t) (end - *p))
+        return false;
+      result = mcsh_value_new_table(vm, n > 0 ? n : 1);
+      for (uint64_t j = 0; j < n; j++)
+      {
+        if (! mcsh_unpack_string(p, end, &s))
+        {
+          mcsh_value_free(&vm->logger, result);
+          return false;
+        }
+        if (! load_value(vm, p, end, &item))
+        {
+          free(s);
+          mcsh_value_free(&vm->logger, result);
+          return false;
+        }
+        table_add(result->table, s, item);
+        mcsh_value_grab(&vm->logger, item);
+        free(s);
+      }
+      break;
+    default:
+      return false;
+  }
+  *output = result;
+  return true;
+}
+
+/** Move *p from a list or table to its member key,
+    stepping over the members before it.
+    @return False if the data is corrupt.  Sets *found */
+static bool
+load_step(const char** p, const char* end, const char* key,
+          bool* found)
+{
+  uint8_t tag;
+  uint64_t n, count;
+  *found = false;
+  if (! mcsh_unpack_bytes(p, end, &tag, 1)) return false;
+  if (tag != SAVE_LIST && tag != SAVE_TABLE)
+    return true;
+  if (! mcsh_unpack_bytes(p, end, &n, sizeof(n)) ||
+      ! mcsh_unpack_bytes(p, end, &count, sizeof(count)))
+    return false;
+  if (tag == SAVE_LIST)
+  {
+    size_t index;
+    if (! is_integer(key, &index) || index >= count) return true;
+    for (size_t i = 0; i < index; i++)
+      if (! skip_value(p, end)) return false;
+    *found = true;
+    return true;
+  }
+  size_t length = strlen(key);
+  for (uint64_t i = 0; i < count; i++)
+  {
+    // Compare the key in place:
+    if (! mcsh_unpack_bytes(p, end, &n, sizeof(n))) return false;
+    if ((uint64_t) (end - *p) < n) return false;
+    bool match = (n == length && memcmp(*p, key, n) == 0);
+    *p += n;
+    if (match)
+    {
+      *found = true;
+      return true;
+    }
+    if (! skip_value(p, end)) return false;
+  }
+  return true;
+}
+
+static bool
+load_header(const char** p, const char* end)
+{
+  char magic[sizeof(save_magic)];
+  uint32_t version, order;
+  return mcsh_unpack_bytes(p, end, magic,    sizeof(magic))   &&
+         mcsh_unpack_bytes(p, end, &version, sizeof(version)) &&
+         mcsh_unpack_bytes(p, end, &order,   sizeof(order))   &&
+         memcmp(magic, save_magic, sizeof(magic)) == 0 &&
+         version == save_version && order == save_order;
+}
+
+/** Path element value as a key: strings and integers */
+static bool
+path_key(mcsh_value* value, char* output, size_t size,
+         mcsh_status* status)
+{
+  mcsh_resolve(value);
+  if (value->type == MCSH_VALUE_STRING)
+    snprintf(output, size, "%s", value->string);
+  else if (value->type == MCSH_VALUE_INT)
+    snprintf(output, size, "%"PRIi64, value->integer);
+  else
+    RAISE(status, NULL, 0, "mcsh.invalid_arguments",
+          "load: a key must be a string or int");
+  status->code = MCSH_OK;
+  return true;
+}
+
+bool
+mcsh_load(mcsh_vm* vm, const char* filename,
+          list_array* args, size_t first,
+          mcsh_value** output, mcsh_status* status)
+{
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  RAISE_IF(fd == -1, status, NULL, 0, "mcsh.io",
+           "load: could not open: '%s': %s", filename, strerror(errno));
+  struct stat s;
+  s.st_size = 0;
+  char* map = MAP_FAILED;
+  if (fstat(fd, &s) == 0 && s.st_size > 0)
+    map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int e = errno;
+  close(fd);
+  RAISE_IF(map == MAP_FAILED, status, NULL, 0, "mcsh.io",
+           "load: could not map: '%s': %s", filename,
+           s.st_size == 0 ? "empty file" : strerror(e));
+
+  const char* p   = map;
+  const char* end = map + s.st_size;
+  char key[1024];
+  bool ok = load_header(&p, end);
+  status->code = MCSH_OK;
+  for (size_t i = first; ok && i < args->size; i++)
+  {
+    path_key(args->data[i], key, sizeof(key), status);
+    if (status->code != MCSH_OK) break;
+    bool found;
+    ok = load_step(&p, end, key, &found);
+    if (ok && ! found)
+      mcsh_raise(status, NULL, 0, "mcsh.undefined",
+                 "load: could not find key: '%s' in: '%s'",
+                 key, filename);
+    if (status->code != MCSH_OK) break;
+  }
+  mcsh_value* value = NULL;
+  if (ok && status->code == MCSH_OK)
+    ok = load_value(vm, &p, end, &value) &&
+      (first < args->size || p == end);
+  munmap(map, s.st_size);
+  if (! ok && value != NULL)
+    mcsh_value_free(&vm->logger, value);
+  PROPAGATE(status);
+  RAISE_IF(! ok, status, NULL, 0, "mcsh.io",
+           "load: not a valid data file: '%s'", filename);
+  maybe_assign(output, value);
+  return true;
+}
@@ -0,0 +1,24 @@
+
+/**
+   MCSH SAVE H
+   Data files for save and load: a versioned binary encoding of
+   null, string, int, float, list and table values, nested.
+   Each list and table records its encoded length, so load can
+   mmap() a file and decode only the value at a path of keys,
+   stepping over the rest without decoding it.
+*/
+
+#pragma once
+
+#include "mcsh.h"
+
+/** Write value to filename, replacing it whole.
+    Raises an exception for types that cannot be saved */
+bool mcsh_save(mcsh_logger* logger, mcsh_value* value,
+               const char* filename, mcsh_status* status);
+
+/** Decode the value in filename at the path args->data[first...]:
+    each is a table key or a list index */
+bool mcsh_load(mcsh_vm* vm, const char* filename,
+               list_array* args, size_t first,
+               mcsh_value** output, mcsh_status* status);
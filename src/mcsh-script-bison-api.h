@@ -7,6 +7,3 @@
 */
 
 #include <stdbool.h>
-
-// in mcsh.c
-extern bool mcsh_script_token_quoted;
@@ -5,20 +5,23 @@
 
 /* %name-prefix "mcsh_script_" */
 %define api.prefix {mcsh_script_}
+%define api.pure full
+%param       {yyscan_t scanner}
+%parse-param {mcsh_parse_context* ctx}
 
-%{
-  #include <stdio.h>
-  #include <stdlib.h>
-
+%code requires {
   #include "mcsh-script-parser.h"
 
-  // Declare stuff from Flex that Bison needs to know about:
-  extern int mcsh_script_lex();
-  extern FILE* mcsh_script_in;
-
-  extern int mcsh_script_line;
+  // The reentrant Flex scanner handle
+  #ifndef YY_TYPEDEF_YY_SCANNER_T
+  #define YY_TYPEDEF_YY_SCANNER_T
+  typedef void* yyscan_t;
+  #endif
+}
 
-  void yyerror(const char *s);
+%{
+  #include <stdio.h>
+  #include <stdlib.h>
 %}
 
 %union {
@@ -27,6 +30,8 @@
 }
 
 %token <sval> STRING
+// A function body skipped by the scanner
+%token <sval> LAZY
 
 %token LBRACE
 %token RBRACE
@@ -39,29 +44,51 @@
 %token END
 %token SEMICOLON
 
-%type   <node>          program stmts stmt term
+%type   <node>          program top stmts stmt term
+
+%code {
+  // Declare stuff from Flex that Bison needs to know about:
+  int mcsh_script_lex(MCSH_SCRIPT_STYPE* lval, yyscan_t scanner);
+
+  void yyerror(yyscan_t scanner, mcsh_parse_context* ctx,
+               const char* s);
+}
 
 %%
 
 program:
- stmts END {
-   mcsh_parse_output_set($1);
+ top END {
+   mcsh_parse_output_set(ctx, $1);
    $$ = $1;
    return 1;
  }
 
+// Top-level stmts: these may be run as they are parsed
+top:
+                stmt
+                { $$ = mcsh_node_top(ctx, NULL, $1, ctx->line); }
+        |
+                top NL stmt
+                { $$ = mcsh_node_top(ctx, $1, $3, ctx->line);
+                  if (ctx->status == MCSH_PARSE_STOP) YYACCEPT; }
+        |
+                top SEMICOLON stmt
+                { $$ = mcsh_node_top(ctx, $1, $3, ctx->line);
+                  if (ctx->status == MCSH_PARSE_STOP) YYACCEPT; }
+                ;
+
 stmts:
                 stmt
                 { // printf("bison: single stmt\n");
-                  $$ = mcsh_node_stmt(NULL, $1, mcsh_script_line); }
+                  $$ = mcsh_node_stmt(NULL, $1, ctx->line); }
         |
                 stmts NL stmt
                 { // printf("bison: node stmt NL\n");
-                  $$ = mcsh_node_stmt($1, $3, mcsh_script_line); }
+                  $$ = mcsh_node_stmt($1, $3, ctx->line); }
         |
                 stmts SEMICOLON stmt
                 { // printf("bison: node stmt SC\n");
-                  $$ = mcsh_node_stmt($1, $3, mcsh_script_line); }
+                  $$ = mcsh_node_stmt($1, $3, ctx->line); }
                 ;
 
 stmt:
@@ -71,29 +98,33 @@ stmt:
         |
                 stmt term
                 {
-                  $$ = mcsh_node_term($1, $2, mcsh_script_line);
+                  $$ = mcsh_node_term($1, $2, ctx->line);
                 }
                   ;
 
 term:
                 STRING
                 { // printf("bison: string: '%s' @ %i\n", $1,
-                  //        mcsh_script_line);
-                  $$ = mcsh_script_token($1, mcsh_script_line);
+                  //        ctx->line);
+                  $$ = mcsh_script_token(ctx, $1);
+                  free($1); }
+        |
+                LAZY
+                { $$ = mcsh_node_lazy(ctx, $1);
                   free($1); }
         |
                 LBRACE stmts RBRACE
                 { // printf("bison: block\n");
-                  $$ = mcsh_node_block($2, mcsh_script_line); }
+                  $$ = mcsh_node_block($2, ctx->line); }
         |
                 SUBCMD stmts RPARENS
                 { // printf("bison: subst\n");
-                  $$ = mcsh_node_subcmd($2, mcsh_script_line);
+                  $$ = mcsh_node_subcmd($2, ctx->line);
                 }
         |
                 FUNCTN stmts RPARENS
                 { // printf("bison: subst\n");
-                  $$ = mcsh_node_subfun($2, mcsh_script_line);
+                  $$ = mcsh_node_subfun($2, ctx->line);
                 }
                 ;
 %%
@@ -101,8 +132,9 @@ term:
 // extern int yylex(void);
 
 void
-yyerror(const char *s)
+yyerror(UNUSED yyscan_t scanner, mcsh_parse_context* ctx,
+        const char *s)
 {
-  printf("MCSH SCRIPT ERROR: line=%i %s \n", mcsh_script_line, s);
+  printf("MCSH SCRIPT ERROR: line=%i %s \n", ctx->line, s);
   exit(EXIT_FAILURE);
 }
@@ -3,12 +3,12 @@
 #include "mcsh-parser-nodes.h"
 
 mcsh_node*
-mcsh_script_token(char* term, int line)
+mcsh_script_token(mcsh_parse_context* ctx, char* term)
 {
-  // printf("add_token(): %i '%s'\n", mcsh_script_token_quoted, term);
+  // printf("add_token(): %i '%s'\n", ctx->token_quoted, term);
   char* p;
   size_t count;
-  if (mcsh_script_token_quoted)
+  if (ctx->token_quoted)
   {
     // Remove double-quotes
     p = &term[1];
@@ -21,7 +21,7 @@ mcsh_script_token(char* term, int line)
     count = strlen(p);
   }
 
-  mcsh_node* node = mcsh_node_token_sized(p, count, line);
+  mcsh_node* node = mcsh_node_token_sized(p, count, ctx->line);
   return node;
 }
 
@@ -46,6 +46,27 @@ mcsh_node_stmt(mcsh_node* left, mcsh_node* right, int line)
   return node;
 }
 
+mcsh_node*
+mcsh_node_top(mcsh_parse_context* ctx,
+              mcsh_node* left, mcsh_node* right, int line)
+{
+  if (ctx->batch == NULL || right == NULL)
+    return mcsh_node_stmt(left, right, line);
+  ctx->batch_count++;
+  if (ctx->batch_count <= ctx->batch_size)
+    return mcsh_node_stmt(left, right, line);
+  // Hold back the newest statement: it may be the last one,
+  // which produces the result
+  ctx->batch_count = 1;
+  if (! ctx->batch(ctx, left))
+  {
+    mcsh_node_free(right, 0);
+    ctx->status = MCSH_PARSE_STOP;
+    return NULL;
+  }
+  return mcsh_node_stmt(NULL, right, line);
+}
+
 mcsh_node*
 mcsh_node_block(mcsh_node* stmts, int line)
 {
@@ -75,3 +96,16 @@ mcsh_node_subfun(mcsh_node* stmts, int line)
   list_array_add(&node->children, stmts);
   return node;
 }
+
+mcsh_node*
+mcsh_node_lazy(mcsh_parse_context* ctx, const char* index)
+{
+  size_t i = strtoul(index, NULL, 10);
+  valgrind_assert(i < ctx->lazy_count);
+  mcsh_lazy* lazy = malloc_checked(sizeof(*lazy));
+  *lazy = ctx->lazy[i];
+  mcsh_node* node =
+    mcsh_node_construct(MCSH_NODE_TYPE_LAZY, 1, lazy->line);
+  list_array_add(&node->children, lazy);
+  return node;
+}
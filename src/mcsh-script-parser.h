@@ -7,10 +7,21 @@
 
 #include "mcsh-parser.h"
 
-// in mcsh.c
-extern bool mcsh_script_token_quoted;
+/** Parse text into ctx->output.  Reentrant: all state is in ctx
+    and a scanner local to this call.
+    In mcsh-script-lexer.l
+    @return True on success
+*/
+bool mcsh_script_parse_string(mcsh_parse_context* ctx, char* text);
+
+/** As mcsh_script_parse_string(), but the scanner reads fp
+    in blocks, so the text is never held in memory whole.
+    Offsets of lazy bodies are relative to the starting position
+    of fp plus ctx->scan.offset
+*/
+bool mcsh_script_parse_file(mcsh_parse_context* ctx, FILE* fp);
 
-mcsh_node* mcsh_script_token(char* term, int line);
+mcsh_node* mcsh_script_token(mcsh_parse_context* ctx, char* term);
 
 mcsh_node* mcsh_node_term(mcsh_node* left, mcsh_node* right,
                           int line);
@@ -18,8 +29,16 @@ mcsh_node* mcsh_node_term(mcsh_node* left, mcsh_node* right,
 mcsh_node* mcsh_node_stmt(mcsh_node* left, mcsh_node* right,
                           int line);
 
+/** As mcsh_node_stmt() for top-level statements:
+    may pass the statements so far to ctx->batch */
+mcsh_node* mcsh_node_top(mcsh_parse_context* ctx,
+                         mcsh_node* left, mcsh_node* right, int line);
+
 mcsh_node* mcsh_node_block(mcsh_node* stmts, int line);
 
 mcsh_node* mcsh_node_subcmd(mcsh_node* stmts, int line);
 
 mcsh_node* mcsh_node_subfun(mcsh_node* stmts, int line);
+
+/** index: the text of a LAZY token */
+mcsh_node* mcsh_node_lazy(mcsh_parse_context* ctx, const char* index);
@@ -0,0 +1,43 @@
+
+/**
+   MCSH STATS H
+   Cheap event counters, always on.
+   Each VM has its own mcsh_stats: the counters are plain increments.
+   The containers have no VM, so table_expands and strmap_reallocs
+   are per thread.
+   Read them with the stats builtin or $STATS.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/** Maximal count of builtins: see builtins.c:builtin_add() */
+#define MCSH_STATS_BUILTINS 64
+
+typedef struct
+{
+  /// Statements executed
+  uint64_t stmts;
+  /// Calls to mcsh_stack_search()
+  uint64_t stack_searches;
+  /// Stack entries walked by those calls
+  uint64_t stack_depth;
+  /// Searches that fell through to the globals
+  uint64_t stack_misses;
+  /// Lookups that fell through to getenv()
+  uint64_t env_lookups;
+  /// Calls of user functions
+  uint64_t calls;
+  /// Expressions parsed
+  uint64_t exprs;
+  /// Forks by kind:
+  uint64_t fork_subcmd;
+  uint64_t fork_bg;
+  uint64_t fork_exec;
+  uint64_t fork_pforeach;
+  /// Dispatches indexed by builtin number
+  uint64_t builtins[MCSH_STATS_BUILTINS];
+} mcsh_stats;
+
+#define STATS(vm, counter) ((vm)->stats.counter++)
@@ -1,5 +1,8 @@
 
 #include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,11 +13,13 @@
 #include "mcsh-sys.h"
 
 #include "buffer.h"
+#include "exceptions.h"
+#include "mcsh-pack.h"
 
 static const int chunk = 128;
 
 bool
-mcsh_exec(UNUSED mcsh_module* module,
+mcsh_exec(mcsh_module* module,
           char* cmd,
           char** a,
           mcsh_value** output,
@@ -22,14 +27,16 @@ mcsh_exec(UNUSED mcsh_module* module,
 {
   // Need to initialize this for GCC 11.4.0 (Dunedin Ubuntu 22.04.4)
   int exitcode = 0;
+  // Do not duplicate pending writes into the child:
+  mcsh_handles_flush_all();
+  STATS(module->vm, fork_exec);
   pid_t pid = fork();
   if (pid != 0)
   {
-    show("pid: %i", pid);
     int status;
     waitpid(pid, &status, 0);
     exitcode = WEXITSTATUS(status);
-    show("exitcode: %i", exitcode);
+    TRACE(WAIT, pid, exitcode);
   }
   else
   {
@@ -59,11 +66,12 @@ mcsh_subcmd_capture(mcsh_module* module,
                     mcsh_value** output,
                     mcsh_status* status)
 {
-  printf("subcmd_capture ...\n");
   int pipefd[2]; // 0=read, 1=write
   int rc;
   rc = pipe(pipefd);
   assert(rc == 0);
+  mcsh_handles_flush_all();
+  STATS(module->vm, fork_subcmd);
   pid_t pid = fork();
   if (pid != 0)
   {
@@ -85,7 +93,7 @@ subcmd_parent(mcsh_module* module, mcsh_value** output, int* pipefd,
 {
   buffer B;
   buffer_init(&B, chunk);
-  printf("parent\n");
+  TRACE(SUBCMD_CAPTURE, pid, 0);
   close(pipefd[1]);
   char t[chunk];
   size_t total = 0;
@@ -105,7 +113,7 @@ subcmd_parent(mcsh_module* module, mcsh_value** output, int* pipefd,
   }
   char* data = buffer_dup(&B);
   // printf("parent: read: %zi '%s'\n", total, data);
-  printf("parent: read: %zi\n", total);
+  TRACE(SUBCMD_READ, pid, total);
   buffer_finalize(&B);
   *output = mcsh_value_new_string(module->vm, data);
   close(pipefd[0]);
@@ -133,8 +141,10 @@ subcmd_child(mcsh_module* module, mcsh_stmts* stmts,
   bool rc = mcsh_stmts_execute(module, stmts, NULL, status);
   CHECK(rc, "child error");
 
-  close(pipefd[1]);
-  return true;
+  // Do not return into the rest of the script:
+  mcsh_handles_flush_all();
+  fflush(stdout);
+  _exit(status->code == MCSH_OK ? 0 : 1);
 }
 
 static bool bg_parent(mcsh_module* module,
@@ -154,6 +164,8 @@ mcsh_bg(mcsh_module* module,
   mcsh_log(&module->vm->logger, MCSH_LOG_EVAL, MCSH_INFO,
            "bg ...");
   bool rc;
+  mcsh_handles_flush_all();
+  STATS(module->vm, fork_bg);
   pid_t pid = fork();
   if (pid != 0)
   {
@@ -201,3 +213,451 @@ bg_child(mcsh_module* module, mcsh_stmts* stmts,
            "bg_child: exit.");
   exit(EXIT_SUCCESS);
 }
+
+/** Frame sent from a pforeach worker to the parent per item.
+    Followed by length bytes of packed payload:
+    OK:        the body result value
+    RETURN:    the returned value
+    EXIT:      the exit code value
+    EXCEPTION: tag string, text string, line int
+    BREAK:     nothing
+*/
+typedef struct
+{
+  uint64_t index;
+  uint32_t code;
+  uint64_t length;
+} pforeach_frame;
+
+/** State held by the parent for each worker */
+typedef struct
+{
+  pid_t pid;
+  int fd;
+  /// Unconsumed bytes from fd
+  buffer B;
+  /// Start of the first unconsumed frame in B
+  size_t offset;
+} pforeach_worker;
+
+/** The first item that stopped the loop, if any */
+typedef struct
+{
+  size_t index;
+  mcsh_code code;
+  char* tag;
+  char* text;
+  int64_t line;
+  mcsh_value* value;
+} pforeach_stop;
+
+static void pforeach_child(mcsh_module* module, const char* name,
+                           mcsh_value* list, mcsh_value* body,
+                           int k, int workers, int fd);
+
+static bool pforeach_read(mcsh_vm* vm, pforeach_worker* worker,
+                          mcsh_value** results, pforeach_stop* stop);
+
+static void pforeach_discard(mcsh_logger* logger, mcsh_value* value);
+
+static void pforeach_abort(pforeach_worker* W, int started);
+
+static bool pforeach_finish(mcsh_module* module, mcsh_value** results,
+                            size_t count, pforeach_stop* stop,
+                            mcsh_value** output,
+                            mcsh_status* status);
+
+bool
+mcsh_pforeach(mcsh_module* module,
+              const char* name, mcsh_value* list,
+              int workers, mcsh_value* body,
+              mcsh_value** output,
+              mcsh_status* status)
+{
+  mcsh_vm* vm = module->vm;
+  size_t count = list->list->size;
+  if (count == 0)
+  {
+    maybe_assign(output, mcsh_value_new_list(vm));
+    status->code = MCSH_OK;
+    return true;
+  }
+  if ((size_t) workers > count) workers = count;
+  mcsh_log(&vm->logger, MCSH_LOG_EVAL, MCSH_INFO,
+           "pforeach: items=%zi workers=%i", count, workers);
+
+  // workers is user input, so not a VLA:
+  pforeach_worker* W = calloc_checked(workers, sizeof(*W));
+  for (int k = 0; k < workers; k++)
+  {
+    int pipefd[2]; // 0=read, 1=write
+    pid_t pid = -1;
+    if (pipe(pipefd) == 0)
+    {
+      mcsh_handles_flush_all();
+      STATS(vm, fork_pforeach);
+      pid = fork();
+      if (pid == -1)
+      {
+        int e = errno;
+        close(pipefd[0]);
+        close(pipefd[1]);
+        errno = e;
+      }
+    }
+    if (pid == -1)
+    {
+      int e = errno;
+      pforeach_abort(W, k);
+      RAISE(status, NULL, 0, "mcsh.os",
+            "pforeach: could not start worker %i: %s",
+            k, strerror(e));
+    }
+    if (pid == 0)
+    {
+      // Do not hold the read ends of the earlier workers:
+      for (int j = 0; j < k; j++)
+        close(W[j].fd);
+      close(pipefd[0]);
+      pforeach_child(module, name, list, body, k, workers,
+                     pipefd[1]);
+      // pforeach_child should not return!
+      assert(false);
+    }
+    close(pipefd[1]);
+    W[k].pid    = pid;
+    W[k].fd     = pipefd[0];
+    W[k].offset = 0;
+    buffer_init(&W[k].B, chunk);
+  }
+
+  mcsh_value** results = calloc_checked(count, sizeof(mcsh_value*));
+  // Count of results received in order from the first item:
+  size_t ready = 0;
+  pforeach_stop stop = { .index = count, .code = MCSH_OK,
+                         .tag = NULL, .text = NULL,
+                         .line = 0, .value = NULL };
+  struct pollfd* fds = calloc_checked(workers, sizeof(*fds));
+  int running = workers;
+  while (running > 0)
+  {
+    // Stop early once every item before the stop has arrived:
+    while (ready < stop.index && results[ready] != NULL)
+      ready++;
+    if (stop.index < count && ready >= stop.index)
+      break;
+    int n = 0;
+    for (int k = 0; k < workers; k++)
+    {
+      if (W[k].fd < 0) continue;
+      fds[n].fd     = W[k].fd;
+      fds[n].events = POLLIN;
+      n++;
+    }
+    int rc = poll(fds, n, -1);
+    if (rc == -1)
+    {
+      if (errno == EINTR) continue;
+      perror("mcsh: pforeach: poll");
+      abort();
+    }
+    for (int k = 0; k < workers; k++)
+    {
+      if (W[k].fd < 0) continue;
+      int i;
+      for (i = 0; i < n; i++)
+        if (fds[i].fd == W[k].fd) break;
+      if (fds[i].revents == 0) continue;
+      if (! pforeach_read(vm, &W[k], results, &stop))
+        running--;
+    }
+  }
+
+  for (int k = 0; k < workers; k++)
+  {
+    if (W[k].fd >= 0)
+    {
+      // Still running after the loop stopped:
+      kill(W[k].pid, SIGTERM);
+      close(W[k].fd);
+    }
+    int wstatus;
+    waitpid(W[k].pid, &wstatus, 0);
+    buffer_finalize(&W[k].B);
+  }
+  free(fds);
+  free(W);
+
+  return pforeach_finish(module, results, count, &stop,
+                         output, status);
+}
+
+/** Stop the workers started before a failed fork() and free W */
+static void
+pforeach_abort(pforeach_worker* W, int started)
+{
+  for (int k = 0; k < started; k++)
+  {
+    kill(W[k].pid, SIGTERM);
+    close(W[k].fd);
+    int wstatus;
+    waitpid(W[k].pid, &wstatus, 0);
+    buffer_finalize(&W[k].B);
+  }
+  free(W);
+}
+
+/**
+   Read available data from the worker and consume complete frames
+   @return False on EOF, the worker is done
+*/
+static bool
+pforeach_read(mcsh_vm* vm, pforeach_worker* worker,
+              mcsh_value** results, pforeach_stop* stop)
+{
+  char t[4096];
+  ssize_t count = read(worker->fd, t, sizeof(t));
+  if (count == -1)
+  {
+    if (errno == EINTR) return true;
+    perror("mcsh: pforeach: read");
+    abort();
+  }
+  if (count == 0)  // EOF
+  {
+    close(worker->fd);
+    worker->fd = -1;
+    return false;
+  }
+  buffer_put(&worker->B, t, count);
+
+  while (true)
+  {
+    const char* p   = worker->B.data + worker->offset;
+    const char* end = worker->B.data + worker->B.length;
+    pforeach_frame frame;
+    if ((size_t) (end - p) < sizeof(frame)) break;
+    memcpy(&frame, p, sizeof(frame));
+    if ((size_t) (end - p) < sizeof(frame) + frame.length) break;
+    p += sizeof(frame);
+    end = p + frame.length;
+    worker->offset += sizeof(frame) + frame.length;
+
+    // Items after the stop are discarded:
+    if (frame.index >= stop->index) continue;
+
+    mcsh_value* value = NULL;
+    bool rc = true;
+    if (frame.code == MCSH_OK &&
+        mcsh_unpack(vm, &p, end, &value))
+    {
+      results[frame.index] = value;
+      continue;
+    }
+
+    // This item stops the loop before any previous stop:
+    free(stop->tag);
+    free(stop->text);
+    stop->tag  = NULL;
+    stop->text = NULL;
+    if (stop->value != NULL)
+      pforeach_discard(&vm->logger, stop->value);
+    mcsh_code code = frame.code;
+    switch (code)
+    {
+      case MCSH_OK:  // The unpack above failed
+        rc = false;
+        break;
+      case MCSH_BREAK:
+        break;
+      case MCSH_RETURN:
+      case MCSH_EXIT:
+        rc = mcsh_unpack(vm, &p, end, &value);
+        break;
+      case MCSH_EXCEPTION:
+        rc = mcsh_unpack_string(&p, end, &stop->tag)  &&
+             mcsh_unpack_string(&p, end, &stop->text) &&
+             mcsh_unpack_int   (&p, end, &stop->line);
+        break;
+      default:
+        rc = false;
+    }
+    if (! rc)
+    {
+      // Report a bad result from the worker as its exception:
+      free(stop->tag);
+      free(stop->text);
+      char t[64];
+      snprintf(t, sizeof(t), "pforeach: corrupt result for item %"
+               PRIu64, frame.index);
+      stop->tag  = strdup_checked("mcsh.io");
+      stop->text = strdup_checked(t);
+      stop->line = 0;
+      code  = MCSH_EXCEPTION;
+      value = NULL;
+    }
+    stop->index = frame.index;
+    stop->code  = code;
+    stop->value = value;
+  }
+
+  // Compact: move any partial frame to the front
+  size_t remainder = worker->B.length - worker->offset;
+  memmove(worker->B.data, worker->B.data + worker->offset, remainder);
+  worker->B.length = remainder;
+  worker->offset   = 0;
+  return true;
+}
+
+static bool
+pforeach_finish(mcsh_module* module, mcsh_value** results,
+                size_t count, pforeach_stop* stop,
+                mcsh_value** output, mcsh_status* status)
+{
+  mcsh_vm* vm = module->vm;
+  mcsh_value* result = mcsh_value_new_list_sized(vm, stop->index+1);
+  bool complete = true;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (i < stop->index && results[i] == NULL)
+      complete = false;
+    if (results[i] == NULL) continue;
+    if (i < stop->index && complete)
+    {
+      list_array_add(result->list, results[i]);
+      mcsh_value_grab(&vm->logger, results[i]);
+    }
+    else
+      pforeach_discard(&vm->logger, results[i]);
+  }
+  free(results);
+
+  status->code = MCSH_OK;
+  if (!complete)
+  {
+    pforeach_discard(&vm->logger, result);
+    RAISE(status, NULL, 0, "mcsh.pforeach",
+          "pforeach: a worker exited before finishing its items");
+  }
+  switch (stop->code)
+  {
+    case MCSH_OK:
+    case MCSH_BREAK:
+      break;
+    case MCSH_RETURN:
+      pforeach_discard(&vm->logger, result);
+      maybe_assign(output, stop->value);
+      status->code = MCSH_RETURN;
+      return true;
+    case MCSH_EXIT:
+      pforeach_discard(&vm->logger, result);
+      maybe_assign(output, &mcsh_null);
+      status->code  = MCSH_EXIT;
+      status->value = stop->value;
+      return true;
+    case MCSH_EXCEPTION:
+      pforeach_discard(&vm->logger, result);
+      mcsh_raise(status, NULL, stop->line, stop->tag, "%s", stop->text);
+      free(stop->tag);
+      free(stop->text);
+      return true;
+    default:
+      valgrind_fail_msg("pforeach: bad stop code: %i", stop->code);
+  }
+  maybe_assign(output, result);
+  return true;
+}
+
+/** Free a received value that was never referenced */
+static void
+pforeach_discard(mcsh_logger* logger, mcsh_value* value)
+{
+  if (value->refs == 0)
+    mcsh_value_free(logger, value);
+}
+
+/** Write all of data to fd or abort */
+static void
+write_all(int fd, const void* data, size_t count)
+{
+  const char* p = data;
+  while (count > 0)
+  {
+    ssize_t n = write(fd, p, count);
+    if (n == -1)
+    {
+      if (errno == EINTR) continue;
+      // The parent may have stopped reading after a break:
+      if (errno == EPIPE) exit(EXIT_SUCCESS);
+      perror("mcsh: pforeach: write");
+      exit(EXIT_FAILURE);
+    }
+    p     += n;
+    count -= n;
+  }
+}
+
+static void
+pforeach_child(mcsh_module* module, const char* name,
+               mcsh_value* list, mcsh_value* body,
+               int k, int workers, int fd)
+{
+  pid_t pid = getpid();
+  mcsh.pid                    = pid;
+  module->vm->logger.pid      = pid;
+  module->vm->logger.show_pid = true;
+  mcsh_log(&module->vm->logger, MCSH_LOG_EVAL, MCSH_INFO,
+           "pforeach_child: %i", k);
+  mcsh_logger* logger = &module->vm->logger;
+  buffer B;
+  buffer_init(&B, chunk);
+  bool done = false;
+  for (size_t i = k; i < list->list->size && !done; i += workers)
+  {
+    mcsh_status status;
+    mcsh_status_init(&status);
+    mcsh_value* item = list->list->data[i];
+    mcsh_set_value(module, name, item, &status);
+    mcsh_value* value = &mcsh_null;
+    if (status.code != MCSH_EXCEPTION)
+      mcsh_stmts_execute(module, &body->block->stmts, &value, &status);
+    if (value == NULL) value = &mcsh_null;
+    if (status.code == MCSH_CONTINUE) value = &mcsh_null;
+    if (status.code == MCSH_EXIT)     value = status.value;
+    if (status.code == MCSH_PROTO || status.code == MCSH_CONTINUE)
+      status.code = MCSH_OK;
+    B.length = 0;
+    if (status.code == MCSH_OK     ||
+        status.code == MCSH_RETURN ||
+        status.code == MCSH_EXIT)
+    {
+      // Values that cannot be packed become exceptions:
+      mcsh_status ps;
+      // The parent cannot unpack a chan packed here:
+      mcsh_pack(logger, value, &B, false, &ps);
+      if (ps.code == MCSH_EXCEPTION)
+        status = ps;
+    }
+    if (status.code == MCSH_EXCEPTION)
+    {
+      B.length = 0;
+      mcsh_pack_string(&B, status.exception->tag);
+      mcsh_pack_string(&B, status.exception->text);
+      mcsh_pack_int(&B, status.exception->line);
+    }
+    pforeach_frame frame;
+    // Zero the padding too, it goes over the pipe:
+    memset(&frame, 0, sizeof(frame));
+    frame.index  = i;
+    frame.length = B.length;
+    frame.code   = status.code;
+    write_all(fd, &frame, sizeof(frame));
+    write_all(fd, B.data, B.length);
+    done = (frame.code != MCSH_OK);
+  }
+  buffer_finalize(&B);
+  close(fd);
+  mcsh_log(&module->vm->logger, MCSH_LOG_EVAL, MCSH_INFO,
+           "pforeach_child: exit.");
+  exit(EXIT_SUCCESS);
+}
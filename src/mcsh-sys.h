@@ -17,3 +17,15 @@ bool mcsh_bg(mcsh_module* module,
              mcsh_stmts* stmts,
              mcsh_value** output,
              mcsh_status* status);
+
+/** Run body once for each item in list across workers
+    forked processes, binding each item to name.
+    The output is a list of the body results in input order.
+    A break, return, exit, or exception in the body stops
+    the loop at that item, as in foreach
+ */
+bool mcsh_pforeach(mcsh_module* module,
+                   const char* name, mcsh_value* list,
+                   int workers, mcsh_value* body,
+                   mcsh_value** output,
+                   mcsh_status* status);
@@ -0,0 +1,216 @@
+
+/**
+   MCSH THREAD C
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mcsh-thread.h"
+#include "buffer.h"
+#include "exceptions.h"
+#include "handles.h"
+#include "mcsh-cache.h"
+#include "mcsh-data.h"
+#include "mcsh-pack.h"
+#include "table.h"
+#include "util.h"
+
+/** Thread IDs are unique in the process */
+static int64_t thread_ids = 0;
+
+static void
+thread_key(int64_t id, char* output, size_t size)
+{
+  snprintf(output, size, "%"PRIi64, id);
+}
+
+/** Bind the packed ARGS as the list $args */
+static bool
+thread_args(mcsh_vm* vm, mcsh_thread* t)
+{
+  const char* p   = t->args.data;
+  const char* end = t->args.data + t->args.length;
+  int64_t count;
+  if (! mcsh_unpack_int(&p, end, &count)) return false;
+  mcsh_value* list = mcsh_value_new_list_sized(vm, count);
+  for (int64_t i = 0; i < count; i++)
+  {
+    mcsh_value* value;
+    if (! mcsh_unpack(vm, &p, end, &value)) return false;
+    list_array_add(list->list, value);
+    mcsh_value_grab(&vm->logger, value);
+  }
+  mcsh_status status;
+  mcsh_status_init(&status);
+  mcsh_set_value(vm->main, "args", list, &status);
+  return p == end;
+}
+
+static void*
+thread_main(void* arg)
+{
+  mcsh_thread* t = arg;
+  char* argv[1] = { t->source };
+  mcsh_vm vm;
+  mcsh_vm_init_thread(&vm, 1, argv);
+  mcsh_module* module = vm.main;
+  strcpy(module->source, t->source);
+  mcsh_log(&vm.logger, MCSH_LOG_CORE, MCSH_INFO,
+           "thread: %"PRIi64" start", t->id);
+
+  bool rc = thread_args(&vm, t) &&
+    mcsh_cache_unpack(module, &t->code, &module->stmts);
+  valgrind_assert_msg(rc, "thread: corrupt code!");
+
+  mcsh_status status;
+  mcsh_status_init(&status);
+  mcsh_value* value = &mcsh_null;
+  mcsh_module_execute(module, &value, &status);
+  if (value == NULL) value = &mcsh_null;
+  if (status.code == MCSH_EXIT) value = status.value;
+  if (status.code != MCSH_EXCEPTION)
+  {
+    // Values that cannot be packed become exceptions:
+    mcsh_status ps;
+    mcsh_status_init(&ps);
+    mcsh_pack(&vm.logger, value, &t->result, true, &ps);
+    if (ps.code == MCSH_EXCEPTION)
+      status = ps;
+  }
+  if (status.code == MCSH_EXCEPTION)
+  {
+    t->tag  = strdup_checked(status.exception->tag);
+    t->text = strdup_checked(status.exception->text);
+    t->line = status.exception->line;
+    mcsh_exception_reset(&status);
+  }
+
+  mcsh_log(&vm.logger, MCSH_LOG_CORE, MCSH_INFO,
+           "thread: %"PRIi64" done", t->id);
+  // The handles list is per thread, so atexit() would miss these:
+  mcsh_handles_flush_all();
+  mcsh_vm_stop(&vm);
+  return NULL;
+}
+
+/** For a thread that never ran: its ARGS are not unpacked */
+static void
+thread_release_args(mcsh_thread* t)
+{
+  // Skip the count:
+  if (t->args.length > sizeof(int64_t))
+    mcsh_pack_release(t->args.data + sizeof(int64_t),
+                      t->args.data + t->args.length);
+}
+
+static void
+thread_free(mcsh_thread* t)
+{
+  buffer_finalize(&t->code);
+  buffer_finalize(&t->args);
+  buffer_finalize(&t->result);
+  free(t->tag);
+  free(t->text);
+  free(t);
+}
+
+bool
+mcsh_thread_start(mcsh_module* module, mcsh_block* block,
+                  list_array* args, size_t first,
+                  mcsh_value** output, mcsh_status* status)
+{
+  mcsh_vm* vm = module->vm;
+  mcsh_thread* t = malloc_checked(sizeof(*t));
+  t->id = __atomic_add_fetch(&thread_ids, 1, __ATOMIC_RELAXED);
+  strcpy(t->source, module->source);
+  buffer_init(&t->code,   1024);
+  buffer_init(&t->args,   64);
+  buffer_init(&t->result, 64);
+  t->tag  = NULL;
+  t->text = NULL;
+  t->line = 0;
+
+  mcsh_pack_int(&t->args, args->size - first);
+  for (size_t i = first; i < args->size; i++)
+  {
+    mcsh_value* value = args->data[i];
+    mcsh_resolve(value);
+    if (! mcsh_pack(&vm->logger, value, &t->args, true, status) ||
+        status->code == MCSH_EXCEPTION)
+    {
+      thread_release_args(t);
+      thread_free(t);
+      return true;
+    }
+  }
+  mcsh_cache_pack(&block->stmts, &t->code);
+
+  int rc = thread_create_noprof(&t->thread, thread_main, t);
+  if (rc != 0)
+  {
+    thread_release_args(t);
+    thread_free(t);
+    RAISE(status, NULL, 0, "mcsh.thread",
+          "thread: could not create: %s", strerror(rc));
+  }
+
+  char key[32];
+  thread_key(t->id, key, sizeof(key));
+  table_add(&vm->threads, key, t);
+  maybe_assign(output, mcsh_value_new_int(t->id));
+  status->code = MCSH_OK;
+  return true;
+}
+
+bool
+mcsh_thread_join(mcsh_module* module, int64_t id,
+                 mcsh_value** output, mcsh_status* status)
+{
+  mcsh_vm* vm = module->vm;
+  char key[32];
+  thread_key(id, key, sizeof(key));
+  mcsh_thread* t;
+  RAISE_IF(! table_remove(&vm->threads, key, (void*) &t),
+           status, NULL, 0, "mcsh.thread",
+           "join: no such thread: %"PRIi64, id);
+  pthread_join(t->thread, NULL);
+
+  if (t->tag != NULL)
+  {
+    mcsh_raise(status, NULL, t->line, t->tag, "%s", t->text);
+    thread_free(t);
+    return true;
+  }
+  const char* p   = t->result.data;
+  const char* end = t->result.data + t->result.length;
+  mcsh_value* value;
+  bool rc = mcsh_unpack(vm, &p, end, &value);
+  valgrind_assert_msg(rc && p == end, "join: corrupt result!");
+  thread_free(t);
+  maybe_assign(output, value);
+  status->code = MCSH_OK;
+  return true;
+}
+
+static void
+thread_reap(void* context, const char* key, void* data)
+{
+  mcsh_vm* vm = context;
+  mcsh_thread* t = data;
+  pthread_join(t->thread, NULL);
+  if (t->tag != NULL)
+    mcsh_log(&vm->logger, MCSH_LOG_CORE, MCSH_WARN,
+             "thread %s not joined: %s: %s", key, t->tag, t->text);
+  else
+    mcsh_pack_release(t->result.data,
+                      t->result.data + t->result.length);
+  thread_free(t);
+}
+
+void
+mcsh_threads_finalize(mcsh_vm* vm)
+{
+  table_free_callback(&vm->threads, false, thread_reap, vm);
+}
@@ -0,0 +1,48 @@
+
+/**
+   MCSH THREAD H
+   thread { block } ARGS... runs block in a new VM on a new pthread,
+   and thread join ID waits for it.
+   The VMs share no values: the block is copied with mcsh_cache_pack()
+   and ARGS and the result are copied with mcsh_pack().
+   In the new VM, ARGS are the list $args.
+   The sampler and crash dump stay with the main thread.
+*/
+
+#pragma once
+
+#include <pthread.h>
+
+#include "mcsh.h"
+
+typedef struct
+{
+  int64_t id;
+  pthread_t thread;
+  /// Source of the block, for messages and imports
+  char source[PATH_MAX];
+  /// The block: see mcsh_cache_pack()
+  buffer code;
+  /// The arguments as a packed list
+  buffer args;
+  /// Set by the thread: the packed result, or an exception
+  buffer result;
+  char* tag;
+  char* text;
+  int line;
+} mcsh_thread;
+
+/** Start block in a new thread.  args->data[first...] are the ARGS.
+    Output: the thread ID for mcsh_thread_join() */
+bool mcsh_thread_start(mcsh_module* module, mcsh_block* block,
+                       list_array* args, size_t first,
+                       mcsh_value** output, mcsh_status* status);
+
+/** Wait for thread id started by this VM.
+    Output: the block result.
+    An exception in the thread is raised again here */
+bool mcsh_thread_join(mcsh_module* module, int64_t id,
+                      mcsh_value** output, mcsh_status* status);
+
+/** Join the threads this VM did not join */
+void mcsh_threads_finalize(mcsh_vm* vm);
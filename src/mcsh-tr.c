@@ -0,0 +1,102 @@
+
+/**
+   MCSH TR: Trace decoder
+   Makes the program mctr
+   Usage: mctr FILE
+   Prints each record of a trace dump as text:
+   sequence number, microseconds since the first record,
+   event name, and payload
+*/
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mcsh.h"
+#include "mcsh-trace.h"
+
+static void
+show_payload(mcsh_trace_payload kind, uint64_t word)
+{
+  char t[16];
+  switch (kind)
+  {
+    case MCSH_TRACE_NONE:
+      break;
+    case MCSH_TRACE_INT:
+      printf(" %"PRIi64, (int64_t) word);
+      break;
+    case MCSH_TRACE_HEX:
+      printf(" 0x%"PRIx64, word);
+      break;
+    case MCSH_TRACE_STR:
+      memcpy(t, &word, 8);
+      t[8] = '\0';
+      for (char* p = t; *p != '\0'; p++)
+        if (! isprint(*p)) *p = '?';
+      printf(" '%s'", t);
+      break;
+    case MCSH_TRACE_CODE:
+      if (mcsh_code_name((mcsh_code) word, t))
+        printf(" %s", t);
+      else
+        printf(" code=%"PRIu64, word);
+      break;
+  }
+}
+
+int
+main(int argc, char* argv[])
+{
+  if (argc != 2)
+  {
+    printf("usage: mctr FILE\n");
+    return EXIT_FAILURE;
+  }
+  FILE* fp = fopen(argv[1], "r");
+  if (fp == NULL)
+  {
+    printf("mctr: could not open: %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  mcsh_trace_header header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, MCSH_TRACE_MAGIC, 8) != 0)
+  {
+    printf("mctr: not a trace: %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  printf("# records: %"PRIu64" of %"PRIu64"\n",
+         header.count, header.total);
+
+  uint64_t seq = header.total - header.count;
+  uint64_t start = 0;
+  mcsh_trace_record r;
+  for (uint64_t i = 0; i < header.count; i++, seq++)
+  {
+    if (fread(&r, sizeof(r), 1, fp) != 1)
+    {
+      printf("mctr: truncated at record %"PRIu64"\n", i);
+      return EXIT_FAILURE;
+    }
+    if (i == 0) start = r.time;
+    printf("%8"PRIu64" %12.3f ", seq, (r.time - start) / 1e3);
+    if (r.event >= MCSH_TRACE_EVENT_COUNT)
+    {
+      printf("event=%"PRIu32" 0x%"PRIx64" 0x%"PRIx64"\n",
+             r.event, r.a, r.b);
+      continue;
+    }
+    const mcsh_trace_event_info* info = &mcsh_trace_events[r.event];
+    printf("%s", info->name);
+    show_payload(info->a, r.a);
+    show_payload(info->b, r.b);
+    printf("\n");
+  }
+  fclose(fp);
+  return EXIT_SUCCESS;
+}
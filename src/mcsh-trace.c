@@ -0,0 +1,160 @@
+
+/**
+   MCSH TRACE C
+*/
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mcsh-trace.h"
+#include "util.h"
+
+_Thread_local mcsh_trace* mcsh_trace_current = NULL;
+
+#define N MCSH_TRACE_NONE
+#define I MCSH_TRACE_INT
+#define H MCSH_TRACE_HEX
+#define S MCSH_TRACE_STR
+#define C MCSH_TRACE_CODE
+
+const mcsh_trace_event_info mcsh_trace_events[] =
+{
+  [MCSH_TRACE_NULL]              = { "null",              N, N },
+  [MCSH_TRACE_STMT_EMPTY]        = { "stmt_empty",        I, N },
+  [MCSH_TRACE_STMT_EXCEPTION]    = { "stmt_exception",    I, N },
+  [MCSH_TRACE_STMT_NO_OUTPUT]    = { "stmt_no_output",    I, N },
+  [MCSH_TRACE_KEYWORD_DONE]      = { "keyword_done",      S, H },
+  [MCSH_TRACE_SPLIT]             = { "split",             I, N },
+  [MCSH_TRACE_STACK_FOUND]       = { "stack_found",       S, I },
+  [MCSH_TRACE_LOOP_CODE]         = { "loop_code",         C, N },
+  [MCSH_TRACE_FOREACH_ITERATION] = { "foreach_iteration", I, N },
+  [MCSH_TRACE_FOR_ITERATION]     = { "for_iteration",     I, N },
+  [MCSH_TRACE_REPEAT_ITERATION]  = { "repeat_iteration",  I, N },
+  [MCSH_TRACE_CALL_SCOPE]        = { "call_scope",        I, I },
+  [MCSH_TRACE_CALL_MACRO]        = { "call_macro",        I, I },
+  [MCSH_TRACE_PARAMETERIZE]      = { "parameterize",      I, I },
+  [MCSH_TRACE_SET_POSITIONAL]    = { "set_positional",    I, S },
+  [MCSH_TRACE_SET_EXTRA]         = { "set_extra",         I, N },
+  [MCSH_TRACE_SET_DEFAULT]       = { "set_default",       I, S },
+  [MCSH_TRACE_SET_PARAMETER]     = { "set_parameter",     I, S },
+  [MCSH_TRACE_FUNCTION_NEW]      = { "function_new",      S, I },
+  [MCSH_TRACE_SIGNATURE_SLOT]    = { "signature_slot",    I, S },
+  [MCSH_TRACE_SIGNATURE_DEFAULT] = { "signature_default", I, S },
+  [MCSH_TRACE_BLOCK_START]       = { "block_start",       H, N },
+  [MCSH_TRACE_BLOCK_END]         = { "block_end",         H, H },
+  [MCSH_TRACE_EXPR_TOKEN]        = { "expr_token",        S, N },
+  [MCSH_TRACE_EXPR_OP]           = { "expr_op",           S, N },
+  [MCSH_TRACE_EXPR_END]          = { "expr_end",          N, N },
+  [MCSH_TRACE_TYPE_CODE]         = { "type_code",         S, N },
+  [MCSH_TRACE_VARIABLE_MEMBER]   = { "variable_member",   S, S },
+  [MCSH_TRACE_ARGS]              = { "args",              I, I },
+  [MCSH_TRACE_TABLE_EVAL]        = { "table_eval",        S, H },
+  [MCSH_TRACE_GLOBAL_LINK]       = { "global_link",       S, N },
+  [MCSH_TRACE_GLOBAL_NEW]        = { "global_new",        S, N },
+  [MCSH_TRACE_PUBLIC_LINK]       = { "public_link",       S, N },
+  [MCSH_TRACE_GETCWD]            = { "getcwd",            I, S },
+  [MCSH_TRACE_SH]                = { "sh",                I, S },
+  [MCSH_TRACE_SUBSTRING]         = { "substring",         I, S },
+  [MCSH_TRACE_EXEC_ARG]          = { "exec_arg",          I, S },
+  [MCSH_TRACE_SUBCMD_CAPTURE]    = { "subcmd_capture",    I, N },
+  [MCSH_TRACE_SUBCMD_READ]       = { "subcmd_read",       I, I },
+  [MCSH_TRACE_WAIT]              = { "wait",              I, I },
+  [MCSH_TRACE_EVENT_COUNT]       = { NULL,                N, N }
+};
+
+#undef N
+#undef I
+#undef H
+#undef S
+#undef C
+
+mcsh_trace*
+mcsh_trace_create(uint64_t records)
+{
+  uint64_t size = 1;
+  while (size < records) size *= 2;
+  mcsh_trace* trace = malloc_checked(sizeof(*trace));
+  atomic_init(&trace->head, 0);
+  trace->mask    = size - 1;
+  trace->records = calloc_checked(size, sizeof(mcsh_trace_record));
+  return trace;
+}
+
+/** Only uses write(): this may run in a signal handler */
+static bool
+dump_fd(mcsh_trace* trace, int fd)
+{
+  uint64_t total = atomic_load(&trace->head);
+  uint64_t size  = trace->mask + 1;
+  mcsh_trace_header header;
+  memcpy(header.magic, MCSH_TRACE_MAGIC, sizeof(header.magic));
+  header.count = total < size ? total : size;
+  header.total = total;
+  if (write(fd, &header, sizeof(header)) != sizeof(header))
+    return false;
+  // Oldest first: the records after the head, then up to it
+  uint64_t start = total - header.count;
+  uint64_t first = start & trace->mask;
+  uint64_t n1 = size - first;
+  if (n1 > header.count) n1 = header.count;
+  size_t bytes = n1 * sizeof(mcsh_trace_record);
+  if (write(fd, &trace->records[first], bytes) != bytes)
+    return false;
+  bytes = (header.count - n1) * sizeof(mcsh_trace_record);
+  if (bytes > 0 && write(fd, &trace->records[0], bytes) != bytes)
+    return false;
+  return true;
+}
+
+bool
+mcsh_trace_dump(mcsh_trace* trace, const char* filename)
+{
+  int fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+  if (fd == -1) return false;
+  bool result = dump_fd(trace, fd);
+  if (close(fd) != 0) result = false;
+  return result;
+}
+
+/** For the signal handler: */
+static mcsh_trace* crash_trace = NULL;
+static char crash_filename[64];
+
+static void
+crash_handler(int signum)
+{
+  int fd = -1;
+  if (crash_trace != NULL)
+    fd = open(crash_filename, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+  if (fd != -1)
+  {
+    dump_fd(crash_trace, fd);
+    close(fd);
+  }
+  // Crash as before:
+  signal(signum, SIG_DFL);
+  raise(signum);
+}
+
+void
+mcsh_trace_crash_dump(mcsh_trace* trace)
+{
+  crash_trace = trace;
+  snprintf(crash_filename, sizeof(crash_filename),
+           "mcsh-trace.%i", getpid());
+  int signums[] = { SIGSEGV, SIGBUS, SIGFPE, SIGABRT };
+  for (size_t i = 0; i < sizeof(signums)/sizeof(int); i++)
+    signal(signums[i], crash_handler);
+}
+
+void
+mcsh_trace_free(mcsh_trace* trace)
+{
+  if (crash_trace == trace) crash_trace = NULL;
+  if (mcsh_trace_current == trace) mcsh_trace_current = NULL;
+  free(trace->records);
+  free(trace);
+}
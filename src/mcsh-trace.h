@@ -0,0 +1,179 @@
+
+/**
+   MCSH TRACE H
+   Binary event trace in a per-VM ring buffer.
+   Each record is a timestamp, an event ID, and two payload words.
+   Writers claim slots with an atomic add: no locks.
+   When the ring is full the oldest records are overwritten.
+   Enable with mcsh --trace[=RECORDS] or MCSH_TRACE=RECORDS.
+   Dump with the trace builtin or on a crash,
+   and decode with mctr.
+*/
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+   Event IDs: make sure this agrees with mcsh-trace.c:events
+   Never renumber these: old dumps use them
+*/
+typedef enum
+{
+  MCSH_TRACE_NULL = 0,
+  // Execution:
+  MCSH_TRACE_STMT_EMPTY,
+  MCSH_TRACE_STMT_EXCEPTION,
+  MCSH_TRACE_STMT_NO_OUTPUT,
+  MCSH_TRACE_KEYWORD_DONE,
+  MCSH_TRACE_SPLIT,
+  MCSH_TRACE_STACK_FOUND,
+  MCSH_TRACE_LOOP_CODE,
+  MCSH_TRACE_FOREACH_ITERATION,
+  MCSH_TRACE_FOR_ITERATION,
+  MCSH_TRACE_REPEAT_ITERATION,
+  MCSH_TRACE_CALL_SCOPE,
+  MCSH_TRACE_CALL_MACRO,
+  // Parameters:
+  MCSH_TRACE_PARAMETERIZE,
+  MCSH_TRACE_SET_POSITIONAL,
+  MCSH_TRACE_SET_EXTRA,
+  MCSH_TRACE_SET_DEFAULT,
+  MCSH_TRACE_SET_PARAMETER,
+  // Definitions:
+  MCSH_TRACE_FUNCTION_NEW,
+  MCSH_TRACE_SIGNATURE_SLOT,
+  MCSH_TRACE_SIGNATURE_DEFAULT,
+  MCSH_TRACE_BLOCK_START,
+  MCSH_TRACE_BLOCK_END,
+  MCSH_TRACE_EXPR_TOKEN,
+  MCSH_TRACE_EXPR_OP,
+  MCSH_TRACE_EXPR_END,
+  MCSH_TRACE_TYPE_CODE,
+  // Data:
+  MCSH_TRACE_VARIABLE_MEMBER,
+  MCSH_TRACE_ARGS,
+  MCSH_TRACE_TABLE_EVAL,
+  MCSH_TRACE_GLOBAL_LINK,
+  MCSH_TRACE_GLOBAL_NEW,
+  MCSH_TRACE_PUBLIC_LINK,
+  // Builtins:
+  MCSH_TRACE_GETCWD,
+  MCSH_TRACE_SH,
+  MCSH_TRACE_SUBSTRING,
+  MCSH_TRACE_EXEC_ARG,
+  // Processes:
+  MCSH_TRACE_SUBCMD_CAPTURE,
+  MCSH_TRACE_SUBCMD_READ,
+  MCSH_TRACE_WAIT,
+  MCSH_TRACE_EVENT_COUNT
+} mcsh_trace_event;
+
+/** How the decoder shows a payload word */
+typedef enum
+{
+  MCSH_TRACE_NONE,
+  MCSH_TRACE_INT,
+  MCSH_TRACE_HEX,
+  /// The first 8 bytes of a string: see mcsh_trace_str()
+  MCSH_TRACE_STR,
+  /// An mcsh_code
+  MCSH_TRACE_CODE
+} mcsh_trace_payload;
+
+typedef struct
+{
+  const char* name;
+  mcsh_trace_payload a, b;
+} mcsh_trace_event_info;
+
+extern const mcsh_trace_event_info mcsh_trace_events[];
+
+typedef struct
+{
+  /// Nanoseconds from CLOCK_MONOTONIC
+  uint64_t time;
+  uint32_t event;
+  uint32_t unused;
+  uint64_t a, b;
+} mcsh_trace_record;
+
+typedef struct
+{
+  /// Count of records ever written: the next slot is head & mask
+  _Atomic uint64_t head;
+  uint64_t mask;
+  mcsh_trace_record* records;
+} mcsh_trace;
+
+/** The trace of the VM running in this thread, or NULL */
+extern _Thread_local mcsh_trace* mcsh_trace_current;
+
+/** records is rounded up to a power of 2 */
+mcsh_trace* mcsh_trace_create(uint64_t records);
+
+/** Also dump to mcsh-trace.PID on SIGSEGV, SIGBUS, SIGFPE,
+    or SIGABRT */
+void mcsh_trace_crash_dump(mcsh_trace* trace);
+
+/** Write the records oldest first.  @return False on I/O error */
+bool mcsh_trace_dump(mcsh_trace* trace, const char* filename);
+
+void mcsh_trace_free(mcsh_trace* trace);
+
+/** Magic number at the start of a dump */
+#define MCSH_TRACE_MAGIC "MCSHTRC1"
+
+typedef struct
+{
+  char magic[8];
+  /// Count of records that follow
+  uint64_t count;
+  /// Count of records ever written
+  uint64_t total;
+} mcsh_trace_header;
+
+static inline uint64_t
+mcsh_trace_now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static inline void
+mcsh_trace_put(mcsh_trace* trace, mcsh_trace_event event,
+               uint64_t a, uint64_t b)
+{
+  uint64_t i = atomic_fetch_add_explicit(&trace->head, 1,
+                                         memory_order_relaxed);
+  mcsh_trace_record* r = &trace->records[i & trace->mask];
+  r->time  = mcsh_trace_now();
+  r->event = event;
+  r->a     = a;
+  r->b     = b;
+}
+
+/** Pack the first 8 bytes of s into a payload word */
+static inline uint64_t
+mcsh_trace_str(const char* s)
+{
+  uint64_t result = 0;
+  if (s == NULL) return result;
+  char* p = (char*) &result;
+  for (int i = 0; i < 8 && s[i] != '\0'; i++)
+    p[i] = s[i];
+  return result;
+}
+
+/** The payloads are not evaluated unless tracing is on */
+#define TRACE(event, a, b)                                      \
+  do {                                                          \
+    mcsh_trace* _trace = mcsh_trace_current;                    \
+    if (__builtin_expect(_trace != NULL, 0))                    \
+      mcsh_trace_put(_trace, MCSH_TRACE_##event,                \
+                     (uint64_t) (a), (uint64_t) (b));           \
+  } while (0)
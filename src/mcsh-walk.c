@@ -0,0 +1,612 @@
+
+/**
+   MCSH WALK C
+
+   Matching is an NFA over segment indices, kept as a bit mask:
+   bit j means segment j is next, and bit count means a match.
+   Each directory task carries the mask for the names inside it.
+*/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "buffer.h"
+#include "mcsh-walk.h"
+#include "util.h"
+
+/** More segments than this do not fit in a mask */
+#define SEGMENTS_MAX 63
+
+/** Bytes per getdents64() call */
+#define WALK_BUFFER (64*1024)
+
+/** Entries a worker gathers before publishing them */
+#define WALK_BATCH 1024
+
+/** Published entries not yet taken before workers wait */
+#define WALK_PENDING_MAX (64*1024)
+
+#define WALK_THREADS_MAX 8
+
+typedef enum
+{
+  SEGMENT_LITERAL,
+  SEGMENT_WILD,
+  /// **
+  SEGMENT_ANY
+} segment_type;
+
+typedef struct
+{
+  segment_type type;
+  char* text;
+} segment;
+
+struct mcsh_walk_pattern_s
+{
+  /// The leading literal directories, "." if none, or "/"
+  char* root;
+  /// The pattern starts with ./: results keep it, as in glob(3),
+  /// so names that start with - are not options
+  bool dot;
+  /// A trailing slash matches only directories
+  bool dirs;
+  size_t count;
+  segment segments[];
+};
+
+#define BIT(j) (((uint64_t) 1) << (j))
+
+static bool
+is_wild(const char* s)
+{
+  return strpbrk(s, "*?[\\") != NULL;
+}
+
+mcsh_walk_pattern*
+mcsh_walk_pattern_compile(const char* pattern)
+{
+  char* copy = strdup_checked((char*) pattern);
+  char* parts[SEGMENTS_MAX+1];
+  size_t n = 0;
+  char* save;
+  for (char* p = strtok_r(copy, "/", &save); p != NULL;
+       p = strtok_r(NULL, "/", &save))
+  {
+    // a/**/**/b is a/**/b:
+    if (n > 0 && strcmp(p, "**") == 0 && strcmp(parts[n-1], "**") == 0)
+      continue;
+    if (n == SEGMENTS_MAX+1)
+    {
+      free(copy);
+      return NULL;
+    }
+    parts[n++] = p;
+  }
+
+  // Leading literal segments become the root,
+  // but the last segment is always matched
+  size_t fixed = 0;
+  while (fixed+1 < n && ! is_wild(parts[fixed]))
+    fixed++;
+  buffer B;
+  buffer_init(&B, 64);
+  if (pattern[0] == '/')
+    buffer_catc(&B, '/');
+  for (size_t i = 0; i < fixed; i++)
+  {
+    if (i > 0) buffer_catc(&B, '/');
+    buffer_cat(&B, parts[i]);
+  }
+  if (B.length == 0)
+    buffer_catc(&B, '.');
+
+  size_t count = n - fixed;
+  if (count > SEGMENTS_MAX)
+  {
+    buffer_finalize(&B);
+    free(copy);
+    return NULL;
+  }
+  mcsh_walk_pattern* result =
+    malloc_checked(sizeof(*result) + count * sizeof(segment));
+  result->root  = B.data;
+  result->dot   = fixed > 0 && strcmp(B.data, ".") == 0;
+  result->dirs  = n > 0 && pattern[strlen(pattern)-1] == '/';
+  result->count = count;
+  for (size_t i = 0; i < count; i++)
+  {
+    segment* s = &result->segments[i];
+    char* p = parts[fixed+i];
+    s->text = strdup_checked(p);
+    if (strcmp(p, "**") == 0)
+      s->type = SEGMENT_ANY;
+    else if (is_wild(p))
+      s->type = SEGMENT_WILD;
+    else
+      s->type = SEGMENT_LITERAL;
+  }
+  free(copy);
+  return result;
+}
+
+void
+mcsh_walk_pattern_free(mcsh_walk_pattern* pattern)
+{
+  for (size_t i = 0; i < pattern->count; i++)
+    free(pattern->segments[i].text);
+  free(pattern->root);
+  free(pattern);
+}
+
+bool
+mcsh_walk_pattern_recursive(const mcsh_walk_pattern* pattern)
+{
+  for (size_t i = 0; i < pattern->count; i++)
+    if (pattern->segments[i].type == SEGMENT_ANY)
+      return true;
+  return false;
+}
+
+/** ** may match nothing, so its successor is live too */
+static uint64_t
+closure(const mcsh_walk_pattern* P, uint64_t mask)
+{
+  for (size_t j = 0; j < P->count; j++)
+    if ((mask & BIT(j)) && P->segments[j].type == SEGMENT_ANY)
+      mask |= BIT(j+1);
+  return mask;
+}
+
+/** Match name against the live segments in mask.
+    stay: states kept by ** if name is a directory
+    advance: states after consuming name */
+static void
+step(const mcsh_walk_pattern* P, uint64_t mask, const char* name,
+     uint64_t* stay, uint64_t* advance)
+{
+  uint64_t s = 0, a = 0;
+  for (size_t j = 0; j < P->count; j++)
+  {
+    if (! (mask & BIT(j))) continue;
+    segment* g = (segment*) &P->segments[j];
+    switch (g->type)
+    {
+      case SEGMENT_ANY:
+        // As in bash, ** does not match hidden names
+        if (name[0] != '.') s |= BIT(j);
+        break;
+      case SEGMENT_LITERAL:
+        if (strcmp(g->text, name) == 0) a |= BIT(j+1);
+        break;
+      case SEGMENT_WILD:
+        if (fnmatch(g->text, name, FNM_PERIOD) == 0) a |= BIT(j+1);
+        break;
+    }
+  }
+  *stay    = closure(P, s);
+  *advance = closure(P, a);
+}
+
+typedef struct task_s
+{
+  char* path;
+  uint64_t mask;
+  struct task_s* next;
+} task;
+
+typedef struct result_s
+{
+  mcsh_walk_entry entry;
+  struct result_s* next;
+} result;
+
+/** Work gathered by one worker without the lock */
+typedef struct
+{
+  result* head;
+  result* tail;
+  size_t count;
+  task* tasks;
+  size_t task_count;
+} batch;
+
+struct mcsh_walk_s
+{
+  mcsh_walk_pattern* pattern;
+  mcsh_walk_options options;
+  pthread_mutex_t lock;
+  /// Signaled when there are tasks, or the walk is over
+  pthread_cond_t work;
+  /// Signaled when there are results, or the walk is over
+  pthread_cond_t ready;
+  /// Signaled when the consumer has taken results
+  pthread_cond_t room;
+  /// Stack of directories to read
+  task* tasks;
+  /// Tasks queued or being read: the walk is over at 0
+  size_t active;
+  result* results;
+  result* last;
+  size_t pending;
+  /// Results taken by the consumer: only it uses these
+  result* taken;
+  bool stop;
+  int thread_count;
+  pthread_t threads[];
+};
+
+static bool
+stopped(mcsh_walk* W)
+{
+  return __atomic_load_n(&W->stop, __ATOMIC_RELAXED);
+}
+
+static void
+results_free(result* r)
+{
+  while (r != NULL)
+  {
+    result* next = r->next;
+    free(r->entry.path);
+    free(r);
+    r = next;
+  }
+}
+
+static void
+tasks_free(task* t)
+{
+  while (t != NULL)
+  {
+    task* next = t->next;
+    free(t->path);
+    free(t);
+    t = next;
+  }
+}
+
+/** Publish B and empty it */
+static void
+flush(mcsh_walk* W, batch* B)
+{
+  if (B->count == 0 && B->task_count == 0) return;
+  pthread_mutex_lock(&W->lock);
+  while (W->pending > WALK_PENDING_MAX && ! W->stop)
+    pthread_cond_wait(&W->room, &W->lock);
+  if (W->stop)
+  {
+    pthread_mutex_unlock(&W->lock);
+    results_free(B->head);
+    tasks_free(B->tasks);
+  }
+  else
+  {
+    if (B->count > 0)
+    {
+      if (W->last == NULL) W->results = B->head;
+      else                 W->last->next = B->head;
+      W->last = B->tail;
+      W->pending += B->count;
+      pthread_cond_signal(&W->ready);
+    }
+    if (B->task_count > 0)
+    {
+      task* t = B->tasks;
+      while (t->next != NULL) t = t->next;
+      t->next = W->tasks;
+      W->tasks = B->tasks;
+      W->active += B->task_count;
+      pthread_cond_broadcast(&W->work);
+    }
+    pthread_mutex_unlock(&W->lock);
+  }
+  B->head = B->tail = NULL;
+  B->tasks = NULL;
+  B->count = B->task_count = 0;
+}
+
+static void
+add_task(batch* B, char* path, uint64_t mask)
+{
+  task* t = malloc_checked(sizeof(*t));
+  t->path = path;
+  t->mask = mask;
+  t->next = B->tasks;
+  B->tasks = t;
+  B->task_count++;
+}
+
+static bool
+pruned(mcsh_walk* W, const char* name)
+{
+  for (size_t i = 0; i < W->options.prune_count; i++)
+    if (fnmatch(W->options.prune[i], name, 0) == 0)
+      return true;
+  return false;
+}
+
+static char*
+path_join(const char* dir, const char* name, bool dot)
+{
+  if (! dot && strcmp(dir, ".") == 0)
+    return strdup_checked((char*) name);
+  size_t m = strlen(dir);
+  size_t n = strlen(name);
+  bool slash = dir[m-1] != '/';
+  char* result = malloc_checked(m + slash + n + 1);
+  memcpy(result, dir, m);
+  if (slash) result[m] = '/';
+  memcpy(result + m + slash, name, n + 1);
+  return result;
+}
+
+static void
+visit(mcsh_walk* W, task* t, int fd, const char* name,
+      unsigned char type, batch* B)
+{
+  if (name[0] == '.' &&
+      (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+    return;
+  mcsh_walk_pattern* P = W->pattern;
+  uint64_t stay, advance;
+  step(P, t->mask, name, &stay, &advance);
+  if (stay == 0 && advance == 0) return;
+
+  struct stat st;
+  bool have_stat = false;
+  if (type == DT_UNKNOWN)
+  {
+    if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+    type = IFTODT(st.st_mode);
+    have_stat = true;
+  }
+  if (type == DT_DIR && pruned(W, name)) return;
+
+  uint64_t accept = BIT(P->count);
+  char* path = path_join(t->path, name, P->dot);
+  if (type == DT_DIR)
+  {
+    uint64_t next = (stay | advance) & ~accept;
+    if (next != 0) add_task(B, strdup_checked(path), next);
+  }
+  else if (type == DT_LNK && (advance & ~accept) != 0)
+  {
+    // Follow links to directories, but not with **,
+    // which could cycle
+    struct stat target;
+    if (fstatat(fd, name, &target, 0) == 0 &&
+        S_ISDIR(target.st_mode) && ! pruned(W, name))
+      add_task(B, strdup_checked(path), advance & ~accept);
+  }
+
+  if (! ((stay | advance) & accept) || (P->dirs && type != DT_DIR))
+  {
+    free(path);
+    return;
+  }
+  result* r = malloc_checked(sizeof(*r));
+  r->entry.path = path;
+  r->entry.type = type;
+  if (W->options.stat)
+  {
+    if (have_stat)
+      r->entry.st = st;
+    else if (fstatat(fd, name, &r->entry.st, AT_SYMLINK_NOFOLLOW) != 0)
+      memset(&r->entry.st, 0, sizeof(r->entry.st));
+  }
+  r->next = NULL;
+  if (B->tail == NULL) B->head = r;
+  else                 B->tail->next = r;
+  B->tail = r;
+  B->count++;
+}
+
+#ifdef __linux__
+/** glibc declares no wrapper for this */
+struct linux_dirent64
+{
+  uint64_t       d_ino;
+  int64_t        d_off;
+  unsigned short d_reclen;
+  unsigned char  d_type;
+  char           d_name[];
+};
+#endif
+
+static void
+read_dir(mcsh_walk* W, task* t, char* buffer)
+{
+  int fd = openat(AT_FDCWD, t->path,
+                  O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  // Unreadable directories are skipped, as by glob()
+  if (fd == -1) return;
+  batch B = { NULL, NULL, 0, NULL, 0 };
+#ifdef __linux__
+  long n;
+  while ((n = syscall(SYS_getdents64, fd, buffer, WALK_BUFFER)) > 0)
+  {
+    for (long offset = 0; offset < n;)
+    {
+      struct linux_dirent64* d = (void*) (buffer + offset);
+      offset += d->d_reclen;
+      visit(W, t, fd, d->d_name, d->d_type, &B);
+    }
+    if (B.count >= WALK_BATCH) flush(W, &B);
+    if (stopped(W)) break;
+  }
+  close(fd);
+#else
+  (void) buffer;
+  DIR* D = fdopendir(fd);
+  if (D == NULL)
+  {
+    close(fd);
+    return;
+  }
+  struct dirent* d;
+  while ((d = readdir(D)) != NULL)
+  {
+    visit(W, t, fd, d->d_name, d->d_type, &B);
+    if (B.count >= WALK_BATCH) flush(W, &B);
+    if (stopped(W)) break;
+  }
+  // Closes fd:
+  closedir(D);
+#endif
+  flush(W, &B);
+}
+
+static void*
+worker(void* data)
+{
+  mcsh_walk* W = data;
+  char* buffer = malloc_checked(WALK_BUFFER);
+  pthread_mutex_lock(&W->lock);
+  while (true)
+  {
+    while (! W->stop && W->tasks == NULL && W->active > 0)
+      pthread_cond_wait(&W->work, &W->lock);
+    if (W->stop || W->tasks == NULL) break;
+    task* t = W->tasks;
+    W->tasks = t->next;
+    pthread_mutex_unlock(&W->lock);
+
+    read_dir(W, t, buffer);
+    free(t->path);
+    free(t);
+
+    pthread_mutex_lock(&W->lock);
+    if (--W->active == 0)
+    {
+      pthread_cond_broadcast(&W->work);
+      pthread_cond_signal(&W->ready);
+    }
+  }
+  pthread_mutex_unlock(&W->lock);
+  free(buffer);
+  return NULL;
+}
+
+static int
+default_threads(void)
+{
+  char* s = getenv("MCSH_WALK_THREADS");
+  size_t n;
+  if (s != NULL && is_integer(s, &n) && n > 0)
+    return (int) n;
+  long p = sysconf(_SC_NPROCESSORS_ONLN);
+  if (p < 1) return 1;
+  if (p > WALK_THREADS_MAX) return WALK_THREADS_MAX;
+  return (int) p;
+}
+
+mcsh_walk*
+mcsh_walk_start(mcsh_walk_pattern* pattern,
+                const mcsh_walk_options* options)
+{
+  int n = options->threads > 0 ? options->threads : default_threads();
+  mcsh_walk* W = malloc_checked(sizeof(*W) + n * sizeof(pthread_t));
+  W->pattern = pattern;
+  W->options = *options;
+  W->options.prune =
+    malloc_checked((options->prune_count+1) * sizeof(char*));
+  for (size_t i = 0; i < options->prune_count; i++)
+    W->options.prune[i] = strdup_checked(options->prune[i]);
+  pthread_mutex_init(&W->lock, NULL);
+  pthread_cond_init(&W->work,  NULL);
+  pthread_cond_init(&W->ready, NULL);
+  pthread_cond_init(&W->room,  NULL);
+  W->tasks   = NULL;
+  W->active  = 0;
+  W->results = W->last = W->taken = NULL;
+  W->pending = 0;
+  W->stop    = false;
+  if (pattern->count > 0)
+  {
+    W->tasks = malloc_checked(sizeof(task));
+    W->tasks->path = strdup_checked(pattern->root);
+    W->tasks->mask = closure(pattern, BIT(0));
+    W->tasks->next = NULL;
+    W->active = 1;
+  }
+  W->thread_count = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if (thread_create_noprof(&W->threads[i], worker, W) != 0)
+      break;
+    W->thread_count++;
+  }
+  valgrind_assert_msg(W->thread_count > 0,
+                      "walk: could not create threads");
+  return W;
+}
+
+static void
+join(mcsh_walk* W)
+{
+  for (int i = 0; i < W->thread_count; i++)
+    pthread_join(W->threads[i], NULL);
+  W->thread_count = 0;
+}
+
+bool
+mcsh_walk_next(mcsh_walk* W, mcsh_walk_entry* entry)
+{
+  if (W->taken == NULL)
+  {
+    // Take everything published so far at once
+    pthread_mutex_lock(&W->lock);
+    while (W->results == NULL && W->active > 0)
+      pthread_cond_wait(&W->ready, &W->lock);
+    W->taken   = W->results;
+    W->results = W->last = NULL;
+    W->pending = 0;
+    pthread_cond_broadcast(&W->room);
+    pthread_mutex_unlock(&W->lock);
+    if (W->taken == NULL)
+    {
+      // The workers have exited: release them now
+      join(W);
+      return false;
+    }
+  }
+  result* r = W->taken;
+  W->taken = r->next;
+  *entry = r->entry;
+  free(r);
+  return true;
+}
+
+void
+mcsh_walk_free(mcsh_walk* W)
+{
+  pthread_mutex_lock(&W->lock);
+  __atomic_store_n(&W->stop, true, __ATOMIC_RELAXED);
+  pthread_cond_broadcast(&W->work);
+  pthread_cond_broadcast(&W->room);
+  pthread_mutex_unlock(&W->lock);
+  join(W);
+
+  tasks_free(W->tasks);
+  results_free(W->results);
+  results_free(W->taken);
+  for (size_t i = 0; i < W->options.prune_count; i++)
+    free(W->options.prune[i]);
+  free(W->options.prune);
+  mcsh_walk_pattern_free(W->pattern);
+  pthread_mutex_destroy(&W->lock);
+  pthread_cond_destroy(&W->work);
+  pthread_cond_destroy(&W->ready);
+  pthread_cond_destroy(&W->room);
+  free(W);
+}
@@ -0,0 +1,61 @@
+
+/**
+   MCSH WALK H
+   Directory traversal for glob and the walk builtin.
+   A pattern is compiled once into its path segments:
+   literal, wildcard (* ? [...]), or ** for any depth,
+   as in bash with globstar.
+   Worker threads read directories with getdents64() and
+   results stream out in no particular order.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+typedef struct mcsh_walk_pattern_s mcsh_walk_pattern;
+
+/** @return NULL if pattern has too many segments */
+mcsh_walk_pattern* mcsh_walk_pattern_compile(const char* pattern);
+
+void mcsh_walk_pattern_free(mcsh_walk_pattern* pattern);
+
+/** @return True if pattern contains ** */
+bool mcsh_walk_pattern_recursive(const mcsh_walk_pattern* pattern);
+
+typedef struct
+{
+  /// Do not enter directories with names matching these globs
+  char** prune;
+  size_t prune_count;
+  /// Worker threads, or 0 for the default:
+  /// MCSH_WALK_THREADS, else online processors up to 8
+  int threads;
+  /// Fill in mcsh_walk_entry.st
+  bool stat;
+} mcsh_walk_options;
+
+typedef struct
+{
+  /// Owned by the caller after mcsh_walk_next()
+  char* path;
+  /// From d_type: DT_REG, DT_DIR, DT_LNK, ...
+  unsigned char type;
+  /// If mcsh_walk_options.stat, from lstat()
+  struct stat st;
+} mcsh_walk_entry;
+
+typedef struct mcsh_walk_s mcsh_walk;
+
+/** Start the workers.  Takes pattern, copies options */
+mcsh_walk* mcsh_walk_start(mcsh_walk_pattern* pattern,
+                           const mcsh_walk_options* options);
+
+/** Block for the next match.
+    @return False when the walk is done */
+bool mcsh_walk_next(mcsh_walk* walk, mcsh_walk_entry* entry);
+
+/** Stop the workers and free everything: may be called early */
+void mcsh_walk_free(mcsh_walk* walk);
@@ -5,9 +5,15 @@
 
 #define _GNU_SOURCE // for asprintf(), vasprintf()
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 
 #include "strlcpyj.h"
@@ -18,15 +24,14 @@
 #include "exceptions.h"
 #include "builtins.h"
 #include "mcsh-sys.h"
+#include "iterators.h"
+#include "mcsh-cache.h"
+#include "mcsh-mem.h"
+#include "mcsh-sample.h"
+#include "mcsh-thread.h"
 
 #include "mcsh-expr-parser.h"
-
-// For mcsh-script.l
-extern int mcsh_script_parse(void);
-extern int mcsh_script_lex_destroy(void);
-
-// For mcsh-expr.l
-extern int mcsh_expr_parse(void);
+#include "mcsh-script-parser.h"
 
 mcsh_system mcsh;
 
@@ -36,7 +41,6 @@ mcsh_system mcsh;
 /** Contains mcsh_things - TODO: remove this */
 static list_array terms_in;
 
-int mcsh_script_get_lineno(void);
 
 mcsh_value mcsh_null;
 char mcsh_null_string[] = "mcsh.NULL";
@@ -44,6 +48,10 @@ char mcsh_null_string[] = "mcsh.NULL";
 /** Counter for miscellaneous identifiers */
 uint64_t counter = 1;
 
+/** Insertion point for the mcsh_block_start() API:
+    per thread, as each VM may parse in its own thread */
+static _Thread_local mcsh_thing* parse_target = NULL;
+
 /** thing->type as string */
 static void
 thing_str(mcsh_thing* thing, char* output)
@@ -72,13 +80,19 @@ thing_str(mcsh_thing* thing, char* output)
 }
 
 static bool system_init(mcsh_system* state);
+static void keywords_init(void);
+static inline void value_names_init(void);
 
 bool
 mcsh_init()
 {
   bool rc = system_init(&mcsh);
   if (!rc) return false;
+  mcsh_mem_init();
   mcsh_builtins_init();
+  // Tables that threads then only read:
+  keywords_init();
+  value_names_init();
   list_array_init(&terms_in, 16);
   mcsh_null.type = MCSH_VALUE_STRING;
   mcsh_null.string = mcsh_null_string;
@@ -91,6 +105,10 @@ mcsh_help()
   printf("mcsh: usage:                        \n"
          "      -h         help               \n"
          "      -c CMD     run command string \n"
+         "      --profile[=PREFIX]            \n"
+         "                 write PREFIX.txt and PREFIX.folded\n"
+         "      --trace[=RECORDS]             \n"
+         "                 record events: see the trace builtin\n"
          );
 }
 
@@ -123,15 +141,23 @@ mcsh_handle_cmd_string(list_array* cmd_tmp, mcsh_cmd_line* cmd)
   cmd->argv[i] = NULL;
 }
 
+/** Default ring size for --trace */
+static const size_t trace_records = 65536;
+
 bool
 mcsh_parse_options(unsigned int argc, char* argv[],
                    mcsh_cmd_line* cmd)
 {
   list_array cmd_tmp;
   list_array_init(&cmd_tmp, 0);
+  static struct option options[] =
+    {{"profile", optional_argument, NULL, 'P'},
+     {"trace",   optional_argument, NULL, 'T'},
+     {NULL, 0, NULL, 0}};
   while (true)
   {
-    int c = getopt(argc, argv, "c:h");
+    // Stop at the script name: the rest are script arguments
+    int c = getopt_long(argc, argv, "+c:h", options, NULL);
     if (c == -1) break;
     switch (c)
     {
@@ -141,6 +167,15 @@ mcsh_parse_options(unsigned int argc, char* argv[],
       case 'c':
         list_array_add(&cmd_tmp, strdup(optarg));
         break;
+      case 'P':
+        free(cmd->profile);
+        cmd->profile = strdup(optarg != NULL ? optarg : "mcsh-profile");
+        break;
+      case 'T':
+        cmd->trace = trace_records;
+        if (optarg != NULL && ! is_integer(optarg, &cmd->trace))
+          fail("mcsh: --trace: not a number: %s\n", optarg);
+        break;
       default:
         fail("unknown flag: %c\n", c);
     }
@@ -157,7 +192,7 @@ bool
 mcsh_parse_args(unsigned int argc, char* argv[],
                 mcsh_cmd_line* cmd)
 {
-  unsigned int index = 1;
+  unsigned int index = optind;
   char key[1024];
   strcpy(cmd->mcsh_command, argv[0]);
   for ( ; index < argc; index++)
@@ -167,9 +202,9 @@ mcsh_parse_args(unsigned int argc, char* argv[],
     {
       size_t key_length = p - argv[index];
       strlcpyj(key, argv[index], key_length+1);
-      printf("key: '%s'\n", key);
       char* value = strdup(argv[index] + key_length+1);
-      printf("value: '%s'\n", value);
+      mcsh_log(&mcsh.logger, MCSH_LOG_SYSTEM, MCSH_DEBUG,
+               "global: %s=%s", key, value);
       strmap_add(&cmd->globals, key, value);
     }
     else break;
@@ -223,6 +258,7 @@ system_init(mcsh_system* sys)
   mcsh_log(&sys->logger, MCSH_LOG_SYSTEM, MCSH_DEBUG,
            "PID: %i", sys->pid);
   sys->vm_count = 0;
+  pthread_mutex_init(&sys->lock, NULL);
   parse_state_init(&sys->parse_state);
   sys->vm_capacity = 4;
   sys->vms = calloc_checked(sizeof(mcsh_vm*), sys->vm_capacity);
@@ -231,6 +267,36 @@ system_init(mcsh_system* sys)
 
 void vm_add(mcsh_vm* vm);
 
+/** Default statements per batch for mcsh_module_stream() */
+static const size_t stream_batch = 256;
+
+bool
+mcsh_vm_init_stream(mcsh_vm* vm, mcsh_status* status)
+{
+  vm->stream = 0;
+  status->code = MCSH_OK;
+  char* s = getenv("MCSH_STREAM");
+  if (s == NULL || s[0] == '\0') return true;
+  if (strcasecmp(s, "true") == 0)
+  {
+    vm->stream = stream_batch;
+    return true;
+  }
+  if (strcasecmp(s, "false") == 0 || strcmp(s, "0") == 0)
+    return true;
+  // strtoul() would take "-1" and "1x":
+  char* end = s;
+  errno = 0;
+  unsigned long n = 0;
+  if (isdigit((unsigned char) s[0]))
+    n = strtoul(s, &end, 10);
+  RAISE_IF(n == 0 || *end != '\0' || errno != 0,
+           status, NULL, 0, "mcsh.invalid_arguments",
+           "MCSH_STREAM: not a batch size or boolean: '%s'", s);
+  vm->stream = n;
+  return true;
+}
+
 void
 mcsh_vm_init(mcsh_vm* vm)
 {
@@ -239,6 +305,18 @@ mcsh_vm_init(mcsh_vm* vm)
   table_init(&vm->globals, 128);
   vm->main = malloc_checked(sizeof(mcsh_module));
   list_array_init(&vm->path, 4);
+  table_init(&vm->modules,  16);
+  table_init(&vm->sources,  16);
+  table_init(&vm->resolved, 16);
+  vm->import_reload = false;
+  getenv_boolean("MCSH_IMPORT_RELOAD", false, &vm->import_reload);
+  vm->lazy_bodies = true;
+  getenv_boolean("MCSH_LAZY", true, &vm->lazy_bodies);
+  vm->stream = 0;
+  vm->profile = NULL;
+  vm->trace = NULL;
+  memset(&vm->stats, 0, sizeof(vm->stats));
+  table_init(&vm->threads, 4);
   mcsh_module_init(vm->main, vm);
   mcsh_entry* entry = malloc_checked(sizeof(mcsh_entry));
   vm->entry_main = entry;
@@ -253,6 +331,7 @@ mcsh_vm_init(mcsh_vm* vm)
 void
 vm_add(mcsh_vm* vm)
 {
+  pthread_mutex_lock(&mcsh.lock);
   size_t i;
   for (i = 0; i < mcsh.vm_capacity; i++)
   {
@@ -262,15 +341,18 @@ vm_add(mcsh_vm* vm)
     }
   }
   // No slot for a VM!
+  size_t old = mcsh.vm_capacity;
   mcsh.vm_capacity = mcsh.vm_capacity * 2;
   mcsh.vms = realloc_checked(mcsh.vms,
-                             mcsh.vm_count * sizeof(mcsh_vm*));
+                             mcsh.vm_capacity * sizeof(mcsh_vm*));
+  memset(&mcsh.vms[old], 0, old * sizeof(mcsh_vm*));
   done:
   vm->id = i;
   mcsh.vms[vm->id] = vm;
   mcsh.vm_count++;
+  pthread_mutex_unlock(&mcsh.lock);
   mcsh_log(&mcsh.logger, MCSH_LOG_SYSTEM, MCSH_DEBUG,
-           "VM ID: %zi", vm->id);
+           "VM ID: %i", vm->id);
 }
 
 void
@@ -278,12 +360,15 @@ mcsh_cmd_line_init(mcsh_cmd_line* cmd)
 {
   cmd->mode = MCSH_MODE_PROTO;
   strmap_init(&cmd->globals, 4);
+  cmd->profile = NULL;
+  cmd->trace = 0;
 }
 
 void
 mcsh_cmd_line_finalize(mcsh_cmd_line* cmd)
 {
   strmap_finalize(&cmd->globals);
+  free(cmd->profile);
 }
 
 mcsh_value* mcsh_value_new_list_charppc(mcsh_vm* vm,
@@ -310,8 +395,18 @@ mcsh_vm_init_argv(mcsh_vm* vm, int argc, char** argv)
   strmap_add(&module_mcsh_value->module->vars,
              "argv" , mcsh_value_new_list_charppc(vm, argc, argv));
 
-  strmap_add(&parameters, "mcsh", module_mcsh);
+  strmap_add(&parameters, "mcsh", module_mcsh_value);
   mcsh_assign_specials(vm, &parameters);
+  strmap_finalize(&parameters);
+}
+
+void
+mcsh_vm_init_thread(mcsh_vm* vm, int argc, char** argv)
+{
+  mcsh_vm_init_argv(vm, argc, argv);
+  vm->argc = argc;
+  vm->argv = argv;
+  vm_init_path(vm);
 }
 
 static void add_globals(mcsh_vm* vm, strmap* map);
@@ -352,6 +447,27 @@ mcsh_vm_init_cmd(mcsh_vm* vm, mcsh_cmd_line* cmd)
   mcsh_assign_specials(vm, &parameters);
   strmap_finalize(&parameters);
   add_globals(vm, &cmd->globals);
+
+  char* profile = cmd->profile;
+  if (profile == NULL) profile = getenv("MCSH_PROFILE");
+  if (profile != NULL && profile[0] != '\0')
+    vm->profile = mcsh_profile_create(profile);
+
+  size_t records = cmd->trace;
+  char* s = getenv("MCSH_TRACE");
+  if (records == 0 && s != NULL && ! is_integer(s, &records))
+  {
+    bool b;
+    getenv_boolean("MCSH_TRACE", false, &b);
+    if (b) records = trace_records;
+  }
+  if (records > 0)
+  {
+    vm->trace = mcsh_trace_create(records);
+    mcsh_trace_current = vm->trace;
+    mcsh_trace_crash_dump(vm->trace);
+  }
+  mcsh_sample_init(vm);
 }
 
 static bool
@@ -377,6 +493,7 @@ vm_init_path(mcsh_vm* vm)
   mcsh_log(&vm->logger, MCSH_LOG_CORE, MCSH_INFO,
            "adding to path: '%s'", p);
   list_array_add(&vm->path, strdup(p));
+  mcsh_resolved_clear(vm);
 
   return true;
 }
@@ -399,10 +516,7 @@ add_globals(mcsh_vm* vm, strmap* map)
 static void
 parse_state_init(mcsh_parse_state* parse_state)
 {
-  parse_state->target = NULL;
-  parse_state->id     = 0;
-  parse_state->status = MCSH_PARSE_NONE;
-  parse_state->output = NULL;
+  parse_state->id = 0;
 }
 
 static void mcsh_stmts_init(mcsh_stmts* stmts);
@@ -416,6 +530,13 @@ mcsh_module_init(mcsh_module* module, mcsh_vm* vm)
   module->instruction = 0;
   mcsh_stmts_init(&module->stmts);
   strmap_init(&module->vars, 4);
+  module->fd      = -1;
+  module->mtime.tv_sec  = 0;
+  module->mtime.tv_nsec = 0;
+  module->size    = 0;
+  module->lazy    = 0;
+  module->pending = NULL;
+  module->sample_id = 0;
 }
 
 void
@@ -494,9 +615,10 @@ mcsh_entry_init_macro(mcsh_entry* entry, mcsh_entry* parent)
 static inline void
 mcsh_entry_init(mcsh_entry* entry, mcsh_entry* parent)
 {
-  entry->id = counter++;
+  entry->id = __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
   // If parent is NULL, this is the main module
   entry->parent = parent;
+  entry->stmt   = NULL;
   strmap_init(&entry->vars, 4);
 }
 
@@ -510,6 +632,20 @@ mcsh_log_line(mcsh_module* module, const char* code)
   }
 }
 
+/** An import or source file already loaded by this VM */
+typedef struct
+{
+  /// For import: the module value, held by the registry
+  mcsh_value* value;
+  /// For source: the module the stmts were parsed for
+  mcsh_module* caller;
+  /// For source: the parsed file
+  mcsh_stmts stmts;
+  /// For the reload check
+  struct timespec mtime;
+  off_t size;
+} registry_entry;
+
 /**
    foundname: output buffer for located file in vm.path.
    Should be allocated by user to PATH_MAX
@@ -518,8 +654,41 @@ mcsh_log_line(mcsh_module* module, const char* code)
 static bool resolve_import(mcsh_vm* vm, const char* name,
                            bool add_suffix, char* foundname);
 
+static registry_entry* registry_lookup(mcsh_vm* vm,
+                                       struct table* registry,
+                                       const char* foundname,
+                                       char* realname);
+
+static registry_entry* registry_add(struct table* registry,
+                                    const char* realname);
+
+/** Read, parse, and run module from filename */
+static void
+module_run(mcsh_module* module, const char* filename,
+           mcsh_entry* parent, mcsh_value** output,
+           mcsh_status* status)
+{
+  mcsh_vm* vm = module->vm;
+  FILE* fp = fopen(filename, "r");
+  if (fp == NULL)
+  {
+    char* msg = strerror(errno);
+    mcsh_raise(status, NULL, 0, "mcsh.import_failed",
+               "import error for '%s': %s", module->name, msg);
+    return;
+  }
+  mcsh_module_parse_file(filename, module->name, fp, module);
+  fclose(fp);
+  mcsh_entry* current = vm->stack.current;
+  mcsh_entry* entry = mcsh_entry_construct_module(module, parent);
+  vm->stack.current = entry;
+  mcsh_module_execute(module, output, status);
+  // TODO: release entry->vars
+  vm->stack.current = current;
+}
+
 bool
-mcsh_import(mcsh_module* caller, const char* name,
+mcsh_import(mcsh_module* caller, const char* name, bool lazy,
             mcsh_value** output, mcsh_status* status)
 {
   mcsh_vm* vm = caller->vm;
@@ -536,24 +705,36 @@ mcsh_import(mcsh_module* caller, const char* name,
   }
   mcsh_log(&vm->logger, MCSH_LOG_MODULE, MCSH_INFO,
            "import resolved: '%s'", foundname);
-  FILE* fp = fopen(foundname, "r");
-  if (fp == NULL)
+
+  char realname[PATH_MAX];
+  registry_entry* r = registry_lookup(vm, &vm->modules,
+                                      foundname, realname);
+  if (r != NULL)
   {
-    char* msg = strerror(errno);
-    mcsh_raise(status, NULL, 0, "mcsh.import_failed",
-               "import error for '%s': %s", name, msg);
+    mcsh_log(&vm->logger, MCSH_LOG_MODULE, MCSH_INFO,
+             "import registered: '%s'", realname);
+    if (! lazy)
+    {
+      mcsh_module_load(r->value->module, status);
+      PROPAGATE(status);
+    }
+    mcsh_value_grab(&vm->logger, r->value);
+    strmap_add(&vm->stack.current->vars, name, r->value);
+    status->code = MCSH_OK;
     return true;
   }
-  char* code = slurp_fp(fp);
+
   mcsh_module* module = malloc_checked(sizeof(*module));
   mcsh_module_init(module, vm);
-  mcsh_module_parse(foundname, name, code, module);
-  mcsh_entry* entry = mcsh_entry_construct_module(module,
-                                                  vm->stack.current);
-  vm->stack.current = entry;
-  mcsh_module_execute(module, output, status);
-  // TODO: release entry->vars
-  vm->stack.current = entry->parent;
+  strcpy(module->source, foundname);
+  strcpy(module->name,   name);
+  if (lazy)
+  {
+    module->pending = strdup_checked(foundname);
+    status->code = MCSH_OK;
+  }
+  else
+    module_run(module, foundname, vm->stack.current, output, status);
 
   mcsh_value* value = mcsh_value_new_module(vm, module);
   strmap_add(&vm->stack.current->vars, name, value);
@@ -561,15 +742,46 @@ mcsh_import(mcsh_module* caller, const char* name,
            "added: '%s'", name);
   value->refs++;
 
+  // Register only modules that loaded cleanly:
+  if (status->code == MCSH_OK && realname[0] != '\0')
+  {
+    r = registry_add(&vm->modules, realname);
+    r->value = value;
+    mcsh_value_grab(&vm->logger, value);
+  }
+
   status->code = MCSH_OK;
   return true;
 }
 
+bool
+mcsh_module_load(mcsh_module* module, mcsh_status* status)
+{
+  if (module->pending == NULL) return true;
+  // Clear this first in case the module refers to itself:
+  char* filename = module->pending;
+  module->pending = NULL;
+  mcsh_log(&module->vm->logger, MCSH_LOG_MODULE, MCSH_INFO,
+           "import load: '%s'", filename);
+  // The importing frame may be gone: run under main like
+  // a top-level import
+  mcsh_value* output = NULL;
+  status->code = MCSH_OK;
+  module_run(module, filename, module->vm->entry_main,
+             &output, status);
+  free(filename);
+  return true;
+}
+
 bool mcsh_source_parse(const char* source,
                        char* code,
                        mcsh_module* module,
                        mcsh_stmts* stmts);
 
+static bool source_parse_file(const char* source, FILE* fp,
+                              mcsh_module* module,
+                              mcsh_stmts* stmts);
+
 bool
 mcsh_source(mcsh_module* caller, const char* name,
             mcsh_value** output, mcsh_status* status)
@@ -588,19 +800,36 @@ mcsh_source(mcsh_module* caller, const char* name,
   }
   mcsh_log(&vm->logger, MCSH_LOG_MODULE, MCSH_INFO,
            "resolved source: '%s'", foundname);
-  FILE* fp = fopen(foundname, "r");
-  if (fp == NULL)
-    RAISE(status, NULL, 0, "mcsh.source_failed",
-          "source error for '%s': %s", name, strerror(errno));
-
-  char* code = slurp_fp(fp);
-
-  mcsh_stmts stmts;
-  mcsh_stmts_init(&stmts);
 
-  mcsh_source_parse(foundname, code, caller, &stmts);
-
-  mcsh_stmts_execute(caller, &stmts, output, status);
+  // Unlike import, source runs the file every time,
+  // but it is only read and parsed once per caller:
+  char realname[PATH_MAX];
+  registry_entry* r = registry_lookup(vm, &vm->sources,
+                                      foundname, realname);
+  if (r == NULL || r->caller != caller)
+  {
+    FILE* fp = fopen(foundname, "r");
+    if (fp == NULL)
+      RAISE(status, NULL, 0, "mcsh.source_failed",
+            "source error for '%s': %s", name, strerror(errno));
+
+    if (r == NULL && realname[0] != '\0')
+      r = registry_add(&vm->sources, realname);
+    mcsh_stmts stmts;
+    mcsh_stmts* target = (r != NULL) ? &r->stmts : &stmts;
+    // Any previous stmts may still back functions: keep them
+    mcsh_stmts_init(target);
+    source_parse_file(foundname, fp, caller, target);
+    fclose(fp);
+    if (r != NULL) r->caller = caller;
+    mcsh_stmts_execute(caller, target, output, status);
+  }
+  else
+  {
+    mcsh_log(&vm->logger, MCSH_LOG_MODULE, MCSH_INFO,
+             "source registered: '%s'", realname);
+    mcsh_stmts_execute(caller, &r->stmts, output, status);
+  }
 
   status->code = MCSH_OK;
   return true;
@@ -629,25 +858,123 @@ resolve_import(mcsh_vm* vm, const char* name,
                bool add_suffix, char* foundname)
 {
   size_t path_max = (size_t) PATH_MAX;
+  char key[PATH_MAX];
+  char* k = &key[0];
+  append(k, name, path_max);
+  if (add_suffix) append(k, ".mc", path_max);
+
+  char* previous;
+  if (table_search(&vm->resolved, key, (void**) &previous))
+  {
+    if (previous != NULL)
+    {
+      strcpy(foundname, previous);
+      return true;
+    }
+    // A failed lookup: trust it unless files may come and go
+    if (! vm->import_reload) return false;
+    table_remove(&vm->resolved, key, NULL);
+  }
+
   struct stat s;
   for (int i = vm->path.size - 1; i >= 0; i--)
   {
     char* p = &foundname[0];
     append(p, vm->path.data[i], path_max);
     append(p, "/",              path_max);
-    append(p, name,             path_max);
-    if (add_suffix) append(p, ".mc", path_max);
-    printf("try: %s\n", foundname);
+    append(p, key,              path_max);
+    mcsh_log(&vm->logger, MCSH_LOG_MODULE, MCSH_DEBUG,
+             "try: %s", foundname);
     int rc = stat(foundname, &s);
     if (rc == 0)
     {
-      printf("found.\n");
+      table_add(&vm->resolved, key, strdup_checked(foundname));
       return true;
     }
   }
+  table_add(&vm->resolved, key, NULL);
   return false;
 }
 
+static void
+resolved_free(UNUSED void* context, UNUSED const char* key, void* data)
+{
+  free(data);
+}
+
+void
+mcsh_resolved_clear(mcsh_vm* vm)
+{
+  table_free_callback(&vm->resolved, false, resolved_free, NULL);
+  table_init(&vm->resolved, 16);
+}
+
+/**
+   Find the registry entry for foundname.
+   realname: output buffer for the key, allocated to PATH_MAX,
+             empty if foundname cannot be registered
+   @return NULL if not registered, or stale under import_reload
+*/
+static registry_entry*
+registry_lookup(mcsh_vm* vm, struct table* registry,
+                const char* foundname, char* realname)
+{
+  realname[0] = '\0';
+  if (realpath(foundname, realname) == NULL)
+  {
+    realname[0] = '\0';
+    return NULL;
+  }
+  registry_entry* r;
+  if (! table_search(registry, realname, (void**) &r))
+    return NULL;
+  if (! vm->import_reload) return r;
+
+  struct stat s;
+  if (stat(realname, &s) == 0 &&
+      s.st_mtim.tv_sec  == r->mtime.tv_sec  &&
+      s.st_mtim.tv_nsec == r->mtime.tv_nsec &&
+      s.st_size         == r->size)
+    return r;
+
+  mcsh_log(&vm->logger, MCSH_LOG_MODULE, MCSH_INFO,
+           "reload: '%s'", realname);
+  // Callers may still refer to the old module and stmts:
+  // only the entry is released
+  table_remove(registry, realname, NULL);
+  if (r->value != NULL) mcsh_value_drop(&vm->logger, r->value);
+  free(r);
+  return NULL;
+}
+
+static registry_entry*
+registry_add(struct table* registry, const char* realname)
+{
+  registry_entry* r = malloc_checked(sizeof(*r));
+  r->value  = NULL;
+  r->caller = NULL;
+  r->mtime.tv_sec  = 0;
+  r->mtime.tv_nsec = 0;
+  r->size   = -1;
+  struct stat s;
+  if (stat(realname, &s) == 0)
+  {
+    r->mtime = s.st_mtim;
+    r->size  = s.st_size;
+  }
+  table_add(registry, realname, r);
+  return r;
+}
+
+static void
+registry_free(void* context, UNUSED const char* key, void* data)
+{
+  mcsh_vm* vm = context;
+  registry_entry* r = data;
+  if (r->value != NULL) mcsh_value_drop(&vm->logger, r->value);
+  free(r);
+}
+
 void mcsh_stmts_finalize(mcsh_module* module, mcsh_stmts* stmts);
 
 void
@@ -657,6 +984,8 @@ mcsh_module_finalize(mcsh_module* module)
            "module_finalize: %s", module->name);
   strmap_finalize(&module->vars);
   mcsh_stmts_finalize(module, &module->stmts);
+  if (module->fd != -1) close(module->fd);
+  free(module->pending);
 }
 
 static void
@@ -685,13 +1014,22 @@ value_free(mcsh_logger* logger, mcsh_value* value)
 {
   char name[64];
 
+  if (value->literal)
+    // Freed with its token: see mcsh_token_free()
+    return;
+  if (value == &mcsh_null)
+    // Static, and shared by all VMs
+    return;
+
   switch (value->type)
   {
     case MCSH_VALUE_STRING:
     {
       mcsh_log(logger, MCSH_LOG_MEM, MCSH_INFO,
                "value_free: \"%s\"", value->string);
-      free(value->string);
+      // Strings from mcsh_value_new_string_n() are freed with value:
+      if (value->string != (char*) (value + 1))
+        free(value->string);
       break;
     }
     case MCSH_VALUE_LIST:
@@ -702,6 +1040,27 @@ value_free(mcsh_logger* logger, mcsh_value* value)
       value_free_list(logger, value);
       break;
     }
+    case MCSH_VALUE_HANDLE:
+    {
+      mcsh_log(logger, MCSH_LOG_MEM, MCSH_INFO,
+               "value_free: handle: %s", value->handle->name);
+      mcsh_handle_free(value->handle);
+      break;
+    }
+    case MCSH_VALUE_CHAN:
+    {
+      mcsh_log(logger, MCSH_LOG_MEM, MCSH_INFO,
+               "value_free: chan:%"PRIi64, value->chan->id);
+      mcsh_chan_unref(value->chan);
+      break;
+    }
+    case MCSH_VALUE_ITERATOR:
+    {
+      mcsh_log(logger, MCSH_LOG_MEM, MCSH_INFO,
+               "value_free: iterator: %s", value->iterator->name);
+      mcsh_iterator_free_all(value->iterator);
+      break;
+    }
     default:
     {
       mcsh_value_type_name(value->type, name);
@@ -709,6 +1068,7 @@ value_free(mcsh_logger* logger, mcsh_value* value)
                "value_free: skip: %p %s", value, name);
     }
   }
+  mcsh_mem_free(value);
   free(value);
 }
 
@@ -761,22 +1121,41 @@ stmts_free(mcsh_module* module, mcsh_stmts* stmts)
 static void
 thing_subfun_free(mcsh_module* module, mcsh_subfun* subfun)
 {
-  stmts_free(module, &subfun->stmts);
+  mcsh_stmts_finalize(module, &subfun->stmts);
   free(subfun);
 }
 
+static void
+thing_subcmd_free(mcsh_module* module, mcsh_subcmd* subcmd)
+{
+  mcsh_stmts_finalize(module, &subcmd->stmts);
+  free(subcmd);
+}
+
+static void
+thing_block_free(mcsh_module* module, mcsh_block* block)
+{
+  if (block->captured) return;
+  mcsh_stmts_finalize(module, &block->stmts);
+  if (block->lazy != NULL)
+  {
+    free(block->lazy);
+    module->lazy--;
+  }
+  free(block);
+}
+
 void
 mcsh_thing_free(mcsh_thing* thing)
 {
   char string[64];
   mcsh_log(&thing->module->vm->logger, MCSH_LOG_MEM, MCSH_INFO,
-           "thing_free(%p)");
+           "thing_free(%p)", thing);
   switch (thing->type)
   {
     case MCSH_THING_TOKEN:
     {
-      free(thing->data.token->text);
-      free(thing->data.token);
+      mcsh_token_free(&thing->module->vm->logger, thing->data.token);
       break;
     }
     case MCSH_THING_SUBFUN:
@@ -784,6 +1163,16 @@ mcsh_thing_free(mcsh_thing* thing)
       thing_subfun_free(thing->module, thing->data.subfun);
       break;
     }
+    case MCSH_THING_SUBCMD:
+    {
+      thing_subcmd_free(thing->module, thing->data.subcmd);
+      break;
+    }
+    case MCSH_THING_BLOCK:
+    {
+      thing_block_free(thing->module, thing->data.block);
+      break;
+    }
     default:
     {
       thing_str(thing, string);
@@ -805,25 +1194,38 @@ mcsh_stmt_init(mcsh_stmt* stmt,
   stmt->line   = line;
 }
 
-/** Get a unique object id for each parsed item */
-static int
-parse_id(void)
+int
+mcsh_parse_id()
 {
-  return ++mcsh.parse_state.id;
+  return __atomic_add_fetch(&mcsh.parse_state.id, 1, __ATOMIC_RELAXED);
 }
 
-void mcsh_script_source_set(char* text);
-bool mcsh_script_preprocess(char* code);
-void mcsh_script_clean(void);
-
-// In mcsh-expr.l
-void mcsh_expr_source_set(char* text);
-
 void mcsh_node_print(mcsh_node* node, int indent);
 static void mcsh_node_to_module(mcsh_module* module,
                                 mcsh_thing* parent,
                                 mcsh_node* node);
 
+/** Convert the parse into module and release it */
+static bool
+module_parse_finish(mcsh_module* module, mcsh_parse_context* ctx)
+{
+  free(ctx->lazy);
+
+  if (mcsh_log_check(&module->vm->logger, MCSH_LOG_PARSE, MCSH_TRACE))
+    mcsh_node_print(ctx->output, 0);
+
+  mcsh_node_to_module(module, NULL, ctx->output);
+
+  mcsh_node_free(ctx->output, 0);
+
+  if (ctx->status != MCSH_PARSE_OK)
+  {
+    printf("mcsh: parse failed!\n");
+    return false;
+  }
+  return true;
+}
+
 /**
    source: The filename or (stdin)
    name:   The module name
@@ -838,39 +1240,65 @@ mcsh_module_parse(const char* source,
 {
   mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_DEBUG,
            "module_parse: %s", source);
-  strcpy(mcsh.parse_state.source, source);
-  strcpy(module->source,          source);
-  strcpy(mcsh.parse_state.name,   name);
-  strcpy(module->name,            name);
-  mcsh.parse_state.status = MCSH_PARSE_START;
-  mcsh_thing* thing = malloc_checked(sizeof(mcsh_thing));
+  strcpy(module->source, source);
+  strcpy(module->name,   name);
 
-  thing->type = MCSH_THING_MODULE;
-  thing->module = module;
-  thing->data.module = module;
-  thing->module = module;
-  mcsh.parse_state.target = thing;
-
-  mcsh_script_preprocess(code);
-
-  mcsh_script_source_set(code);
-
-  // Call to bison parser:
-  mcsh_script_parse();
+  mcsh_parse_context ctx;
+  mcsh_parse_context_init(&ctx);
+  mcsh_script_parse_string(&ctx, code);
+  return module_parse_finish(module, &ctx);
+}
 
-  if (mcsh_log_check(&module->vm->logger, MCSH_LOG_PARSE, MCSH_TRACE))
-    mcsh_node_print(mcsh.parse_state.output, 0);
+/** Keep the source file open for mcsh_block_load() */
+static void
+module_hold(mcsh_module* module, int fd, struct stat* s)
+{
+  module->fd    = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  module->mtime = s->st_mtim;
+  module->size  = s->st_size;
+}
 
-  mcsh_node_to_module(module, NULL, mcsh.parse_state.output);
+bool
+mcsh_module_parse_file(const char* source,
+                       const char* name,
+                       FILE* fp,
+                       mcsh_module* module)
+{
+  mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_DEBUG,
+           "module_parse_file: %s", source);
+  // The caller may pass module's own fields:
+  if (source != module->source) strcpy(module->source, source);
+  if (name   != module->name)   strcpy(module->name,   name);
 
-  mcsh_script_clean();
+  int fd = fileno(fp);
+  struct stat s;
+  bool regular = (fstat(fd, &s) == 0 && S_ISREG(s.st_mode));
+  // Only whole files are cached, not interactive lines:
+  bool cacheable = regular && (module->stmts.stmts.size == 0);
+  uint64_t hash = 0;
+  if (cacheable && ! mcsh_cache_hash_file(fd, &hash))
+    cacheable = false;
+  if (cacheable && mcsh_cache_load(module, source, hash, &module->stmts))
+  {
+    if (module->lazy > 0) module_hold(module, fd, &s);
+    return true;
+  }
 
-  if (mcsh.parse_state.status != MCSH_PARSE_OK)
+  mcsh_parse_context ctx;
+  mcsh_parse_context_init(&ctx);
+  // Only one file per module may back lazy bodies:
+  if (regular && module->vm->lazy_bodies && module->fd == -1)
   {
-    printf("mcsh: parse failed!\n");
-    return false;
+    ctx.scan.lazy_bodies = true;
+    ctx.scan.offset      = ftell(fp);
   }
-  return true;
+  mcsh_script_parse_file(&ctx, fp);
+  if (ctx.lazy_count > 0) module_hold(module, fd, &s);
+
+  bool result = module_parse_finish(module, &ctx);
+  if (result && cacheable)
+    mcsh_cache_store(module, source, hash, &module->stmts);
+  return result;
 }
 
 static void node_to_stmts(mcsh_module* module, mcsh_thing* parent,
@@ -878,32 +1306,19 @@ static void node_to_stmts(mcsh_module* module, mcsh_thing* parent,
                           mcsh_stmts* stmts,
                           bool* added);
 
-bool
-mcsh_source_parse(const char* source,
-                  char* code,
-                  mcsh_module* module,
-                  mcsh_stmts* stmts)
+static bool
+source_parse_finish(mcsh_module* module, mcsh_parse_context* ctx,
+                    mcsh_stmts* stmts)
 {
-  mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_DEBUG,
-           "module_parse: %s", source);
-  strcpy(mcsh.parse_state.source, source);
-
-  mcsh_script_preprocess(code);
-
-  mcsh_script_source_set(code);
-
-  // Call to bison parser:
-  mcsh_script_parse();
-
   if (mcsh_log_check(&module->vm->logger, MCSH_LOG_PARSE, MCSH_FATAL))
-    mcsh_node_print(mcsh.parse_state.output, 0);
+    mcsh_node_print(ctx->output, 0);
 
   bool added = false;
-  node_to_stmts(module, NULL, mcsh.parse_state.output, stmts, &added);
+  node_to_stmts(module, NULL, ctx->output, stmts, &added);
 
-  mcsh_script_clean();
+  mcsh_node_free(ctx->output, 0);
 
-  if (mcsh.parse_state.status != MCSH_PARSE_OK)
+  if (ctx->status != MCSH_PARSE_OK)
   {
     printf("mcsh: source parse  failed!\n");
     return false;
@@ -911,13 +1326,43 @@ mcsh_source_parse(const char* source,
   return true;
 }
 
+bool
+mcsh_source_parse(const char* source,
+                  char* code,
+                  mcsh_module* module,
+                  mcsh_stmts* stmts)
+{
+  mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_DEBUG,
+           "module_parse: %s", source);
+
+  mcsh_parse_context ctx;
+  mcsh_parse_context_init(&ctx);
+  mcsh_script_parse_string(&ctx, code);
+  return source_parse_finish(module, &ctx, stmts);
+}
+
+/** Sourced text may run under many callers,
+    so function bodies are never lazy here */
+static bool
+source_parse_file(const char* source, FILE* fp,
+                  mcsh_module* module, mcsh_stmts* stmts)
+{
+  mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_DEBUG,
+           "module_parse: %s", source);
+
+  mcsh_parse_context ctx;
+  mcsh_parse_context_init(&ctx);
+  mcsh_script_parse_file(&ctx, fp);
+  return source_parse_finish(module, &ctx, stmts);
+}
+
 static inline mcsh_thing*
 mcsh_thing_construct_token(mcsh_module* module, const char* token)
 {
   mcsh_thing* thing = malloc_checked(sizeof(mcsh_thing));
   thing->type = MCSH_THING_TOKEN;
   thing->data.token = malloc_checked(sizeof(mcsh_token));
-  thing->data.token->text = strdup(token);
+  mcsh_token_init(thing->data.token, strdup(token));
   thing->module = module;
   return thing;
 }
@@ -927,9 +1372,11 @@ mcsh_thing_construct_block(mcsh_module* module, mcsh_thing* parent,
                            int line)
 {
   mcsh_block* block = malloc_checked(sizeof(mcsh_block));
-  block->id = parse_id();
+  block->id = mcsh_parse_id();
   block->line = line;
   list_array_init(&block->stmts.stmts, 2);
+  block->lazy = NULL;
+  block->captured = false;
   mcsh_thing* thing = malloc_checked(sizeof(mcsh_thing));
   thing->type = MCSH_THING_BLOCK;
   thing->data.block = block;
@@ -943,7 +1390,7 @@ mcsh_thing_construct_subcmd(mcsh_module* module, mcsh_thing* parent,
                             UNUSED int line)
 {
   mcsh_subcmd* subcmd = malloc_checked(sizeof(mcsh_subcmd));
-  /* subcmd->id = parse_id(); */
+  /* subcmd->id = mcsh_parse_id(); */
   /* subcmd->line = line; */
   list_array_init(&subcmd->stmts.stmts, 2);
   mcsh_thing* thing = malloc_checked(sizeof(mcsh_thing));
@@ -959,7 +1406,7 @@ mcsh_thing_construct_subfun(mcsh_module* module, mcsh_thing* parent,
                             UNUSED int line)
 {
   mcsh_subfun* subfun = malloc_checked(sizeof(mcsh_subfun));
-  /* subfun->id = parse_id(); */
+  /* subfun->id = mcsh_parse_id(); */
   /* subfun->line = line; */
   list_array_init(&subfun->stmts.stmts, 2);
   mcsh_thing* thing = malloc_checked(sizeof(mcsh_thing));
@@ -985,38 +1432,38 @@ mcsh_stmt_construct(mcsh_module* module, mcsh_thing* parent,
 /* mcsh_stmt_end2() */
 /* { */
 /*   char text[64]; */
-/*   thing_str(mcsh.parse_state.target, text); */
+/*   thing_str(parse_target, text); */
 /*   printf("stmt_end() in: %s\n", text); */
-/*   if (mcsh.parse_state.target->type == MCSH_THING_STMT  || */
-/*       mcsh.parse_state.target->type == MCSH_THING_BLOCK || */
-/*       mcsh.parse_state.target->type == MCSH_THING_SUBFUN) */
+/*   if (parse_target->type == MCSH_THING_STMT  || */
+/*       parse_target->type == MCSH_THING_BLOCK || */
+/*       parse_target->type == MCSH_THING_SUBFUN) */
 /*   { */
-/*     if (mcsh.parse_state.target->type == MCSH_THING_STMT) */
+/*     if (parse_target->type == MCSH_THING_STMT) */
 /*     { */
-/*       mcsh_thing* tgt = mcsh.parse_state.target; */
+/*       mcsh_thing* tgt = parse_target; */
 /*       mcsh_stmt* stmt = tgt->data.stmt; */
-/*       thing_str(mcsh.parse_state.target, text); */
+/*       thing_str(parse_target, text); */
 /*       printf("parse target is stmt: %s\n", text); */
-/*       mcsh.parse_state.target = tgt->parent; */
+/*       parse_target = tgt->parent; */
 /*       printf("line: %i\n", __LINE__); */
-/*       thing_str(mcsh.parse_state.target, text); */
+/*       thing_str(parse_target, text); */
 /*       printf("parse target is now: %s\n", text); */
 /*       mcsh_add_stmt(stmt); */
 /*       free(tgt); // Free the old parse_target */
 /*     } */
-/*     else if (mcsh.parse_state.target->type == MCSH_THING_BLOCK) */
+/*     else if (parse_target->type == MCSH_THING_BLOCK) */
 /*     { */
 /*       // Empty stmt */
-/*       /\* mcsh_thing* parent = mcsh.parse_state.target->parent; *\/ */
+/*       /\* mcsh_thing* parent = parse_target->parent; *\/ */
 /*       /\* if (parent == NULL) *\/ */
 /*       /\*   printf("parent is NULL\n"); *\/ */
-/*       /\* mcsh.parse_state.target = parent; *\/ */
+/*       /\* parse_target = parent; *\/ */
 /*       printf("empty stmt in block\n"); */
 /*     } */
 /*     else */
 /*       valgrind_fail(); */
 /*   } */
-/*   else if (mcsh.parse_state.target->type == MCSH_THING_MODULE) */
+/*   else if (parse_target->type == MCSH_THING_MODULE) */
 /*   { */
 /*     printf("mcsh_stmt_end() MODULE ...\n"); */
 /*   } */
@@ -1028,19 +1475,19 @@ static bool
 mcsh_add_stmt(mcsh_stmt* stmt)
 {
   bool result = false;
-  if (mcsh.parse_state.target->type == MCSH_THING_MODULE)
+  if (parse_target->type == MCSH_THING_MODULE)
   {
-    mcsh_module* module = mcsh.parse_state.target->module;
+    mcsh_module* module = parse_target->module;
     list_array_add(&module->stmts.stmts, stmt);
   }
-  else if (mcsh.parse_state.target->type == MCSH_THING_BLOCK)
+  else if (parse_target->type == MCSH_THING_BLOCK)
   {
-    mcsh_block* block = mcsh.parse_state.target->data.block;
+    mcsh_block* block = parse_target->data.block;
     list_array_add(&block->stmts.stmts, stmt);
   }
-  else if (mcsh.parse_state.target->type == MCSH_THING_SUBFUN)
+  else if (parse_target->type == MCSH_THING_SUBFUN)
   {
-    mcsh_subfun* subfun = mcsh.parse_state.target->data.subfun;
+    mcsh_subfun* subfun = parse_target->data.subfun;
     list_array_add(&subfun->stmts.stmts, stmt);
   }
   else valgrind_fail();
@@ -1051,35 +1498,30 @@ mcsh_add_stmt(mcsh_stmt* stmt)
 void
 mcsh_block_start()
 {
-  int line = mcsh_script_get_lineno();
+  // Line numbers now live in the per-call parse context
+  int line = -1;
   // Start a new block
-  mcsh_thing* parent = mcsh.parse_state.target;
+  mcsh_thing* parent = parse_target;
   mcsh_thing* thing =
     mcsh_thing_construct_block(parent->module, parent, line);
-  char text[64];
-  thing_str(thing, text);
-  printf("block_start(): %s\n", text);
-  mcsh.parse_state.target = thing;
+  TRACE(BLOCK_START, thing, 0);
+  parse_target = thing;
 }
 
 void mcsh_block_end2()
 {
-  char text[64];
-  mcsh_thing* this = mcsh.parse_state.target;
-  thing_str(this, text);
-  printf("block_end(): %s\n", text);
+  mcsh_thing* this = parse_target;
   // mcsh_block* this = tgt->data.block;
 
-  mcsh_thing* parent = mcsh.parse_state.target->parent;
-  thing_str(parent, text);
-  printf("parent: %s\n", text);
+  mcsh_thing* parent = parse_target->parent;
+  TRACE(BLOCK_END, this, parent);
   if (parent->type == MCSH_THING_STMT)
   {
     mcsh_stmt* stmt = parent->data.stmt;
     list_array_add(&stmt->things, this);
     /* mcsh_block* block = mcsh.parse_target->data.block; */
     /* list_array_add(&block->stmts.stmts, stmt); */
-    mcsh.parse_state.target = parent;
+    parse_target = parent;
   }
   else
   {
@@ -1103,9 +1545,9 @@ mcsh_subfun_start()
 void
 mcsh_module_end()
 {
-  assert(mcsh.parse_state.target->type == MCSH_THING_MODULE);
+  assert(parse_target->type == MCSH_THING_MODULE);
   /* printf("mcsh_module_end() ... stmts=%zi\n", */
-  /*        mcsh.parse_state.target->module->stmts.stmts.size); */
+  /*        parse_target->module->stmts.stmts.size); */
 }
 
 static void hp_directive(mcsh_vm* vm, buffer* line, const char** start);
@@ -1198,60 +1640,88 @@ mcsh_value_new_string(mcsh_vm* vm, const char* s)
   mcsh_value* value = malloc_checked(sizeof(mcsh_value));
   mcsh_log(&vm->logger, MCSH_LOG_DATA, MCSH_TRACE,
            "new string: %p \"%s\"", value, s);
-  mcsh_value_init_string(value, strdup(s));
+  mcsh_value_init_string(value, strdup_checked((char*) s));
+  mcsh_mem_new(value);
+  return value;
+}
+
+mcsh_value*
+mcsh_value_new_string_n(const char* s, size_t n)
+{
+  mcsh_value* value = malloc_checked(sizeof(mcsh_value) + n + 1);
+  char* t = (char*) (value + 1);
+  memcpy(t, s, n);
+  t[n] = '\0';
+  mcsh_value_init_string(value, t);
+  mcsh_mem_new(value);
+  return value;
+}
+
+mcsh_value*
+mcsh_value_new_string_take(char* s)
+{
+  mcsh_value* value = malloc_checked(sizeof(mcsh_value));
+  mcsh_value_init_string(value, s);
+  mcsh_mem_new(value);
   return value;
 }
 
 mcsh_value*
 mcsh_value_new_string_null()
 {
-  mcsh_value* result = malloc(sizeof(mcsh_value));
+  mcsh_value* result = malloc_checked(sizeof(mcsh_value));
   mcsh_value_init_string(result, NULL);
+  mcsh_mem_new(result);
   return result;
 }
 
 mcsh_value*
 mcsh_value_new_null()
 {
-  mcsh_value* result = malloc(sizeof(mcsh_value));
+  mcsh_value* result = malloc_checked(sizeof(mcsh_value));
   mcsh_value_init_null(result);
+  mcsh_mem_new(result);
   return result;
 }
 
 mcsh_value*
 mcsh_value_new_link(mcsh_value* target)
 {
-  mcsh_value* result = malloc(sizeof(mcsh_value));
+  mcsh_value* result = malloc_checked(sizeof(mcsh_value));
   mcsh_value_init(result);
   result->type = MCSH_VALUE_LINK;
   result->link = target;
   result->refs = 1;
+  mcsh_mem_new(result);
   return result;
 }
 
 mcsh_value*
 mcsh_value_new_int(int64_t i)
 {
-  mcsh_value* result = malloc(sizeof(mcsh_value));
+  mcsh_value* result = malloc_checked(sizeof(mcsh_value));
   mcsh_value_init_int(result, i);
+  mcsh_mem_new(result);
   return result;
 }
 
 mcsh_value*
 mcsh_value_new_float(double f)
 {
-  mcsh_value* result = malloc(sizeof(mcsh_value));
+  mcsh_value* result = malloc_checked(sizeof(mcsh_value));
   mcsh_value_init_float(result, f);
+  mcsh_mem_new(result);
   return result;
 }
 
 mcsh_value*
 mcsh_value_new_list_sized(mcsh_vm* vm, size_t size)
 {
-  mcsh_value* value = malloc(sizeof(mcsh_value));
+  mcsh_value* value = malloc_checked(sizeof(mcsh_value));
   mcsh_value_init_list_sized(value, size);
   mcsh_log(&vm->logger, MCSH_LOG_DATA, MCSH_DEBUG,
              "value new L: %p size=%zi", value, size);
+  mcsh_mem_new(value);
   return value;
 }
 
@@ -1282,8 +1752,9 @@ mcsh_value_new_table(mcsh_vm* vm, size_t size)
 {
   mcsh_log(&vm->logger, MCSH_LOG_DATA, MCSH_DEBUG,
            "value new table: size=%zi", size);
-  mcsh_value* result = malloc(sizeof(mcsh_value));
+  mcsh_value* result = malloc_checked(sizeof(mcsh_value));
   mcsh_value_init_table(result, size);
+  mcsh_mem_new(result);
   return result;
 }
 
@@ -1292,8 +1763,9 @@ mcsh_value_new_module(mcsh_vm* vm, mcsh_module* module)
 {
   mcsh_log(&vm->logger, MCSH_LOG_DATA, MCSH_DEBUG,
            "value new module");
-  mcsh_value* result = malloc(sizeof(mcsh_value));
+  mcsh_value* result = malloc_checked(sizeof(mcsh_value));
   mcsh_value_init_module(result, module);
+  mcsh_mem_new(result);
   return result;
 }
 
@@ -1301,9 +1773,11 @@ static mcsh_value*
 mcsh_value_new_block(mcsh_block* block)
 {
   mcsh_value* result = malloc_checked(sizeof(mcsh_value));
+  mcsh_value_init(result);
   result->type  = MCSH_VALUE_BLOCK;
   result->block = block;
   result->refs  = 0;
+  mcsh_mem_new(result);
   return result;
 }
 
@@ -1311,9 +1785,44 @@ mcsh_value*
 mcsh_value_new_activation(mcsh_activation* activation)
 {
   mcsh_value* result = malloc_checked(sizeof(mcsh_value));
+  mcsh_value_init(result);
   result->activation = activation;
   result->type = MCSH_VALUE_ACTIVATION;
   result->refs = 0;
+  mcsh_mem_new(result);
+  return result;
+}
+
+mcsh_value*
+mcsh_value_new_handle(mcsh_handle* handle)
+{
+  mcsh_value* result = malloc_checked(sizeof(mcsh_value));
+  mcsh_value_init(result);
+  result->type   = MCSH_VALUE_HANDLE;
+  result->handle = handle;
+  mcsh_mem_new(result);
+  return result;
+}
+
+mcsh_value*
+mcsh_value_new_chan(mcsh_chan* chan)
+{
+  mcsh_value* result = malloc_checked(sizeof(mcsh_value));
+  mcsh_value_init(result);
+  result->type = MCSH_VALUE_CHAN;
+  result->chan = chan;
+  mcsh_mem_new(result);
+  return result;
+}
+
+mcsh_value*
+mcsh_value_new_iterator(mcsh_iterator* iterator)
+{
+  mcsh_value* result = malloc_checked(sizeof(mcsh_value));
+  mcsh_value_init(result);
+  result->type     = MCSH_VALUE_ITERATOR;
+  result->iterator = iterator;
+  mcsh_mem_new(result);
   return result;
 }
 
@@ -1321,8 +1830,10 @@ mcsh_value*
 mcsh_value_clone(mcsh_value* value)
 {
   mcsh_value* result = malloc_checked(sizeof(mcsh_value));
+  mcsh_value_init(result);
   result->type = value->type;
   result->string = strdup(value->string);
+  mcsh_mem_new(result);
   return result;
 }
 
@@ -1330,6 +1841,10 @@ void
 mcsh_value_grab(mcsh_logger* logger, mcsh_value* value)
 {
   valgrind_assert(value != NULL);
+  // Shared by all VMs: not counted
+  if (value == &mcsh_null) return;
+  // The block may now outlive its statement:
+  if (value->type == MCSH_VALUE_BLOCK) value->block->captured = true;
   value->refs++;
   mcsh_log(logger, MCSH_LOG_MEM, MCSH_INFO,
            "grab: %p %i", value, value->refs);
@@ -1339,6 +1854,7 @@ void
 mcsh_value_drop(mcsh_logger* logger, mcsh_value* value)
 {
   valgrind_assert_msg(value != NULL, "drop(): value == NULL!");
+  if (value == &mcsh_null) return;
   valgrind_assert_msg(value->refs > 0,
                       "drop(): value %p refs == %i",
                       value, value->refs);
@@ -1352,6 +1868,7 @@ mcsh_value_drop(mcsh_logger* logger, mcsh_value* value)
 void
 mcsh_value_assign(mcsh_value* target, mcsh_value* value)
 {
+  valgrind_assert_msg(! target->literal, "assign to literal!");
   // TODO: Free old data
   switch (value->type)
   {
@@ -1389,6 +1906,15 @@ mcsh_value_assign(mcsh_value* target, mcsh_value* value)
     case MCSH_VALUE_ACTIVATION:
       assert(false);
       break;
+    case MCSH_VALUE_HANDLE:
+      assert(false);
+      break;
+    case MCSH_VALUE_ITERATOR:
+      assert(false);
+      break;
+    case MCSH_VALUE_CHAN:
+      assert(false);
+      break;
     case MCSH_VALUE_ANY:
       // A real value cannot have type ANY
       assert(false);
@@ -1437,6 +1963,7 @@ mcsh_value_new_function(mcsh_module* module,
                                         type, name, arglist,
                                         code,
                                         status);
+  mcsh_mem_new(value);
   return value;
 }
 
@@ -1465,9 +1992,11 @@ mcsh_function_new(mcsh_module* module,
   */
 
   mcsh_signature_parse(module, &result->signature, sgtokens, status);
-  mcsh_signature_print(&result->signature);
-
+  TRACE(FUNCTION_NEW, mcsh_trace_str(name), result->signature.count);
 
+  // Defaults may be literals held by the signature tokens:
+  sgtokens->captured = true;
+  code->captured     = true;
   result->block = code;
   return result;
 }
@@ -1486,7 +2015,6 @@ mcsh_signature_init_block(mcsh_signature* sg,
 
   mcsh_stmt* stmt0 = sgtokens->stmts.stmts.data[0];
   sg->count = stmt0->things.size;
-  show("count: %u", sg->count);
   if (sg->count > 0)
   {
     mcsh_thing* thing = stmt0->things.data[sg->count-1];
@@ -1505,7 +2033,7 @@ mcsh_signature_init_block(mcsh_signature* sg,
     mcsh_thing* thing = stmt0->things.data[i];
     mcsh_value* value;
     valgrind_assert(thing->type == MCSH_THING_TOKEN);
-    printf("slot text: '%s'\n", thing->data.token->text);
+    TRACE(SIGNATURE_SLOT, i, mcsh_trace_str(thing->data.token->text));
     mcsh_token_to_value(&vm->logger,
                         vm->stack.current,
                         thing->data.token->text,
@@ -1513,12 +2041,10 @@ mcsh_signature_init_block(mcsh_signature* sg,
                         status);
 
     valgrind_assert(value->type == MCSH_VALUE_STRING);
-    show("slot %u", i);
     sg->slots[i].name = strdup(value->string);
     sg->slots[i].dflt = NULL;
     if (sg->slots[i].dflt != NULL)
       mcsh_value_grab(NULL, sg->slots[i].dflt);
-    show("loop");
   }
 }
 
@@ -1584,9 +2110,8 @@ mcsh_signature_parse(mcsh_module* module,
     if (p != NULL)
     {
       d = p + 1;
-      printf("dflt string: '%s'\n", d);
       *p = '\0';
-      printf("dflt: '%s'   \n", d);
+      TRACE(SIGNATURE_DEFAULT, i, mcsh_trace_str(d));
       bool rc = mcsh_token_to_value(&module->vm->logger,
                                     module->vm->stack.current, d,
                                     &dflt, status);
@@ -1599,7 +2124,7 @@ mcsh_signature_parse(mcsh_module* module,
       mcsh_value_type_code(q, &type);
       *p = '\0';
     }
-    printf("name: '%s'   \n", ntd);
+    TRACE(SIGNATURE_SLOT, i, mcsh_trace_str(ntd));
     // printf("name: '%s'  dflt: '%s'   type=%i \n", ntd, q, type);
     slot_init(&signature->slots[i],
               ntd, dflt, type);
@@ -1616,7 +2141,6 @@ mcsh_signature_parse(mcsh_module* module,
     */
   }
 
-  printf("signature_parse: %zu\n", N);
   return true;
 }
 
@@ -1683,6 +2207,100 @@ static bool mcsh_stmt_execute(mcsh_module* module, mcsh_stmt* stmt,
                               mcsh_value** output,
                               mcsh_status* status);
 
+typedef struct
+{
+  mcsh_module* module;
+  mcsh_status* status;
+  /// Executed so far, for the log
+  size_t count;
+} stream_state;
+
+/** Run a batch of top-level statements then free them.
+    None of these is the last statement, so results are dropped
+    as for the non-last statements in mcsh_stmts_execute() */
+static bool
+stream_execute(mcsh_parse_context* ctx, mcsh_node* node)
+{
+  stream_state* S = ctx->batch_data;
+  mcsh_module* module = S->module;
+  mcsh_node_to_module(module, NULL, node);
+  mcsh_node_free(node, 0);
+
+  bool result = true;
+  list_array* L = &module->stmts.stmts;
+  for (size_t i = module->instruction; i < L->size; i++)
+  {
+    mcsh_value* tmp = NULL;
+    bool rc = mcsh_stmt_execute(module, L->data[i], &tmp, S->status);
+    CHECK(rc, "stream_execute: stmt failed: %zi", S->count + i);
+    mcsh_code code = S->status->code;
+    if (code != MCSH_PROTO && code != MCSH_OK)
+    {
+      result = false;
+      break;
+    }
+  }
+  S->count += L->size;
+  mcsh_log(&module->vm->logger, MCSH_LOG_EVAL, MCSH_DEBUG,
+           "stream_execute: %zi", S->count);
+
+  // Blocks captured by functions or values are kept
+  stmts_free(module, &module->stmts);
+  L->size = 0;
+  module->instruction = 0;
+  return result;
+}
+
+bool
+mcsh_module_stream(const char* source,
+                   const char* name,
+                   FILE* fp,
+                   mcsh_module* module,
+                   mcsh_value** output,
+                   mcsh_status* status)
+{
+  mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_DEBUG,
+           "module_stream: %s", source);
+  strcpy(module->source, source);
+  strcpy(module->name,   name);
+  valgrind_assert(module->stmts.stmts.size == 0);
+
+  stream_state S = { module, status, 0 };
+  mcsh_parse_context ctx;
+  mcsh_parse_context_init(&ctx);
+  ctx.batch      = stream_execute;
+  ctx.batch_data = &S;
+  ctx.batch_size = module->vm->stream;
+
+  int fd = fileno(fp);
+  struct stat s;
+  bool regular = (fstat(fd, &s) == 0 && S_ISREG(s.st_mode));
+  if (regular && module->vm->lazy_bodies && module->fd == -1)
+  {
+    ctx.scan.lazy_bodies = true;
+    ctx.scan.offset      = ftell(fp);
+    // Functions may be called before the parse is done:
+    module_hold(module, fd, &s);
+  }
+  status->code = MCSH_OK;
+  mcsh_script_parse_file(&ctx, fp);
+  free(ctx.lazy);
+
+  if (ctx.status == MCSH_PARSE_STOP)
+    // A batch stopped with an exception or exit in status
+    return true;
+  if (ctx.status != MCSH_PARSE_OK)
+  {
+    printf("mcsh: parse failed!\n");
+    return false;
+  }
+
+  // The final batch holds the last statement
+  mcsh_node_to_module(module, NULL, ctx.output);
+  mcsh_node_free(ctx.output, 0);
+  return mcsh_module_execute(module, output, status);
+}
+
 bool
 mcsh_stmts_execute(mcsh_module* module, mcsh_stmts* stmts,
                    mcsh_value** output, mcsh_status* status)
@@ -1746,7 +2364,7 @@ mcsh_stmts_execute(mcsh_module* module, mcsh_stmts* stmts,
         // printf("execute: stmt exited!\n");
         return true;
       case MCSH_EXCEPTION:
-        printf("execute: exception!\n");
+        TRACE(STMT_EXCEPTION, i, 0);
         return true;
       default:
         ;
@@ -1755,8 +2373,7 @@ mcsh_stmts_execute(mcsh_module* module, mcsh_stmts* stmts,
     // printf("execute: output %p %p\n", output, *output);
     if (output == NULL)
     {
-      ;
-      printf("execute: stmt-out: output==NULL\n");
+      TRACE(STMT_NO_OUTPUT, i, 0);
       // return false;
     }
     else if (*output == NULL)  // Statement did not return a value - OK
@@ -1800,15 +2417,54 @@ static bool mcsh_value_call(mcsh_module* module,
                             mcsh_value* f, list_array* A,
                             mcsh_value** output, mcsh_status* status);
 
+static inline bool stmt_execute(mcsh_module* module, mcsh_stmt* stmt,
+                                mcsh_value** output,
+                                mcsh_status* status);
+
 static bool
 mcsh_stmt_execute(mcsh_module* module, mcsh_stmt* stmt,
                   mcsh_value** output, mcsh_status* status)
+{
+  STATS(module->vm, stmts);
+  mcsh_profile* profile = module->vm->profile;
+  if (profile == NULL && ! mcsh_mem_sites && ! mcsh_sampling)
+    return stmt_execute(module, stmt, output, status);
+
+  mcsh_stmt* site = mcsh_mem_site;
+  mcsh_mem_site = stmt;
+  mcsh_entry* entry = module->vm->stack.current;
+  mcsh_stmt* running = entry->stmt;
+  if (mcsh_sampling && stmt->module->sample_id == 0)
+    mcsh_sample_source(stmt->module);
+  entry->stmt = stmt;
+  if (profile == NULL)
+  {
+    bool rc = stmt_execute(module, stmt, output, status);
+    entry->stmt = running;
+    mcsh_mem_site = site;
+    return rc;
+  }
+
+  char name[PATH_MAX+16];
+  snprintf(name, sizeof(name), "%s:%i",
+           stmt->module->source, stmt->line);
+  mcsh_profile_enter(profile, MCSH_PROFILE_STMT, name);
+  bool rc = stmt_execute(module, stmt, output, status);
+  mcsh_profile_exit(profile);
+  entry->stmt = running;
+  mcsh_mem_site = site;
+  return rc;
+}
+
+static inline bool
+stmt_execute(mcsh_module* module, mcsh_stmt* stmt,
+             mcsh_value** output, mcsh_status* status)
 {
   mcsh_logger* logger = &module->vm->logger;
   status->code = MCSH_OK;  // default
   if (stmt->things.size == 0)
   {
-    printf("stmt_execute(): empty\n");
+    TRACE(STMT_EMPTY, stmt->line, 0);
     maybe_assign(output, &mcsh_null);
     return true;
   }
@@ -1829,7 +2485,10 @@ mcsh_stmt_execute(mcsh_module* module, mcsh_stmt* stmt,
     // printf("token type: %i\n", token->type);
     do_token(logger, module, token, &values, status);
     if (status->code == MCSH_EXCEPTION)
+    {
+      list_array_finalize(&values);
       return true;
+    }
   }
 
   mcsh_value* command_value = values.data[0];
@@ -1883,6 +2542,8 @@ mcsh_stmt_execute(mcsh_module* module, mcsh_stmt* stmt,
   // Need to start ref counting.
   // This fails when passing value for builtin 'set'
   // list_array_demolish_callback(&values, mcsh_value_free_void);
+  // The values may still be held, but the array is not:
+  list_array_finalize(&values);
   return true;
 }
 
@@ -1892,10 +2553,14 @@ static bool mcsh_do_loop(mcsh_module* module, list_array* args,
                          mcsh_value** output, mcsh_status* status);
 static bool mcsh_do_foreach(mcsh_module* module, list_array* args,
                             mcsh_value** output, mcsh_status* status);
+static bool mcsh_do_pforeach(mcsh_module* module, list_array* args,
+                             mcsh_value** output, mcsh_status* status);
 static bool mcsh_do_for(mcsh_module* module, list_array* args,
                         mcsh_value** output, mcsh_status* status);
 static bool mcsh_do_repeat(mcsh_module* module, list_array* args,
                            mcsh_value** output, mcsh_status* status);
+static bool mcsh_do_bench(mcsh_module* module, list_array* args,
+                          mcsh_value** output, mcsh_status* status);
 
 static void build_keywords(char* keyword_string);
 
@@ -1908,26 +2573,30 @@ static char* keyword_list[] =
     "loop",
     "for",
     "foreach",
+    "pforeach",
     "repeat",
+    "bench",
     "return",
     NULL
   };
 
+/** Space-separated keywords: built once by mcsh_init(),
+    then only read, by any thread */
+static char keyword_string[KEYWORD_TOTAL];
+
+static void
+keywords_init()
+{
+  build_keywords(keyword_string);
+}
+
 static inline bool
 is_keyword(const char* command)
 {
-  static bool built_keywords = false;
-  static char keyword_string[KEYWORD_TOTAL];
   char t[128];
   t[0] = ' ';
   strcpy(&t[1], command);
   strcat(t, " ");
-  if (!built_keywords)
-  {
-    build_keywords(&keyword_string[0]);
-    built_keywords = true;
-    // printf("keyword_string: '%s'\n", keyword_string);
-  }
   bool result = (strstr(keyword_string, t) != NULL);
   return result;
 }
@@ -1977,17 +2646,27 @@ do_keyword(mcsh_logger* logger, mcsh_module* module,
   else if (strcmp(command, "foreach") == 0)
   {
     mcsh_do_foreach(module, values, output, status);
-    printf("do_foreach returned: *output=%p\n", *output);
+    TRACE(KEYWORD_DONE, mcsh_trace_str(command), *output);
+  }
+  else if (strcmp(command, "pforeach") == 0)
+  {
+    rc = mcsh_do_pforeach(module, values, output, status);
+    CHECK(rc, "execute(): do_pforeach failed!");
   }
   else if (strcmp(command, "for") == 0)
   {
     mcsh_do_for(module, values, output, status);
-    printf("do_for returned: *output=%p\n", *output);
+    TRACE(KEYWORD_DONE, mcsh_trace_str(command), *output);
   }
   else if (strcmp(command, "repeat") == 0)
   {
     mcsh_do_repeat(module, values, output, status);
-    printf("do_repeat returned: *output=%p\n", *output);
+    TRACE(KEYWORD_DONE, mcsh_trace_str(command), *output);
+  }
+  else if (strcmp(command, "bench") == 0)
+  {
+    mcsh_do_bench(module, values, output, status);
+    TRACE(KEYWORD_DONE, mcsh_trace_str(command), *output);
   }
   else if (strcmp(command, "return") == 0)
   {
@@ -2012,11 +2691,11 @@ do_token(mcsh_logger* logger, mcsh_module* module,
   {
     case MCSH_THING_TOKEN:
       // printf("convert: '%s'\n", token->data.token->text);
-      rc = mcsh_token_to_value(logger,
-                               module->vm->stack.current,
-                               token->data.token->text,
-                               (void*) &value,
-                               status);
+      rc = mcsh_token_eval(logger,
+                           module->vm->stack.current,
+                           token->data.token,
+                           &value,
+                           status);
       CHECK(rc, "could not convert token to string: '%s'",
             token->data.token->text);
       // printf("TOKEN: '%s'\n", token->data.token->text);
@@ -2083,7 +2762,7 @@ static bool add_word_split_list(list_array* args, mcsh_value* value);
 static bool
 add_word_split(list_array* args, mcsh_value* value)
 {
-  printf("split\n");
+  TRACE(SPLIT, value->type, 0);
 
   switch (value->type)
   {
@@ -2170,10 +2849,13 @@ mcsh_stack_search(mcsh_entry* entry, const char* name,
   /* printf("stack_search(): %zi:%zi start:  '%s'\n", */
   /*        entry->depth, entry->id, name); */
 
+  mcsh_vm* vm = entry->stack->vm;
+  STATS(vm, stack_searches);
   bool modules_only = false;
   char type_name[64];
   while (true)
   {
+    STATS(vm, stack_depth);
     if (modules_only)
       if (entry->type != MCSH_ENTRY_MODULE)
         goto loop;
@@ -2187,8 +2869,7 @@ mcsh_stack_search(mcsh_entry* entry, const char* name,
     {
       if (strmap_search(&entry->module->vars, name, (void**) result))
       {
-        printf("stack_search(): %zi:%zi found:  '%s'\n",
-               entry->depth, entry->id, name);
+        TRACE(STACK_FOUND, mcsh_trace_str(name), entry->depth);
         goto found;
       }
     }
@@ -2202,7 +2883,7 @@ mcsh_stack_search(mcsh_entry* entry, const char* name,
     entry = entry->parent;
   }
   // not found yet
-  mcsh_vm* vm = entry->stack->vm;
+  STATS(vm, stack_misses);
   if (table_search(&vm->globals, name, (void**) result))
     goto found;
 
@@ -2324,7 +3005,6 @@ mcsh_do_loop(mcsh_module* module, list_array* args,
 
   mcsh_value* v = args->data[counter];
 
-  char t[64];
   int rc;
 
   if (v->type == MCSH_VALUE_STRING)
@@ -2375,30 +3055,27 @@ mcsh_do_loop(mcsh_module* module, list_array* args,
       }
       case MCSH_BREAK:
       {
-        printf("loop: caught break:\n");
+        TRACE(LOOP_CODE, status->code, 0);
         status->code = MCSH_OK;
-        printf("break *output=%p\n", *output);
         loop_break = true;
         break;
       }
       case MCSH_CONTINUE:
       {
-        printf("loop: caught continue:\n");
+        TRACE(LOOP_CODE, status->code, 0);
         status->code = MCSH_OK;
         loop_break = true;
         break;
       }
       case MCSH_EXCEPTION:
       {
-        printf("loop: exception...\n");
-        printf("loop: %s\n", status->exception->tag);
+        TRACE(LOOP_CODE, status->code, 0);
         return true;
       }
       case MCSH_EXIT:
       case MCSH_RETURN:
       {
-        mcsh_code_name(status->code, t);
-        printf("loop: caught code: %s\n", t);
+        TRACE(LOOP_CODE, status->code, 0);
         return true;
       }
       case MCSH_OK:
@@ -2453,6 +3130,10 @@ typedef struct
 
 static inline loop_result loop_check(mcsh_status* status);
 
+static bool foreach_iterator(mcsh_module* module, mcsh_value* name,
+                             mcsh_iterator* it, mcsh_value* body,
+                             mcsh_value** output, mcsh_status* status);
+
 static bool
 mcsh_do_foreach(mcsh_module* module, list_array* args,
                 mcsh_value** output, mcsh_status* status)
@@ -2461,17 +3142,87 @@ mcsh_do_foreach(mcsh_module* module, list_array* args,
   mcsh_value* name = args->data[1];
   mcsh_value* list = args->data[2];
   mcsh_value* body = args->data[3];
+  if (list->type == MCSH_VALUE_ITERATOR)
+    return foreach_iterator(module, name, list->iterator, body,
+                            output, status);
   mcsh_value* value_result;
-  printf("foreach start...\n");
   for (unsigned int i = 0; i < list->list->size; i++)
   {
-    printf("foreach iteration: %u\n", i);
+    TRACE(FOREACH_ITERATION, i, 0);
     mcsh_value* item = list->list->data[i];
     mcsh_set_value(module, name->string, item, status);
     // TODO: check status
     mcsh_stmts_execute(module, &body->block->stmts,
                        &value_result, status);
-    printf("executed\n");
+    loop_result result = loop_check(status);
+    if (result.loop_break)  break;
+    if (result.loop_return) break;
+  }
+  maybe_assign(output, value_result);
+  return true;
+}
+
+/**
+   pforeach name $L { body }
+   pforeach name $L -j N { body }
+   Default N is the number of online processors
+*/
+static bool
+mcsh_do_pforeach(mcsh_module* module, list_array* args,
+                 mcsh_value** output, mcsh_status* status)
+{
+  if (args->size != 4 && args->size != 6)
+    RAISE(status, NULL, 0, "mcsh.invalid_arguments",
+          "pforeach: requires 3 or 5 arguments, given %zi",
+          args->size - 1);
+  mcsh_value* name = args->data[1];
+  mcsh_value* list = args->data[2];
+  mcsh_value* body = args->data[args->size-1];
+  TYPE_CHECK(name, MCSH_VALUE_STRING, status, "pforeach", 1);
+  TYPE_CHECK(list, MCSH_VALUE_LIST,   status, "pforeach", 2);
+  TYPE_CHECK(body, MCSH_VALUE_BLOCK,  status, "pforeach",
+             (int) args->size-1);
+  int64_t workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (args->size == 6)
+  {
+    mcsh_value* flag  = args->data[3];
+    mcsh_value* count = args->data[4];
+    RAISE_IF(flag->type != MCSH_VALUE_STRING ||
+             strcmp(flag->string, "-j") != 0,
+             status, NULL, 0, "mcsh.invalid_arguments",
+             "pforeach: expected -j N");
+    RAISE_IF(! mcsh_value_integer(count, &workers) || workers < 1,
+             status, NULL, 0, "mcsh.invalid_arguments",
+             "pforeach: -j requires a positive integer");
+    RAISE_IF(workers > INT_MAX,
+             status, NULL, 0, "mcsh.invalid_arguments",
+             "pforeach: -j is too large: %"PRId64, workers);
+  }
+  if (workers < 1) workers = 1;
+  return mcsh_pforeach(module, name->string, list, (int) workers,
+                       body, output, status);
+}
+
+/** Pull items from the iterator one at a time */
+static bool
+foreach_iterator(mcsh_module* module, mcsh_value* name,
+                 mcsh_iterator* it, mcsh_value* body,
+                 mcsh_value** output, mcsh_status* status)
+{
+  mcsh_logger* logger = &module->vm->logger;
+  LOG(MCSH_LOG_CONTROL, MCSH_DEBUG, "foreach iterator: %s", it->name);
+  mcsh_value* value_result = &mcsh_null;
+  while (true)
+  {
+    mcsh_value* item;
+    if (! it->next(it, module->vm, &item))
+      RAISE(status, NULL, 0, "mcsh.io", "foreach: %s: %s",
+            it->name, strerror(errno));
+    if (item == NULL) break;
+    mcsh_set_value(module, name->string, item, status);
+    PROPAGATE(status);
+    mcsh_stmts_execute(module, &body->block->stmts,
+                       &value_result, status);
     loop_result result = loop_check(status);
     if (result.loop_break)  break;
     if (result.loop_return) break;
@@ -2491,30 +3242,26 @@ mcsh_do_for(mcsh_module* module, list_array* args,
   mcsh_value* post = args->data[3];
   mcsh_value* body = args->data[4];
   mcsh_value* value_post, * value_result;
-  printf("for: start...\n");
   mcsh_stmts_execute(module, &init->block->stmts,
                      &value_result, status);
 
-  while (true)
+  for (uint64_t i = 0; ; i++)
   {
-    printf("for: test ...\n");
     mcsh_stmts_execute(module, &test->block->stmts,
                        &value_result, status);
     int64_t v;
     mcsh_value_integer(value_result, &v);
     if (v == 0) break;
 
-    printf("for: iteration ...\n");
+    TRACE(FOR_ITERATION, i, 0);
     mcsh_stmts_execute(module, &body->block->stmts,
                        &value_result, status);
-    printf("executed\n");
     loop_result result = loop_check(status);
     if (result.loop_break) break;
 
     mcsh_stmts_execute(module, &post->block->stmts,
                        &value_post, status);
   }
-  printf("for: done.\n");
   maybe_assign(output, value_result);
   return true;
 }
@@ -2543,10 +3290,9 @@ mcsh_do_repeat(mcsh_module* module, list_array* args,
   mcsh_value_integer(stop, &s);
 
   mcsh_value* value_result;
-  printf("repeat start...\n");
   for (unsigned int i = 0; i < s; i++)
   {
-    printf("repeat iteration: %u\n", i);
+    TRACE(REPEAT_ITERATION, i, 0);
     if (name != NULL)
     {
       mcsh_value* item = mcsh_value_new_int(i);
@@ -2555,7 +3301,6 @@ mcsh_do_repeat(mcsh_module* module, list_array* args,
     }
     mcsh_stmts_execute(module, &body->block->stmts,
                        &value_result, status);
-    printf("executed\n");
     loop_result result = loop_check(status);
     if (result.loop_break)  break;
     if (result.loop_return) break;
@@ -2564,10 +3309,118 @@ mcsh_do_repeat(mcsh_module* module, list_array* args,
   return true;
 }
 
+static int
+bench_compare(const void* a, const void* b)
+{
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+  return (x > y) - (x < y);
+}
+
+static void
+bench_add(mcsh_vm* vm, mcsh_value* t, const char* key, mcsh_value* v)
+{
+  mcsh_value_grab(&vm->logger, v);
+  table_add(t->table, key, v);
+}
+
+/** Sorts times: n may be 0, then only n is reported */
+static mcsh_value*
+bench_table(mcsh_vm* vm, uint64_t* times, int64_t n,
+            uint64_t total, unsigned long allocs)
+{
+  mcsh_value* table = mcsh_value_new_table(vm, 8);
+  bench_add(vm, table, "n", mcsh_value_new_int(n));
+  if (n == 0) return table;
+  qsort(times, n, sizeof(uint64_t), bench_compare);
+  bench_add(vm, table, "min",    mcsh_value_new_int(times[0]));
+  bench_add(vm, table, "median", mcsh_value_new_int(times[n/2]));
+  bench_add(vm, table, "max",    mcsh_value_new_int(times[n-1]));
+  bench_add(vm, table, "mean",
+            mcsh_value_new_float((double) total / n));
+  bench_add(vm, table, "allocs",
+            mcsh_value_new_float((double) allocs / n));
+  return table;
+}
+
+/**
+   bench N { block }
+   Run block N/10 times (at least once) to warm up,
+   then N more times, each timed with the monotonic clock.
+   Output: a table: n, min, median, max in nanoseconds,
+           mean in nanoseconds, and allocs: the mean allocations
+           per timed iteration, from util_allocs
+   On break, only the iterations that completed are reported:
+   a break during warmup gives n=0 and no times
+*/
+static bool
+mcsh_do_bench(mcsh_module* module, list_array* args,
+              mcsh_value** output, mcsh_status* status)
+{
+  mcsh_vm* vm = module->vm;
+  if (args->size != 3)
+    RAISE(status, NULL, 0, "mcsh.invalid_arguments",
+          "bench: requires COUNT and a block");
+  mcsh_value* count = args->data[1];
+  mcsh_value* body  = args->data[2];
+  mcsh_resolve(count);
+  int64_t n;
+  if (! mcsh_value_integer(count, &n) || n < 1)
+    RAISE(status, NULL, 0, "mcsh.invalid_arguments",
+          "bench: COUNT must be a positive integer");
+  if (body->type != MCSH_VALUE_BLOCK)
+    RAISE(status, NULL, 0, "mcsh.invalid_arguments",
+          "bench: requires a block");
+
+  mcsh_value* value_result;
+  int64_t warmup = n / 10 > 0 ? n / 10 : 1;
+  for (int64_t i = 0; i < warmup; i++)
+  {
+    mcsh_stmts_execute(module, &body->block->stmts,
+                       &value_result, status);
+    loop_result result = loop_check(status);
+    if (result.loop_return)
+      maybe_assign(output, value_result);
+    if (result.loop_break)
+      maybe_assign(output, bench_table(vm, NULL, 0, 0, 0));
+    if (result.loop_break || result.loop_return) return true;
+  }
+
+  uint64_t* times = malloc_checked(n * sizeof(uint64_t));
+  uint64_t total = 0;
+  unsigned long allocs = 0;
+  int64_t i;
+  for (i = 0; i < n; i++)
+  {
+    unsigned long allocs_start = util_allocs;
+    uint64_t start = mcsh_trace_now();
+    mcsh_stmts_execute(module, &body->block->stmts,
+                       &value_result, status);
+    uint64_t elapsed = mcsh_trace_now() - start;
+    unsigned long allocated = util_allocs - allocs_start;
+    loop_result result = loop_check(status);
+    // The iteration that broke out did not complete:
+    if (result.loop_break || result.loop_return) break;
+    times[i] = elapsed;
+    allocs  += allocated;
+    total   += elapsed;
+  }
+  if (status->code != MCSH_OK)
+  {
+    free(times);
+    maybe_assign(output, value_result);
+    return true;
+  }
+  // On break, report the iterations that completed:
+  mcsh_value* table = bench_table(vm, times, i, total, allocs);
+  free(times);
+  maybe_assign(output, table);
+  return true;
+}
+
 static inline loop_result
 loop_check(mcsh_status* status)
 {
-  char t[64];
   loop_result result = {0};
   switch (status->code)
   {
@@ -2575,22 +3428,21 @@ loop_check(mcsh_status* status)
       valgrind_fail_msg("found MCSH_PROTO");
       break;
     case MCSH_BREAK:
-      printf("loop_check: caught break:\n");
+      TRACE(LOOP_CODE, status->code, 0);
       status->code = MCSH_OK;
       result.loop_break = true;
       break;
     case MCSH_CONTINUE:
-      printf("loop: caught continue:\n");
+      TRACE(LOOP_CODE, status->code, 0);
       status->code = MCSH_OK;
       break;
     case MCSH_EXCEPTION:
-      printf("loop: hit exception: '%s'\n", status->exception->tag);
+      TRACE(LOOP_CODE, status->code, 0);
       result.loop_return = true;
       break;
     case MCSH_EXIT:
     case MCSH_RETURN:
-      mcsh_code_name(status->code, t);
-      printf("loop: caught code: %s\n", t);
+      TRACE(LOOP_CODE, status->code, 0);
       result.loop_return = true;
       break;
     case MCSH_OK:
@@ -2602,10 +3454,32 @@ loop_check(mcsh_status* status)
 static bool set_params(list_array* A, mcsh_value* f,
                        mcsh_entry* entry, mcsh_status* status);
 
+static inline bool value_call(mcsh_module* module, mcsh_value* f,
+                              list_array* A, mcsh_value** output,
+                              mcsh_status* status);
+
 static bool
 mcsh_value_call(mcsh_module* module, mcsh_value* f,
                 list_array* A, mcsh_value** output,
                 mcsh_status* status)
+{
+  if (f->type == MCSH_VALUE_FUNCTION)
+    STATS(module->vm, calls);
+  mcsh_profile* profile = module->vm->profile;
+  if (profile == NULL || f->type != MCSH_VALUE_FUNCTION)
+    return value_call(module, f, A, output, status);
+
+  mcsh_profile_enter(profile, MCSH_PROFILE_FUNCTION,
+                     f->function->name);
+  bool rc = value_call(module, f, A, output, status);
+  mcsh_profile_exit(profile);
+  return rc;
+}
+
+static inline bool
+value_call(mcsh_module* module, mcsh_value* f,
+           list_array* A, mcsh_value** output,
+           mcsh_status* status)
 {
   if (f->type != MCSH_VALUE_FUNCTION)
     RAISE(status, NULL, 0, "mcsh.invalid_type",
@@ -2614,7 +3488,7 @@ mcsh_value_call(mcsh_module* module, mcsh_value* f,
   mcsh_block* block = function->block;
   // Default to success:
   status->code = MCSH_OK;
-  mcsh_entry* entry = malloc(sizeof(*entry));
+  mcsh_entry* entry = malloc_checked(sizeof(*entry));
   switch (function->type)
   {
     case MCSH_FN_NORMAL:
@@ -2625,12 +3499,15 @@ mcsh_value_call(mcsh_module* module, mcsh_value* f,
       break;
     case MCSH_FN_INPLACE:
       mcsh_entry_init_scope(entry, module->vm->stack.current);
-      printf("call(): scope: %zi:%zi\n", entry->depth, entry->id);
+      TRACE(CALL_SCOPE, entry->depth, entry->id);
       break;
     case MCSH_FN_MACRO:
       mcsh_entry_init_macro(entry, module->vm->stack.current);
-      printf("call(): macro: %zi:%zi\n", entry->depth, entry->id);
+      TRACE(CALL_MACRO, entry->depth, entry->id);
       break;
+    default:
+      valgrind_fail_msg("call(): unknown function type: %i",
+                        function->type);
   }
   module->vm->stack.current = entry;
   entry->args = A;
@@ -2638,6 +3515,9 @@ mcsh_value_call(mcsh_module* module, mcsh_value* f,
   rc = set_params(A, f, module->vm->stack.current, status);
   CHECK(rc, "call(): set_params() failed!");
   PROPAGATE(status);
+  RAISE_IF(! mcsh_block_load(block), status, NULL, 0,
+           "mcsh.syntax_error",
+           "could not parse body of '%s'", function->name);
   rc = mcsh_stmts_execute(module, &block->stmts, output, status);
   CHECK(rc, "call(): failed for '%s'", function->name);
   mcsh_log(&module->vm->logger, MCSH_LOG_EVAL, MCSH_DEBUG,
@@ -2674,7 +3554,7 @@ mcsh_parameterize(mcsh_signature* sg, list_array* A,
    A: list of mcsh_arg*
  */
 {
-  show("parameterize A=%zi...", A->size);
+  TRACE(PARAMETERIZE, A->size, sg->count);
   parameters_init(P, sg);
 
   if (A->size > sg->count && ! sg->extras)
@@ -2686,10 +3566,6 @@ mcsh_parameterize(mcsh_signature* sg, list_array* A,
   for (size_t i = 0; i < A->size; i++)
   {
     mcsh_arg* arg = list_array_get(A, i);
-    if (arg->name == NULL)
-      show("got: NULL");
-    else
-      show("got: '%s'", arg->name->string);
     if (arg->name == NULL)
       set_positional_next(sg, arg->value, P);
     else
@@ -2697,7 +3573,6 @@ mcsh_parameterize(mcsh_signature* sg, list_array* A,
   }
 
   set_defaults(sg, P, status);
-  show("parameterize OK.");
   return true;
 }
 
@@ -2732,7 +3607,6 @@ static inline void
 set_positional_next(mcsh_signature* sg, mcsh_value* value,
                     mcsh_parameters* P)
 {
-  printf("set_positional:\n");
   for (uint16_t j = 0; j < sg->count; j++)
   {
     if (P->values[j] == NULL)
@@ -2744,7 +3618,7 @@ set_positional_next(mcsh_signature* sg, mcsh_value* value,
 
   if (! sg->extras)
     valgrind_fail_msg("too many arguments!");
-  printf("set extra:\n");
+  TRACE(SET_EXTRA, P->extra_values.size, 0);
   list_array_add(&P->extra_names,  NULL);
   list_array_add(&P->extra_values, value);
 }
@@ -2753,9 +3627,8 @@ static inline void
 set_positional_at(mcsh_signature* sg, mcsh_value* value,
                   mcsh_parameters* P, uint16_t j)
 {
-  printf("%i orig %p\n", j, sg->slots[j].name);
   P->names[j] = strdup_null_checked(sg->slots[j].name);
-  printf("%i name %p '%s'\n", j, P->names[j], P->names[j]);
+  TRACE(SET_POSITIONAL, j, mcsh_trace_str(P->names[j]));
   P->count++;
   P->values[j] = value;
   mcsh_value_grab(NULL, value);
@@ -2796,17 +3669,15 @@ set_defaults(mcsh_signature* sg, mcsh_parameters* P,
 {
   for (uint16_t j = 0; j < sg->count; j++)
   {
-    printf("check: j=%i\n", j);
     if (P->values[j] == NULL)
     {
-      printf(" found NULL\n");
+      TRACE(SET_DEFAULT, j, mcsh_trace_str(sg->slots[j].name));
       if (sg->slots[j].dflt != NULL)
       {
         set_positional_at(sg, sg->slots[j].dflt, P, j);
       }
       else
       {
-        printf("did not assign to: '%s'", sg->slots[j].name);
         RAISE(status, NULL, 0,
               "mcsh.invalid_arguments",
               "did not assign to: '%s'", sg->slots[j].name);
@@ -2859,7 +3730,7 @@ set_params(list_array* A, mcsh_value* f, mcsh_entry* entry,
   mcsh_logger* logger = &entry->stack->vm->logger;
 
   LOG(MCSH_LOG_DATA, MCSH_INFO,
-      "set_params: slots=%zi arguments=%zi",
+      "set_params: slots=%i arguments=%zi",
       f->function->signature.count, A->size-1);
 
   mcsh_parameters P;
@@ -2879,13 +3750,12 @@ set_params(list_array* A, mcsh_value* f, mcsh_entry* entry,
   bool rc = mcsh_parameterize(&f->function->signature, &L, &P,
                               status);
   valgrind_assert(rc);
-  mcsh_parameters_print(&P);
 
   int i = 0;
   for ( ; i < P.count; i++)
   {
-    show("set parameter to stack entry: %i", i);
     char*       name  = P.names[i];
+    TRACE(SET_PARAMETER, i, mcsh_trace_str(name));
     LOG(MCSH_LOG_DATA, MCSH_TRACE, "param: '%s'", name);
     mcsh_value* value = P.values[i];
     strmap_add(&entry->vars, name, value);
@@ -2899,7 +3769,10 @@ set_params(list_array* A, mcsh_value* f, mcsh_entry* entry,
       mcsh_value_new_list_sized(
         entry->stack->vm, args_size);
     for ( ; i < P.count; i++)
+    {
       list_array_add(args->list, A->data[i]);
+      mcsh_value_grab(logger, A->data[i]);
+    }
     strmap_add(&entry->vars, "args", args);
   }
   return true;
@@ -2968,6 +3841,11 @@ mcsh_thing_show(mcsh_thing* thing, int indent)
 void
 mcsh_block_print(mcsh_block* block, int indent)
 {
+  if (block->lazy != NULL)
+  {
+    printf("{ (lazy: %zi bytes) }", block->lazy->length);
+    return;
+  }
   printf("{\n");
   for (size_t i = 0; i < block->stmts.stmts.size; i++)
   {
@@ -3139,9 +4017,18 @@ pair_to_stmt(mcsh_module* module, mcsh_thing* parent,
 mcsh_thing*
 mcsh_thing_from_value(mcsh_module* module, mcsh_value* value)
 {
-  valgrind_assert(value->type == MCSH_VALUE_STRING);
-  mcsh_thing* result =
-    mcsh_thing_construct_token(module, value->string);
+  if (value->type == MCSH_VALUE_STRING)
+    return mcsh_thing_construct_token(module, value->string);
+  // Other values, such as channels, are passed through as they are:
+  mcsh_token* token = malloc_checked(sizeof(mcsh_token));
+  token->text  = strdup_checked("(value)");
+  token->kind  = MCSH_TOKEN_LITERAL;
+  token->value = value;
+  mcsh_value_grab(&module->vm->logger, value);
+  mcsh_thing* result = malloc_checked(sizeof(mcsh_thing));
+  result->type       = MCSH_THING_TOKEN;
+  result->data.token = token;
+  result->module     = module;
   return result;
 }
 
@@ -3156,6 +4043,9 @@ static mcsh_thing* node_to_thing_subcmd(mcsh_module* module,
 static mcsh_thing* node_to_thing_subfun(mcsh_module* module,
                                        mcsh_thing* parent,
                                        mcsh_node* node);
+static mcsh_thing* node_to_thing_lazy(mcsh_module* module,
+                                      mcsh_thing* parent,
+                                      mcsh_node* node);
 
 static mcsh_thing*
 node_to_thing(mcsh_module* module, mcsh_thing* parent,
@@ -3176,6 +4066,9 @@ node_to_thing(mcsh_module* module, mcsh_thing* parent,
     case MCSH_NODE_TYPE_SUBFUN:
       thing = node_to_thing_subfun(module, parent, node);
       break;
+    case MCSH_NODE_TYPE_LAZY:
+      thing = node_to_thing_lazy(module, parent, node);
+      break;
     default:
       valgrind_fail();
   }
@@ -3228,6 +4121,84 @@ node_to_thing_subfun(mcsh_module* module, mcsh_thing* parent,
   return subfun;
 }
 
+static mcsh_thing*
+node_to_thing_lazy(mcsh_module* module, mcsh_thing* parent,
+                   mcsh_node* node)
+{
+  mcsh_lazy* lazy = node->children.data[0];
+  // The block takes the lazy record from the node:
+  node->children.data[0] = NULL;
+  lazy->module = module;
+  module->lazy++;
+  mcsh_thing* block =
+    mcsh_thing_construct_block(module, parent, lazy->line);
+  block->data.block->lazy = lazy;
+  return block;
+}
+
+/** @return The body text, or NULL on error, after logging it */
+static char*
+lazy_read(mcsh_module* module, mcsh_lazy* lazy)
+{
+  struct stat s;
+  if (module->fd == -1 || fstat(module->fd, &s) == -1)
+  {
+    mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_WARN,
+             "block_load: %s: source not open", module->source);
+    return NULL;
+  }
+  // Offsets are only good for the text that was scanned:
+  if (s.st_mtim.tv_sec  != module->mtime.tv_sec  ||
+      s.st_mtim.tv_nsec != module->mtime.tv_nsec ||
+      s.st_size         != module->size)
+  {
+    mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_WARN,
+             "block_load: %s: changed since parse", module->source);
+    return NULL;
+  }
+  char* text = malloc_checked(lazy->length + 1);
+  ssize_t n = pread(module->fd, text, lazy->length, lazy->offset);
+  if (n != (ssize_t) lazy->length)
+  {
+    mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_WARN,
+             "block_load: %s: short read", module->source);
+    free(text);
+    return NULL;
+  }
+  text[n] = '\0';
+  return text;
+}
+
+bool
+mcsh_block_load(mcsh_block* block)
+{
+  mcsh_lazy* lazy = block->lazy;
+  if (lazy == NULL) return true;
+  mcsh_module* module = lazy->module;
+  mcsh_log(&module->vm->logger, MCSH_LOG_PARSE, MCSH_DEBUG,
+           "block_load: %s:%i", module->source, lazy->line);
+
+  char* text = lazy_read(module, lazy);
+  if (text == NULL) return false;
+
+  mcsh_parse_context ctx;
+  mcsh_parse_context_init(&ctx);
+  ctx.line = lazy->line;
+  // Nested function bodies stay lazy:
+  ctx.scan.lazy_bodies = module->vm->lazy_bodies;
+  ctx.scan.offset      = lazy->offset;
+  mcsh_script_parse_string(&ctx, text);
+  free(text);
+  free(ctx.lazy);
+
+  node_to_stmts(module, NULL, ctx.output, &block->stmts, NULL);
+  mcsh_node_free(ctx.output, 0);
+  block->lazy = NULL;
+  free(lazy);
+  module->lazy--;
+  return ctx.status == MCSH_PARSE_OK;
+}
+
 static void
 vm_global_free(UNUSED void* context,
                UNUSED const char* k, UNUSED void* v)
@@ -3260,15 +4231,34 @@ mcsh_vm_stop(mcsh_vm* vm)
 {
   mcsh_log(&vm->logger, MCSH_LOG_CORE, MCSH_DEBUG,
            "VM stop ...");
+  mcsh_sample_exit(vm);
+  mcsh_mem_exit(vm);
+  if (vm->profile != NULL)
+  {
+    mcsh_profile_write(vm->profile, &vm->logger);
+    mcsh_profile_free(vm->profile);
+    vm->profile = NULL;
+  }
+  if (vm->trace != NULL)
+  {
+    mcsh_trace_free(vm->trace);
+    vm->trace = NULL;
+  }
+  mcsh_threads_finalize(vm);
   mcsh_module_finalize(vm->main);
 
+  pthread_mutex_lock(&mcsh.lock);
   mcsh.vms[vm->id] = NULL;
   mcsh.vm_count--;
+  pthread_mutex_unlock(&mcsh.lock);
   stack_finalize(&vm->stack);
   // mcsh_entry_free(vm->entry_main);
   mcsh_log(&vm->logger, MCSH_LOG_DATA, MCSH_DEBUG,
            "free globals");
   table_free_callback(&vm->globals, false, vm_global_free, NULL);
+  table_free_callback(&vm->modules,  false, registry_free, vm);
+  table_free_callback(&vm->sources,  false, registry_free, vm);
+  table_free_callback(&vm->resolved, false, resolved_free, NULL);
   mcsh_data_finalize(vm);
   free(vm->main);
 }
@@ -3279,14 +4269,14 @@ void
 mcsh_finalize()
 {
   char text[64];
-  thing_str(mcsh.parse_state.target, text);
+  thing_str(parse_target, text);
   // printf("mcsh_finalize: parse_target is %s\n", text);
-  free(mcsh.parse_state.target);
+  free(parse_target);
   mcsh_builtins_finalize();
   if (terms_in.size > 0)
     printf("warning: terms_in has size %zi\n", terms_in.size);
   list_array_finalize(&terms_in);
-  mcsh_script_lex_destroy();
+  mcsh_mem_finalize();
   system_finalize(&mcsh);
 }
 
@@ -3294,43 +4284,40 @@ static void
 system_finalize(mcsh_system* sys)
 {
   null(&sys->vms);
+  mcsh_log_finalize(&sys->logger);
 }
 
-static void expr_scan_exception(mcsh_status* status);
+static void expr_scan_exception(mcsh_parse_context* ctx,
+                                mcsh_status* status);
 
 bool
 mcsh_expr_scan(char* code, mcsh_node** node,
                mcsh_status* status)
 {
-  mcsh_expr_source_set(code);
-
-  mcsh_expr_grammar_status = true;
+  mcsh_parse_context ctx;
+  mcsh_parse_context_init(&ctx);
 
-  // Call to Bison parser:
-  mcsh_expr_parse();
-
-  if (! mcsh_expr_grammar_status)
+  if (! mcsh_expr_parse_string(&ctx, code))
   {
     *node = NULL;
-    expr_scan_exception(status);
+    expr_scan_exception(&ctx, status);
     return true;  // status is EXCEPTION
   }
 
-  // mcsh_node_print(mcsh.parse_state.output, 0);
+  // mcsh_node_print(ctx.output, 0);
 
-  *node = mcsh.parse_state.output;
+  *node = ctx.output;
   return true;
 }
 
 static void
-expr_scan_exception(mcsh_status* status)
+expr_scan_exception(mcsh_parse_context* ctx, mcsh_status* status)
 {
   char* source = NULL;
-  int line = mcsh_expr_line;
-  mcsh_raise(status, source, line,
+  mcsh_raise(status, source, ctx->line,
              "mcsh.syntax_error",
-             mcsh_expr_grammar_message);
-  null(&mcsh_expr_grammar_message);
+             ctx->message);
+  null(&ctx->message);
 }
 
 static bool mcsh_expr_eval_op(mcsh_vm* vm, mcsh_expr* expr,
@@ -3632,19 +4619,19 @@ mcsh_to_float(double* result, const mcsh_value* value,
 void
 mcsh_expr_token(const char* token)
 {
-  printf("mcsh_expr_token(%s)\n", token);
+  TRACE(EXPR_TOKEN, mcsh_trace_str(token), 0);
 }
 
 void
 mcsh_expr_end()
 {
-  printf("mcsh_expr_end()\n");
+  TRACE(EXPR_END, 0, 0);
 }
 
 void
 mcsh_expr_op(const char* op_string)
 {
-  printf("mcsh_expr_op(%s)\n", op_string);
+  TRACE(EXPR_OP, mcsh_trace_str(op_string), 0);
 }
 
 static inline mcsh_expr*
@@ -3725,6 +4712,9 @@ mcsh_node_to_expr(mcsh_node* node, mcsh_expr** output)
           for (size_t i = 0; i < expr_left->children.size; i++)
             list_array_add(&expr->children,
                            expr_left->children.data[i]);
+          // The children moved up, so drop only the shell:
+          list_array_finalize(&expr_left->children);
+          free(expr_left);
         }
         else
           list_array_add(&expr->children, expr_left);
@@ -3862,6 +4852,17 @@ mcsh_to_string(mcsh_logger* logger,
     case MCSH_VALUE_ACTIVATION:
       actual = sprintf(result, "(ACTIVATION)");
       break;
+    case MCSH_VALUE_HANDLE:
+      actual = snprintf(result, max, "handle:%s",
+                        value->handle->name);
+      break;
+    case MCSH_VALUE_ITERATOR:
+      actual = snprintf(result, max, "iterator:%s",
+                        value->iterator->name);
+      break;
+    case MCSH_VALUE_CHAN:
+      actual = snprintf(result, max, "chan:%"PRIi64, value->chan->id);
+      break;
     default:
       valgrind_fail_msg("mcsh_to_string: unknown value type: %i\n",
                         value->type);
@@ -3907,6 +4908,15 @@ mcsh_value_buffer(mcsh_logger* logger, const mcsh_value* value,
     case MCSH_VALUE_TABLE:
       mcsh_join_table_to_buffer(logger, value->table, ",", output);
       break;
+    case MCSH_VALUE_HANDLE:
+      buffer_catv(output, "handle:%s", value->handle->name);
+      break;
+    case MCSH_VALUE_ITERATOR:
+      buffer_catv(output, "iterator:%s", value->iterator->name);
+      break;
+    case MCSH_VALUE_CHAN:
+      buffer_catv(output, "chan:%"PRIi64, value->chan->id);
+      break;
     default:
       valgrind_fail_msg("mcsh_value_buffer: unknown value type: %i\n",
                         value->type);
@@ -3952,6 +4962,9 @@ value_names_init(void)
      {MCSH_VALUE_MODULE,     "module"    },
      {MCSH_VALUE_LINK,       "link"      },
      {MCSH_VALUE_ACTIVATION, "activation"},
+     {MCSH_VALUE_HANDLE,     "handle"    },
+     {MCSH_VALUE_ITERATOR,   "iterator"  },
+     {MCSH_VALUE_CHAN,       "chan"      },
      {MCSH_VALUE_ANY,        "any"       },
      lookup_sentinel
     };
@@ -3976,7 +4989,7 @@ bool
 mcsh_value_type_code(char* name, mcsh_value_type* type)
 {
   value_names_init();
-  printf("value_type_code: '%s'\n", name);
+  TRACE(TYPE_CODE, mcsh_trace_str(name), 0);
   int result = lookup_by_text(type_names, name);
   valgrind_assert_msg(result > 0, "bad name: '%s'\n", name);
   *type = result;
@@ -3987,6 +5000,15 @@ void
 mcsh_expr_finalize(mcsh_expr* expr)
 {
   if (expr == NULL) return;
+  for (size_t i = 0; i < expr->children.size; i++)
+  {
+    if (expr->type == MCSH_EXPR_TYPE_TOKEN)
+      free(expr->children.data[i]);
+    else
+      mcsh_expr_finalize(expr->children.data[i]);
+  }
+  list_array_finalize(&expr->children);
+  free(expr);
 }
 
 void
@@ -3995,8 +5017,15 @@ mcsh_node_free(mcsh_node* node, int lvl)
   switch (node->type)
   {
     case MCSH_NODE_TYPE_TOKEN:
+    case MCSH_NODE_TYPE_LAZY:
       free(node->children.data[0]);
       break;
+    case MCSH_NODE_TYPE_OP:
+      // The operator, then the operand nodes:
+      free(node->children.data[0]);
+      for (size_t i = 1; i < node->children.size; i++)
+        mcsh_node_free(node->children.data[i], lvl+1);
+      break;
     default:
       for (size_t i = 0; i < node->children.size; i++)
       {
@@ -4035,7 +5064,7 @@ mcsh_final_status(bool result, mcsh_status* status, int* exit_status)
     {
       *exit_status = status->value->integer;
       mcsh_log(&mcsh.logger, MCSH_LOG_SYSTEM, MCSH_TRACE,
-               "exit status handled: code=%i\n", exit_status);
+               "exit status handled: code=%i", *exit_status);
       break;
     }
     default:
@@ -10,15 +10,23 @@
 #endif
 #include <stdlib.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "buffer.h"
+#include "handles.h"
 #include "list-array.h"
+#include "mcsh-chan.h"
 #include "list_i.h"
 #include "log.h"
+#include "mcsh-profile.h"
+#include "mcsh-stats.h"
+#include "mcsh-trace.h"
 #include "strmap.h"
 #include "table.h"
 
@@ -31,12 +39,29 @@ struct mcsh_stmts
   list_array stmts;
 };
 
+/** A function body not parsed yet: see mcsh_block_load() */
+typedef struct
+{
+  /// Holds the source file open
+  mcsh_module* module;
+  /// The body text between the braces, as a file offset
+  size_t offset;
+  size_t length;
+  /// Line of the opening brace
+  int line;
+} mcsh_lazy;
+
 typedef struct
 {
   /// Starting line number:
   int id;
   int line;
   mcsh_stmts stmts;
+  /// If not NULL, stmts is empty until mcsh_block_load()
+  mcsh_lazy* lazy;
+  /// Held past its statement by a function or a stored value,
+  /// so it is not freed with its thing
+  bool captured;
 } mcsh_block;
 
 typedef enum
@@ -53,7 +78,7 @@ typedef struct mcsh_signature_s mcsh_signature;
 
 /* Sync this with mcsh.c type_names[] */
 /// Number of named types (size of enum + sentinel)
-#define MCSH_TYPE_COUNT 13
+#define MCSH_TYPE_COUNT 16
 typedef enum
 {
   MCSH_VALUE_NULL        =  0,
@@ -67,6 +92,9 @@ typedef enum
   MCSH_VALUE_MODULE      =  8,
   MCSH_VALUE_LINK        =  9,
   MCSH_VALUE_ACTIVATION  =  10,
+  MCSH_VALUE_HANDLE      =  11,
+  MCSH_VALUE_ITERATOR    =  12,
+  MCSH_VALUE_CHAN        =  13,
   MCSH_VALUE_ANY         =  1000
 } mcsh_value_type;
 
@@ -90,6 +118,7 @@ typedef enum
 
 typedef struct mcsh_value_s     mcsh_value;
 typedef struct mcsh_exception_s mcsh_exception;
+typedef struct mcsh_iterator_s  mcsh_iterator;
 
 /** Resulting status from a function call */
 typedef struct
@@ -123,6 +152,12 @@ struct mcsh_value_s
   mcsh_value_type type;
   int refs;
   bool word_split;
+  /// Interned by a token: never modified, freed with the token
+  bool literal;
+  /// For mcsh-mem: the type and bytes at construction,
+  /// or 0 bytes if not counted
+  uint8_t  mem_type;
+  uint32_t mem_bytes;
   union
   {
     char* string;
@@ -135,6 +170,9 @@ struct mcsh_value_s
     mcsh_module* module;
     mcsh_value* link;
     mcsh_activation* activation;
+    mcsh_handle* handle;
+    mcsh_iterator* iterator;
+    mcsh_chan* chan;
   };
 };
 
@@ -231,9 +269,31 @@ op_to_string(char* s, mcsh_operator op)
   }
 }
 
+typedef enum
+{
+  /// Plain text: evaluates to its interned value
+  MCSH_TOKEN_LITERAL,
+  /// $name and its subscripts and expanders
+  MCSH_TOKEN_VARIABLE,
+  /// Text containing *: expanded on each evaluation
+  MCSH_TOKEN_GLOB
+} mcsh_token_kind;
+
+/** A parsed variable reference: see mcsh-data.c */
+typedef struct mcsh_variable_s mcsh_variable;
+
+/** Classified once by mcsh_token_init() */
 typedef struct
 {
   char* text;
+  mcsh_token_kind kind;
+  union
+  {
+    /// LITERAL: shared by every evaluation- do not modify
+    mcsh_value* value;
+    /// VARIABLE:
+    mcsh_variable* variable;
+  };
 } mcsh_token;
 
 typedef struct
@@ -360,7 +420,8 @@ typedef enum
   MCSH_NODE_TYPE_STMTS  = 4,
   MCSH_NODE_TYPE_BLOCK  = 5,
   MCSH_NODE_TYPE_SUBCMD = 6,
-  MCSH_NODE_TYPE_SUBFUN = 7
+  MCSH_NODE_TYPE_SUBFUN = 7,
+  MCSH_NODE_TYPE_LAZY   = 8
 } mcsh_node_type;
 
 typedef struct
@@ -368,6 +429,7 @@ typedef struct
   mcsh_node_type type;
   /** children are:
       if   type==TOKEN: char*
+      if   type==LAZY:  mcsh_lazy*
       else node
   */
   list_array children;
@@ -394,19 +456,17 @@ typedef enum
   MCSH_PARSE_NONE,
   MCSH_PARSE_START,
   MCSH_PARSE_OK,
-  MCSH_PARSE_FAIL
+  MCSH_PARSE_FAIL,
+  /// A batch callback stopped the parse: see mcsh_module_stream()
+  MCSH_PARSE_STOP
 } mcsh_parse_status;
 
+/** Parser results are in mcsh_parse_context, per call.
+    The insertion point for the mcsh_block_start() API
+    is per thread: see mcsh.c:parse_target */
 typedef struct
 {
-  /// Source filename or equivalent for parser text:
-  char source[PATH_MAX];
-  /// Symbolic name for parser text:
-  char name[PATH_MAX];
-  mcsh_parse_status status;
-  mcsh_thing* target;
-  /// Resulting node tree goes here:
-  mcsh_node* output;
+  /// Last id from mcsh_parse_id()
   int id;
 } mcsh_parse_state;
 
@@ -419,9 +479,16 @@ bool mcsh_signature_parse(mcsh_module* module,
                           mcsh_block* sgtokens,
                           mcsh_status* status);
 
+typedef struct mcsh_regex_cache_s mcsh_regex_cache;
+
 struct mcsh_data_s
 {
   struct table* specials;
+  /// Compiled patterns for $v/regex/ and match
+  mcsh_regex_cache* regex;
+  /// For $random: random() state is per process
+  struct random_data random;
+  char random_state[128];
 };
 
 struct mcsh_stack_s
@@ -441,6 +508,35 @@ struct mcsh_vm_s
       Searches start at the end!
    */
   list_array path;
+  /** Map from resolved path to registry entry: see mcsh_import() */
+  struct table modules;
+  /** Map from resolved path to registry entry: see mcsh_source() */
+  struct table sources;
+  /** Map from requested name to found filename, or NULL for
+      a failed lookup.  Cleared when the path changes */
+  struct table resolved;
+  /** Re-stat registered files and reload them if changed:
+      set by MCSH_IMPORT_RELOAD */
+  bool import_reload;
+  /** Defer parsing function bodies until the first call:
+      unset by MCSH_LAZY=0 */
+  bool lazy_bodies;
+  /** If not 0, run the main script as it is parsed, in batches
+      of this many statements: see mcsh_module_stream().
+      Set by MCSH_STREAM=N, or true for a default:
+      see mcsh_vm_init_stream() */
+  size_t stream;
+  /** If not NULL, record each statement, function, and builtin:
+      set by mcsh --profile or MCSH_PROFILE */
+  mcsh_profile* profile;
+  /** If not NULL, the event ring for TRACE():
+      set by mcsh --trace or MCSH_TRACE */
+  mcsh_trace* trace;
+  /** Event counters: see mcsh-stats.h */
+  mcsh_stats stats;
+  /** Map from thread ID to mcsh_thread* not yet joined:
+      see mcsh-thread.h */
+  struct table threads;
   mcsh_module* main;
   mcsh_data* data;
   mcsh_stack stack;
@@ -463,6 +559,18 @@ struct mcsh_module_s
   int instruction;
   mcsh_stmts stmts;
   mcsh_module* parent;
+  /// Source file backing lazy function bodies, or -1
+  int fd;
+  /// Lazy bodies are stale if the file changes from these
+  struct timespec mtime;
+  off_t size;
+  /// Count of lazy function bodies not yet loaded
+  int lazy;
+  /// For import -l: file to load on first member access, or NULL
+  char* pending;
+  /// Index+1 of the source name in the sampler, or 0:
+  /// see mcsh_sample_source()
+  int sample_id;
 };
 
 typedef enum
@@ -490,6 +598,9 @@ struct mcsh_entry_s
   list_array* args;
   // Only used if this is an ENTRY_MODULE:
   mcsh_module* module;
+  // The statement running in this entry, or NULL:
+  // only set if mcsh_sampling
+  mcsh_stmt* stmt;
 };
 
 bool mcsh_code_name(mcsh_code type, char* output);
@@ -513,6 +624,8 @@ typedef struct
   size_t vm_capacity;
   /// Number of running VMs:
   size_t vm_count;
+  /// Guards vms and vm_count: each VM may run in its own thread
+  pthread_mutex_t lock;
   mcsh_parse_state parse_state;
   struct table* builtins;
   struct table* exprs;
@@ -545,6 +658,10 @@ typedef struct
   */
   char** argv;
   strmap globals;
+  /// From --profile: the report file prefix, or NULL
+  char* profile;
+  /// From --trace: the ring size in records, or 0
+  size_t trace;
 } mcsh_cmd_line;
 
 #include "mcsh-data.h"
@@ -574,6 +691,9 @@ void mcsh_vm_init_argv(mcsh_vm* vm, int argc, char** argv);
 
 void mcsh_vm_init_cmd(mcsh_vm* vm, mcsh_cmd_line* cmd);
 
+/** For a VM on a new thread: argv[0] is the source of its code */
+void mcsh_vm_init_thread(mcsh_vm* vm, int argc, char** argv);
+
 void mcsh_module_init(mcsh_module* module, mcsh_vm* vm);
 
 void mcsh_stack_init(mcsh_stack* stack, mcsh_vm* vm);
@@ -591,22 +711,62 @@ void mcsh_entry_init_module(mcsh_entry* entry,
                             mcsh_module* module,
                             mcsh_entry* parent);
 
+/** Get a unique object id for each parsed item.  Thread-safe */
+int mcsh_parse_id(void);
+
 bool mcsh_module_parse(const char* source,
                        const char* name,
                        char* code,
                        mcsh_module* module);
 
+/** As mcsh_module_parse(), streaming from fp.
+    Function bodies in a regular file may be left lazy */
+bool mcsh_module_parse_file(const char* source,
+                            const char* name,
+                            FILE* fp,
+                            mcsh_module* module);
+
+/** Set vm->stream from MCSH_STREAM: a positive batch size,
+    true for the default, or 0 or false for none.
+    Raises an exception for anything else */
+bool mcsh_vm_init_stream(mcsh_vm* vm, mcsh_status* status);
+
+/** Parse and execute fp in batches of vm->stream top-level statements,
+    freeing each batch after it runs, so memory use does not
+    grow with the length of the script.
+    Unlike mcsh_module_parse_file() with mcsh_module_execute(),
+    statements run before later syntax errors are found */
+bool mcsh_module_stream(const char* source,
+                        const char* name,
+                        FILE* fp,
+                        mcsh_module* module,
+                        mcsh_value** output,
+                        mcsh_status* status);
+
 void mcsh_module_print(mcsh_module* module, int indent);
 
 /** Log a new line of code */
 void mcsh_log_line(mcsh_module* module, const char* code);
 
-bool mcsh_import(mcsh_module* caller, const char* name,
+/** Parse the body of a lazy block if not done yet
+    @return False on parse error */
+bool mcsh_block_load(mcsh_block* block);
+
+/** Run a module deferred by import -l */
+bool mcsh_module_load(mcsh_module* module, mcsh_status* status);
+
+/** Import is run once per file: later imports of the same file
+    bind the registered module value.
+    If lazy, the file is not read until a member is accessed */
+bool mcsh_import(mcsh_module* caller, const char* name, bool lazy,
                  mcsh_value** output, mcsh_status* status);
 
 bool mcsh_source(mcsh_module* caller, const char* name,
                  mcsh_value** output, mcsh_status* status);
 
+/** Forget cached lookups: call after modifying vm->path */
+void mcsh_resolved_clear(mcsh_vm* vm);
+
 bool mcsh_eval(mcsh_module* caller, char* code,
                mcsh_value** output, mcsh_status* status);
 
@@ -662,6 +822,8 @@ mcsh_value_init(mcsh_value* value)
   //       Short job when have clean SVN for testing
   value->refs       = 0;
   value->word_split = false;
+  value->literal    = false;
+  value->mem_bytes  = 0;
 }
 
 static inline void
@@ -731,7 +893,12 @@ mcsh_value* mcsh_value_new_link(mcsh_value* value);
 mcsh_value* mcsh_value_new_int(int64_t i);
 mcsh_value* mcsh_value_new_float(double f);
 mcsh_value* mcsh_value_new_string(mcsh_vm* vm, const char* s);
+/** Copy n bytes of s: the value and its characters share
+    one allocation */
+mcsh_value* mcsh_value_new_string_n(const char* s, size_t n);
 mcsh_value* mcsh_value_new_string_null(void);
+/** The value takes s, which must be from malloc */
+mcsh_value* mcsh_value_new_string_take(char* s);
 mcsh_value* mcsh_value_new_list(mcsh_vm* vm);
 mcsh_value* mcsh_value_new_list_sized(mcsh_vm* vm, size_t size);
 mcsh_value* mcsh_value_new_table(mcsh_vm* vm, size_t size);
@@ -746,6 +913,13 @@ mcsh_value* mcsh_value_new_function(mcsh_module* module,
 
 mcsh_value* mcsh_value_new_activation(mcsh_activation* activation);
 
+mcsh_value* mcsh_value_new_handle(mcsh_handle* handle);
+
+mcsh_value* mcsh_value_new_iterator(mcsh_iterator* iterator);
+
+/** Takes the caller's reference to chan */
+mcsh_value* mcsh_value_new_chan(mcsh_chan* chan);
+
 mcsh_value* mcsh_value_clone(mcsh_value* value);
 
 void mcsh_value_assign(mcsh_value* target, mcsh_value* value);
@@ -761,6 +935,8 @@ bool mcsh_module_execute(mcsh_module* module,
 bool mcsh_stmts_execute(mcsh_module* module, mcsh_stmts* stmts,
                         mcsh_value** output, mcsh_status* status);
 
+void mcsh_stmts_finalize(mcsh_module* module, mcsh_stmts* stmts);
+
 
 /** Parser insertion point */
 bool mcsh_module_put_token(mcsh_module* module, char* token);
@@ -776,6 +952,7 @@ void mcsh_expr_print(mcsh_expr* expr, int indent);
 
 bool mcsh_expr_eval(mcsh_vm* vm, mcsh_expr* expr, mcsh_value** output);
 
+/** Free expr and all of its children */
 void mcsh_expr_finalize(mcsh_expr* expr);
 
 void mcsh_entry_free(mcsh_entry* entry);
@@ -3,9 +3,12 @@
 
 #include "inttypes.h"
 
+_Thread_local unsigned long strmap_reallocs = 0;
+
 bool
 strmap_realloc_capacity(strmap* map)
 {
+  strmap_reallocs++;
   size_t new = map->capacity * 2;
   DEBUG(DBG, "strmap_realloc_capacity: %zi -> %zi",
              map->capacity, new);
@@ -18,6 +21,7 @@ strmap_realloc_capacity(strmap* map)
 bool
 strmap_realloc_keys(strmap* map)
 {
+  strmap_reallocs++;
   size_t length_new = map->length * 2;
 
   DEBUG(DBG, "strmap_realloc_keys: %zi -> %zi",
@@ -25,7 +29,8 @@ strmap_realloc_keys(strmap* map)
 
   ptrdiff_t n = map->tail - map->text;
 
-  int16_t D[map->size];
+  // Offsets of each key: the text may move
+  ptrdiff_t* D = malloc_checked(map->size * sizeof(ptrdiff_t));
   for (size_t i = 0; i < map->size; i++)
   {
     if (map->keys[i] != NULL)
@@ -43,6 +48,7 @@ strmap_realloc_keys(strmap* map)
       map->keys[i] = map->text + D[i];
     else
       map->keys[i] = NULL;
+  free(D);
 
   DEBUG(DBG, "strmap_realloc_keys: OK");
   return true;
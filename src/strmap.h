@@ -53,6 +53,9 @@ void strmap_show_text(strmap* map);
 void strmap_show_keys(strmap* map);
 void strmap_show_data(strmap* map);
 
+/** Count of reallocations in all strmaps in this thread */
+extern _Thread_local unsigned long strmap_reallocs;
+
 bool strmap_realloc_capacity(strmap* map);
 bool strmap_realloc_keys(strmap* map);
 
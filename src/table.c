@@ -28,6 +28,8 @@
 // Double in size for now
 static const float table_expand_factor = 2.0;
 
+_Thread_local unsigned long table_expands = 0;
+
 static void
 table_dump2(const char* format, const struct table* target,
                bool include_vals);
@@ -512,6 +514,7 @@ table_remove(struct table* table, const char* key, void** data)
 static bool
 table_expand(struct table *T)
 {
+  table_expands++;
   int new_capacity = (int)(table_expand_factor * (float)T->capacity);
   assert(new_capacity > T->capacity);
   table_entry *new_array = malloc(sizeof(T->array[0]) *
@@ -40,6 +40,9 @@ struct table_entry
 
 #define TABLE_DEFAULT_LOAD_FACTOR 0.75
 
+/** Count of resizes in all tables in this thread */
+extern _Thread_local unsigned long table_expands;
+
 /*
   Macro for iterating over table entries.  This handles the simple case
   of iterating over all valid table entries with no modifications.
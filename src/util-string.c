@@ -6,19 +6,16 @@
 char*
 list_array_join_strings(list_array* L, char* delimiter)
 {
-  printf("join_strings: %zi\n", L->size);
   buffer B;
   buffer_init(&B, L->size);
   for (size_t i = 0; i < L->size; i++)
   {
     char* s = L->data[i];
-    printf("append: '%s'\n", s);
     buffer_cat(&B, s);
     if (i < L->size - 1)
       buffer_cat(&B, delimiter);
   }
   char* result = buffer_dup(&B);
-  printf("result: '%s'\n", result);
   buffer_finalize(&B);
   return result;
 }
@@ -26,20 +23,25 @@ list_array_join_strings(list_array* L, char* delimiter)
 char*
 list_array_join_values(list_array* L, char* delimiter)
 {
-  printf("join_values: %zi\n", L->size);
   buffer B;
   buffer_init(&B, L->size);
   for (size_t i = 0; i < L->size; i++)
   {
     mcsh_value* v = L->data[i];
     mcsh_resolve(v);
-    // printf("append: '%s'\n", v->text);
     buffer_cat(&B, v->string);
     if (i < L->size - 1)
       buffer_cat(&B, delimiter);
   }
   char* result = buffer_dup(&B);
-  printf("result: '%s'\n", result);
   buffer_finalize(&B);
   return result;
 }
+
+char*
+string_find(const char* p, const char* end, const char* d, size_t n)
+{
+  if (n == 1)
+    return memchr(p, d[0], end - p);
+  return memmem(p, end - p, d, n);
+}
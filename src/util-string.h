@@ -8,3 +8,8 @@ char* list_array_join_strings(list_array* L, char* delimiter);
 
 /** Returns the new string in fresh memory */
 char* list_array_join_values(list_array* L, char* delimiter);
+
+/** Find delimiter d of length n in [p,end), or NULL.
+    Uses memchr() for single bytes, else memmem() */
+char* string_find(const char* p, const char* end,
+                  const char* d, size_t n);
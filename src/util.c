@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -12,6 +13,8 @@
 
 #include "util.h"
 
+_Thread_local unsigned long util_allocs = 0;
+
 void
 show(const char* format, ...)
 {
@@ -245,3 +248,16 @@ trim_right(char* s)
 
   return s;
 }
+
+int
+thread_create_noprof(pthread_t* thread,
+                     void* (*start)(void*), void* arg)
+{
+  sigset_t mask, old;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &mask, &old);
+  int rc = pthread_create(thread, NULL, start, arg);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return rc;
+}
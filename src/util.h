@@ -15,6 +15,7 @@
 
 #pragma once
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -103,9 +104,19 @@ char* slurp(const char* filename);
 
 char* slurp_fp(FILE* fp);
 
+/** Like pthread_create(), but SIGPROF is blocked in the new thread:
+    the sampling profiler signal goes only to the thread it samples */
+int thread_create_noprof(pthread_t* thread,
+                         void* (*start)(void*), void* arg);
+
+/** Count of allocations by the *_checked functions in this thread:
+    the profiler reports differences in this */
+extern _Thread_local unsigned long util_allocs;
+
 static inline void*
 malloc_checked(size_t n)
 {
+  util_allocs++;
   void* result = malloc(n);
   valgrind_assert(result != NULL);
   return result;
@@ -114,6 +125,7 @@ malloc_checked(size_t n)
 static inline void*
 calloc_checked(size_t n, size_t size)
 {
+  util_allocs++;
   void* result = calloc(n, size);
   valgrind_assert(result != NULL);
   return result;
@@ -134,6 +146,7 @@ strdup_checked(char* ptr)
 {
   valgrind_assert(ptr != NULL);
 
+  util_allocs++;
   char* result = strdup(ptr);
   valgrind_assert(result != NULL);
 
@@ -84,6 +84,13 @@ then
   # print "TEST_ARGS_SCRIPT: $TEST_ARGS_SCRIPT"
 fi
 
+# Environment for mcsh, as NAME=VALUE words
+TEST_ENV=()
+if grep -q "TEST:ENV" $TEST
+then
+  TEST_ENV=( $( sed -n 's/.*TEST:ENV: \(.*\)/\1/p' $TEST ) )
+fi
+
 CODE=0
 SUCCESS=0
 
@@ -106,7 +113,7 @@ if (( REDIRECT )) {
   alias -g output=""
 }
 
-if $VG bin/mcsh $TEST_ARGS_MCSH $TEST $TEST_ARGS_SCRIPT ${*} output
+if env $TEST_ENV $VG bin/mcsh $TEST_ARGS_MCSH $TEST $TEST_ARGS_SCRIPT ${*} output
 then
   if (( ! TEST_FAIL )) SUCCESS=1
 else
@@ -133,6 +140,19 @@ if (( SUCCESS && REDIRECT )) {
       (( COUNT ++ ))
     done
   fi
+  if grep -q "TEST:EXPECT_NOT:" $TEST
+  then
+    TEST_EXPECT_NOT=$( sed -n 's/.*TEST:EXPECT_NOT: \(.*\)/\1/p' $TEST )
+    for UNEXPECTED in ${(f)TEST_EXPECT_NOT}
+    do
+      if grep -F -q "$UNEXPECTED" $TEST_OUTPUT
+      then
+        print "test.sh: unexpected output: '$UNEXPECTED'"
+        SUCCESS=0
+        break
+      fi
+    done
+  fi
 }
 
 if (( ! SUCCESS )) {
@@ -0,0 +1,63 @@
+/**
+   CHAN 1
+   A channel breaks when a process dies holding its lock,
+   and rejects a frame length past MCSH_CHAN_FRAME_MAX
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mcsh-chan.h"
+
+static void
+child_dies_locked(mcsh_chan* chan)
+{
+  pid_t pid = fork();
+  assert(pid != -1);
+  if (pid == 0)
+  {
+    pthread_mutex_lock(&chan->locks->send);
+    _exit(0);
+  }
+  int wstatus;
+  waitpid(pid, &wstatus, 0);
+}
+
+int
+main()
+{
+  printf("chan-1 ...\n");
+
+  mcsh_chan* chan = mcsh_chan_create();
+  assert(chan != NULL);
+  assert(mcsh_chan_send(chan, "x", 1));
+  child_dies_locked(chan);
+  errno = 0;
+  assert(! mcsh_chan_send(chan, "y", 1));
+  assert(errno == EOWNERDEAD);
+  // The recv lock is intact, but the channel is broken:
+  buffer B;
+  buffer_init(&B, 64);
+  int index;
+  assert(! mcsh_chan_recv(&chan, 1, 0, &B, &index));
+  assert(errno == EOWNERDEAD);
+  mcsh_chan_unref(chan);
+
+  chan = mcsh_chan_create();
+  uint32_t length = UINT32_MAX;
+  assert(write(chan->fd[1], &length, sizeof(length)) ==
+         sizeof(length));
+  assert(! mcsh_chan_recv(&chan, 1, 0, &B, &index));
+  assert(errno == EBADMSG);
+  assert(! mcsh_chan_send(chan, "z", 1));
+  mcsh_chan_unref(chan);
+
+  buffer_finalize(&B);
+  printf("chan-1 OK\n");
+  return EXIT_SUCCESS;
+}